@@ -398,6 +398,7 @@ static void reset_handle(fec_handle *f)
     f->data_size = 0;
     f->pos = 0;
     f->size = 0;
+    f->pool = NULL;
 
     memset(&f->ecc, 0, sizeof(f->ecc));
     memset(&f->verity, 0, sizeof(f->verity));
@@ -408,6 +409,9 @@ int fec_close(struct fec_handle *f)
 {
     check(f);
 
+    /* stop the worker threads before the handle goes away */
+    process_cleanup(f);
+
     if (f->fd != -1) {
         if (f->mode & O_RDWR && fdatasync(f->fd) == -1) {
             warn("fdatasync failed: %s", strerror(errno));
@@ -425,6 +429,12 @@ int fec_close(struct fec_handle *f)
     if (f->verity.table) {
         delete[] f->verity.table;
     }
+    verity_cache_free(f);
+    for (int i = 0; i < ECC_CACHE_RS_BLOCKS; ++i) {
+        if (f->ecc.cache[i].data) {
+            delete[] f->ecc.cache[i].data;
+        }
+    }
 
     pthread_mutex_destroy(&f->mutex);
 
@@ -499,6 +509,7 @@ int fec_get_status(struct fec_handle *f, struct fec_status *s)
     s->data_size = f->data_size;
     s->size = f->size;
 
+    verity_cache_status(f, s);
     return 0;
 }
 
@@ -38,10 +38,19 @@
 /* processing parameters */
 #define WORK_MIN_THREADS 1
 #define WORK_MAX_THREADS 64
+#define WORK_MIN_CHUNK_SIZE (64 * FEC_BLOCKSIZE) /* smaller reads stay on the
+                                                    calling thread */
+#define WORK_CHUNKS_PER_THREAD 8 /* for balancing uneven work by stealing */
+
+/* ecc parameters */
+#define ECC_CACHE_RS_BLOCKS 4 /* decoded RS blocks kept for reuse */
 
 /* verity parameters */
-#define VERITY_CACHE_BLOCKS 4096
+#define VERITY_CACHE_BLOCKS 4096 /* default, see fec_set_cache_size */
 #define VERITY_NO_CACHE UINT64_MAX
+#define VERITY_READ_BLOCKS 64 /* blocks read and verified at once */
+#define VERITY_CACHE_MAX_READ (16 * FEC_BLOCKSIZE) /* larger reads do not fill
+                                                      the cache */
 
 /* verity definitions */
 #define VERITY_METADATA_SIZE (8 * FEC_BLOCKSIZE)
@@ -64,6 +73,13 @@ struct verity_header {
 };
 
 /* file handle */
+struct ecc_cache_entry {
+    uint8_t *data; /* FEC_RSM * FEC_BLOCKSIZE bytes of decoded codewords */
+    uint64_t rsb;
+    uint64_t last_used;
+    bool use_erasures;
+};
+
 struct ecc_info {
     bool valid;
     int roots;
@@ -72,8 +88,12 @@ struct ecc_info {
     uint64_t blocks;
     uint64_t rounds;
     uint64_t start; /* offset in file */
+    ecc_cache_entry cache[ECC_CACHE_RS_BLOCKS]; /* protected by f->mutex */
+    uint64_t cache_clock;
 };
 
+struct verity_cache; /* see fec_verity.cpp */
+
 struct verity_info {
     bool disabled;
     char *table;
@@ -84,11 +104,13 @@ struct verity_info {
     uint8_t *hash;
     uint32_t salt_size;
     uint8_t *salt;
+    SHA256_CTX salt_ctx; /* context after hashing the salt */
     uint64_t data_blocks;
     uint64_t metadata_start; /* offset in file */
     uint8_t zero_hash[SHA256_DIGEST_LENGTH];
     verity_header header;
     verity_header ecc_header;
+    verity_cache *cache; /* verified blocks and recently read data */
 };
 
 struct verity_block_info {
@@ -96,6 +118,17 @@ struct verity_block_info {
     bool valid;
 };
 
+struct work_pool; /* worker threads, see fec_process.cpp */
+
+/* per-thread statistics of reads split between threads; entry 0 is for
+   the threads calling fec_pread */
+struct work_stats {
+    uint64_t chunks; /* chunks processed */
+    uint64_t stolen; /* chunks taken over from other threads */
+    uint64_t busy_ns; /* time spent processing chunks */
+    uint64_t total_ns; /* wall time of all split reads */
+};
+
 struct fec_handle {
     ecc_info ecc;
     int fd;
@@ -107,6 +140,7 @@ struct fec_handle {
     uint64_t pos;
     uint64_t size;
     verity_info verity;
+    work_pool *pool; /* created on the first read that is split */
 };
 
 /* I/O helpers */
@@ -119,6 +153,12 @@ extern bool raw_pwrite(fec_handle *f, const void *buf, size_t count,
 typedef ssize_t (*read_func)(fec_handle *f, uint8_t *dest, size_t count,
         uint64_t offset, size_t *errors);
 
+extern int process_init(fec_handle *f, int threads);
+
+extern void process_cleanup(fec_handle *f);
+
+extern int process_get_stats(fec_handle *f, work_stats *stats, int count);
+
 extern ssize_t process(fec_handle *f, uint8_t *buf, size_t count,
         uint64_t offset, read_func func);
 
@@ -131,6 +171,22 @@ extern int verity_parse_header(fec_handle *f, uint64_t offset);
 extern bool verity_check_block(fec_handle *f, const uint8_t *expected,
         const uint8_t *block);
 
+extern size_t verity_check_blocks(fec_handle *f, const uint8_t *expected,
+        const uint8_t *blocks, size_t count);
+
+extern bool verity_is_verified(fec_handle *f, uint64_t block);
+
+extern void verity_set_verified(fec_handle *f, uint64_t block, size_t count);
+
+extern bool verity_cache_get(fec_handle *f, uint64_t block, uint8_t *dest);
+
+extern void verity_cache_put(fec_handle *f, uint64_t block,
+        const uint8_t *data);
+
+extern void verity_cache_status(fec_handle *f, fec_status *s);
+
+extern void verity_cache_free(fec_handle *f);
+
 /* helper macros */
 #ifndef unlikely
     #define unlikely(x) __builtin_expect(!!(x), 0)
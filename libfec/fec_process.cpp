@@ -14,44 +14,190 @@
  * limitations under the License.
  */
 
+#include <atomic>
+#include <time.h>
+
 #include "fec_private.h"
 
-struct process_info {
-    int id;
+/* a read split into chunks; each thread starts with a contiguous range of
+   chunks, and once it runs out, steals chunks from the end of the largest
+   range left, so a few slow chunks that need error correction do not leave
+   the other threads idle */
+struct work_job {
     fec_handle *f;
     uint8_t *buf;
     size_t count;
     uint64_t offset;
+    uint64_t start; /* offset rounded down to a block */
+    uint64_t chunk_size;
     read_func func;
-    ssize_t rc;
-    size_t errors;
+    int threads;
+    std::atomic<uint64_t> ranges[WORK_MAX_THREADS]; /* next << 32 | end */
+    std::atomic<bool> failed;
+    std::atomic<size_t> nread;
+    std::atomic<size_t> errors;
+};
+
+struct work_worker {
+    work_pool *pool;
+    int id;
 };
 
-/* thread function  */
-static void * __process(void *cookie)
+/* threads waiting for jobs, with the calling thread as thread 0 */
+struct work_pool {
+    pthread_mutex_t busy; /* held while a job is processed */
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    std::vector<pthread_t> threads;
+    work_worker workers[WORK_MAX_THREADS];
+    work_job *job;
+    uint64_t generation;
+    int pending; /* workers still processing the job */
+    bool stop;
+    work_stats stats[WORK_MAX_THREADS]; /* protected by `busy' */
+};
+
+static inline uint64_t now_ns()
 {
-    process_info *p = static_cast<process_info *>(cookie);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t make_range(uint64_t next, uint64_t end)
+{
+    return (next << 32) | end;
+}
+
+/* takes the next chunk from the range of thread `id', or steals the last
+   one from the largest range left; returns false when all are taken */
+static bool take_chunk(work_job *job, int id, uint64_t *chunk, bool *stolen)
+{
+    uint64_t r = job->ranges[id].load();
+
+    while ((r >> 32) < (r & UINT32_MAX)) {
+        if (job->ranges[id].compare_exchange_weak(r,
+                make_range((r >> 32) + 1, r & UINT32_MAX))) {
+            *chunk = r >> 32;
+            *stolen = false;
+            return true;
+        }
+    }
+
+    for (;;) {
+        int victim = -1;
+        uint64_t most = 0;
 
-    debug("thread %d: [%" PRIu64 ", %" PRIu64 ")", p->id, p->offset,
-        p->offset + p->count);
+        for (int i = 0; i < job->threads; ++i) {
+            r = job->ranges[i].load();
 
-    p->rc = p->func(p->f, p->buf, p->count, p->offset, &p->errors);
-    return p;
+            if ((r & UINT32_MAX) > (r >> 32) &&
+                    (r & UINT32_MAX) - (r >> 32) > most) {
+                most = (r & UINT32_MAX) - (r >> 32);
+                victim = i;
+            }
+        }
+
+        if (victim == -1) {
+            return false;
+        }
+
+        r = job->ranges[victim].load();
+
+        if ((r >> 32) < (r & UINT32_MAX) &&
+                job->ranges[victim].compare_exchange_strong(r,
+                    make_range(r >> 32, (r & UINT32_MAX) - 1))) {
+            *chunk = (r & UINT32_MAX) - 1;
+            *stolen = true;
+            return true;
+        }
+    }
 }
 
-/* launches a maximum number of threads to process a read */
-ssize_t process(fec_handle *f, uint8_t *buf, size_t count, uint64_t offset,
-        read_func func)
+/* processes chunks of `job' on thread `id' until none are left */
+static void work(work_pool *pool, work_job *job, int id)
 {
-    check(f);
-    check(buf)
-    check(func);
+    work_stats *stats = &pool->stats[id];
+    uint64_t end = job->offset + job->count;
+    uint64_t chunk;
+    bool stolen;
 
-    if (count == 0) {
-        return 0;
+    while (!job->failed && take_chunk(job, id, &chunk, &stolen)) {
+        uint64_t first = job->start + chunk * job->chunk_size;
+        uint64_t last = first + job->chunk_size;
+
+        if (first < job->offset) {
+            first = job->offset;
+        }
+        if (last > end) {
+            last = end;
+        }
+
+        debug("thread %d: [%" PRIu64 ", %" PRIu64 ")", id, first, last);
+
+        uint64_t begin = now_ns();
+        size_t errors = 0;
+        ssize_t rc = job->func(job->f, &job->buf[first - job->offset],
+                        (size_t)(last - first), first, &errors);
+
+        if (rc == -1) {
+            job->failed = true;
+        } else {
+            job->nread += rc;
+            job->errors += errors;
+        }
+
+        stats->busy_ns += now_ns() - begin;
+        ++stats->chunks;
+
+        if (stolen) {
+            ++stats->stolen;
+        }
     }
+}
+
+/* thread function */
+static void * __work(void *cookie)
+{
+    work_worker *w = static_cast<work_worker *>(cookie);
+    work_pool *pool = w->pool;
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    for (;;) {
+        while (!pool->stop && pool->generation == generation) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+
+        if (pool->stop) {
+            break;
+        }
+
+        generation = pool->generation;
+        work_job *job = pool->job;
 
-    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+        pthread_mutex_unlock(&pool->mutex);
+        work(pool, job, w->id);
+        pthread_mutex_lock(&pool->mutex);
+
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+/* starts a pool of `threads' threads for `f', counting the calling thread,
+   unless `f' already has one; must be called with f->mutex held */
+static work_pool *start_pool(fec_handle *f, int threads)
+{
+    if (f->pool) {
+        return f->pool;
+    }
 
     if (threads < WORK_MIN_THREADS) {
         threads = WORK_MIN_THREADS;
@@ -59,81 +205,227 @@ ssize_t process(fec_handle *f, uint8_t *buf, size_t count, uint64_t offset,
         threads = WORK_MAX_THREADS;
     }
 
-    uint64_t start = (offset / FEC_BLOCKSIZE) * FEC_BLOCKSIZE;
-    size_t blocks = fec_div_round_up(count, FEC_BLOCKSIZE);
+    work_pool *pool = new (std::nothrow) work_pool();
+
+    if (unlikely(!pool)) {
+        error("failed to allocate a worker pool");
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->busy, NULL);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 1; i < threads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, __work, &pool->workers[i]) != 0) {
+            /* carry on with the threads we have */
+            warn("failed to create thread: %s", strerror(errno));
+            break;
+        }
+
+        pool->threads.push_back(thread);
+    }
+
+    debug("%zu worker threads", pool->threads.size());
+
+    f->pool = pool;
+    return pool;
+}
+
+/* returns the worker pool for `f', starting as many workers as there are
+   processors besides the calling thread the first time */
+static work_pool *get_pool(fec_handle *f)
+{
+    pthread_mutex_lock(&f->mutex);
+    work_pool *pool = start_pool(f, sysconf(_SC_NPROCESSORS_ONLN));
+    pthread_mutex_unlock(&f->mutex);
+
+    return pool;
+}
+
+/* starts `threads' threads, counting the calling thread, for reads split
+   later, unless they were already started; returns 0 on success */
+int process_init(fec_handle *f, int threads)
+{
+    check(f);
+
+    pthread_mutex_lock(&f->mutex);
+    work_pool *pool = start_pool(f, threads);
+    pthread_mutex_unlock(&f->mutex);
+
+    return pool ? 0 : -1;
+}
+
+/* stops the worker threads of `f', if any */
+void process_cleanup(fec_handle *f)
+{
+    work_pool *pool = f->pool;
+
+    if (!pool) {
+        return;
+    }
 
-    size_t count_per_thread = fec_div_round_up(blocks, threads) * FEC_BLOCKSIZE;
-    size_t max_threads = fec_div_round_up(count, count_per_thread);
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
 
-    if ((size_t)threads > max_threads) {
-        threads = (int)max_threads;
+    for (auto thread : pool->threads) {
+        if (pthread_join(thread, NULL) != 0) {
+            error("failed to join thread: %s", strerror(errno));
+        }
     }
 
-    size_t left = count;
-    uint64_t pos = offset;
-    uint64_t end = start + count_per_thread;
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_mutex_destroy(&pool->busy);
 
-    debug("%d threads, %zu bytes per thread (total %zu)", threads,
-        count_per_thread, count);
+    delete pool;
+    f->pool = NULL;
+}
 
-    std::vector<pthread_t> handles;
-    process_info info[threads];
-    ssize_t rc = 0;
+/* copies up to `count' entries of thread statistics to `stats', returns the
+   number of threads reads are split between, or zero if no threads have
+   been started yet */
+int process_get_stats(fec_handle *f, work_stats *stats, int count)
+{
+    check(f);
+    check(stats || count == 0);
 
-    /* start threads to process queue */
-    for (int i = 0; i < threads; ++i) {
-        check(left > 0);
+    pthread_mutex_lock(&f->mutex);
+    work_pool *pool = f->pool;
+    pthread_mutex_unlock(&f->mutex);
 
-        info[i].id = i;
-        info[i].f = f;
-        info[i].buf = &buf[pos - offset];
-        info[i].count = (size_t)(end - pos);
-        info[i].offset = pos;
-        info[i].func = func;
-        info[i].rc = -1;
-        info[i].errors = 0;
+    if (!pool) {
+        return 0;
+    }
 
-        if (info[i].count > left) {
-            info[i].count = left;
+    int threads = (int)pool->threads.size() + 1;
+
+    pthread_mutex_lock(&pool->busy);
+
+    for (int i = 0; i < count && i < threads; ++i) {
+        stats[i] = pool->stats[i];
+    }
+
+    pthread_mutex_unlock(&pool->busy);
+    return threads;
+}
+
+/* splits a read into chunks and processes them using the calling thread and
+   the worker pool; reads smaller than two chunks, and reads while another
+   thread is using the pool, are processed on the calling thread */
+ssize_t process(fec_handle *f, uint8_t *buf, size_t count, uint64_t offset,
+        read_func func)
+{
+    check(f);
+    check(buf)
+    check(func);
+
+    if (count == 0) {
+        return 0;
+    }
+
+    work_pool *pool = NULL;
+
+    if (count >= 2 * WORK_MIN_CHUNK_SIZE) {
+        pool = get_pool(f);
+
+        if (pool && pthread_mutex_trylock(&pool->busy) != 0) {
+            pool = NULL;
         }
+    }
 
-        pthread_t thread;
+    if (!pool) {
+        size_t errors = 0;
+        ssize_t rc = func(f, buf, count, offset, &errors);
 
-        if (pthread_create(&thread, NULL, __process, &info[i]) != 0) {
-            error("failed to create thread: %s", strerror(errno));
-            rc = -1;
-        } else {
-            handles.push_back(thread);
+        if (rc == -1) {
+            errno = EIO;
+            return -1;
         }
 
-        pos = end;
-        end  += count_per_thread;
-        left -= info[i].count;
+        f->errors += errors;
+        return rc;
     }
 
-    check(left == 0);
+    work_job job;
 
-    ssize_t nread = 0;
+    job.f = f;
+    job.buf = buf;
+    job.count = count;
+    job.offset = offset;
+    job.start = (offset / FEC_BLOCKSIZE) * FEC_BLOCKSIZE;
+    job.func = func;
+    job.threads = (int)pool->threads.size() + 1;
+    job.failed = false;
+    job.nread = 0;
+    job.errors = 0;
 
-    /* wait for all threads to complete */
-    for (auto thread : handles) {
-        process_info *p = NULL;
+    uint64_t blocks = fec_div_round_up(offset + count - job.start,
+                        FEC_BLOCKSIZE);
+    uint64_t chunk_blocks = fec_div_round_up(blocks,
+                                job.threads * WORK_CHUNKS_PER_THREAD);
 
-        if (pthread_join(thread, (void **)&p) != 0) {
-            error("failed to join thread: %s", strerror(errno));
-            rc = -1;
-        } else if (!p || p->rc == -1) {
-            rc = -1;
-        } else {
-            nread += p->rc;
-            f->errors += p->errors;
-        }
+    if (chunk_blocks < WORK_MIN_CHUNK_SIZE / FEC_BLOCKSIZE) {
+        chunk_blocks = WORK_MIN_CHUNK_SIZE / FEC_BLOCKSIZE;
     }
 
-    if (rc == -1) {
+    job.chunk_size = chunk_blocks * FEC_BLOCKSIZE;
+
+    uint64_t chunks = fec_div_round_up(blocks, chunk_blocks);
+    check(chunks <= UINT32_MAX);
+
+    /* give each thread an equal share of consecutive chunks to start with */
+    for (int i = 0; i < job.threads; ++i) {
+        job.ranges[i] = make_range(chunks * i / job.threads,
+                            chunks * (i + 1) / job.threads);
+    }
+
+    debug("%d threads, %" PRIu64 " chunks of %" PRIu64 " bytes (total %zu)",
+        job.threads, chunks, job.chunk_size, count);
+
+    uint64_t begin = now_ns();
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = &job;
+    pool->pending = job.threads - 1;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    work(pool, &job, 0);
+
+    /* wait for the workers to finish their chunks */
+    pthread_mutex_lock(&pool->mutex);
+
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+
+    pool->job = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+
+    uint64_t elapsed = now_ns() - begin;
+
+    for (int i = 0; i < job.threads; ++i) {
+        pool->stats[i].total_ns += elapsed;
+    }
+
+    pthread_mutex_unlock(&pool->busy);
+
+    if (job.failed) {
         errno = EIO;
         return -1;
     }
 
-    return nread;
+    f->errors += job.errors;
+    return job.nread;
 }
@@ -102,8 +102,70 @@ static inline bool is_zero(fec_handle *f, uint64_t offset)
     return !memcmp(v->zero_hash, &v->hash[hash_offset], SHA256_DIGEST_LENGTH);
 }
 
+/* copies the block at `data_index' from a cached decoded RS block `rsb' to
+   `dest', returns false if the RS block is not in the cache */
+static bool ecc_cache_get(fec_handle *f, uint64_t rsb, bool use_erasures,
+        int data_index, uint8_t *dest)
+{
+    ecc_info *e = &f->ecc;
+    bool found = false;
+
+    pthread_mutex_lock(&f->mutex);
+
+    for (int i = 0; i < ECC_CACHE_RS_BLOCKS; ++i) {
+        ecc_cache_entry *c = &e->cache[i];
+
+        if (c->data && c->rsb == rsb && c->use_erasures == use_erasures) {
+            for (int j = 0; j < FEC_BLOCKSIZE; ++j) {
+                dest[j] = c->data[j * FEC_RSM + data_index];
+            }
+
+            c->last_used = ++e->cache_clock;
+            found = true;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&f->mutex);
+    return found;
+}
+
+/* stores the decoded RS block `rsb' in the cache in place of the least
+   recently used one */
+static void ecc_cache_put(fec_handle *f, uint64_t rsb, bool use_erasures,
+        const uint8_t *ecc_data)
+{
+    ecc_info *e = &f->ecc;
+
+    pthread_mutex_lock(&f->mutex);
+
+    ecc_cache_entry *c = &e->cache[0];
+
+    for (int i = 1; i < ECC_CACHE_RS_BLOCKS && c->data; ++i) {
+        if (!e->cache[i].data || e->cache[i].last_used < c->last_used) {
+            c = &e->cache[i];
+        }
+    }
+
+    if (!c->data) {
+        c->data = new (std::nothrow) uint8_t[FEC_RSM * FEC_BLOCKSIZE];
+    }
+
+    /* the cache is only an optimization, so ignore allocation failures */
+    if (likely(c->data)) {
+        memcpy(c->data, ecc_data, FEC_RSM * FEC_BLOCKSIZE);
+        c->rsb = rsb;
+        c->use_erasures = use_erasures;
+        c->last_used = ++e->cache_clock;
+    }
+
+    pthread_mutex_unlock(&f->mutex);
+}
+
 /* reads and decodes a single block starting from `offset', returns the number
-   of bytes corrected in `errors' */
+   of bytes corrected in `errors'; the data blocks of an RS block are all
+   corrected at once, so the decoded RS block is cached for the other blocks
+   in it, whose corrections are not counted again */
 static int __ecc_read(fec_handle *f, void *rs, uint8_t *dest, uint64_t offset,
         bool use_erasures, uint8_t *ecc_data, size_t *errors)
 {
@@ -111,23 +173,27 @@ static int __ecc_read(fec_handle *f, void *rs, uint8_t *dest, uint64_t offset,
     ecc_info *e = &f->ecc;
 
     /* reverse interleaving: calculate the RS block that includes the requested
-       offset */
+       offset, and the index of the block in it */
     uint64_t rsb = offset - (offset / (e->rounds * FEC_BLOCKSIZE)) *
                         e->rounds * FEC_BLOCKSIZE;
-    int data_index = -1;
+    int data_index = (int)(offset / (e->rounds * FEC_BLOCKSIZE));
     int erasures[e->rsn];
     int neras = 0;
 
+    check(data_index < e->rsn);
+
     /* verity is required to check for erasures */
     check(!use_erasures || f->verity.hash);
 
+    if (ecc_cache_get(f, rsb, use_erasures, data_index, dest)) {
+        return FEC_BLOCKSIZE;
+    }
+
     for (int i = 0; i < e->rsn; ++i) {
         uint64_t interleaved = fec_ecc_interleave(rsb * e->rsn + i, e->rsn,
                                     e->rounds);
 
-        if (interleaved == offset) {
-            data_index = i;
-        }
+        check(i != data_index || interleaved == offset);
 
         /* to improve our chances of correcting IO errors, initialize the
            buffer to zeros even if we are going to read to it later */
@@ -153,18 +219,23 @@ static int __ecc_read(fec_handle *f, void *rs, uint8_t *dest, uint64_t offset,
         }
     }
 
-    check(data_index >= 0);
+    /* parity for the codewords of the RS block is stored contiguously, so
+       read all of it at once */
+    uint8_t *parity = &ecc_data[FEC_RSM * FEC_BLOCKSIZE];
+
+    if (!raw_pread(f, parity, e->roots * FEC_BLOCKSIZE,
+            e->start + rsb * e->roots)) {
+        error("failed to read ecc data: %s", strerror(errno));
+        return -1;
+    }
 
     size_t nerrs = 0;
     uint8_t copy[FEC_RSM];
 
     for (int i = 0; i < FEC_BLOCKSIZE; ++i) {
         /* copy parity data */
-        if (!raw_pread(f, &ecc_data[i * FEC_RSM + e->rsn], e->roots,
-                e->start + (i + rsb) * e->roots)) {
-            error("failed to read ecc data: %s", strerror(errno));
-            return -1;
-        }
+        memcpy(&ecc_data[i * FEC_RSM + e->rsn], &parity[i * e->roots],
+            e->roots);
 
         /* for debugging decoding failures, because decode_rs_char can mangle
            ecc_data */
@@ -201,6 +272,7 @@ static int __ecc_read(fec_handle *f, void *rs, uint8_t *dest, uint64_t offset,
         *errors += nerrs;
     }
 
+    ecc_cache_put(f, rsb, use_erasures, ecc_data);
     return FEC_BLOCKSIZE;
 }
 
@@ -218,7 +290,9 @@ static int ecc_init(fec_handle *f, rs_unique_ptr& rs,
         return -1;
     }
 
-    ecc_data.reset(new (std::nothrow) uint8_t[FEC_RSM * FEC_BLOCKSIZE]);
+    /* room for an RS block followed by its parity */
+    ecc_data.reset(new (std::nothrow) uint8_t[(FEC_RSM + f->ecc.roots) *
+                                              FEC_BLOCKSIZE]);
 
     if (unlikely(!ecc_data)) {
         error("failed to allocate ecc buffer");
@@ -279,6 +353,89 @@ static ssize_t ecc_read(fec_handle *f, uint8_t *dest, size_t count,
     return count;
 }
 
+/* reads up to `blocks' full blocks starting from block `curr' straight into
+   `dest', copying the ones in the cache and reading the others from disk in
+   extents of up to VERITY_READ_BLOCKS blocks, which are verified in batches
+   unless they were verified before; returns the number of blocks read that
+   are valid, stopping at the first block that needs to be corrected, or that
+   is skipped because it is expected to contain zeros */
+static size_t verity_read_valid(fec_handle *f, uint8_t *dest, uint64_t curr,
+        size_t blocks, uint64_t max_hash_block, bool fill_cache)
+{
+    bool skip_zeros = (f->mode & O_ACCMODE) == O_RDONLY;
+    size_t valid = 0;
+
+    while (valid < blocks) {
+        uint64_t first = curr + valid;
+        uint8_t *p = &dest[valid * FEC_BLOCKSIZE];
+        size_t n = 0;
+        bool cached = false;
+
+        /* an extent ends before a block that is in the cache, which is
+           copied right after it */
+        while (n < VERITY_READ_BLOCKS && valid + n < blocks &&
+                first + n <= max_hash_block &&
+                !(skip_zeros && is_zero(f, (first + n) * FEC_BLOCKSIZE))) {
+            if (verity_cache_get(f, first + n, &p[n * FEC_BLOCKSIZE])) {
+                cached = true;
+                break;
+            }
+
+            ++n;
+        }
+
+        /* leave read errors to the block by block path */
+        if (n > 0 && !raw_pread(f, p, n * FEC_BLOCKSIZE,
+                            first * FEC_BLOCKSIZE)) {
+            break;
+        }
+
+        size_t checked = 0;
+
+        while (checked < n) {
+            if (verity_is_verified(f, first + checked)) {
+                ++checked;
+                continue;
+            }
+
+            size_t run = 1;
+
+            while (checked + run < n &&
+                    !verity_is_verified(f, first + checked + run)) {
+                ++run;
+            }
+
+            size_t ok = verity_check_blocks(f,
+                            &f->verity.hash[(first + checked) *
+                                SHA256_DIGEST_LENGTH],
+                            &p[checked * FEC_BLOCKSIZE], run);
+
+            verity_set_verified(f, first + checked, ok);
+            checked += ok;
+
+            if (ok < run) {
+                break;
+            }
+        }
+
+        if (fill_cache) {
+            for (size_t i = 0; i < checked; ++i) {
+                verity_cache_put(f, first + i, &p[i * FEC_BLOCKSIZE]);
+            }
+        }
+
+        valid += checked;
+
+        if (checked < n || !cached) {
+            break;
+        }
+
+        ++valid;
+    }
+
+    return valid;
+}
+
 /* reads `count' bytes from `offset', corrects possible errors with
    erasure detection, and verifies the integrity of read data using
    verity hash tree; returns the number of corrections in `errors' */
@@ -309,7 +466,28 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
     uint64_t max_hash_block = (f->verity.hash_data_blocks * FEC_BLOCKSIZE -
                                 SHA256_DIGEST_LENGTH) / SHA256_DIGEST_LENGTH;
 
+    /* large reads are usually sequential and would only evict blocks that
+       are read repeatedly from the cache, so they only look blocks up */
+    bool fill_cache = count <= VERITY_CACHE_MAX_READ;
+
     while (left > 0) {
+        /* read and verify whole blocks directly into `dest' as long as they
+           are valid, which avoids a system call, a hash and a copy per
+           block in the common case */
+        if (coff == 0 && left >= FEC_BLOCKSIZE) {
+            size_t valid = verity_read_valid(f, dest, curr,
+                                left / FEC_BLOCKSIZE, max_hash_block,
+                                fill_cache);
+
+            dest += valid * FEC_BLOCKSIZE;
+            left -= valid * FEC_BLOCKSIZE;
+            curr += valid;
+
+            if (left == 0) {
+                break;
+            }
+        }
+
         check(curr <= max_hash_block);
 
         uint8_t *hash = &f->verity.hash[curr * SHA256_DIGEST_LENGTH];
@@ -324,14 +502,25 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
             goto valid;
         }
 
+        /* full blocks were already looked up above */
+        if ((coff > 0 || left < FEC_BLOCKSIZE) &&
+                verity_cache_get(f, curr, data)) {
+            goto valid;
+        }
+
         /* copy raw data without error correction */
         if (!raw_pread(f, data, FEC_BLOCKSIZE, curr_offset)) {
             error("failed to read: %s", strerror(errno));
             return -1;
         }
 
+        if (likely(verity_is_verified(f, curr))) {
+            goto cache;
+        }
+
         if (likely(verity_check_block(f, hash, data))) {
-            goto valid;
+            verity_set_verified(f, curr, 1);
+            goto cache;
         }
 
         /* we know the block is supposed to contain zeros, so return zeros
@@ -376,10 +565,20 @@ static ssize_t verity_read(fec_handle *f, uint8_t *dest, size_t count,
 
 corrected:
         /* update the corrected block to the file if we are in r/w mode */
-        if (f->mode & O_RDWR &&
-                !raw_pwrite(f, data, FEC_BLOCKSIZE, curr_offset)) {
-            error("failed to write: %s", strerror(errno));
-            return -1;
+        if (f->mode & O_RDWR) {
+            if (!raw_pwrite(f, data, FEC_BLOCKSIZE, curr_offset)) {
+                error("failed to write: %s", strerror(errno));
+                return -1;
+            }
+
+            verity_set_verified(f, curr, 1);
+        }
+
+cache:
+        /* corrected blocks are cached even if they are still corrupted on
+           disk, so reading them again does not need another correction */
+        if (fill_cache) {
+            verity_cache_put(f, curr, data);
         }
 
 valid:
@@ -14,8 +14,10 @@
  * limitations under the License.
  */
 
+#include <atomic>
 #include <ctype.h>
 #include <stdlib.h>
+#include <unordered_map>
 #include <android-base/strings.h>
 #include "fec_private.h"
 
@@ -120,12 +122,11 @@ uint64_t verity_get_size(uint64_t file_size, uint32_t *verity_levels,
 static inline int verity_hash(fec_handle *f, const uint8_t *block,
         uint8_t *hash)
 {
-    SHA256_CTX ctx;
-    SHA256_Init(&ctx);
-
     check(f);
     check(f->verity.salt);
-    SHA256_Update(&ctx, f->verity.salt, f->verity.salt_size);
+
+    /* start from the context that has already hashed the salt */
+    SHA256_CTX ctx = f->verity.salt_ctx;
 
     check(block);
     SHA256_Update(&ctx, block, FEC_BLOCKSIZE);
@@ -154,6 +155,319 @@ bool verity_check_block(fec_handle *f, const uint8_t *expected,
     return !memcmp(expected, hash, SHA256_DIGEST_LENGTH);
 }
 
+/* checks `count' consecutive FEC_BLOCKSIZE byte blocks from buffer `blocks'
+   against consecutive hashes in `expected', and returns the number of blocks
+   that are valid before the first invalid one */
+size_t verity_check_blocks(fec_handle *f, const uint8_t *expected,
+        const uint8_t *blocks, size_t count)
+{
+    uint8_t hash[SHA256_DIGEST_LENGTH];
+
+    for (size_t i = 0; i < count; ++i) {
+        if (unlikely(verity_hash(f, &blocks[i * FEC_BLOCKSIZE], hash) == -1) ||
+                memcmp(&expected[i * SHA256_DIGEST_LENGTH], hash,
+                    SHA256_DIGEST_LENGTH)) {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+struct verity_cache_entry {
+    uint64_t block; /* VERITY_NO_CACHE if unused */
+    uint32_t prev; /* more recently used entry */
+    uint32_t next; /* less recently used entry */
+};
+
+/* a least recently used cache of verified or corrected data blocks, so
+   repeated reads need neither hashing nor system calls; blocks read from
+   disk again are verified again, unless the handle was opened with
+   FEC_VERITY_CHECK_AT_MOST_ONCE, in which case a bit is kept for every data
+   block that has been verified on disk */
+struct verity_cache {
+    std::unique_ptr<std::atomic<uint64_t>[]> verified;
+    uint64_t blocks; /* number of bits in `verified' */
+    std::atomic<uint64_t> verified_hits;
+
+    pthread_mutex_t mutex; /* protects the rest */
+    uint32_t size; /* number of entries, 0 if the cache is disabled */
+    std::unique_ptr<uint8_t[]> data; /* allocated on first use */
+    std::unique_ptr<verity_cache_entry[]> entries;
+    std::unordered_map<uint64_t, uint32_t> index;
+    uint32_t head; /* most recently used entry */
+    uint32_t tail; /* least recently used entry */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/* returns true if `block' has already been verified on disk */
+bool verity_is_verified(fec_handle *f, uint64_t block)
+{
+    verity_cache *c = f->verity.cache;
+
+    if (!c || !c->verified || block >= c->blocks ||
+            !(c->verified[block / 64].load(std::memory_order_relaxed) &
+                (1ULL << (block % 64)))) {
+        return false;
+    }
+
+    c->verified_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/* marks `count' blocks starting from `block' as verified on disk */
+void verity_set_verified(fec_handle *f, uint64_t block, size_t count)
+{
+    verity_cache *c = f->verity.cache;
+
+    if (!c || !c->verified) {
+        return;
+    }
+
+    for (uint64_t b = block; b < block + count && b < c->blocks; ++b) {
+        c->verified[b / 64].fetch_or(1ULL << (b % 64),
+            std::memory_order_relaxed);
+    }
+}
+
+/* moves entry `i' to the head of the list */
+static void cache_touch(verity_cache *c, uint32_t i)
+{
+    if (c->head == i) {
+        return;
+    }
+
+    verity_cache_entry *e = &c->entries[i];
+
+    /* unlink */
+    c->entries[e->prev].next = e->next;
+
+    if (c->tail == i) {
+        c->tail = e->prev;
+    } else {
+        c->entries[e->next].prev = e->prev;
+    }
+
+    /* link at the head */
+    e->next = c->head;
+    c->entries[c->head].prev = i;
+    c->head = i;
+}
+
+/* copies `block' to `dest' if it is in the cache */
+bool verity_cache_get(fec_handle *f, uint64_t block, uint8_t *dest)
+{
+    verity_cache *c = f->verity.cache;
+
+    if (!c) {
+        return false;
+    }
+
+    pthread_mutex_lock(&c->mutex);
+
+    if (!c->size) {
+        pthread_mutex_unlock(&c->mutex);
+        return false;
+    }
+
+    auto it = c->index.find(block);
+
+    if (it == c->index.end()) {
+        ++c->misses;
+        pthread_mutex_unlock(&c->mutex);
+        return false;
+    }
+
+    memcpy(dest, &c->data[(uint64_t)it->second * FEC_BLOCKSIZE],
+        FEC_BLOCKSIZE);
+    cache_touch(c, it->second);
+    ++c->hits;
+
+    pthread_mutex_unlock(&c->mutex);
+    return true;
+}
+
+/* stores the valid contents of `block' in the cache in place of the least
+   recently used block */
+void verity_cache_put(fec_handle *f, uint64_t block, const uint8_t *data)
+{
+    verity_cache *c = f->verity.cache;
+
+    if (!c) {
+        return;
+    }
+
+    pthread_mutex_lock(&c->mutex);
+
+    if (!c->size) {
+        pthread_mutex_unlock(&c->mutex);
+        return;
+    }
+
+    if (!c->data) {
+        c->data.reset(new (std::nothrow)
+            uint8_t[(uint64_t)c->size * FEC_BLOCKSIZE]);
+
+        /* the cache is only an optimization, so carry on without it */
+        if (unlikely(!c->data)) {
+            pthread_mutex_unlock(&c->mutex);
+            return;
+        }
+    }
+
+    auto it = c->index.find(block);
+    uint32_t i;
+
+    if (it != c->index.end()) {
+        i = it->second;
+    } else {
+        i = c->tail;
+
+        if (c->entries[i].block != VERITY_NO_CACHE) {
+            c->index.erase(c->entries[i].block);
+        }
+
+        c->entries[i].block = block;
+        c->index[block] = i;
+    }
+
+    memcpy(&c->data[(uint64_t)i * FEC_BLOCKSIZE], data, FEC_BLOCKSIZE);
+    cache_touch(c, i);
+
+    pthread_mutex_unlock(&c->mutex);
+}
+
+/* copies cache statistics to `s' */
+void verity_cache_status(fec_handle *f, fec_status *s)
+{
+    verity_cache *c = f->verity.cache;
+
+    s->cache_hits = 0;
+    s->cache_misses = 0;
+    s->verified_hits = 0;
+
+    if (!c) {
+        return;
+    }
+
+    pthread_mutex_lock(&c->mutex);
+    s->cache_hits = c->hits;
+    s->cache_misses = c->misses;
+    pthread_mutex_unlock(&c->mutex);
+
+    s->verified_hits = c->verified_hits.load(std::memory_order_relaxed);
+}
+
+/* empties the cache and makes room for `size' blocks, with the memory for
+   the data allocated on first use; must be called with c->mutex held */
+static int verity_cache_resize(verity_cache *c, uint32_t size)
+{
+    c->size = 0;
+    c->data.reset();
+    c->entries.reset();
+    c->index.clear();
+
+    if (!size) {
+        return 0;
+    }
+
+    std::unique_ptr<verity_cache_entry[]> entries(new (std::nothrow)
+        verity_cache_entry[size]);
+
+    if (unlikely(!entries)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* all entries start out unused in a list in index order */
+    for (uint32_t i = 0; i < size; ++i) {
+        entries[i].block = VERITY_NO_CACHE;
+        entries[i].prev = i > 0 ? i - 1 : 0;
+        entries[i].next = i + 1;
+    }
+
+    c->entries = std::move(entries);
+    c->size = size;
+    c->head = 0;
+    c->tail = size - 1;
+    return 0;
+}
+
+void verity_cache_free(fec_handle *f)
+{
+    verity_cache *c = f->verity.cache;
+
+    if (!c) {
+        return;
+    }
+
+    pthread_mutex_destroy(&c->mutex);
+    delete c;
+    f->verity.cache = NULL;
+}
+
+/* allocates the cache for blocks covered by the hash tree */
+static int verity_cache_init(fec_handle *f)
+{
+    verity_info *v = &f->verity;
+
+    verity_cache_free(f);
+
+    std::unique_ptr<verity_cache> c(new (std::nothrow) verity_cache());
+
+    if (unlikely(!c) || verity_cache_resize(c.get(),
+                            VERITY_CACHE_BLOCKS) == -1) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (f->flags & FEC_VERITY_CHECK_AT_MOST_ONCE) {
+        c->blocks = (uint64_t)v->hash_data_blocks * FEC_BLOCKSIZE /
+                        SHA256_DIGEST_LENGTH;
+        c->verified.reset(new (std::nothrow)
+            std::atomic<uint64_t>[fec_div_round_up(c->blocks, 64)]());
+
+        /* without the bitmap, every block read from disk is verified */
+        if (unlikely(!c->verified)) {
+            warn("failed to allocate verified block bitmap");
+        }
+    }
+
+    pthread_mutex_init(&c->mutex, NULL);
+    v->cache = c.release();
+    return 0;
+}
+
+/* sets the number of recently read data blocks kept in memory, which is
+   VERITY_CACHE_BLOCKS by default; 0 disables the cache */
+int fec_set_cache_size(struct fec_handle *f, uint32_t blocks)
+{
+    check(f);
+
+    if (!f->verity.hash) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!f->verity.cache && verity_cache_init(f) == -1) {
+        error("failed to allocate verity cache");
+        return -1;
+    }
+
+    verity_cache *c = f->verity.cache;
+
+    pthread_mutex_lock(&c->mutex);
+    int rc = verity_cache_resize(c, blocks);
+    pthread_mutex_unlock(&c->mutex);
+
+    if (rc == -1) {
+        error("failed to allocate verity cache of %u blocks", blocks);
+    }
+
+    return rc;
+}
+
 /* reads a verity hash and the corresponding data block using error correction,
    if available */
 static bool ecc_read_hashes(fec_handle *f, uint64_t hash_offset,
@@ -447,6 +761,10 @@ static int parse_table(fec_handle *f, uint64_t offset, uint32_t size, bool useec
 
     v->salt = salt.release();
 
+    /* every block hash starts with the salt, so only hash it once */
+    SHA256_Init(&v->salt_ctx);
+    SHA256_Update(&v->salt_ctx, v->salt, v->salt_size);
+
     if (v->table) {
         delete[] v->table;
         v->table = NULL;
@@ -630,6 +948,11 @@ int verity_parse_header(fec_handle *f, uint64_t offset)
         f->data_size = v->hash_start;
     }
 
+    /* the cache is only an optimization, so carry on without it */
+    if (verity_cache_init(f) == -1) {
+        warn("failed to allocate verity cache: %s", strerror(errno));
+    }
+
     return 0;
 }
 
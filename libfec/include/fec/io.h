@@ -58,6 +58,10 @@ struct fec_status {
     uint64_t errors;
     uint64_t data_size;
     uint64_t size;
+    uint64_t cache_hits; /* blocks read from the data block cache */
+    uint64_t cache_misses; /* blocks looked up but not found in the cache */
+    uint64_t verified_hits; /* blocks read again without checking the hash,
+                               see FEC_VERITY_CHECK_AT_MOST_ONCE */
 };
 
 struct fec_ecc_metadata {
@@ -81,7 +85,11 @@ struct fec_verity_metadata {
 enum {
     FEC_FS_EXT4 = 1 << 0,
     FEC_FS_SQUASH = 1 << 1,
-    FEC_VERITY_DISABLE = 1 << 8
+    FEC_VERITY_DISABLE = 1 << 8,
+    /* like check_at_most_once in dm-verity, blocks read from the file again
+       after they were verified are not checked again, which is faster, but
+       misses blocks changed on disk after the first read */
+    FEC_VERITY_CHECK_AT_MOST_ONCE = 1 << 9
 };
 
 struct fec_handle;
@@ -102,6 +110,8 @@ extern int fec_ecc_get_metadata(struct fec_handle *f,
 
 extern int fec_get_status(struct fec_handle *f, struct fec_status *s);
 
+extern int fec_set_cache_size(struct fec_handle *f, uint32_t blocks);
+
 extern int fec_seek(struct fec_handle *f, int64_t offset, int whence);
 
 extern ssize_t fec_read(struct fec_handle *f, void *buf, size_t count);
@@ -163,6 +173,10 @@ namespace fec {
             return !fec_get_status(handle_.get(), &status);
         }
 
+        bool set_cache_size(uint32_t blocks) {
+            return !fec_set_cache_size(handle_.get(), blocks);
+        }
+
         bool get_verity_metadata(fec_verity_metadata& data) {
             return !fec_verity_get_metadata(handle_.get(), &data);
         }
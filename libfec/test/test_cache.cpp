@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Reads blocks of a copy of an image through the verity data block cache,
+   and checks that repeated reads hit the cache, that the least recently
+   used blocks are evicted, that blocks changed on disk after they were
+   verified are not returned, that large reads use the cache without filling
+   it, that the cache size can be changed, and that blocks are verified only
+   once with FEC_VERITY_CHECK_AT_MOST_ONCE. The image needs verity metadata
+   and enough non-zero blocks to fill the cache. */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+#include <fec/io.h>
+
+#include "fec_private.h"
+
+using namespace std;
+
+static mt19937_64 random_bytes(1);
+
+static bool check_stats(fec_handle *f, const char *what, uint64_t hits,
+        uint64_t misses, uint64_t verified_hits = 0)
+{
+    fec_status status;
+
+    if (fec_get_status(f, &status) == -1) {
+        cerr << what << ": failed to get status" << endl;
+        return false;
+    }
+
+    if (status.cache_hits != hits || status.cache_misses != misses ||
+            status.verified_hits != verified_hits) {
+        cerr << what << ": " << status.cache_hits << " hits, "
+             << status.cache_misses << " misses and " << status.verified_hits
+             << " verified hits, expected " << hits << ", " << misses
+             << " and " << verified_hits << endl;
+        return false;
+    }
+
+    return true;
+}
+
+/* opens `path' with `flags' and a cache of `size' blocks */
+static fec::handle open_cached(const char *path, int flags, uint32_t size)
+{
+    fec_handle *f = NULL;
+
+    if (fec_open(&f, path, O_RDONLY, flags, FEC_DEFAULT_ROOTS) == -1) {
+        cerr << "failed to open " << path << endl;
+        return fec::handle(NULL, fec_close);
+    }
+
+    fec::handle handle(f, fec_close);
+
+    if (fec_set_cache_size(f, size) == -1) {
+        cerr << "failed to set the cache size to " << size << endl;
+        return fec::handle(NULL, fec_close);
+    }
+
+    return handle;
+}
+
+/* reads `count' bytes from block `block' and returns false if the read
+   returns anything but `expected'; a failed read is fine if `may_fail' */
+static bool check_read(fec_handle *f, const char *what, uint64_t block,
+        size_t count, const uint8_t *expected, bool may_fail = false)
+{
+    unique_ptr<uint8_t[]> data(new uint8_t[count]);
+    ssize_t rc = fec_pread(f, data.get(), count, block * FEC_BLOCKSIZE);
+
+    if (rc == -1 && may_fail) {
+        return true;
+    }
+
+    if (rc != (ssize_t)count || memcmp(data.get(), expected, count)) {
+        cerr << what << ": unexpected data in block " << block << endl;
+        return false;
+    }
+
+    return true;
+}
+
+/* overwrites block `block' of `path' with random data */
+static bool corrupt(const char *path, uint64_t block)
+{
+    uint8_t data[FEC_BLOCKSIZE];
+
+    for (size_t i = 0; i < FEC_BLOCKSIZE; ++i) {
+        data[i] = random_bytes();
+    }
+
+    int fd = open(path, O_WRONLY);
+
+    if (fd == -1 || pwrite(fd, data, FEC_BLOCKSIZE,
+                        block * FEC_BLOCKSIZE) != FEC_BLOCKSIZE) {
+        cerr << "failed to corrupt block " << block << endl;
+        return false;
+    }
+
+    close(fd);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        cerr << "usage: " << argv[0] << " input output" << endl;
+        return 1;
+    }
+
+    fec::io input(argv[1]);
+    fec_status status;
+
+    if (!input || !input.get_status(status)) {
+        cerr << "failed to open " << argv[1] << endl;
+        return 1;
+    }
+
+    if (!input.has_verity()) {
+        cerr << argv[1] << " has no verity metadata" << endl;
+        return 1;
+    }
+
+    /* the blocks read below, and a large read after them, which does not
+       use the cache */
+    const size_t large = VERITY_CACHE_MAX_READ + FEC_BLOCKSIZE;
+    const size_t needed = VERITY_CACHE_BLOCKS + 2;
+    uint64_t data_blocks = status.data_size / FEC_BLOCKSIZE;
+    vector<uint64_t> blocks;
+    vector<uint8_t> original;
+    uint8_t data[FEC_BLOCKSIZE];
+
+    /* zero blocks are not cached in read-only mode, so skip them */
+    for (uint64_t i = 0; i < data_blocks && blocks.size() < needed; ++i) {
+        if (input.pread(data, FEC_BLOCKSIZE, i * FEC_BLOCKSIZE) !=
+                FEC_BLOCKSIZE) {
+            cerr << "failed to read block " << i << endl;
+            return 1;
+        }
+
+        for (size_t j = 0; j < FEC_BLOCKSIZE; ++j) {
+            if (data[j]) {
+                blocks.push_back(i);
+                original.insert(original.end(), data, data + FEC_BLOCKSIZE);
+                break;
+            }
+        }
+    }
+
+    uint64_t last = blocks.empty() ? 0 : blocks.back();
+
+    if (blocks.size() < needed || last * FEC_BLOCKSIZE + large >
+            status.data_size) {
+        cerr << argv[1] << " has too few non-zero blocks" << endl;
+        return 1;
+    }
+
+    unique_ptr<uint8_t[]> large_original(new uint8_t[large]);
+
+    if (input.pread(large_original.get(), large, last * FEC_BLOCKSIZE) !=
+            (ssize_t)large) {
+        cerr << "failed to read block " << last << endl;
+        return 1;
+    }
+
+    input.close();
+
+    {
+        ifstream src(argv[1], ios::binary);
+        ofstream dst(argv[2], ios::binary | ios::trunc);
+
+        if (!(dst << src.rdbuf())) {
+            cerr << "failed to copy " << argv[1] << " to " << argv[2] << endl;
+            return 1;
+        }
+    }
+
+    fec_handle *f = NULL;
+
+    if (fec_open(&f, argv[2], O_RDONLY, 0, FEC_DEFAULT_ROOTS) == -1) {
+        cerr << "failed to open " << argv[2] << endl;
+        return 1;
+    }
+
+    unique_ptr<fec_handle, decltype(&fec_close)> handle(f, fec_close);
+    auto block_data = [&](size_t i) { return &original[i * FEC_BLOCKSIZE]; };
+
+    /* the first read of a block misses, the second one hits */
+    if (!check_read(f, "miss", blocks[0], FEC_BLOCKSIZE, block_data(0)) ||
+            !check_stats(f, "miss", 0, 1) ||
+            !check_read(f, "hit", blocks[0], FEC_BLOCKSIZE, block_data(0)) ||
+            !check_stats(f, "hit", 1, 1)) {
+        return 1;
+    }
+
+    /* filling the cache with other blocks evicts the least recently used
+       one, but keeps the ones read after it */
+    for (size_t i = 1; i <= VERITY_CACHE_BLOCKS; ++i) {
+        if (!check_read(f, "fill", blocks[i], FEC_BLOCKSIZE, block_data(i))) {
+            return 1;
+        }
+    }
+
+    if (!check_stats(f, "fill", 1, 1 + VERITY_CACHE_BLOCKS) ||
+            !check_read(f, "kept", blocks[VERITY_CACHE_BLOCKS], FEC_BLOCKSIZE,
+                block_data(VERITY_CACHE_BLOCKS)) ||
+            !check_stats(f, "kept", 2, 1 + VERITY_CACHE_BLOCKS) ||
+            !check_read(f, "evicted", blocks[0], FEC_BLOCKSIZE,
+                block_data(0)) ||
+            !check_stats(f, "evicted", 2, 2 + VERITY_CACHE_BLOCKS)) {
+        return 1;
+    }
+
+    /* reading blocks[0] again evicted blocks[1], which was verified before;
+       after it changes on disk, it must be verified again */
+    if (!corrupt(argv[2], blocks[1]) ||
+            !check_read(f, "changed evicted block", blocks[1], FEC_BLOCKSIZE,
+                block_data(1), true)) {
+        return 1;
+    }
+
+    /* cached blocks hold data that was verified when it was read, so a
+       cached block that changes on disk is still read correctly */
+    if (!corrupt(argv[2], blocks[0]) ||
+            !check_read(f, "changed cached block", blocks[0], FEC_BLOCKSIZE,
+                block_data(0))) {
+        return 1;
+    }
+
+    /* large reads do not fill the cache, so a block verified by one must be
+       verified again by the next one */
+    if (!check_read(f, "large", last, large, large_original.get()) ||
+            !corrupt(argv[2], last) ||
+            !check_read(f, "changed large", last, large,
+                large_original.get(), true)) {
+        return 1;
+    }
+
+    handle.reset();
+
+    /* large reads copy the blocks that are in the cache, but do not add the
+       blocks they read from disk */
+    fec::handle h = open_cached(argv[2], 0, VERITY_CACHE_BLOCKS);
+
+    if (!h || !check_read(h.get(), "small", blocks[2], FEC_BLOCKSIZE,
+                    block_data(2)) ||
+            !check_stats(h.get(), "small", 0, 1)) {
+        return 1;
+    }
+
+    unique_ptr<uint8_t[]> large_data(new uint8_t[large]);
+
+    for (uint64_t i = 0; i < 2; ++i) {
+        if (fec_pread(h.get(), large_data.get(), large,
+                blocks[2] * FEC_BLOCKSIZE) != (ssize_t)large ||
+                memcmp(large_data.get(), block_data(2), FEC_BLOCKSIZE) ||
+                fec_get_status(h.get(), &status) == -1) {
+            cerr << "large: failed to read block " << blocks[2] << endl;
+            return 1;
+        }
+
+        if (status.cache_hits != 1 + i) {
+            cerr << "large: " << status.cache_hits << " hits, expected "
+                 << 1 + i << endl;
+            return 1;
+        }
+    }
+
+    /* a smaller cache evicts blocks sooner, and no cache has no hits */
+    h = open_cached(argv[2], 0, 2);
+
+    if (!h || !check_read(h.get(), "size", blocks[2], FEC_BLOCKSIZE,
+                    block_data(2)) ||
+            !check_read(h.get(), "size", blocks[3], FEC_BLOCKSIZE,
+                block_data(3)) ||
+            !check_read(h.get(), "size", blocks[4], FEC_BLOCKSIZE,
+                block_data(4)) ||
+            !check_read(h.get(), "size", blocks[2], FEC_BLOCKSIZE,
+                block_data(2)) ||
+            !check_read(h.get(), "size", blocks[2], FEC_BLOCKSIZE,
+                block_data(2)) ||
+            !check_stats(h.get(), "size", 1, 4) ||
+            fec_set_cache_size(h.get(), 0) == -1 ||
+            !check_read(h.get(), "disabled", blocks[2], FEC_BLOCKSIZE,
+                block_data(2)) ||
+            !check_stats(h.get(), "disabled", 1, 4)) {
+        return 1;
+    }
+
+    /* with FEC_VERITY_CHECK_AT_MOST_ONCE, blocks read from disk again are
+       not verified again */
+    h = open_cached(argv[2], FEC_VERITY_CHECK_AT_MOST_ONCE, 0);
+
+    if (!h || !check_read(h.get(), "once", blocks[2], FEC_BLOCKSIZE,
+                    block_data(2)) ||
+            !check_stats(h.get(), "once", 0, 0, 0) ||
+            !check_read(h.get(), "once", blocks[2], FEC_BLOCKSIZE,
+                block_data(2)) ||
+            !check_stats(h.get(), "once", 0, 0, 1)) {
+        return 1;
+    }
+
+    cout << "ok" << endl;
+    return 0;
+}
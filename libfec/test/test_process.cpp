@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Splits reads between the worker threads of a handle without an image,
+   using a read function that records the chunks it is called for, and
+   checks how reads are split into chunks, that idle threads steal chunks
+   from busy ones, that errors from worker threads fail the read, and that
+   idle threads stop when the handle is closed. */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "fec_private.h"
+
+using namespace std;
+
+#define TEST_THREADS 4
+
+/* what the read function does, and the chunks it was called for */
+static struct {
+    pthread_mutex_t mutex;
+    pthread_t caller;
+    vector<pair<uint64_t, size_t>> chunks;
+    uint64_t slow_offset; /* the chunk at this offset takes a while */
+    uint64_t fail_offset; /* the chunk at this offset fails */
+    bool failed_on_caller;
+} state = { PTHREAD_MUTEX_INITIALIZER, 0, {}, UINT64_MAX, UINT64_MAX, false };
+
+static inline uint8_t pattern(uint64_t offset)
+{
+    return (uint8_t)(offset ^ (offset >> 8) ^ (offset >> 16));
+}
+
+static ssize_t test_read(fec_handle *, uint8_t *dest, size_t count,
+        uint64_t offset, size_t *errors)
+{
+    pthread_mutex_lock(&state.mutex);
+    state.chunks.emplace_back(offset, count);
+    bool slow = offset == state.slow_offset;
+    bool fail = offset == state.fail_offset;
+
+    if (fail && pthread_equal(pthread_self(), state.caller)) {
+        state.failed_on_caller = true;
+    }
+
+    pthread_mutex_unlock(&state.mutex);
+
+    if (slow) {
+        usleep(200000);
+    }
+
+    if (fail) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        dest[i] = pattern(offset + i);
+    }
+
+    *errors = 1;
+    return count;
+}
+
+/* a handle with only what process() needs */
+struct test_handle {
+    fec_handle *f;
+
+    test_handle() : f(new fec_handle()) {
+        pthread_mutex_init(&f->mutex, NULL);
+    }
+
+    ~test_handle() {
+        process_cleanup(f);
+        pthread_mutex_destroy(&f->mutex);
+        delete f;
+    }
+};
+
+static void reset_state()
+{
+    state.caller = pthread_self();
+    state.chunks.clear();
+    state.slow_offset = UINT64_MAX;
+    state.fail_offset = UINT64_MAX;
+    state.failed_on_caller = false;
+}
+
+/* reads `count' bytes from `offset', and checks that every byte was read
+   exactly once */
+static bool read_all(fec_handle *f, uint64_t offset, size_t count)
+{
+    unique_ptr<uint8_t[]> buf(new uint8_t[count]);
+
+    if (process(f, buf.get(), count, offset, test_read) != (ssize_t)count) {
+        cerr << "read of " << count << " bytes at " << offset << " failed"
+             << endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (buf[i] != pattern(offset + i)) {
+            cerr << "wrong data at " << offset + i << endl;
+            return false;
+        }
+    }
+
+    sort(state.chunks.begin(), state.chunks.end());
+    uint64_t next = offset;
+
+    for (auto& chunk : state.chunks) {
+        if (chunk.first != next) {
+            cerr << "chunk at " << chunk.first << ", expected " << next
+                 << endl;
+            return false;
+        }
+
+        next += chunk.second;
+    }
+
+    if (next != offset + count) {
+        cerr << "chunks end at " << next << ", expected " << offset + count
+             << endl;
+        return false;
+    }
+
+    return true;
+}
+
+static uint64_t total(const vector<work_stats>& stats,
+        uint64_t work_stats::*field)
+{
+    uint64_t sum = 0;
+
+    for (auto& s : stats) {
+        sum += s.*field;
+    }
+
+    return sum;
+}
+
+/* reads are split into block aligned chunks of equal size, and small ones
+   are not split at all */
+static bool test_split()
+{
+    test_handle h;
+    reset_state();
+
+    if (process_init(h.f, TEST_THREADS) == -1) {
+        return false;
+    }
+
+    int threads = process_get_stats(h.f, NULL, 0);
+    uint64_t offset = 123;
+    size_t count = 10 * 1024 * 1024 + 1000;
+
+    if (!read_all(h.f, offset, count)) {
+        return false;
+    }
+
+    uint64_t blocks = fec_div_round_up(offset + count, FEC_BLOCKSIZE);
+    uint64_t chunk_blocks = max<uint64_t>(
+                                fec_div_round_up(blocks,
+                                    threads * WORK_CHUNKS_PER_THREAD),
+                                WORK_MIN_CHUNK_SIZE / FEC_BLOCKSIZE);
+    uint64_t chunk_size = chunk_blocks * FEC_BLOCKSIZE;
+
+    if (state.chunks.size() != fec_div_round_up(blocks, chunk_blocks)) {
+        cerr << threads << " threads: " << state.chunks.size()
+             << " chunks, expected "
+             << fec_div_round_up(blocks, chunk_blocks) << endl;
+        return false;
+    }
+
+    for (size_t i = 1; i < state.chunks.size(); ++i) {
+        if (state.chunks[i].first % chunk_size ||
+                state.chunks[i].second > chunk_size) {
+            cerr << "chunk of " << state.chunks[i].second << " bytes at "
+                 << state.chunks[i].first << " is not aligned to "
+                 << chunk_size << endl;
+            return false;
+        }
+    }
+
+    vector<work_stats> stats(threads);
+
+    if (process_get_stats(h.f, stats.data(), threads) != threads ||
+            total(stats, &work_stats::chunks) != state.chunks.size()) {
+        cerr << "thread statistics do not add up to the chunks read" << endl;
+        return false;
+    }
+
+    /* reads smaller than two chunks stay on the calling thread */
+    reset_state();
+
+    if (!read_all(h.f, offset, 2 * WORK_MIN_CHUNK_SIZE - 1) ||
+            state.chunks.size() != 1) {
+        cerr << "a small read was split" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+/* chunks left to a thread that is held up are stolen by the others */
+static bool test_steal()
+{
+    test_handle h;
+    reset_state();
+
+    if (process_init(h.f, TEST_THREADS) == -1) {
+        return false;
+    }
+
+    int threads = process_get_stats(h.f, NULL, 0);
+
+    if (threads < 2) {
+        cerr << "no worker threads to steal chunks" << endl;
+        return false;
+    }
+
+    /* the calling thread starts with the first chunk */
+    state.slow_offset = 0;
+
+    if (!read_all(h.f, 0, 8 * 1024 * 1024)) {
+        return false;
+    }
+
+    vector<work_stats> stats(threads);
+    process_get_stats(h.f, stats.data(), threads);
+
+    uint64_t own = fec_div_round_up(state.chunks.size(), threads);
+
+    if (total(stats, &work_stats::stolen) == 0 || stats[0].chunks >= own) {
+        cerr << "no chunks were stolen from the calling thread" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+/* a chunk that fails on a worker thread fails the whole read, and the
+   threads can be used again afterwards */
+static bool test_error()
+{
+    test_handle h;
+    reset_state();
+
+    if (process_init(h.f, TEST_THREADS) == -1) {
+        return false;
+    }
+
+    size_t count = 8 * 1024 * 1024;
+    unique_ptr<uint8_t[]> buf(new uint8_t[count]);
+
+    /* keep the calling thread busy while the last chunk fails */
+    state.slow_offset = 0;
+    state.fail_offset = count - WORK_MIN_CHUNK_SIZE;
+
+    errno = 0;
+
+    if (process(h.f, buf.get(), count, 0, test_read) != -1 ||
+            errno != EIO) {
+        cerr << "a failed chunk did not fail the read" << endl;
+        return false;
+    }
+
+    if (state.failed_on_caller) {
+        cerr << "the failed chunk was not read by a worker thread" << endl;
+        return false;
+    }
+
+    reset_state();
+
+    if (!read_all(h.f, 0, count)) {
+        return false;
+    }
+
+    /* only errors corrected by reads that succeed are counted */
+    if (h.f->errors != state.chunks.size()) {
+        cerr << h.f->errors << " errors, expected " << state.chunks.size()
+             << endl;
+        return false;
+    }
+
+    return true;
+}
+
+/* idle threads stop when the handle is cleaned up, whether they have read
+   anything or not */
+static bool test_shutdown()
+{
+    {
+        test_handle h;
+
+        if (process_init(h.f, TEST_THREADS) == -1) {
+            return false;
+        }
+    }
+
+    {
+        test_handle h;
+        reset_state();
+
+        if (process_init(h.f, TEST_THREADS) == -1 ||
+                !read_all(h.f, 0, 4 * 1024 * 1024)) {
+            return false;
+        }
+
+        /* let the threads go back to waiting for work */
+        usleep(10000);
+        process_cleanup(h.f);
+
+        if (h.f->pool) {
+            cerr << "the worker pool was not freed" << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main()
+{
+    /* a thread that does not stop hangs the test */
+    alarm(60);
+
+    static const struct {
+        const char *name;
+        bool (*func)();
+    } tests[] = {
+        { "split", test_split },
+        { "steal", test_steal },
+        { "error", test_error },
+        { "shutdown", test_shutdown },
+    };
+
+    int failed = 0;
+
+    for (auto& test : tests) {
+        bool ok = test.func();
+        cout << test.name << ": " << (ok ? "ok" : "FAILED") << endl;
+
+        if (!ok) {
+            ++failed;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Corrupts random data blocks in a copy of an image and measures how long
+   reading them back through libfec takes. Whole blocks are overwritten,
+   so the image needs verity metadata for them to be located as
+   erasures. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+#include <fec/io.h>
+
+using namespace std;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4 && argc != 5) {
+        cerr << "usage: " << argv[0] << " input output blocks [seed]" << endl;
+        return 1;
+    }
+
+    uint64_t count = strtoull(argv[3], NULL, 0);
+    mt19937_64 random(argc == 5 ? strtoull(argv[4], NULL, 0) : 1);
+
+    fec::io input(argv[1]);
+    fec_status status;
+
+    if (!input || !input.get_status(status)) {
+        cerr << "failed to open " << argv[1] << endl;
+        return 1;
+    }
+
+    if (!input.has_ecc()) {
+        cerr << argv[1] << " has no ecc data" << endl;
+        return 1;
+    }
+
+    if (!input.has_verity()) {
+        cerr << "warning: " << argv[1] << " has no verity metadata" << endl;
+    }
+
+    uint64_t data_blocks = status.data_size / FEC_BLOCKSIZE;
+
+    if (count == 0 || count > data_blocks) {
+        cerr << "blocks must be between 1 and " << data_blocks << endl;
+        return 1;
+    }
+
+    /* pick distinct blocks to corrupt */
+    vector<uint64_t> blocks;
+
+    while (blocks.size() < count) {
+        uint64_t block = random() % data_blocks;
+
+        if (find(blocks.begin(), blocks.end(), block) == blocks.end()) {
+            blocks.push_back(block);
+        }
+    }
+
+    unique_ptr<uint8_t[]> original(new (nothrow) uint8_t[count * FEC_BLOCKSIZE]);
+    uint8_t data[FEC_BLOCKSIZE];
+
+    if (!original) {
+        cerr << "failed to allocate buffer" << endl;
+        return 1;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        if (input.pread(&original[i * FEC_BLOCKSIZE], FEC_BLOCKSIZE,
+                blocks[i] * FEC_BLOCKSIZE) != FEC_BLOCKSIZE) {
+            cerr << "failed to read block " << blocks[i] << endl;
+            return 1;
+        }
+    }
+
+    input.close();
+
+    {
+        ifstream src(argv[1], ios::binary);
+        ofstream dst(argv[2], ios::binary | ios::trunc);
+
+        if (!(dst << src.rdbuf())) {
+            cerr << "failed to copy " << argv[1] << " to " << argv[2] << endl;
+            return 1;
+        }
+    }
+
+    {
+        fstream output(argv[2], ios::binary | ios::in | ios::out);
+
+        for (uint64_t i = 0; i < count; ++i) {
+            for (size_t j = 0; j < FEC_BLOCKSIZE; ++j) {
+                data[j] = random();
+            }
+
+            output.seekp(blocks[i] * FEC_BLOCKSIZE);
+
+            if (!output.write(reinterpret_cast<const char *>(data),
+                    FEC_BLOCKSIZE)) {
+                cerr << "failed to corrupt block " << blocks[i] << endl;
+                return 1;
+            }
+        }
+    }
+
+    fec::io corrupted(argv[2]);
+
+    if (!corrupted) {
+        cerr << "failed to open " << argv[2] << endl;
+        return 1;
+    }
+
+    uint64_t failed = 0;
+    uint64_t start = now_ns();
+
+    for (uint64_t i = 0; i < count; ++i) {
+        if (corrupted.pread(data, FEC_BLOCKSIZE, blocks[i] * FEC_BLOCKSIZE) !=
+                FEC_BLOCKSIZE ||
+            memcmp(data, &original[i * FEC_BLOCKSIZE], FEC_BLOCKSIZE)) {
+            cerr << "failed to recover block " << blocks[i] << endl;
+            ++failed;
+        }
+    }
+
+    uint64_t elapsed = now_ns() - start;
+
+    if (!corrupted.get_status(status)) {
+        cerr << "failed to get status" << endl;
+        return 1;
+    }
+
+    cout << count << " blocks, " << failed << " not recovered, "
+         << status.errors << " errors corrected in " << elapsed / 1000
+         << " us (" << elapsed / count / 1000 << " us per block)" << endl;
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Checks batches of VERITY_READ_BLOCKS blocks with the first, a middle, or
+   the last block corrupted. verity_check_blocks must stop at the corrupted
+   block, and reading the batch from a copy of an image must still return
+   the original data by correcting the block. The image needs verity and
+   ecc metadata. */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+#include <fec/io.h>
+
+#include "fec_private.h"
+
+using namespace std;
+
+static const size_t batch_size = VERITY_READ_BLOCKS * FEC_BLOCKSIZE;
+
+/* positions of the corrupted block in a batch */
+static const size_t corrupted[] = {
+    0, VERITY_READ_BLOCKS / 2, VERITY_READ_BLOCKS - 1
+};
+
+static mt19937_64 random_bytes(1);
+
+/* checks verity_check_blocks on a batch of random blocks with a bare
+   handle that only has a salt */
+static bool test_check_blocks()
+{
+    uint8_t salt[SHA256_DIGEST_LENGTH];
+    unique_ptr<uint8_t[]> blocks(new uint8_t[batch_size]);
+    uint8_t hashes[VERITY_READ_BLOCKS * SHA256_DIGEST_LENGTH];
+
+    for (size_t i = 0; i < sizeof(salt); ++i) {
+        salt[i] = random_bytes();
+    }
+
+    for (size_t i = 0; i < batch_size; ++i) {
+        blocks[i] = random_bytes();
+    }
+
+    for (size_t i = 0; i < VERITY_READ_BLOCKS; ++i) {
+        SHA256_CTX ctx;
+        SHA256_Init(&ctx);
+        SHA256_Update(&ctx, salt, sizeof(salt));
+        SHA256_Update(&ctx, &blocks[i * FEC_BLOCKSIZE], FEC_BLOCKSIZE);
+        SHA256_Final(&hashes[i * SHA256_DIGEST_LENGTH], &ctx);
+    }
+
+    unique_ptr<fec_handle> f(new fec_handle());
+    f->verity.salt = salt;
+    f->verity.salt_size = sizeof(salt);
+    SHA256_Init(&f->verity.salt_ctx);
+    SHA256_Update(&f->verity.salt_ctx, salt, sizeof(salt));
+
+    size_t ok = verity_check_blocks(f.get(), hashes, blocks.get(),
+                    VERITY_READ_BLOCKS);
+
+    if (ok != VERITY_READ_BLOCKS) {
+        cerr << "valid batch: " << ok << " blocks ok" << endl;
+        return false;
+    }
+
+    for (size_t bad : corrupted) {
+        blocks[bad * FEC_BLOCKSIZE + FEC_BLOCKSIZE / 2] ^= 1;
+        ok = verity_check_blocks(f.get(), hashes, blocks.get(),
+                VERITY_READ_BLOCKS);
+        blocks[bad * FEC_BLOCKSIZE + FEC_BLOCKSIZE / 2] ^= 1;
+
+        if (ok != bad) {
+            cerr << "block " << bad << " corrupted: " << ok
+                 << " blocks ok" << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* returns true if `data' has a non-zero byte */
+static bool is_nonzero(const uint8_t *data, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (data[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        cerr << "usage: " << argv[0] << " input output" << endl;
+        return 1;
+    }
+
+    if (!test_check_blocks()) {
+        return 1;
+    }
+
+    fec::io input(argv[1]);
+    fec_status status;
+
+    if (!input || !input.get_status(status)) {
+        cerr << "failed to open " << argv[1] << endl;
+        return 1;
+    }
+
+    if (!input.has_verity() || !input.has_ecc()) {
+        cerr << argv[1] << " has no verity or ecc metadata" << endl;
+        return 1;
+    }
+
+    /* the batches are read in read-write mode, where zero blocks are read
+       and verified like the others, but the corrupted block must not be a
+       zero block, because those are not corrected */
+    const size_t count = sizeof(corrupted) / sizeof(corrupted[0]);
+    uint64_t data_blocks = status.data_size / FEC_BLOCKSIZE;
+    vector<uint64_t> batches;
+    vector<uint8_t> original;
+    uint64_t next = 0;
+    uint8_t data[FEC_BLOCKSIZE];
+
+    while (batches.size() < count) {
+        uint64_t block = next + corrupted[batches.size()];
+
+        if (block - corrupted[batches.size()] + VERITY_READ_BLOCKS >
+                data_blocks) {
+            cerr << argv[1] << " has too few non-zero blocks" << endl;
+            return 1;
+        }
+
+        if (input.pread(data, FEC_BLOCKSIZE, block * FEC_BLOCKSIZE) !=
+                FEC_BLOCKSIZE) {
+            cerr << "failed to read block " << block << endl;
+            return 1;
+        }
+
+        if (is_nonzero(data, FEC_BLOCKSIZE)) {
+            batches.push_back(next);
+            next += VERITY_READ_BLOCKS;
+        } else {
+            ++next;
+        }
+    }
+
+    original.resize(count * batch_size);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (input.pread(&original[i * batch_size], batch_size,
+                batches[i] * FEC_BLOCKSIZE) != (ssize_t)batch_size) {
+            cerr << "failed to read block " << batches[i] << endl;
+            return 1;
+        }
+    }
+
+    input.close();
+
+    {
+        ifstream src(argv[1], ios::binary);
+        ofstream dst(argv[2], ios::binary | ios::trunc);
+
+        if (!(dst << src.rdbuf())) {
+            cerr << "failed to copy " << argv[1] << " to " << argv[2] << endl;
+            return 1;
+        }
+    }
+
+    {
+        int fd = open(argv[2], O_WRONLY);
+
+        if (fd == -1) {
+            cerr << "failed to open " << argv[2] << endl;
+            return 1;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t block = batches[i] + corrupted[i];
+
+            for (size_t j = 0; j < FEC_BLOCKSIZE; ++j) {
+                data[j] = random_bytes();
+            }
+
+            if (pwrite(fd, data, FEC_BLOCKSIZE, block * FEC_BLOCKSIZE) !=
+                    FEC_BLOCKSIZE) {
+                cerr << "failed to corrupt block " << block << endl;
+                return 1;
+            }
+        }
+
+        close(fd);
+    }
+
+    fec::io corrupted_input(argv[2], O_RDWR);
+
+    if (!corrupted_input) {
+        cerr << "failed to open " << argv[2] << endl;
+        return 1;
+    }
+
+    unique_ptr<uint8_t[]> buf(new uint8_t[batch_size]);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (corrupted_input.pread(buf.get(), batch_size,
+                batches[i] * FEC_BLOCKSIZE) != (ssize_t)batch_size ||
+            memcmp(buf.get(), &original[i * batch_size], batch_size)) {
+            cerr << "block " << corrupted[i] << " of a batch corrupted: "
+                 << "failed to recover" << endl;
+            return 1;
+        }
+    }
+
+    corrupted_input.close();
+
+    /* corrected blocks are written back in read-write mode */
+    {
+        ifstream output(argv[2], ios::binary);
+
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t block = batches[i] + corrupted[i];
+
+            output.seekg(block * FEC_BLOCKSIZE);
+
+            if (!output.read(reinterpret_cast<char *>(data), FEC_BLOCKSIZE) ||
+                    memcmp(data, &original[i * batch_size +
+                        corrupted[i] * FEC_BLOCKSIZE], FEC_BLOCKSIZE)) {
+                cerr << "block " << corrupted[i] << " of a batch corrupted: "
+                     << "not corrected on disk" << endl;
+                return 1;
+            }
+        }
+    }
+
+    cout << "ok" << endl;
+    return 0;
+}
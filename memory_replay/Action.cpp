@@ -15,26 +15,19 @@
  */
 
 #include <inttypes.h>
-#include <malloc.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
-#include <time.h>
 
 #include <new>
 
 #include "Action.h"
 #include "Threads.h"
 #include "Pointers.h"
-
-static uint64_t nanotime() {
-  struct timespec t;
-  t.tv_sec = t.tv_nsec = 0;
-  clock_gettime(CLOCK_MONOTONIC, &t);
-  return static_cast<uint64_t>(t.tv_sec) * 1000000000LL + t.tv_nsec;
-}
+#include "TraceFile.h"
+#include "Utils.h"
 
 class EndThreadAction : public Action {
  public:
@@ -42,13 +35,15 @@ class EndThreadAction : public Action {
 
   bool EndThread() override { return true; }
 
-  uint64_t Execute(Pointers*) override { return 0; }
+  uint64_t Execute(Pointers*, Allocator*, MemoryToucher*) override { return 0; }
 };
 
 class AllocAction : public Action {
  public:
   explicit AllocAction(uintptr_t key_pointer) : key_pointer_(key_pointer) {}
 
+  size_t size() override { return size_; }
+
  protected:
   uintptr_t key_pointer_ = 0;
   size_t size_ = 0;
@@ -61,13 +56,20 @@ class MallocAction : public AllocAction {
       is_error_ = true;
     }
   }
+  MallocAction(uintptr_t key_pointer, size_t size) : AllocAction(key_pointer) {
+    size_ = size;
+  }
+
+  ActionType type() override { return ACTION_MALLOC; }
 
-  uint64_t Execute(Pointers* pointers) override {
-    uint64_t time_nsecs = nanotime();
-    void* memory = malloc(size_);
-    time_nsecs = nanotime() - time_nsecs;
+  uint64_t Execute(Pointers* pointers, Allocator* allocator, MemoryToucher* toucher) override {
+    toucher->Begin();
+    uint64_t time_nsecs = Nanotime();
+    void* memory = allocator->Malloc(size_);
+    time_nsecs = Nanotime() - time_nsecs;
+    toucher->EndPhase(TOUCH_PHASE_ALLOC, time_nsecs);
 
-    memset(memory, 1, size_);
+    toucher->Write(memory, size_, 1);
     pointers->Add(key_pointer_, memory);
 
     return time_nsecs;
@@ -81,13 +83,22 @@ class CallocAction : public AllocAction {
       is_error_ = true;
     }
   }
+  CallocAction(uintptr_t key_pointer, size_t n_elements, size_t size)
+      : AllocAction(key_pointer), n_elements_(n_elements) {
+    size_ = size;
+  }
+
+  ActionType type() override { return ACTION_CALLOC; }
+  size_t size() override { return n_elements_ * size_; }
 
-  uint64_t Execute(Pointers* pointers) override {
-    uint64_t time_nsecs = nanotime();
-    void* memory = calloc(n_elements_, size_);
-    time_nsecs = nanotime() - time_nsecs;
+  uint64_t Execute(Pointers* pointers, Allocator* allocator, MemoryToucher* toucher) override {
+    toucher->Begin();
+    uint64_t time_nsecs = Nanotime();
+    void* memory = allocator->Calloc(n_elements_, size_);
+    time_nsecs = Nanotime() - time_nsecs;
+    toucher->EndPhase(TOUCH_PHASE_ALLOC, time_nsecs);
 
-    memset(memory, 0, n_elements_ * size_);
+    toucher->Write(memory, n_elements_ * size_, 0);
     pointers->Add(key_pointer_, memory);
 
     return time_nsecs;
@@ -104,20 +115,28 @@ class ReallocAction : public AllocAction {
       is_error_ = true;
     }
   }
+  ReallocAction(uintptr_t key_pointer, uintptr_t old_pointer, size_t size)
+      : AllocAction(key_pointer), old_pointer_(old_pointer) {
+    size_ = size;
+  }
 
   bool DoesFree() override { return old_pointer_ != 0; }
 
-  uint64_t Execute(Pointers* pointers) override {
+  ActionType type() override { return ACTION_REALLOC; }
+
+  uint64_t Execute(Pointers* pointers, Allocator* allocator, MemoryToucher* toucher) override {
     void* old_memory = nullptr;
     if (old_pointer_ != 0) {
       old_memory = pointers->Remove(old_pointer_);
     }
 
-    uint64_t time_nsecs = nanotime();
-    void* memory = realloc(old_memory, size_);
-    time_nsecs = nanotime() - time_nsecs;
+    toucher->Begin();
+    uint64_t time_nsecs = Nanotime();
+    void* memory = allocator->Realloc(old_memory, size_);
+    time_nsecs = Nanotime() - time_nsecs;
+    toucher->EndPhase(TOUCH_PHASE_ALLOC, time_nsecs);
 
-    memset(memory, 1, size_);
+    toucher->Write(memory, size_, 1);
     pointers->Add(key_pointer_, memory);
 
     return time_nsecs;
@@ -134,13 +153,21 @@ class MemalignAction : public AllocAction {
       is_error_ = true;
     }
   }
+  MemalignAction(uintptr_t key_pointer, size_t align, size_t size)
+      : AllocAction(key_pointer), align_(align) {
+    size_ = size;
+  }
 
-  uint64_t Execute(Pointers* pointers) override {
-    uint64_t time_nsecs = nanotime();
-    void* memory = memalign(align_, size_);
-    time_nsecs = nanotime() - time_nsecs;
+  ActionType type() override { return ACTION_MEMALIGN; }
 
-    memset(memory, 1, size_);
+  uint64_t Execute(Pointers* pointers, Allocator* allocator, MemoryToucher* toucher) override {
+    toucher->Begin();
+    uint64_t time_nsecs = Nanotime();
+    void* memory = allocator->Memalign(align_, size_);
+    time_nsecs = Nanotime() - time_nsecs;
+    toucher->EndPhase(TOUCH_PHASE_ALLOC, time_nsecs);
+
+    toucher->Write(memory, size_, 1);
     pointers->Add(key_pointer_, memory);
 
     return time_nsecs;
@@ -154,20 +181,48 @@ class FreeAction : public AllocAction {
  public:
   explicit FreeAction(uintptr_t key_pointer) : AllocAction(key_pointer) {
   }
+  // The size of the freed allocation is only known in a compiled trace.
+  FreeAction(uintptr_t key_pointer, size_t size) : AllocAction(key_pointer) {
+    size_ = size;
+  }
 
   bool DoesFree() override { return key_pointer_ != 0; }
 
-  uint64_t Execute(Pointers* pointers) override {
+  // A free of a nullptr doesn't call free().
+  ActionType type() override { return key_pointer_ != 0 ? ACTION_FREE : ACTION_NONE; }
+
+  uint64_t Execute(Pointers* pointers, Allocator* allocator, MemoryToucher* toucher) override {
     if (key_pointer_) {
       void* memory = pointers->Remove(key_pointer_);
-      uint64_t time_nsecs = nanotime();
-      free(memory);
-      return nanotime() - time_nsecs;
+      toucher->Begin();
+      toucher->Read(memory, size_);
+      uint64_t time_nsecs = Nanotime();
+      allocator->Free(memory);
+      time_nsecs = Nanotime() - time_nsecs;
+      toucher->EndPhase(TOUCH_PHASE_FREE, time_nsecs);
+      return time_nsecs;
     }
     return 0;
   }
 };
 
+const char* Action::GetTypeName(ActionType type) {
+  switch (type) {
+    case ACTION_MALLOC:
+      return "malloc";
+    case ACTION_CALLOC:
+      return "calloc";
+    case ACTION_REALLOC:
+      return "realloc";
+    case ACTION_MEMALIGN:
+      return "memalign";
+    case ACTION_FREE:
+      return "free";
+    default:
+      return "none";
+  }
+}
+
 size_t Action::MaxActionSize() {
   size_t max = MAX(sizeof(EndThreadAction), sizeof(MallocAction));
   max = MAX(max, sizeof(CallocAction));
@@ -198,3 +253,22 @@ Action* Action::CreateAction(uintptr_t key_pointer, const char* type,
   }
   return action;
 }
+
+Action* Action::CreateAction(const TraceEntry& entry, void* action_memory) {
+  switch (entry.type) {
+    case TRACE_MALLOC:
+      return new (action_memory) MallocAction(entry.id, entry.size);
+    case TRACE_FREE:
+      return new (action_memory) FreeAction(entry.id, entry.size);
+    case TRACE_CALLOC:
+      return new (action_memory) CallocAction(entry.id, entry.arg, entry.size);
+    case TRACE_REALLOC:
+      return new (action_memory) ReallocAction(entry.id, entry.arg, entry.size);
+    case TRACE_MEMALIGN:
+      return new (action_memory) MemalignAction(entry.id, entry.arg, entry.size);
+    case TRACE_THREAD_DONE:
+      return new (action_memory) EndThreadAction();
+    default:
+      return nullptr;
+  }
+}
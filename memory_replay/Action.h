@@ -19,14 +19,37 @@
 
 #include <stdint.h>
 
+#include "Allocator.h"
+#include "MemoryToucher.h"
+
 class Pointers;
+struct TraceEntry;
+
+enum ActionType {
+  ACTION_MALLOC = 0,
+  ACTION_CALLOC,
+  ACTION_REALLOC,
+  ACTION_MEMALIGN,
+  ACTION_FREE,
+  NUM_ACTION_TYPES,
+  // The action doesn't call an allocation function.
+  ACTION_NONE = NUM_ACTION_TYPES,
+};
 
 class Action {
  public:
   Action() {}
   virtual ~Action() {}
 
-  virtual uint64_t Execute(Pointers* pointers) = 0;
+  // Runs the action using the allocation functions of the given allocator,
+  // and returns the time spent in the allocation function. The toucher
+  // uses the memory of the allocation and counts the faults of each phase.
+  virtual uint64_t Execute(Pointers* pointers, Allocator* allocator, MemoryToucher* toucher) = 0;
+  uint64_t Execute(Pointers* pointers, Allocator* allocator) {
+    MemoryToucher toucher;
+    return Execute(pointers, allocator, &toucher);
+  }
+  uint64_t Execute(Pointers* pointers) { return Execute(pointers, Allocator::GetLibc()); }
 
   bool IsError() { return is_error_; };
 
@@ -34,9 +57,17 @@ class Action {
 
   virtual bool DoesFree() { return false; }
 
+  // The allocation function called by Execute(), and the number of bytes
+  // allocated or freed by it.
+  virtual ActionType type() { return ACTION_NONE; }
+  virtual size_t size() { return 0; }
+
+  static const char* GetTypeName(ActionType type);
+
   static size_t MaxActionSize();
   static Action* CreateAction(uintptr_t key_pointer, const char* type,
                               const char* line, void* action_memory);
+  static Action* CreateAction(const TraceEntry& entry, void* action_memory);
 
  protected:
   bool is_error_ = false;
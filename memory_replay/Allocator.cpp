@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dlfcn.h>
+#include <err.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <string>
+
+#include "Allocator.h"
+
+class LibcAllocator : public Allocator {
+ public:
+  void* Malloc(size_t size) override { return malloc(size); }
+  void* Calloc(size_t n_elements, size_t size) override { return calloc(n_elements, size); }
+  void* Realloc(void* pointer, size_t size) override { return realloc(pointer, size); }
+  void* Memalign(size_t align, size_t size) override { return memalign(align, size); }
+  void Free(void* pointer) override { free(pointer); }
+};
+
+// Allocates by bumping a pointer in a chunk owned by the calling thread, so
+// allocations take no locks. Freed memory is never reused, so this shows
+// the cost of the replay itself, without any allocator bookkeeping.
+class BumpAllocator : public Allocator {
+ public:
+  BumpAllocator() : generation_(next_generation_++) {}
+  virtual ~BumpAllocator();
+
+  void* Malloc(size_t size) override { return Allocate(16, size); }
+  void* Calloc(size_t n_elements, size_t size) override {
+    size_t total;
+    if (__builtin_mul_overflow(n_elements, size, &total)) {
+      return nullptr;
+    }
+    // Chunks are fresh mmaps that are never reused, so they are zero filled.
+    return Allocate(16, total);
+  }
+  void* Realloc(void* pointer, size_t size) override;
+  void* Memalign(size_t align, size_t size) override { return Allocate(align, size); }
+  void Free(void*) override {}
+
+ private:
+  static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+  // Every allocation is preceded by its size, so realloc knows how much to
+  // copy. The header keeps allocations 16 byte aligned.
+  static constexpr size_t HEADER_SIZE = 16;
+
+  struct ChunkHeader {
+    ChunkHeader* next;
+    size_t size;
+  };
+
+  struct ThreadChunk {
+    uint64_t generation;
+    uintptr_t next;
+    uintptr_t end;
+  };
+
+  void* Allocate(size_t align, size_t size);
+  ChunkHeader* MapChunk(size_t size);
+
+  // The thread chunks of an allocator that was destroyed are ignored by
+  // comparing generations.
+  const uint64_t generation_;
+  static std::atomic<uint64_t> next_generation_;
+  static thread_local ThreadChunk thread_chunk_;
+
+  pthread_mutex_t chunks_lock_ = PTHREAD_MUTEX_INITIALIZER;
+  ChunkHeader* chunks_ = nullptr;
+};
+
+std::atomic<uint64_t> BumpAllocator::next_generation_(1);
+thread_local BumpAllocator::ThreadChunk BumpAllocator::thread_chunk_;
+
+BumpAllocator::~BumpAllocator() {
+  ChunkHeader* chunk = chunks_;
+  while (chunk != nullptr) {
+    ChunkHeader* next = chunk->next;
+    munmap(chunk, chunk->size);
+    chunk = next;
+  }
+}
+
+BumpAllocator::ChunkHeader* BumpAllocator::MapChunk(size_t size) {
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  ChunkHeader* chunk = reinterpret_cast<ChunkHeader*>(memory);
+  chunk->size = size;
+  pthread_mutex_lock(&chunks_lock_);
+  chunk->next = chunks_;
+  chunks_ = chunk;
+  pthread_mutex_unlock(&chunks_lock_);
+  return chunk;
+}
+
+void* BumpAllocator::Allocate(size_t align, size_t size) {
+  if (align < HEADER_SIZE) {
+    align = HEADER_SIZE;
+  }
+  if ((align & (align - 1)) != 0 || size > SIZE_MAX / 2) {
+    return nullptr;
+  }
+  size_t max_size = sizeof(ChunkHeader) + HEADER_SIZE + align + size;
+
+  uintptr_t start;
+  if (max_size > CHUNK_SIZE / 4) {
+    // Large allocations get their own chunk.
+    ChunkHeader* chunk = MapChunk(max_size);
+    if (chunk == nullptr) {
+      return nullptr;
+    }
+    uintptr_t base = reinterpret_cast<uintptr_t>(chunk + 1);
+    start = (base + HEADER_SIZE + align - 1) & ~(align - 1);
+  } else {
+    ThreadChunk& thread_chunk = thread_chunk_;
+    if (thread_chunk.generation != generation_) {
+      thread_chunk = ThreadChunk{generation_, 0, 0};
+    }
+    start = (thread_chunk.next + HEADER_SIZE + align - 1) & ~(align - 1);
+    if (thread_chunk.next == 0 || start + size > thread_chunk.end) {
+      ChunkHeader* chunk = MapChunk(CHUNK_SIZE);
+      if (chunk == nullptr) {
+        return nullptr;
+      }
+      thread_chunk.next = reinterpret_cast<uintptr_t>(chunk + 1);
+      thread_chunk.end = reinterpret_cast<uintptr_t>(chunk) + CHUNK_SIZE;
+      start = (thread_chunk.next + HEADER_SIZE + align - 1) & ~(align - 1);
+    }
+    thread_chunk.next = start + size;
+  }
+  *reinterpret_cast<size_t*>(start - HEADER_SIZE) = size;
+  return reinterpret_cast<void*>(start);
+}
+
+void* BumpAllocator::Realloc(void* pointer, size_t size) {
+  void* memory = Allocate(16, size);
+  if (pointer != nullptr && memory != nullptr) {
+    size_t old_size = *reinterpret_cast<size_t*>(reinterpret_cast<uintptr_t>(pointer) -
+                                                 HEADER_SIZE);
+    memcpy(memory, pointer, old_size < size ? old_size : size);
+  }
+  return memory;
+}
+
+// Calls the malloc functions exported by a shared library. The library is
+// never unloaded, since an allocator may still have thread local data or
+// background threads alive.
+class SharedLibAllocator : public Allocator {
+ public:
+  static SharedLibAllocator* Open(const std::string& lib, const std::string& prefix);
+
+  void* Malloc(size_t size) override { return malloc_(size); }
+  void* Calloc(size_t n_elements, size_t size) override { return calloc_(n_elements, size); }
+  void* Realloc(void* pointer, size_t size) override { return realloc_(pointer, size); }
+  void* Memalign(size_t align, size_t size) override {
+    if (memalign_ != nullptr) {
+      return memalign_(align, size);
+    }
+    void* memory;
+    return posix_memalign_(&memory, align, size) == 0 ? memory : nullptr;
+  }
+  void Free(void* pointer) override { free_(pointer); }
+
+ private:
+  SharedLibAllocator() {}
+
+  void* (*malloc_)(size_t) = nullptr;
+  void* (*calloc_)(size_t, size_t) = nullptr;
+  void* (*realloc_)(void*, size_t) = nullptr;
+  void* (*memalign_)(size_t, size_t) = nullptr;
+  int (*posix_memalign_)(void**, size_t, size_t) = nullptr;
+  void (*free_)(void*) = nullptr;
+};
+
+template <typename Function>
+static bool FindSymbol(void* handle, const std::string& name, Function* function) {
+  *function = reinterpret_cast<Function>(dlsym(handle, name.c_str()));
+  return *function != nullptr;
+}
+
+SharedLibAllocator* SharedLibAllocator::Open(const std::string& lib, const std::string& prefix) {
+  void* handle = dlopen(lib.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    fprintf(stderr, "Failed to load allocator %s: %s\n", lib.c_str(), dlerror());
+    return nullptr;
+  }
+  SharedLibAllocator* allocator = new SharedLibAllocator;
+  const char* missing = nullptr;
+  if (!FindSymbol(handle, prefix + "malloc", &allocator->malloc_)) {
+    missing = "malloc";
+  } else if (!FindSymbol(handle, prefix + "calloc", &allocator->calloc_)) {
+    missing = "calloc";
+  } else if (!FindSymbol(handle, prefix + "realloc", &allocator->realloc_)) {
+    missing = "realloc";
+  } else if (!FindSymbol(handle, prefix + "free", &allocator->free_)) {
+    missing = "free";
+  } else if (!FindSymbol(handle, prefix + "memalign", &allocator->memalign_) &&
+             !FindSymbol(handle, prefix + "posix_memalign", &allocator->posix_memalign_)) {
+    missing = "memalign";
+  }
+  if (missing != nullptr) {
+    fprintf(stderr, "Allocator %s doesn't export %s%s\n", lib.c_str(), prefix.c_str(), missing);
+    delete allocator;
+    return nullptr;
+  }
+  return allocator;
+}
+
+Allocator* Allocator::GetLibc() {
+  static LibcAllocator libc_allocator;
+  return &libc_allocator;
+}
+
+Allocator* Allocator::Create(const char* name) {
+  if (strcmp(name, "libc") == 0) {
+    return new LibcAllocator;
+  }
+  if (strcmp(name, "bump") == 0) {
+    return new BumpAllocator;
+  }
+  std::string lib = name;
+  std::string prefix;
+  size_t colon = lib.rfind(':');
+  if (colon != std::string::npos) {
+    prefix = lib.substr(colon + 1);
+    lib.resize(colon);
+  }
+  return SharedLibAllocator::Open(lib, prefix);
+}
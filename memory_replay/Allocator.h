@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_ALLOCATOR_H
+#define _MEMORY_REPLAY_ALLOCATOR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// The allocation functions used to replay a trace.
+class Allocator {
+ public:
+  Allocator() {}
+  virtual ~Allocator() {}
+
+  virtual void* Malloc(size_t size) = 0;
+  virtual void* Calloc(size_t n_elements, size_t size) = 0;
+  virtual void* Realloc(void* pointer, size_t size) = 0;
+  virtual void* Memalign(size_t align, size_t size) = 0;
+  virtual void Free(void* pointer) = 0;
+
+  // Returns the allocator calling the libc functions of the process.
+  static Allocator* GetLibc();
+
+  // Creates an allocator from a name given on the command line:
+  //   libc           The malloc functions of the process.
+  //   bump           A baseline that bumps a pointer in per thread chunks
+  //                  and never reuses freed memory.
+  //   LIB[:PREFIX]   The malloc functions exported by the shared library
+  //                  LIB, optionally with a symbol prefix, such as je_.
+  // Returns nullptr and prints an error on failure.
+  static Allocator* Create(const char* name);
+};
+
+#endif // _MEMORY_REPLAY_ALLOCATOR_H
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "Histogram.h"
+
+size_t Histogram::GetBucket(uint64_t value) {
+  if (value < SUB_BUCKETS) {
+    return value;
+  }
+  size_t exponent = 63 - __builtin_clzll(value);
+  if (exponent >= MAX_EXPONENT) {
+    return NUM_BUCKETS - 1;
+  }
+  size_t sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKETS;
+  return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t Histogram::GetBucketMaxValue(size_t bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  if (bucket == NUM_BUCKETS - 1) {
+    return UINT64_MAX;
+  }
+  size_t exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+  uint64_t sub_bucket = bucket % SUB_BUCKETS;
+  return ((SUB_BUCKETS + sub_bucket + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+}
+
+void Histogram::Record(uint64_t value) {
+  counts_[GetBucket(value)]++;
+  count_++;
+  total_ += value;
+  if (value > max_) {
+    max_ = value;
+  }
+}
+
+void Histogram::Merge(const Histogram& other) {
+  for (size_t i = 0; i < NUM_BUCKETS; i++) {
+    counts_[i] += other.counts_[i];
+  }
+  count_ += other.count_;
+  total_ += other.total_;
+  if (other.max_ > max_) {
+    max_ = other.max_;
+  }
+}
+
+uint64_t Histogram::Percentile(double percentile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  uint64_t target = static_cast<uint64_t>(ceil(percentile / 100.0 * count_));
+  if (target == 0) {
+    target = 1;
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < NUM_BUCKETS; i++) {
+    seen += counts_[i];
+    if (seen >= target) {
+      uint64_t value = GetBucketMaxValue(i);
+      return value < max_ ? value : max_;
+    }
+  }
+  return max_;
+}
+
+ActionHistograms* ActionHistograms::Create() {
+  // The memory is zero filled, which is a valid empty state.
+  void* memory = mmap(nullptr, sizeof(ActionHistograms), PROT_READ | PROT_WRITE,
+                      MAP_ANON | MAP_PRIVATE, -1, 0);
+  if (memory == MAP_FAILED) {
+    err(1, "Unable to allocate data for histograms: map size %zu\n", sizeof(ActionHistograms));
+  }
+  return reinterpret_cast<ActionHistograms*>(memory);
+}
+
+void ActionHistograms::Destroy(ActionHistograms* histograms) {
+  if (histograms != nullptr) {
+    munmap(histograms, sizeof(ActionHistograms));
+  }
+}
+
+void ActionHistograms::Merge(const ActionHistograms& other) {
+  for (size_t type = 0; type < NUM_ACTION_TYPES; type++) {
+    for (size_t size_class = 0; size_class < NUM_SIZE_CLASSES; size_class++) {
+      histograms_[type][size_class].Merge(other.histograms_[type][size_class]);
+    }
+  }
+}
+
+// Size classes are powers of two up to 1KB, and powers of four above that.
+static constexpr size_t SIZE_CLASS_LIMITS[NUM_SIZE_CLASSES - 1] = {
+  16, 32, 64, 128, 256, 512, 1024, 4096, 16384, 65536, 262144,
+};
+
+static constexpr const char* SIZE_CLASS_NAMES[NUM_SIZE_CLASSES] = {
+  "<=16", "<=32", "<=64", "<=128", "<=256", "<=512", "<=1K", "<=4K", "<=16K", "<=64K",
+  "<=256K", ">256K",
+};
+
+size_t ActionHistograms::GetSizeClass(size_t size) {
+  for (size_t i = 0; i < NUM_SIZE_CLASSES - 1; i++) {
+    if (size <= SIZE_CLASS_LIMITS[i]) {
+      return i;
+    }
+  }
+  return NUM_SIZE_CLASSES - 1;
+}
+
+const char* ActionHistograms::GetSizeClassName(size_t size_class) {
+  return SIZE_CLASS_NAMES[size_class];
+}
+
+static constexpr double PERCENTILES[] = {50, 90, 99, 99.9};
+
+template <typename Callback>
+static void ForEachRow(const Histogram (&histograms)[NUM_ACTION_TYPES][NUM_SIZE_CLASSES],
+                       Callback callback) {
+  for (size_t type = 0; type < NUM_ACTION_TYPES; type++) {
+    const char* type_name = Action::GetTypeName(static_cast<ActionType>(type));
+    Histogram all = {};
+    for (size_t size_class = 0; size_class < NUM_SIZE_CLASSES; size_class++) {
+      all.Merge(histograms[type][size_class]);
+    }
+    if (all.count() == 0) {
+      continue;
+    }
+    callback(type_name, "all", all);
+    for (size_t size_class = 0; size_class < NUM_SIZE_CLASSES; size_class++) {
+      const Histogram& histogram = histograms[type][size_class];
+      if (histogram.count() != 0) {
+        callback(type_name, ActionHistograms::GetSizeClassName(size_class), histogram);
+      }
+    }
+  }
+}
+
+void ActionHistograms::Print(FILE* fp) const {
+  fprintf(fp, "%-9s %-7s %10s %8s %8s %8s %8s %8s %10s\n", "Action", "Size", "Count", "Mean",
+          "p50", "p90", "p99", "p99.9", "Max");
+  ForEachRow(histograms_, [fp](const char* type, const char* size_class,
+                               const Histogram& histogram) {
+    fprintf(fp, "%-9s %-7s %10" PRIu64 " %8" PRIu64, type, size_class, histogram.count(),
+            histogram.total() / histogram.count());
+    for (double percentile : PERCENTILES) {
+      fprintf(fp, " %8" PRIu64, histogram.Percentile(percentile));
+    }
+    fprintf(fp, " %10" PRIu64 "\n", histogram.max());
+  });
+  fprintf(fp, "All latencies are in ns.\n");
+}
+
+bool ActionHistograms::WriteCsv(const char* file) const {
+  FILE* fp = fopen(file, "we");
+  if (fp == nullptr) {
+    fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+    return false;
+  }
+  fprintf(fp, "action,size_class,count,mean_ns,p50_ns,p90_ns,p99_ns,p99.9_ns,max_ns\n");
+  ForEachRow(histograms_, [fp](const char* type, const char* size_class,
+                               const Histogram& histogram) {
+    fprintf(fp, "%s,%s,%" PRIu64 ",%" PRIu64, type, size_class, histogram.count(),
+            histogram.total() / histogram.count());
+    for (double percentile : PERCENTILES) {
+      fprintf(fp, ",%" PRIu64, histogram.Percentile(percentile));
+    }
+    fprintf(fp, ",%" PRIu64 "\n", histogram.max());
+  });
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", file, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool ActionHistograms::WriteJson(const char* file) const {
+  FILE* fp = fopen(file, "we");
+  if (fp == nullptr) {
+    fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+    return false;
+  }
+  fprintf(fp, "[");
+  bool first = true;
+  ForEachRow(histograms_, [fp, &first](const char* type, const char* size_class,
+                                       const Histogram& histogram) {
+    fprintf(fp, "%s\n  {\"action\": \"%s\", \"size_class\": \"%s\", \"count\": %" PRIu64
+            ", \"mean_ns\": %" PRIu64, first ? "" : ",", type, size_class, histogram.count(),
+            histogram.total() / histogram.count());
+    fprintf(fp, ", \"p50_ns\": %" PRIu64 ", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+            ", \"p99.9_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 "}",
+            histogram.Percentile(50), histogram.Percentile(90), histogram.Percentile(99),
+            histogram.Percentile(99.9), histogram.max());
+    first = false;
+  });
+  fprintf(fp, "\n]\n");
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", file, strerror(errno));
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_HISTOGRAM_H
+#define _MEMORY_REPLAY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "Action.h"
+
+// A latency histogram with log-linear buckets, in the style of an HDR
+// histogram. Every power of two is split into 16 buckets, so values are
+// recorded with a relative error of at most 1/16. Values larger than
+// 2^32 ns go into the last bucket, but the max is kept exactly.
+// A Histogram is only written by one thread, so recording uses no locks
+// or atomics.
+class Histogram {
+ public:
+  void Record(uint64_t value);
+  void Merge(const Histogram& other);
+
+  uint64_t count() const { return count_; }
+  uint64_t total() const { return total_; }
+  uint64_t max() const { return max_; }
+  // Returns the highest value in the bucket holding the given percentile.
+  uint64_t Percentile(double percentile) const;
+
+  static constexpr size_t SUB_BUCKET_BITS = 4;
+  static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static constexpr size_t MAX_EXPONENT = 32;
+  static constexpr size_t NUM_BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  static size_t GetBucket(uint64_t value);
+  static uint64_t GetBucketMaxValue(size_t bucket);
+
+ private:
+  uint64_t counts_[NUM_BUCKETS];
+  uint64_t count_;
+  uint64_t total_;
+  uint64_t max_;
+};
+
+// The size classes used to split the histograms of each action type.
+constexpr size_t NUM_SIZE_CLASSES = 12;
+
+// Latency histograms for every action type and size class. The memory is
+// mmap'ed so that it isn't counted in the native heap of the replay.
+class ActionHistograms {
+ public:
+  static ActionHistograms* Create();
+  static void Destroy(ActionHistograms* histograms);
+
+  void Record(ActionType type, size_t size, uint64_t nsecs) {
+    histograms_[type][GetSizeClass(size)].Record(nsecs);
+  }
+  void Merge(const ActionHistograms& other);
+
+  void Print(FILE* fp) const;
+  bool WriteCsv(const char* file) const;
+  bool WriteJson(const char* file) const;
+
+  static size_t GetSizeClass(size_t size);
+  static const char* GetSizeClassName(size_t size_class);
+
+ private:
+  ActionHistograms() = delete;
+
+  Histogram histograms_[NUM_ACTION_TYPES][NUM_SIZE_CLASSES];
+};
+
+#endif // _MEMORY_REPLAY_HISTOGRAM_H
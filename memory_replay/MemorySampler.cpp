@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "MemorySampler.h"
+#include "NativeInfo.h"
+#include "Utils.h"
+
+MemorySampler::MemorySampler(const std::atomic<uint64_t>* num_actions, uint64_t interval_nsecs)
+    : num_actions_(num_actions), interval_nsecs_(interval_nsecs) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&cond_, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+MemorySampler::~MemorySampler() {
+  Stop();
+  pthread_cond_destroy(&cond_);
+  if (smaps_fd_ != -1) {
+    close(smaps_fd_);
+  }
+  if (statm_fd_ != -1) {
+    close(statm_fd_);
+  }
+  if (samples_ != nullptr) {
+    munmap(samples_, MAX_SAMPLES * sizeof(MemorySample));
+  }
+}
+
+bool MemorySampler::Start() {
+  // Only the pages actually written are backed by memory.
+  void* memory = mmap(nullptr, MAX_SAMPLES * sizeof(MemorySample), PROT_READ | PROT_WRITE,
+                      MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    fprintf(stderr, "Failed to map memory samples: %s\n", strerror(errno));
+    return false;
+  }
+  samples_ = reinterpret_cast<MemorySample*>(memory);
+
+  // The files are kept open, since smaps_rollup can be reread from the
+  // start, and statm is read with pread.
+  smaps_fd_ = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+  if (smaps_fd_ == -1) {
+    statm_fd_ = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (statm_fd_ == -1) {
+      fprintf(stderr, "Failed to open /proc/self/statm: %s\n", strerror(errno));
+      return false;
+    }
+  }
+
+  start_nsecs_ = Nanotime();
+  int ret = pthread_create(&thread_id_, nullptr, ThreadRunner, this);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to create sampler thread: %s\n", strerror(ret));
+    return false;
+  }
+  running_ = true;
+  return true;
+}
+
+void MemorySampler::Stop() {
+  if (!running_) {
+    return;
+  }
+  pthread_mutex_lock(&mutex_);
+  stop_ = true;
+  pthread_cond_signal(&cond_);
+  pthread_mutex_unlock(&mutex_);
+  pthread_join(thread_id_, nullptr);
+  running_ = false;
+
+  TakeSample();
+}
+
+void* MemorySampler::ThreadRunner(void* data) {
+  reinterpret_cast<MemorySampler*>(data)->Run();
+  return nullptr;
+}
+
+void MemorySampler::Run() {
+  // Only lower the priority of this thread, not of the whole process.
+  setpriority(PRIO_PROCESS, syscall(__NR_gettid), 19);
+
+  uint64_t next_nsecs = start_nsecs_;
+  pthread_mutex_lock(&mutex_);
+  while (!stop_) {
+    pthread_mutex_unlock(&mutex_);
+    TakeSample();
+    pthread_mutex_lock(&mutex_);
+
+    // Sample at fixed times, so a slow sample doesn't shift the next ones.
+    next_nsecs += interval_nsecs_;
+    struct timespec deadline;
+    deadline.tv_sec = next_nsecs / 1000000000;
+    deadline.tv_nsec = next_nsecs % 1000000000;
+    while (!stop_ && pthread_cond_timedwait(&cond_, &mutex_, &deadline) != ETIMEDOUT) {
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void MemorySampler::TakeSample() {
+  if (num_samples_ == MAX_SAMPLES) {
+    return;
+  }
+  MemorySample* sample = &samples_[num_samples_];
+  sample->time_nsecs = Nanotime() - start_nsecs_;
+  sample->num_actions = num_actions_->load(std::memory_order_relaxed);
+
+  if (smaps_fd_ != -1) {
+    ProcessMemory memory;
+    if (lseek(smaps_fd_, 0, SEEK_SET) == 0) {
+      GetProcessMemory(smaps_fd_, &memory);
+    }
+    sample->rss_bytes = memory.rss_bytes;
+    sample->pss_bytes = memory.pss_bytes;
+    sample->anon_bytes = memory.anon_bytes;
+  } else {
+    // The sizes in statm are in pages: size resident shared text lib data dt
+    char buffer[128];
+    ssize_t bytes = TEMP_FAILURE_RETRY(pread(statm_fd_, buffer, sizeof(buffer) - 1, 0));
+    size_t resident_pages = 0;
+    size_t shared_pages = 0;
+    if (bytes > 0) {
+      buffer[bytes] = '\0';
+      sscanf(buffer, "%*s %zu %zu", &resident_pages, &shared_pages);
+    }
+    size_t page_size = getpagesize();
+    sample->rss_bytes = resident_pages * page_size;
+    sample->pss_bytes = 0;
+    sample->anon_bytes = (resident_pages - shared_pages) * page_size;
+  }
+
+  struct mallinfo info = mallinfo();
+  sample->native_allocated_bytes = info.uordblks;
+  num_samples_++;
+}
+
+void MemorySampler::Print(FILE* fp, size_t max_rows) const {
+  if (num_samples_ == 0 || max_rows == 0) {
+    return;
+  }
+  size_t peak_rss = 0;
+  size_t peak_pss = 0;
+  for (size_t i = 0; i < num_samples_; i++) {
+    peak_rss = samples_[i].rss_bytes > peak_rss ? samples_[i].rss_bytes : peak_rss;
+    peak_pss = samples_[i].pss_bytes > peak_pss ? samples_[i].pss_bytes : peak_pss;
+  }
+
+  fprintf(fp, "%10s %12s %10s %10s %10s %10s\n", "Time", "Actions", "RSS", "PSS", "Anon",
+          "Allocated");
+  size_t rows = num_samples_ < max_rows ? num_samples_ : max_rows;
+  for (size_t row = 0; row < rows; row++) {
+    // Always include the first and the last sample.
+    size_t index = rows == 1 ? num_samples_ - 1 : row * (num_samples_ - 1) / (rows - 1);
+    const MemorySample& sample = samples_[index];
+    fprintf(fp, "%9.2fs %12" PRIu64 " %8.2fMB %8.2fMB %8.2fMB %8.2fMB\n",
+            sample.time_nsecs / 1000000000.0, sample.num_actions,
+            sample.rss_bytes / (1024 * 1024.0), sample.pss_bytes / (1024 * 1024.0),
+            sample.anon_bytes / (1024 * 1024.0),
+            sample.native_allocated_bytes / (1024 * 1024.0));
+  }
+  fprintf(fp, "Peak RSS: %zu bytes %0.2fMB\n", peak_rss, peak_rss / (1024 * 1024.0));
+  if (has_pss()) {
+    fprintf(fp, "Peak PSS: %zu bytes %0.2fMB\n", peak_pss, peak_pss / (1024 * 1024.0));
+  }
+}
+
+bool MemorySampler::WriteCsv(const char* file) const {
+  FILE* fp = fopen(file, "we");
+  if (fp == nullptr) {
+    fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+    return false;
+  }
+  fprintf(fp, "time_ns,actions,rss_bytes,pss_bytes,anon_bytes,allocated_bytes\n");
+  for (size_t i = 0; i < num_samples_; i++) {
+    const MemorySample& sample = samples_[i];
+    fprintf(fp, "%" PRIu64 ",%" PRIu64 ",%zu,%zu,%zu,%zu\n", sample.time_nsecs,
+            sample.num_actions, sample.rss_bytes, sample.pss_bytes, sample.anon_bytes,
+            sample.native_allocated_bytes);
+  }
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "Failed to write %s: %s\n", file, strerror(errno));
+    return false;
+  }
+  return true;
+}
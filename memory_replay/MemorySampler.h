@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_MEMORY_SAMPLER_H
+#define _MEMORY_REPLAY_MEMORY_SAMPLER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+struct MemorySample {
+  // Time since the sampler was started.
+  uint64_t time_nsecs;
+  // The number of actions replayed when the sample was taken.
+  uint64_t num_actions;
+  size_t rss_bytes;
+  size_t pss_bytes;
+  size_t anon_bytes;
+  // The bytes in use according to mallinfo.
+  size_t native_allocated_bytes;
+};
+
+// Samples the memory of the process at a fixed interval from a low
+// priority thread, so the replay isn't stalled every few actions to parse
+// all of /proc/self/smaps. The totals are read from /proc/self/smaps_rollup,
+// or from /proc/self/statm when the kernel doesn't support smaps_rollup, in
+// which case there is no PSS. The samples are mmap'ed so that they aren't
+// counted in the native heap of the replay.
+class MemorySampler {
+ public:
+  // num_actions is read at every sample, and is updated by the replay.
+  MemorySampler(const std::atomic<uint64_t>* num_actions, uint64_t interval_nsecs);
+  virtual ~MemorySampler();
+
+  bool Start();
+  // Stops the sampler thread after taking a last sample.
+  void Stop();
+
+  size_t num_samples() const { return num_samples_; }
+  const MemorySample* samples() const { return samples_; }
+  bool has_pss() const { return smaps_fd_ != -1; }
+
+  // Prints at most max_rows samples, evenly spread over the replay.
+  void Print(FILE* fp, size_t max_rows) const;
+  bool WriteCsv(const char* file) const;
+
+  static constexpr size_t MAX_SAMPLES = 1 << 20;
+
+ private:
+  static void* ThreadRunner(void* data);
+  void Run();
+  void TakeSample();
+
+  const std::atomic<uint64_t>* num_actions_ = nullptr;
+  uint64_t interval_nsecs_ = 0;
+  uint64_t start_nsecs_ = 0;
+  int smaps_fd_ = -1;
+  int statm_fd_ = -1;
+
+  pthread_t thread_id_;
+  bool running_ = false;
+  pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t cond_;
+  bool stop_ = false;
+
+  MemorySample* samples_ = nullptr;
+  size_t num_samples_ = 0;
+};
+
+#endif // _MEMORY_REPLAY_MEMORY_SAMPLER_H
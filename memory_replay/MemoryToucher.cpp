@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "MemoryToucher.h"
+#include "Utils.h"
+
+void TouchStats::Record(TouchPhase phase, uint64_t nsecs, uint64_t minor_faults,
+                        uint64_t major_faults) {
+  Phase& stats = phases_[phase];
+  stats.count++;
+  stats.time_nsecs += nsecs;
+  stats.minor_faults += minor_faults;
+  stats.major_faults += major_faults;
+}
+
+void TouchStats::Merge(const TouchStats& other) {
+  for (size_t i = 0; i < NUM_TOUCH_PHASES; i++) {
+    phases_[i].count += other.phases_[i].count;
+    phases_[i].time_nsecs += other.phases_[i].time_nsecs;
+    phases_[i].minor_faults += other.phases_[i].minor_faults;
+    phases_[i].major_faults += other.phases_[i].major_faults;
+  }
+}
+
+const char* TouchStats::GetPhaseName(TouchPhase phase) {
+  switch (phase) {
+    case TOUCH_PHASE_ALLOC:
+      return "alloc";
+    case TOUCH_PHASE_WRITE:
+      return "write";
+    case TOUCH_PHASE_READ:
+      return "read";
+    case TOUCH_PHASE_FREE:
+      return "free";
+    default:
+      return "none";
+  }
+}
+
+void TouchStats::Print(FILE* fp) const {
+  fprintf(fp, "%-6s %10s %14s %10s %12s %12s\n", "Phase", "Count", "Time(ns)", "Mean(ns)",
+          "Minor Faults", "Major Faults");
+  for (size_t i = 0; i < NUM_TOUCH_PHASES; i++) {
+    const Phase& stats = phases_[i];
+    if (stats.count == 0) {
+      continue;
+    }
+    fprintf(fp, "%-6s %10" PRIu64 " %14" PRIu64 " %10" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+            GetPhaseName(static_cast<TouchPhase>(i)), stats.count, stats.time_nsecs,
+            stats.time_nsecs / stats.count, stats.minor_faults, stats.major_faults);
+  }
+}
+
+void MemoryToucher::GetFaults(uint64_t* minor_faults, uint64_t* major_faults) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) == -1) {
+    *minor_faults = minor_faults_;
+    *major_faults = major_faults_;
+    return;
+  }
+  *minor_faults = usage.ru_minflt;
+  *major_faults = usage.ru_majflt;
+}
+
+void MemoryToucher::Begin() {
+  if (options_.count_faults) {
+    GetFaults(&minor_faults_, &major_faults_);
+  }
+}
+
+void MemoryToucher::EndPhase(TouchPhase phase, uint64_t nsecs) {
+  if (!options_.count_faults) {
+    return;
+  }
+  uint64_t minor_faults;
+  uint64_t major_faults;
+  GetFaults(&minor_faults, &major_faults);
+  stats_.Record(phase, nsecs, minor_faults - minor_faults_, major_faults - major_faults_);
+  minor_faults_ = minor_faults;
+  major_faults_ = major_faults;
+}
+
+size_t MemoryToucher::GetLength(size_t size) const {
+  if (options_.write_fraction >= 1.0) {
+    return size;
+  }
+  return static_cast<size_t>(size * options_.write_fraction);
+}
+
+void MemoryToucher::Write(void* memory, size_t size, int value) {
+  size_t length = GetLength(size);
+  if (length == 0) {
+    return;
+  }
+  uint64_t time_nsecs = Nanotime();
+  memset(memory, value, length);
+  EndPhase(TOUCH_PHASE_WRITE, Nanotime() - time_nsecs);
+}
+
+// Reading one byte of every cache line is enough to get the cache misses
+// and faults of reading the whole allocation.
+static constexpr size_t CACHE_LINE_SIZE = 64;
+
+void MemoryToucher::Read(const void* memory, size_t size) {
+  size_t length = GetLength(size);
+  if (!options_.read_before_free || memory == nullptr || length == 0) {
+    return;
+  }
+  uint64_t time_nsecs = Nanotime();
+  const volatile uint8_t* bytes = reinterpret_cast<const volatile uint8_t*>(memory);
+  for (size_t i = 0; i < length; i += CACHE_LINE_SIZE) {
+    bytes[i];
+  }
+  bytes[length - 1];
+  EndPhase(TOUCH_PHASE_READ, Nanotime() - time_nsecs);
+}
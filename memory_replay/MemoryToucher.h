@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_MEMORY_TOUCHER_H
+#define _MEMORY_REPLAY_MEMORY_TOUCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// How the replay uses the memory of the allocations it makes.
+struct TouchOptions {
+  // The fraction of every allocation written once it is allocated. The
+  // default writes all of it.
+  double write_fraction = 1.0;
+  // Read the written part of every allocation right before freeing it.
+  bool read_before_free = false;
+  // Count the time and page faults of every phase of the actions. This
+  // adds a getrusage() call after every phase, outside of the timed calls.
+  bool count_faults = false;
+};
+
+enum TouchPhase {
+  // The call to the allocation function, including realloc.
+  TOUCH_PHASE_ALLOC = 0,
+  // Writing the new allocation.
+  TOUCH_PHASE_WRITE,
+  // Reading the allocation before it is freed.
+  TOUCH_PHASE_READ,
+  // The call to free().
+  TOUCH_PHASE_FREE,
+  NUM_TOUCH_PHASES,
+};
+
+// The time and page faults of every phase.
+class TouchStats {
+ public:
+  void Record(TouchPhase phase, uint64_t nsecs, uint64_t minor_faults, uint64_t major_faults);
+  void Merge(const TouchStats& other);
+
+  uint64_t count(TouchPhase phase) const { return phases_[phase].count; }
+  uint64_t time_nsecs(TouchPhase phase) const { return phases_[phase].time_nsecs; }
+  uint64_t minor_faults(TouchPhase phase) const { return phases_[phase].minor_faults; }
+  uint64_t major_faults(TouchPhase phase) const { return phases_[phase].major_faults; }
+
+  void Print(FILE* fp) const;
+
+  static const char* GetPhaseName(TouchPhase phase);
+
+ private:
+  struct Phase {
+    uint64_t count = 0;
+    uint64_t time_nsecs = 0;
+    uint64_t minor_faults = 0;
+    uint64_t major_faults = 0;
+  };
+  Phase phases_[NUM_TOUCH_PHASES];
+};
+
+// Touches the memory of allocations as configured, and counts the faults
+// of every phase of an action with the fault counters of the calling
+// thread. Each replay thread has its own, so nothing is shared.
+class MemoryToucher {
+ public:
+  MemoryToucher() {}
+  explicit MemoryToucher(const TouchOptions& options) : options_(options) {}
+  virtual ~MemoryToucher() {}
+
+  // Starts the first phase of an action.
+  void Begin();
+  // Ends the phase started by Begin() or the previous EndPhase().
+  void EndPhase(TouchPhase phase, uint64_t nsecs);
+
+  // Writes the configured part of an allocation with value, as its own
+  // phase.
+  void Write(void* memory, size_t size, int value);
+  // If enabled, reads every cache line of the written part of an
+  // allocation, as its own phase.
+  void Read(const void* memory, size_t size);
+
+  const TouchStats& stats() const { return stats_; }
+
+ private:
+  size_t GetLength(size_t size) const;
+  void GetFaults(uint64_t* minor_faults, uint64_t* major_faults);
+
+  TouchOptions options_;
+  TouchStats stats_;
+  uint64_t minor_faults_ = 0;
+  uint64_t major_faults_ = 0;
+};
+
+#endif // _MEMORY_REPLAY_MEMORY_TOUCHER_H
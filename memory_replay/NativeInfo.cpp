@@ -61,6 +61,47 @@ void GetNativeInfo(int smaps_fd, size_t* pss_bytes, size_t* va_bytes) {
   *va_bytes = total_va_bytes;
 }
 
+void GetProcessMemory(int smaps_fd, ProcessMemory* memory) {
+  // The buffer is on the stack so that the memory can be sampled from
+  // another thread while the replay runs.
+  char map_buffer[4096];
+  LineBuffer line_buf(smaps_fd, map_buffer, sizeof(map_buffer));
+  char* line;
+  size_t line_len;
+  bool in_long_line = false;
+  *memory = ProcessMemory();
+  while (line_buf.GetLine(&line, &line_len)) {
+    // A line that fills the buffer is a piece of a line too long for it, like
+    // a map with a long name in smaps. Skip all of its pieces, so the rest of
+    // the name isn't parsed as a line.
+    bool skip = in_long_line;
+    in_long_line = line_len == sizeof(map_buffer) - 1;
+    if (skip || in_long_line) {
+      continue;
+    }
+    size_t kB;
+    if (sscanf(line, "Rss: %zu", &kB) == 1) {
+      memory->rss_bytes += kB * 1024;
+    } else if (sscanf(line, "Pss: %zu", &kB) == 1) {
+      memory->pss_bytes += kB * 1024;
+    } else if (sscanf(line, "Anonymous: %zu", &kB) == 1) {
+      memory->anon_bytes += kB * 1024;
+    }
+  }
+}
+
+bool GetProcessMemory(ProcessMemory* memory) {
+  android::base::unique_fd smaps_fd(open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC));
+  if (smaps_fd == -1) {
+    smaps_fd.reset(open("/proc/self/smaps", O_RDONLY | O_CLOEXEC));
+    if (smaps_fd == -1) {
+      return false;
+    }
+  }
+  GetProcessMemory(smaps_fd, memory);
+  return true;
+}
+
 void PrintNativeInfo(const char* preamble) {
   size_t pss_bytes;
   size_t va_bytes;
@@ -17,9 +17,25 @@
 #ifndef _MEMORY_REPLAY_NATIVE_INFO_H
 #define _MEMORY_REPLAY_NATIVE_INFO_H
 
+#include <sys/types.h>
+
+// The memory totals of all maps of a process.
+struct ProcessMemory {
+  size_t rss_bytes = 0;
+  size_t pss_bytes = 0;
+  size_t anon_bytes = 0;
+};
+
 // This function is not re-entrant.
 void GetNativeInfo(int smaps_fd, size_t* pss_bytes, size_t* va_bytes);
 
+// Sums the Rss, Pss and Anonymous lines of a smaps or smaps_rollup file.
+void GetProcessMemory(int smaps_fd, ProcessMemory* memory);
+
+// Reads /proc/self/smaps_rollup, or /proc/self/smaps if the kernel doesn't
+// support smaps_rollup. Returns false on failure.
+bool GetProcessMemory(ProcessMemory* memory);
+
 // This function is not re-entrant.
 void PrintNativeInfo(const char* preamble);
 
@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "Action.h"
+#include "Histogram.h"
+#include "ParallelReplay.h"
+#include "Pointers.h"
+#include "Thread.h"
+#include "TraceFile.h"
+#include "Utils.h"
+
+// Event states, events start as zero which means not signaled. An event is
+// waited for at most by the threads freeing an allocation, so it is rarely
+// contended. Waiters only make a futex call when the event is not signaled.
+static constexpr uint32_t EVENT_SIGNALED = 1;
+static constexpr uint32_t EVENT_HAS_WAITERS = 2;
+
+// How often each thread adds to the shared count of replayed actions.
+static constexpr size_t ACTIONS_PER_UPDATE = 1024;
+
+static void FutexWait(std::atomic<uint32_t>* addr, uint32_t value) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, value, nullptr,
+          nullptr, 0);
+}
+
+static void FutexWakeAll(std::atomic<uint32_t>* addr) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr,
+          nullptr, 0);
+}
+
+static void* MapMemory(size_t* size, const char* name) {
+  size_t pagesize = getpagesize();
+  *size = (*size + pagesize - 1) & ~(pagesize - 1);
+  void* memory = mmap(nullptr, *size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+  if (memory == MAP_FAILED) {
+    err(1, "Unable to allocate data for %s: map size %zu\n", name, *size);
+  }
+  // Make sure that all of the PSS for this is counted right away.
+  memset(memory, 0, *size);
+  return memory;
+}
+
+// Returns the id that must have been allocated before the entry can run,
+// or zero if the entry has no dependency.
+static uint64_t GetDependency(const TraceEntry& entry) {
+  if (entry.type == TRACE_FREE) {
+    return entry.id;
+  }
+  if (entry.type == TRACE_REALLOC) {
+    return entry.arg;
+  }
+  return 0;
+}
+
+static bool CreatesId(const TraceEntry& entry) {
+  return entry.type != TRACE_FREE && entry.type != TRACE_THREAD_DONE;
+}
+
+// Hides the cache misses on the Pointers table of the next entry while the
+// current one runs.
+void ParallelReplay::PrefetchEntry(const TraceEntry& entry) {
+  uint64_t dependency = GetDependency(entry);
+  if (dependency != 0) {
+    pointers_->Prefetch(dependency);
+  }
+  if (CreatesId(entry) && entry.id != 0) {
+    pointers_->Prefetch(entry.id);
+  }
+}
+
+size_t ParallelReplay::GetMaxAllocs(const TraceFile& trace) {
+  // The Pointers table grows if more allocations are alive than in the
+  // recording, so the maximum from the trace is enough.
+  return trace.header().max_allocs;
+}
+
+double ParallelReplay::GetTraceConcurrency(const TraceFile& trace) {
+  // Find the step at which every action can run at the earliest, when all
+  // actions take one step. The number of steps is the critical path.
+  const TraceEntry* entries = trace.entries();
+  std::vector<uint64_t> created(trace.header().num_ids + 1);
+  std::unordered_map<pid_t, uint64_t> live_threads;
+  uint64_t last_end = 0;
+  uint64_t num_steps = 0;
+  for (size_t i = 0; i < trace.num_entries(); i++) {
+    const TraceEntry& entry = entries[i];
+    auto it = live_threads.find(entry.tid);
+    if (it == live_threads.end()) {
+      it = live_threads.emplace(entry.tid, last_end).first;
+    }
+    uint64_t step = it->second;
+    uint64_t dependency = GetDependency(entry);
+    if (dependency != 0) {
+      step = std::max(step, created[dependency]);
+    }
+    step++;
+    num_steps = std::max(num_steps, step);
+    if (CreatesId(entry)) {
+      created[entry.id] = step;
+    }
+    if (entry.type == TRACE_THREAD_DONE) {
+      last_end = std::max(last_end, step);
+      live_threads.erase(it);
+    } else {
+      it->second = step;
+    }
+  }
+  return num_steps == 0 ? 0 : double(trace.num_entries()) / num_steps;
+}
+
+ParallelReplay::ParallelReplay(const TraceFile& trace, Pointers* pointers, Allocator* allocator,
+                               const TouchOptions& touch_options)
+    : trace_(trace), pointers_(pointers), allocator_(allocator), running_(0), max_running_(0),
+      num_actions_(0) {
+  const TraceEntry* entries = trace.entries();
+  size_t num_entries = trace.num_entries();
+  if (num_entries > UINT32_MAX) {
+    errx(1, "Too many entries in trace: %zu\n", num_entries);
+  }
+
+  // Split the trace into one stream of entries per thread. A tid reused
+  // after a thread_done starts a new thread.
+  struct ThreadInfo {
+    size_t num_entries = 0;
+    uint64_t start_deps = 0;
+  };
+  std::vector<ThreadInfo> infos;
+  std::unordered_map<pid_t, size_t> live_threads;
+  std::vector<size_t> ended_threads;
+  for (size_t i = 0; i < num_entries; i++) {
+    auto it = live_threads.find(entries[i].tid);
+    if (it == live_threads.end()) {
+      it = live_threads.emplace(entries[i].tid, infos.size()).first;
+      infos.emplace_back();
+      infos.back().start_deps = ended_threads.size();
+    }
+    ThreadInfo& info = infos[it->second];
+    info.num_entries++;
+    if (entries[i].type == TRACE_THREAD_DONE) {
+      ended_threads.push_back(it->second);
+      live_threads.erase(it);
+    }
+  }
+
+  num_threads_ = infos.size();
+  threads_ = new ReplayThread[num_threads_];
+  size_t first_index = 0;
+  for (size_t i = 0; i < num_threads_; i++) {
+    ReplayThread* replay_thread = &threads_[i];
+    replay_thread->replay = this;
+    replay_thread->thread.set_pointers(pointers_);
+    replay_thread->thread.set_toucher(MemoryToucher(touch_options));
+    replay_thread->first_index = first_index;
+    replay_thread->start_deps = infos[i].start_deps;
+    first_index += infos[i].num_entries;
+  }
+  for (size_t thread_index : ended_threads) {
+    end_threads_.push_back(&threads_[thread_index]);
+  }
+
+  indices_size_ = num_entries * sizeof(uint32_t);
+  indices_ = reinterpret_cast<uint32_t*>(MapMemory(&indices_size_, "thread entries"));
+  live_threads.clear();
+  for (size_t i = 0, next_thread = 0; i < num_entries; i++) {
+    auto it = live_threads.find(entries[i].tid);
+    if (it == live_threads.end()) {
+      it = live_threads.emplace(entries[i].tid, next_thread++).first;
+    }
+    ReplayThread* replay_thread = &threads_[it->second];
+    indices_[replay_thread->first_index + replay_thread->num_entries++] = i;
+    if (entries[i].type == TRACE_THREAD_DONE) {
+      live_threads.erase(it);
+    }
+  }
+
+  events_size_ = (trace.header().num_ids + 1) * sizeof(std::atomic<uint32_t>);
+  events_ = reinterpret_cast<std::atomic<uint32_t>*>(MapMemory(&events_size_, "events"));
+  histograms_ = ActionHistograms::Create();
+}
+
+ParallelReplay::~ParallelReplay() {
+  delete[] threads_;
+  ActionHistograms::Destroy(histograms_);
+  if (indices_ != nullptr) {
+    munmap(indices_, indices_size_);
+    indices_ = nullptr;
+  }
+  if (events_ != nullptr) {
+    munmap(events_, events_size_);
+    events_ = nullptr;
+  }
+}
+
+bool ParallelReplay::IsSignaled(uint64_t event) {
+  return events_[event].load(std::memory_order_acquire) == EVENT_SIGNALED;
+}
+
+void ParallelReplay::WaitForEvent(uint64_t event) {
+  std::atomic<uint32_t>* state = &events_[event];
+  uint32_t value = state->load(std::memory_order_acquire);
+  while (value != EVENT_SIGNALED) {
+    if (value == EVENT_HAS_WAITERS ||
+        state->compare_exchange_weak(value, EVENT_HAS_WAITERS, std::memory_order_acquire)) {
+      FutexWait(state, EVENT_HAS_WAITERS);
+    }
+    value = state->load(std::memory_order_acquire);
+  }
+}
+
+void ParallelReplay::SignalEvent(uint64_t event) {
+  std::atomic<uint32_t>* state = &events_[event];
+  if (state->exchange(EVENT_SIGNALED, std::memory_order_release) == EVENT_HAS_WAITERS) {
+    FutexWakeAll(state);
+  }
+}
+
+void ParallelReplay::UpdateRunning(int delta) {
+  int running = running_.fetch_add(delta, std::memory_order_relaxed) + delta;
+  int max_running = max_running_.load(std::memory_order_relaxed);
+  while (running > max_running &&
+         !max_running_.compare_exchange_weak(max_running, running, std::memory_order_relaxed)) {
+  }
+}
+
+void* ParallelReplay::ThreadRunner(void* data) {
+  ReplayThread* replay_thread = reinterpret_cast<ReplayThread*>(data);
+  replay_thread->replay->RunThread(replay_thread);
+  return nullptr;
+}
+
+void ParallelReplay::RunThread(ReplayThread* replay_thread) {
+  UpdateRunning(1);
+  uint64_t start_nsecs = Nanotime();
+
+  Thread* thread = &replay_thread->thread;
+  const TraceEntry* entries = trace_.entries();
+  const uint32_t* indices = indices_ + replay_thread->first_index;
+  for (size_t i = 0; i < replay_thread->num_entries; i++) {
+    const TraceEntry& entry = entries[indices[i]];
+    uint64_t dependency = GetDependency(entry);
+    if (dependency != 0 && !IsSignaled(dependency)) {
+      uint64_t wait_start_nsecs = Nanotime();
+      UpdateRunning(-1);
+      WaitForEvent(dependency);
+      UpdateRunning(1);
+      replay_thread->wait_nsecs += Nanotime() - wait_start_nsecs;
+      replay_thread->num_waits++;
+    }
+    Action* action = thread->CreateAction(entry);
+    if (action == nullptr) {
+      errx(1, "Cannot create action from entry %u: unknown type %u\n", indices[i], entry.type);
+    }
+    if (i + 1 < replay_thread->num_entries) {
+      PrefetchEntry(entries[indices[i + 1]]);
+    }
+    thread->AddActionTime(action, action->Execute(pointers_, allocator_, thread->toucher()));
+    if (CreatesId(entry)) {
+      SignalEvent(entry.id);
+    }
+    // Update the shared counter in batches to avoid contention.
+    if ((i + 1) % ACTIONS_PER_UPDATE == 0) {
+      num_actions_.fetch_add(ACTIONS_PER_UPDATE, std::memory_order_relaxed);
+    }
+  }
+  num_actions_.fetch_add(replay_thread->num_entries % ACTIONS_PER_UPDATE,
+                         std::memory_order_relaxed);
+
+  replay_thread->active_nsecs = Nanotime() - start_nsecs - replay_thread->wait_nsecs;
+  UpdateRunning(-1);
+
+  // Merge the histograms once the thread is done, so only the threads
+  // alive at the same time have their own histograms.
+  ActionHistograms* histograms = thread->ReleaseHistograms();
+  if (histograms != nullptr) {
+    pthread_mutex_lock(&histograms_lock_);
+    histograms_->Merge(*histograms);
+    pthread_mutex_unlock(&histograms_lock_);
+    ActionHistograms::Destroy(histograms);
+  }
+}
+
+void ParallelReplay::CreateThread(ReplayThread* replay_thread) {
+  int ret = pthread_create(&replay_thread->thread_id, nullptr, ThreadRunner, replay_thread);
+  if (ret != 0) {
+    errx(1, "Failed to create thread %zu with %zu threads alive: %s\n",
+         static_cast<size_t>(replay_thread - threads_), live_threads_, strerror(ret));
+  }
+  replay_thread->created = true;
+  max_live_threads_ = std::max(max_live_threads_, ++live_threads_);
+}
+
+void ParallelReplay::JoinThread(ReplayThread* replay_thread) {
+  int ret = pthread_join(replay_thread->thread_id, nullptr);
+  if (ret != 0) {
+    errx(1, "pthread_join failed: %s\n", strerror(ret));
+  }
+  replay_thread->created = false;
+  live_threads_--;
+}
+
+void ParallelReplay::Run() {
+  // Threads are created in the order they start in the trace, each once the
+  // threads that ended before its first action have been joined. Those
+  // threads only depend on allocations made by threads created before them,
+  // so joining them can't deadlock. Traces with many short lived threads
+  // then never need more threads than were alive together when recording.
+  uint64_t start_nsecs = Nanotime();
+  uint64_t num_joined = 0;
+  for (size_t i = 0; i < num_threads_; i++) {
+    for (; num_joined < threads_[i].start_deps; num_joined++) {
+      JoinThread(end_threads_[num_joined]);
+    }
+    CreateThread(&threads_[i]);
+  }
+  for (size_t i = 0; i < num_threads_; i++) {
+    if (threads_[i].created) {
+      JoinThread(&threads_[i]);
+    }
+  }
+  wall_time_nsecs_ = Nanotime() - start_nsecs;
+
+  for (size_t i = 0; i < num_threads_; i++) {
+    ReplayThread* replay_thread = &threads_[i];
+    total_time_nsecs_ += replay_thread->thread.total_time_nsecs();
+    active_time_nsecs_ += replay_thread->active_nsecs;
+    num_waits_ += replay_thread->num_waits;
+    wait_time_nsecs_ += replay_thread->wait_nsecs;
+    touch_stats_.Merge(replay_thread->thread.toucher()->stats());
+  }
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_PARALLEL_REPLAY_H
+#define _MEMORY_REPLAY_PARALLEL_REPLAY_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <vector>
+
+#include "MemoryToucher.h"
+#include "Thread.h"
+
+class ActionHistograms;
+class Allocator;
+class Pointers;
+class TraceFile;
+struct TraceEntry;
+
+// Replays a compiled trace with every thread of the trace running its own
+// actions independently, instead of dispatching each action from a single
+// thread. Threads only block on happens-before edges taken from the trace:
+//  - A free or realloc waits until the allocation it frees has been made.
+//  - A thread starts once all threads that ended before its first action
+//    in the trace have ended, so the number of live threads is about the
+//    same as during the recording.
+// Threads are created when they can start and joined once they end, so the
+// replay never has more threads than were alive together in the recording.
+// Since every dependency points backwards in the trace, the replay can
+// never deadlock.
+class ParallelReplay {
+ public:
+  ParallelReplay(const TraceFile& trace, Pointers* pointers, Allocator* allocator,
+                 const TouchOptions& touch_options = TouchOptions());
+  virtual ~ParallelReplay();
+
+  void Run();
+
+  size_t num_threads() { return num_threads_; }
+  // Total time spent in allocation functions.
+  uint64_t total_time_nsecs() { return total_time_nsecs_; }
+  uint64_t wall_time_nsecs() { return wall_time_nsecs_; }
+  // Total time threads were runnable, not waiting for a dependency.
+  uint64_t active_time_nsecs() { return active_time_nsecs_; }
+  uint64_t num_waits() { return num_waits_; }
+  uint64_t wait_time_nsecs() { return wait_time_nsecs_; }
+  size_t max_concurrency() { return max_running_; }
+  // The most replay threads that existed at the same time.
+  size_t max_live_threads() { return max_live_threads_; }
+  const ActionHistograms& histograms() { return *histograms_; }
+  const TouchStats& touch_stats() { return touch_stats_; }
+  // The number of actions replayed so far, updated every few actions.
+  const std::atomic<uint64_t>* num_actions() { return &num_actions_; }
+  // The average number of threads running at the same time.
+  double concurrency() {
+    return wall_time_nsecs_ == 0 ? 0 : double(active_time_nsecs_) / wall_time_nsecs_;
+  }
+
+  // The Pointers table size needed to replay the trace.
+  static size_t GetMaxAllocs(const TraceFile& trace);
+  // The average number of threads that can run at the same time when every
+  // action takes as long, which bounds the concurrency a replay achieves.
+  static double GetTraceConcurrency(const TraceFile& trace);
+
+ private:
+  struct ReplayThread {
+    ParallelReplay* replay = nullptr;
+    Thread thread;
+    pthread_t thread_id;
+    bool created = false;
+    // Range of this thread's entries in indices_.
+    size_t first_index = 0;
+    size_t num_entries = 0;
+    // The thread starts after the first |start_deps| threads to end in the
+    // trace have ended.
+    uint64_t start_deps = 0;
+
+    uint64_t active_nsecs = 0;
+    uint64_t wait_nsecs = 0;
+    uint64_t num_waits = 0;
+  };
+
+  static void* ThreadRunner(void* data);
+  void RunThread(ReplayThread* replay_thread);
+  bool IsSignaled(uint64_t event);
+  void WaitForEvent(uint64_t event);
+  void SignalEvent(uint64_t event);
+  void UpdateRunning(int delta);
+  void PrefetchEntry(const TraceEntry& entry);
+  void CreateThread(ReplayThread* replay_thread);
+  void JoinThread(ReplayThread* replay_thread);
+
+  const TraceFile& trace_;
+  Pointers* pointers_ = nullptr;
+  Allocator* allocator_ = nullptr;
+
+  // Event i is signaled when the allocation with id i has been made.
+  std::atomic<uint32_t>* events_ = nullptr;
+  size_t events_size_ = 0;
+  // Threads that end in the trace, in the order they end.
+  std::vector<ReplayThread*> end_threads_;
+
+  // Indices of the entries replayed by each thread.
+  uint32_t* indices_ = nullptr;
+  size_t indices_size_ = 0;
+
+  ReplayThread* threads_ = nullptr;
+  size_t num_threads_ = 0;
+  size_t live_threads_ = 0;
+  size_t max_live_threads_ = 0;
+
+  std::atomic<int> running_;
+  std::atomic<int> max_running_;
+  std::atomic<uint64_t> num_actions_;
+
+  pthread_mutex_t histograms_lock_ = PTHREAD_MUTEX_INITIALIZER;
+  ActionHistograms* histograms_ = nullptr;
+  TouchStats touch_stats_;
+
+  uint64_t total_time_nsecs_ = 0;
+  uint64_t wall_time_nsecs_ = 0;
+  uint64_t active_time_nsecs_ = 0;
+  uint64_t num_waits_ = 0;
+  uint64_t wait_time_nsecs_ = 0;
+};
+
+#endif // _MEMORY_REPLAY_PARALLEL_REPLAY_H
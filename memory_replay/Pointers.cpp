@@ -24,38 +24,67 @@
 #include <unistd.h>
 
 #include "err.h"
+#include "Allocator.h"
 #include "Pointers.h"
 
 Pointers::Pointers(size_t max_allocs) {
-  size_t pagesize = getpagesize();
-  // Create a mmap that contains a 4:1 ratio of allocations to entries.
-  // Align to a page.
-  pointers_size_ = (max_allocs * 4 * sizeof(pointer_data) + pagesize - 1) & ~(pagesize - 1);
-  max_pointers_ = pointers_size_ / sizeof(pointer_data);
-  void* memory = mmap(nullptr, pointers_size_, PROT_READ | PROT_WRITE,
-                      MAP_ANON | MAP_PRIVATE, -1, 0);
-  if (memory == MAP_FAILED) {
+  // Create a first level that contains a 2:1 ratio of entries to
+  // allocations, of at least a page.
+  size_t min_buckets = getpagesize() / sizeof(bucket_data);
+  size_t buckets = (max_allocs * 2 + ENTRIES_PER_BUCKET - 1) / ENTRIES_PER_BUCKET;
+  for (num_buckets_ = 1; num_buckets_ < min_buckets || num_buckets_ < buckets;
+       num_buckets_ *= 2) {
+  }
+  max_pointers_ = num_buckets_ * ENTRIES_PER_BUCKET;
+  for (size_t i = 0; i < MAX_LEVELS; i++) {
+    atomic_init(&levels_[i], nullptr);
+  }
+  if (GetLevel(0, true) == nullptr) {
     err(1, "Unable to allocate data for pointer hash: %zu total_allocs\n", max_allocs);
   }
-  // Make sure that all of the PSS for this is counted right away.
-  memset(memory, 0, pointers_size_);
-  pointers_ = reinterpret_cast<pointer_data*>(memory);
 }
 
 Pointers::~Pointers() {
-  if (pointers_ != nullptr) {
-    munmap(pointers_, pointers_size_);
-    pointers_ = nullptr;
+  for (size_t i = 0; i < MAX_LEVELS; i++) {
+    bucket_data* buckets = atomic_load(&levels_[i]);
+    if (buckets != nullptr) {
+      munmap(buckets, (num_buckets_ << i) * sizeof(bucket_data));
+      atomic_store(&levels_[i], static_cast<bucket_data*>(nullptr));
+    }
   }
 }
 
+Pointers::bucket_data* Pointers::GetLevel(size_t level, bool create) {
+  bucket_data* buckets = atomic_load_explicit(&levels_[level], std::memory_order_acquire);
+  if (buckets != nullptr || !create) {
+    return buckets;
+  }
+
+  size_t size = (num_buckets_ << level) * sizeof(bucket_data);
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  // Make sure that all of the PSS for this is counted right away.
+  memset(memory, 0, size);
+
+  // Several threads can run out of space at the same time, only the first
+  // one installs its level.
+  bucket_data* new_buckets = reinterpret_cast<bucket_data*>(memory);
+  if (!atomic_compare_exchange_strong(&levels_[level], &buckets, new_buckets)) {
+    munmap(memory, size);
+    return buckets;
+  }
+  return new_buckets;
+}
+
 void Pointers::Add(uintptr_t key_pointer, void* pointer) {
   pointer_data* data = FindEmpty(key_pointer);
   if (data == nullptr) {
     err(1, "No empty entry found for 0x%" PRIxPTR "\n", key_pointer);
   }
-  atomic_store(&data->key_pointer, key_pointer);
   data->pointer = pointer;
+  atomic_store(&data->key_pointer, key_pointer);
 }
 
 void* Pointers::Remove(uintptr_t key_pointer) {
@@ -75,41 +104,62 @@ void* Pointers::Remove(uintptr_t key_pointer) {
 }
 
 pointer_data* Pointers::Find(uintptr_t key_pointer) {
-  size_t index = GetHash(key_pointer);
-  for (size_t entries = max_pointers_; entries != 0; entries--) {
-    if (atomic_load(&pointers_[index].key_pointer) == key_pointer) {
-      return pointers_ + index;
+  for (size_t level = 0; level < MAX_LEVELS; level++) {
+    bucket_data* buckets = GetLevel(level, false);
+    if (buckets == nullptr) {
+      break;
     }
-    if (++index == max_pointers_) {
-      index = 0;
+    size_t mask = (num_buckets_ << level) - 1;
+    size_t index = GetBucket(key_pointer, level);
+    for (size_t probe = 0; probe < MAX_PROBES && probe <= mask; probe++) {
+      bucket_data* bucket = &buckets[(index + probe) & mask];
+      for (size_t i = 0; i < ENTRIES_PER_BUCKET; i++) {
+        if (atomic_load(&bucket->entries[i].key_pointer) == key_pointer) {
+          return &bucket->entries[i];
+        }
+      }
     }
   }
   return nullptr;
 }
 
 pointer_data* Pointers::FindEmpty(uintptr_t key_pointer) {
-  size_t index = GetHash(key_pointer);
-  for (size_t entries = 0; entries < max_pointers_; entries++) {
-    uintptr_t empty = 0;
-    if (atomic_compare_exchange_strong(&pointers_[index].key_pointer, &empty,
-        uintptr_t(1))) {
-      return pointers_ + index;
+  for (size_t level = 0; level < MAX_LEVELS; level++) {
+    bucket_data* buckets = GetLevel(level, true);
+    if (buckets == nullptr) {
+      break;
     }
-    if (++index == max_pointers_) {
-      index = 0;
+    size_t mask = (num_buckets_ << level) - 1;
+    size_t index = GetBucket(key_pointer, level);
+    for (size_t probe = 0; probe < MAX_PROBES && probe <= mask; probe++) {
+      bucket_data* bucket = &buckets[(index + probe) & mask];
+      for (size_t i = 0; i < ENTRIES_PER_BUCKET; i++) {
+        uintptr_t empty = 0;
+        // Reserve the entry with a key that is neither a real pointer nor a
+        // trace id, so a concurrent Find() can't match it.
+        if (atomic_load_explicit(&bucket->entries[i].key_pointer, std::memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong(&bucket->entries[i].key_pointer, &empty,
+                                           UINTPTR_MAX)) {
+          return &bucket->entries[i];
+        }
+      }
     }
   }
   return nullptr;
 }
 
-size_t Pointers::GetHash(uintptr_t key_pointer) {
-  return key_pointer % max_pointers_;
-}
-
-void Pointers::FreeAll() {
-  for (size_t i = 0; i < max_pointers_; i++) {
-    if (atomic_load(&pointers_[i].key_pointer) != 0) {
-      free(pointers_[i].pointer);
+void Pointers::FreeAll(Allocator* allocator) {
+  for (size_t level = 0; level < MAX_LEVELS; level++) {
+    bucket_data* buckets = GetLevel(level, false);
+    if (buckets == nullptr) {
+      break;
+    }
+    for (size_t i = 0; i < (num_buckets_ << level); i++) {
+      for (size_t j = 0; j < ENTRIES_PER_BUCKET; j++) {
+        if (atomic_load(&buckets[i].entries[j].key_pointer) != 0) {
+          allocator->Free(buckets[i].entries[j].pointer);
+        }
+      }
     }
   }
 }
@@ -20,11 +20,24 @@
 #include <stdatomic.h>
 #include <stdint.h>
 
+#include <atomic>
+
+class Allocator;
+
 struct pointer_data {
   std::atomic_uintptr_t key_pointer;
   void* pointer;
 };
 
+// A lock free open addressing table from trace keys to allocations.
+//
+// Entries are grouped in buckets of one cache line, and keys are hashed so
+// that consecutive keys, which are usually used by different threads, land
+// in different cache lines. A key is only looked for in a few buckets
+// after its hash bucket. If those are full, the key goes into an overflow
+// level twice as big as the previous one, created on demand. The table
+// never moves entries, so a table sized from an estimate that turns out
+// too small keeps working, only a bit slower.
 class Pointers {
  public:
   explicit Pointers(size_t max_allocs);
@@ -34,17 +47,43 @@ class Pointers {
 
   void* Remove(uintptr_t key_pointer);
 
+  // Starts loading the bucket of the key into the cache, to hide the cache
+  // miss of an Add or Remove of the key coming up next.
+  void Prefetch(uintptr_t key_pointer) {
+    bucket_data* buckets = levels_[0].load(std::memory_order_relaxed);
+    __builtin_prefetch(&buckets[GetBucket(key_pointer, 0)], 1);
+  }
+
+  // The number of entries in the first level of the table.
   size_t max_pointers() { return max_pointers_; }
 
-  void FreeAll();
+  void FreeAll(Allocator* allocator);
 
  private:
+  static constexpr size_t BUCKET_SIZE = 64;
+  static constexpr size_t ENTRIES_PER_BUCKET = BUCKET_SIZE / sizeof(pointer_data);
+  // The number of buckets searched for a key in each level.
+  static constexpr size_t MAX_PROBES = 8;
+  static constexpr size_t MAX_LEVELS = 16;
+
+  struct alignas(BUCKET_SIZE) bucket_data {
+    pointer_data entries[ENTRIES_PER_BUCKET];
+  };
+
+  bucket_data* GetLevel(size_t level, bool create);
   pointer_data* FindEmpty(uintptr_t key_pointer);
   pointer_data* Find(uintptr_t key_pointer);
-  size_t GetHash(uintptr_t key_pointer);
+  size_t GetBucket(uintptr_t key_pointer, size_t level) {
+    uint64_t hash = key_pointer;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash & ((num_buckets_ << level) - 1);
+  }
 
-  pointer_data* pointers_ = nullptr;
-  size_t pointers_size_ = 0;
+  std::atomic<bucket_data*> levels_[MAX_LEVELS];
+  // The number of buckets in the first level, always a power of two.
+  size_t num_buckets_ = 0;
   size_t max_pointers_ = 0;
 };
 
@@ -17,6 +17,7 @@
 #include <pthread.h>
 
 #include "Action.h"
+#include "Histogram.h"
 #include "Thread.h"
 
 Thread::Thread() {
@@ -25,6 +26,7 @@ Thread::Thread() {
 
 Thread::~Thread() {
   pthread_cond_destroy(&cond_);
+  ActionHistograms::Destroy(histograms_);
 }
 
 void Thread::WaitForReady() {
@@ -60,3 +62,25 @@ void Thread::ClearPending() {
 Action* Thread::CreateAction(uintptr_t key_pointer, const char* type, const char* line) {
   return Action::CreateAction(key_pointer, type, line, action_memory_);
 }
+
+Action* Thread::CreateAction(const TraceEntry& entry) {
+  return Action::CreateAction(entry, action_memory_);
+}
+
+void Thread::AddActionTime(Action* action, uint64_t nsecs) {
+  total_time_nsecs_ += nsecs;
+  ActionType type = action->type();
+  if (type == ACTION_NONE) {
+    return;
+  }
+  if (histograms_ == nullptr) {
+    histograms_ = ActionHistograms::Create();
+  }
+  histograms_->Record(type, action->size(), nsecs);
+}
+
+ActionHistograms* Thread::ReleaseHistograms() {
+  ActionHistograms* histograms = histograms_;
+  histograms_ = nullptr;
+  return histograms;
+}
@@ -21,8 +21,13 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include "MemoryToucher.h"
+
 class Action;
+class ActionHistograms;
+class Allocator;
 class Pointers;
+struct TraceEntry;
 
 constexpr size_t ACTION_MEMORY_SIZE = 128;
 
@@ -37,11 +42,26 @@ class Thread {
   void ClearPending();
 
   Action* CreateAction(uintptr_t key_pointer, const char* type, const char* line);
+  Action* CreateAction(const TraceEntry& entry);
   void AddTimeNsecs(uint64_t nsecs) { total_time_nsecs_ += nsecs; }
+  uint64_t total_time_nsecs() { return total_time_nsecs_; }
+
+  // Add the time spent executing the action, and record it in the latency
+  // histograms of the action type.
+  void AddActionTime(Action* action, uint64_t nsecs);
+  // Returns the recorded histograms, or nullptr if nothing was recorded.
+  // The caller takes ownership of the histograms.
+  ActionHistograms* ReleaseHistograms();
 
   void set_pointers(Pointers* pointers) { pointers_ = pointers; }
   Pointers* pointers() { return pointers_; }
 
+  void set_allocator(Allocator* allocator) { allocator_ = allocator; }
+  Allocator* allocator() { return allocator_; }
+
+  void set_toucher(const MemoryToucher& toucher) { toucher_ = toucher; }
+  MemoryToucher* toucher() { return &toucher_; }
+
   Action* GetAction() { return reinterpret_cast<Action*>(action_memory_); }
 
  private:
@@ -52,8 +72,11 @@ class Thread {
   pthread_t thread_id_;
   pid_t tid_ = 0;
   uint64_t total_time_nsecs_ = 0;
+  ActionHistograms* histograms_ = nullptr;
 
   Pointers* pointers_ = nullptr;
+  Allocator* allocator_ = nullptr;
+  MemoryToucher toucher_;
 
   // Per thread memory for an Action. Only one action can be processed.
   // at a time.
@@ -27,6 +27,7 @@
 #include <new>
 
 #include "Action.h"
+#include "Histogram.h"
 #include "Thread.h"
 #include "Threads.h"
 
@@ -35,7 +36,8 @@ void* ThreadRunner(void* data) {
   while (true) {
     thread->WaitForPending();
     Action* action = thread->GetAction();
-    thread->AddTimeNsecs(action->Execute(thread->pointers()));
+    thread->AddActionTime(action, action->Execute(thread->pointers(), thread->allocator(),
+                                                    thread->toucher()));
     bool end_thread = action->EndThread();
     thread->ClearPending();
     if (end_thread) {
@@ -45,8 +47,10 @@ void* ThreadRunner(void* data) {
   return nullptr;
 }
 
-Threads::Threads(Pointers* pointers, size_t max_threads)
-    : pointers_(pointers), max_threads_(max_threads) {
+Threads::Threads(Pointers* pointers, size_t max_threads, Allocator* allocator,
+                 const TouchOptions& touch_options)
+    : pointers_(pointers), allocator_(allocator), touch_options_(touch_options),
+      max_threads_(max_threads) {
   size_t pagesize = getpagesize();
   data_size_ = (max_threads_ * sizeof(Thread) + pagesize - 1) & ~(pagesize - 1);
   max_threads_ = data_size_ / sizeof(Thread);
@@ -63,14 +67,20 @@ Threads::Threads(Pointers* pointers, size_t max_threads)
   }
 
   threads_ = new (memory) Thread[max_threads_];
+  histograms_ = ActionHistograms::Create();
 }
 
 Threads::~Threads() {
   if (threads_) {
+    for (size_t i = 0; i < max_threads_; i++) {
+      ActionHistograms::Destroy(threads_[i].ReleaseHistograms());
+    }
     munmap(threads_, data_size_);
     threads_ = nullptr;
     data_size_ = 0;
   }
+  ActionHistograms::Destroy(histograms_);
+  histograms_ = nullptr;
 }
 
 Thread* Threads::CreateThread(pid_t tid) {
@@ -84,6 +94,8 @@ Thread* Threads::CreateThread(pid_t tid) {
   }
   thread->tid_ = tid;
   thread->pointers_ = pointers_;
+  thread->allocator_ = allocator_;
+  thread->toucher_ = MemoryToucher(touch_options_);
   thread->total_time_nsecs_ = 0;
   if (pthread_create(&thread->thread_id_, nullptr, ThreadRunner, thread) == -1) {
     err(1, "Failed to create thread %d: %s\n", tid, strerror(errno));
@@ -144,6 +156,12 @@ void Threads::Finish(Thread* thread) {
     exit(1);
   }
   total_time_nsecs_ += thread->total_time_nsecs_;
+  touch_stats_.Merge(thread->toucher_.stats());
+  ActionHistograms* histograms = thread->ReleaseHistograms();
+  if (histograms != nullptr) {
+    histograms_->Merge(*histograms);
+    ActionHistograms::Destroy(histograms);
+  }
   thread->tid_ = 0;
   num_threads_--;
 }
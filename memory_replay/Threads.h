@@ -20,12 +20,17 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include "Allocator.h"
+#include "MemoryToucher.h"
+
+class ActionHistograms;
 class Pointers;
 class Thread;
 
 class Threads {
  public:
-  Threads(Pointers* pointers, size_t max_threads);
+  Threads(Pointers* pointers, size_t max_threads, Allocator* allocator = Allocator::GetLibc(),
+          const TouchOptions& touch_options = TouchOptions());
   virtual ~Threads();
 
   Thread* CreateThread(pid_t tid);
@@ -37,14 +42,22 @@ class Threads {
   size_t num_threads() { return num_threads_; }
   size_t max_threads() { return max_threads_; }
   uint64_t total_time_nsecs() { return total_time_nsecs_; }
+  // The latency histograms of all finished threads.
+  const ActionHistograms& histograms() { return *histograms_; }
+  // The touch stats of all finished threads.
+  const TouchStats& touch_stats() { return touch_stats_; }
 
  private:
   Pointers* pointers_ = nullptr;
+  Allocator* allocator_ = nullptr;
+  TouchOptions touch_options_;
   Thread* threads_ = nullptr;
   size_t data_size_ = 0;
   size_t max_threads_ = 0;
   size_t num_threads_= 0;
   uint64_t total_time_nsecs_ = 0;
+  ActionHistograms* histograms_ = nullptr;
+  TouchStats touch_stats_;
 
   Thread* FindEmptyEntry(pid_t tid);
   size_t GetHashEntry(pid_t tid);
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <android-base/file.h>
+
+#include "LineBuffer.h"
+#include "TraceFile.h"
+
+TraceFile::~TraceFile() {
+  if (data_ != nullptr) {
+    munmap(data_, data_size_);
+    data_ = nullptr;
+  }
+}
+
+bool TraceFile::Open(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    fprintf(stderr, "Failed to stat trace file: %s\n", strerror(errno));
+    return false;
+  }
+  data_size_ = st.st_size;
+  if (data_size_ < sizeof(TraceHeader)) {
+    fprintf(stderr, "Trace file is too small: %zu bytes\n", data_size_);
+    return false;
+  }
+  data_ = mmap(nullptr, data_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data_ == MAP_FAILED) {
+    data_ = nullptr;
+    fprintf(stderr, "Failed to map trace file: %s\n", strerror(errno));
+    return false;
+  }
+  // Entries are only read once from start to end.
+  madvise(data_, data_size_, MADV_SEQUENTIAL);
+
+  header_ = reinterpret_cast<const TraceHeader*>(data_);
+  entries_ = reinterpret_cast<const TraceEntry*>(header_ + 1);
+  if (memcmp(header_->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+    fprintf(stderr, "Not a compiled trace file.\n");
+    return false;
+  }
+  if (header_->version != TRACE_VERSION) {
+    fprintf(stderr, "Unsupported trace version %u, expected %u\n", header_->version,
+            TRACE_VERSION);
+    return false;
+  }
+  if ((data_size_ - sizeof(TraceHeader)) / sizeof(TraceEntry) != header_->num_entries) {
+    fprintf(stderr, "Trace file is truncated: expected %" PRIu64 " entries\n",
+            header_->num_entries);
+    return false;
+  }
+  return true;
+}
+
+bool TraceFile::IsTraceFile(int fd) {
+  char magic[sizeof(TRACE_MAGIC)];
+  if (TEMP_FAILURE_RETRY(pread(fd, magic, sizeof(magic), 0)) != sizeof(magic)) {
+    return false;
+  }
+  return memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+TraceWriter::TraceWriter(int fd) : fd_(fd) {
+  memcpy(header_.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header_.version = TRACE_VERSION;
+  entries_.reserve(kMaxBufferedEntries);
+}
+
+bool TraceWriter::Start() {
+  if (ftruncate(fd_, 0) == -1 || lseek(fd_, sizeof(TraceHeader), SEEK_SET) == -1) {
+    fprintf(stderr, "Failed to set up trace file: %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool TraceWriter::Write(const TraceEntry& entry) {
+  entries_.push_back(entry);
+  header_.num_entries++;
+  if (entries_.size() == kMaxBufferedEntries) {
+    return FlushEntries();
+  }
+  return true;
+}
+
+bool TraceWriter::FlushEntries() {
+  if (!android::base::WriteFully(fd_, entries_.data(), entries_.size() * sizeof(TraceEntry))) {
+    fprintf(stderr, "Failed to write trace entries: %s\n", strerror(errno));
+    return false;
+  }
+  entries_.clear();
+  return true;
+}
+
+bool TraceWriter::Finish() {
+  if (!FlushEntries()) {
+    return false;
+  }
+  if (lseek(fd_, 0, SEEK_SET) == -1 ||
+      !android::base::WriteFully(fd_, &header_, sizeof(header_))) {
+    fprintf(stderr, "Failed to write trace header: %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+class TraceCompiler {
+ public:
+  explicit TraceCompiler(int trace_fd) : writer_(trace_fd), header_(writer_.header()) {}
+
+  bool Start() { return writer_.Start(); }
+
+  bool ProcessLine(const char* line);
+  bool Finish() { return writer_.Finish(); }
+
+ private:
+  struct LiveAlloc {
+    uint64_t id;
+    size_t size;
+  };
+
+  uint64_t AddId(uintptr_t pointer, size_t size);
+  bool RemoveId(uintptr_t pointer, uint64_t* id, size_t* size);
+
+  TraceWriter writer_;
+  TraceHeader* header_;
+  std::unordered_map<uintptr_t, LiveAlloc> live_ids_;
+  std::unordered_set<pid_t> live_threads_;
+  uint64_t live_allocs_ = 0;
+};
+
+uint64_t TraceCompiler::AddId(uintptr_t pointer, size_t size) {
+  uint64_t id = ++header_->num_ids;
+  // A pointer allocated twice without a free in between leaves the first
+  // allocation alive until the end of the replay, so keep counting it.
+  if (pointer != 0) {
+    live_ids_[pointer] = LiveAlloc{id, size};
+  }
+  if (++live_allocs_ > header_->max_allocs) {
+    header_->max_allocs = live_allocs_;
+  }
+  return id;
+}
+
+bool TraceCompiler::RemoveId(uintptr_t pointer, uint64_t* id, size_t* size) {
+  if (pointer == 0) {
+    *id = 0;
+    *size = 0;
+    return true;
+  }
+  auto it = live_ids_.find(pointer);
+  if (it == live_ids_.end()) {
+    fprintf(stderr, "No allocation found for pointer 0x%" PRIxPTR "\n", pointer);
+    return false;
+  }
+  *id = it->second.id;
+  *size = it->second.size;
+  live_ids_.erase(it);
+  live_allocs_--;
+  return true;
+}
+
+bool TraceCompiler::ProcessLine(const char* line) {
+  pid_t tid;
+  int line_pos = 0;
+  char type[128];
+  uintptr_t key_pointer;
+
+  // Every line is of this format:
+  //   <tid>: <action_type> <pointer>
+  // Some actions have extra arguments.
+  if (sscanf(line, "%d: %127s %" SCNxPTR " %n", &tid, type, &key_pointer, &line_pos) != 3) {
+    fprintf(stderr, "Unparseable line found: %s\n", line);
+    return false;
+  }
+  const char* args = line + line_pos;
+
+  TraceEntry entry = {};
+  entry.tid = tid;
+  size_t size = 0;
+  bool valid = true;
+  if (strcmp(type, "malloc") == 0) {
+    entry.type = TRACE_MALLOC;
+    valid = sscanf(args, "%zu", &size) == 1;
+    entry.id = AddId(key_pointer, size);
+  } else if (strcmp(type, "free") == 0) {
+    entry.type = TRACE_FREE;
+    valid = RemoveId(key_pointer, &entry.id, &size);
+  } else if (strcmp(type, "calloc") == 0) {
+    size_t n_elements = 0;
+    entry.type = TRACE_CALLOC;
+    valid = sscanf(args, "%zu %zu", &n_elements, &size) == 2;
+    entry.arg = n_elements;
+    entry.id = AddId(key_pointer, n_elements * size);
+  } else if (strcmp(type, "realloc") == 0) {
+    uintptr_t old_pointer;
+    size_t old_size;
+    entry.type = TRACE_REALLOC;
+    valid = sscanf(args, "%" SCNxPTR " %zu", &old_pointer, &size) == 2 &&
+            RemoveId(old_pointer, &entry.arg, &old_size);
+    entry.id = AddId(key_pointer, size);
+  } else if (strcmp(type, "memalign") == 0) {
+    size_t align;
+    entry.type = TRACE_MEMALIGN;
+    valid = sscanf(args, "%zu %zu", &align, &size) == 2;
+    entry.arg = align;
+    entry.id = AddId(key_pointer, size);
+  } else if (strcmp(type, "thread_done") == 0) {
+    entry.type = TRACE_THREAD_DONE;
+  } else {
+    valid = false;
+  }
+  if (!valid) {
+    fprintf(stderr, "Cannot create action from line: %s\n", line);
+    return false;
+  }
+  entry.size = size;
+
+  if (entry.type == TRACE_THREAD_DONE) {
+    live_threads_.erase(tid);
+  } else if (live_threads_.insert(tid).second && live_threads_.size() > header_->max_threads) {
+    header_->max_threads = live_threads_.size();
+  }
+
+  return writer_.Write(entry);
+}
+
+bool CompileTrace(int text_fd, int trace_fd) {
+  if (lseek(text_fd, 0, SEEK_SET) == -1) {
+    fprintf(stderr, "Failed to set up trace compile: %s\n", strerror(errno));
+    return false;
+  }
+
+  TraceCompiler compiler(trace_fd);
+  if (!compiler.Start()) {
+    return false;
+  }
+  std::vector<char> buffer(65535);
+  LineBuffer line_buf(text_fd, buffer.data(), buffer.size());
+  char* line;
+  size_t line_len;
+  while (line_buf.GetLine(&line, &line_len)) {
+    if (!compiler.ProcessLine(line)) {
+      return false;
+    }
+  }
+  return compiler.Finish();
+}
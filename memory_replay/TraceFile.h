@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_TRACE_FILE_H
+#define _MEMORY_REPLAY_TRACE_FILE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+// A compiled trace is a binary version of a text dump that can be mapped
+// and replayed without any parsing. The file is a TraceHeader followed by
+// num_entries fixed size TraceEntry records, one per line of the dump.
+// All fields are 64 bit wide so that a trace compiled on a 64 bit host can
+// be replayed by a 32 bit memory_replay.
+//
+// Pointers in the dump are renumbered into dense ids: every allocation gets
+// a new id starting at 1, and the id stays the same until the allocation
+// is freed. An id of zero means a nullptr.
+
+constexpr char TRACE_MAGIC[8] = "MRTRACE";
+constexpr uint32_t TRACE_VERSION = 1;
+
+enum TraceType : uint8_t {
+  TRACE_MALLOC = 1,
+  TRACE_CALLOC,
+  TRACE_REALLOC,
+  TRACE_MEMALIGN,
+  TRACE_FREE,
+  TRACE_THREAD_DONE,
+};
+
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  // The maximum number of threads alive at the same time.
+  uint32_t max_threads;
+  // The maximum number of allocations alive at the same time.
+  uint64_t max_allocs;
+  // The number of ids used, ids are in the range [1, num_ids].
+  uint64_t num_ids;
+  uint64_t num_entries;
+};
+static_assert(sizeof(TraceHeader) == 40, "Unexpected TraceHeader size");
+
+struct TraceEntry {
+  uint8_t type;
+  uint8_t reserved[3];
+  int32_t tid;
+  // The id of the allocation created, or freed for TRACE_FREE.
+  uint64_t id;
+  // TRACE_REALLOC: the id of the old allocation.
+  // TRACE_CALLOC: the number of elements.
+  // TRACE_MEMALIGN: the alignment.
+  uint64_t arg;
+  // The requested size, or the size of the freed allocation for TRACE_FREE.
+  uint64_t size;
+};
+static_assert(sizeof(TraceEntry) == 32, "Unexpected TraceEntry size");
+
+class TraceFile {
+ public:
+  TraceFile() {}
+  virtual ~TraceFile();
+
+  // Map a compiled trace. Returns false and prints an error if the file
+  // is not a valid compiled trace.
+  bool Open(int fd);
+
+  const TraceHeader& header() const { return *header_; }
+  const TraceEntry* entries() const { return entries_; }
+  size_t num_entries() const { return header_->num_entries; }
+
+  // Returns true if the file starts with the compiled trace magic.
+  static bool IsTraceFile(int fd);
+
+ private:
+  void* data_ = nullptr;
+  size_t data_size_ = 0;
+  const TraceHeader* header_ = nullptr;
+  const TraceEntry* entries_ = nullptr;
+};
+
+// Writes a compiled trace. The header is written last, since it contains
+// totals only known once all entries have been written.
+class TraceWriter {
+ public:
+  explicit TraceWriter(int fd);
+  virtual ~TraceWriter() {}
+
+  // Truncates the file and leaves room for the header.
+  bool Start();
+  bool Write(const TraceEntry& entry);
+  // Writes the buffered entries and the header.
+  bool Finish();
+
+  // The totals are filled in by the caller, except for num_entries.
+  TraceHeader* header() { return &header_; }
+
+ private:
+  bool FlushEntries();
+
+  static constexpr size_t kMaxBufferedEntries = 4096;
+
+  int fd_;
+  TraceHeader header_ = {};
+  std::vector<TraceEntry> entries_;
+};
+
+// Convert the text dump in text_fd into a compiled trace written to
+// trace_fd. Returns false and prints an error if the dump is malformed.
+bool CompileTrace(int text_fd, int trace_fd);
+
+#endif // _MEMORY_REPLAY_TRACE_FILE_H
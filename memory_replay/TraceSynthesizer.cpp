@@ -0,0 +1,432 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "Action.h"
+#include "Histogram.h"
+#include "TraceFile.h"
+#include "TraceSynthesizer.h"
+
+void Distribution::Add(uint64_t value, uint64_t count) {
+  counts_[value] += count;
+  total_ += count;
+}
+
+void Distribution::Finalize() {
+  values_.clear();
+  cumulative_counts_.clear();
+  uint64_t total = 0;
+  for (const auto& entry : counts_) {
+    total += entry.second;
+    values_.push_back(entry.first);
+    cumulative_counts_.push_back(total);
+  }
+  counts_.clear();
+}
+
+uint64_t Distribution::Sample(Random* random) const {
+  if (total_ == 0) {
+    return 0;
+  }
+  uint64_t target = random->Uniform(total_);
+  size_t index = std::upper_bound(cumulative_counts_.begin(), cumulative_counts_.end(), target) -
+                 cumulative_counts_.begin();
+  return values_[index];
+}
+
+uint64_t Distribution::Percentile(double percentile) const {
+  if (total_ == 0) {
+    return 0;
+  }
+  uint64_t target = static_cast<uint64_t>(ceil(percentile / 100.0 * total_));
+  size_t index = std::lower_bound(cumulative_counts_.begin(), cumulative_counts_.end(), target) -
+                 cumulative_counts_.begin();
+  return values_[std::min(index, values_.size() - 1)];
+}
+
+// Realloc size changes are kept in quarters of a power of two, offset so
+// that they are positive.
+static constexpr int64_t RATIO_STEPS = 4;
+static constexpr int64_t RATIO_OFFSET = 32 * RATIO_STEPS;
+
+void TraceProfile::AddLifetime(size_t size, uint64_t lifetime) {
+  size_t size_class = ActionHistograms::GetSizeClass(size);
+  lifetimes_[size_class].Add(Histogram::GetBucket(lifetime));
+  all_lifetimes_.Add(Histogram::GetBucket(lifetime));
+}
+
+void TraceProfile::AddChainEnd(uint32_t depth, bool realloc, bool cross_thread) {
+  if (realloc) {
+    chain_reallocs_[depth]++;
+  } else {
+    chain_frees_[depth]++;
+  }
+  num_ends_++;
+  if (cross_thread) {
+    cross_thread_ends_++;
+  }
+}
+
+void TraceProfile::Build(const TraceFile& trace) {
+  struct AllocInfo {
+    uint64_t created;
+    uint64_t size;
+    int32_t tid;
+    uint32_t depth;
+    bool live;
+  };
+  std::vector<AllocInfo> allocs(trace.header().num_ids + 1);
+  // The index in thread_counts of the threads alive.
+  std::unordered_map<pid_t, size_t> live_threads;
+  std::vector<uint64_t> thread_counts;
+
+  max_threads_ = trace.header().max_threads;
+  const TraceEntry* entries = trace.entries();
+  for (size_t i = 0; i < trace.num_entries(); i++) {
+    const TraceEntry& entry = entries[i];
+    auto thread = live_threads.find(entry.tid);
+    if (thread == live_threads.end()) {
+      thread = live_threads.emplace(entry.tid, thread_counts.size()).first;
+      thread_counts.push_back(0);
+    }
+    if (entry.type == TRACE_THREAD_DONE) {
+      live_threads.erase(thread);
+      continue;
+    }
+    if (entry.type == TRACE_FREE && entry.id == 0) {
+      // A free of a nullptr doesn't call free().
+      continue;
+    }
+    thread_counts[thread->second]++;
+    num_actions_++;
+
+    uint32_t depth = 0;
+    uint64_t size = entry.size;
+    if (entry.type == TRACE_FREE || (entry.type == TRACE_REALLOC && entry.arg != 0)) {
+      uint64_t old_id = entry.type == TRACE_FREE ? entry.id : entry.arg;
+      AllocInfo& old_alloc = allocs[old_id];
+      AddLifetime(old_alloc.size, i - old_alloc.created);
+      AddChainEnd(old_alloc.depth, entry.type == TRACE_REALLOC, old_alloc.tid != entry.tid);
+      old_alloc.live = false;
+      if (entry.type == TRACE_FREE) {
+        continue;
+      }
+      realloc_sizes_.Add(entry.size);
+      if (old_alloc.size != 0 && entry.size != 0) {
+        double ratio = log2(static_cast<double>(entry.size) / old_alloc.size);
+        int64_t step = llround(ratio * RATIO_STEPS);
+        step = std::max(-RATIO_OFFSET, std::min(RATIO_OFFSET, step));
+        realloc_ratios_.Add(step + RATIO_OFFSET);
+      }
+      depth = std::min<uint32_t>(old_alloc.depth + 1, MAX_CHAIN - 1);
+    } else {
+      if (entry.type == TRACE_CALLOC) {
+        size = entry.arg * entry.size;
+      }
+      alloc_types_.Add(entry.type);
+      sizes_[entry.type].Add(size);
+      if (entry.type == TRACE_MEMALIGN) {
+        alignments_.Add(entry.arg);
+      }
+    }
+    allocs[entry.id] = AllocInfo{i, size, entry.tid, depth, true};
+  }
+
+  for (size_t id = 1; id < allocs.size(); id++) {
+    size_t size_class = ActionHistograms::GetSizeClass(allocs[id].size);
+    num_allocs_[size_class]++;
+    if (allocs[id].live) {
+      never_freed_[size_class]++;
+    }
+  }
+  for (uint64_t count : thread_counts) {
+    if (count != 0) {
+      thread_actions_.Add(count);
+    }
+  }
+
+  alloc_types_.Finalize();
+  for (Distribution& sizes : sizes_) {
+    sizes.Finalize();
+  }
+  alignments_.Finalize();
+  for (Distribution& lifetimes : lifetimes_) {
+    lifetimes.Finalize();
+  }
+  all_lifetimes_.Finalize();
+  realloc_ratios_.Finalize();
+  realloc_sizes_.Finalize();
+  thread_actions_.Finalize();
+}
+
+void TraceProfile::Print(FILE* fp) const {
+  fprintf(fp, "Profile: %" PRIu64 " actions, %" PRIu64 " threads, %u max threads alive\n",
+          num_actions_, thread_actions_.count(), max_threads_);
+  fprintf(fp, "  Actions per thread: p50 %" PRIu64 " p90 %" PRIu64 " max %" PRIu64 "\n",
+          thread_actions_.Percentile(50), thread_actions_.Percentile(90),
+          thread_actions_.Percentile(100));
+  for (uint8_t type : {TRACE_MALLOC, TRACE_CALLOC, TRACE_REALLOC, TRACE_MEMALIGN}) {
+    const Distribution& sizes = sizes_[type];
+    if (sizes.count() == 0) {
+      continue;
+    }
+    fprintf(fp, "  %-8s %5.1f%% of allocations, size p50 %" PRIu64 " p90 %" PRIu64 " p99 %"
+            PRIu64 "\n", Action::GetTypeName(static_cast<ActionType>(type - TRACE_MALLOC)),
+            100.0 * sizes.count() / alloc_types_.count(), sizes.Percentile(50),
+            sizes.Percentile(90), sizes.Percentile(99));
+  }
+  fprintf(fp, "  Lifetime in actions: p50 %" PRIu64 " p90 %" PRIu64 " p99 %" PRIu64 "\n",
+          Histogram::GetBucketMaxValue(all_lifetimes_.Percentile(50)),
+          Histogram::GetBucketMaxValue(all_lifetimes_.Percentile(90)),
+          Histogram::GetBucketMaxValue(all_lifetimes_.Percentile(99)));
+  uint64_t num_allocs = 0;
+  uint64_t never_freed = 0;
+  for (size_t i = 0; i < NUM_SIZE_CLASSES; i++) {
+    num_allocs += num_allocs_[i];
+    never_freed += never_freed_[i];
+  }
+  fprintf(fp, "  Never freed: %0.1f%%, freed by another thread: %0.1f%%\n",
+          num_allocs == 0 ? 0.0 : 100.0 * never_freed / num_allocs,
+          num_ends_ == 0 ? 0.0 : 100.0 * cross_thread_ends_ / num_ends_);
+  fprintf(fp, "  Realloc chains, chance of another realloc at depth:");
+  for (size_t depth = 0; depth < MAX_CHAIN; depth++) {
+    uint64_t ends = chain_reallocs_[depth] + chain_frees_[depth];
+    if (ends != 0) {
+      fprintf(fp, " %zu:%0.1f%%", depth, 100.0 * chain_reallocs_[depth] / ends);
+    }
+  }
+  fprintf(fp, "\n");
+}
+
+// A pending end of an allocation, either a free or a realloc.
+struct AllocEnd {
+  uint64_t due;
+  uint64_t created;
+  uint64_t id;
+  uint64_t size;
+  uint32_t depth;
+  int32_t tid;
+
+  bool operator>(const AllocEnd& other) const {
+    return due != other.due ? due > other.due : id > other.id;
+  }
+};
+
+class TraceSynthesizer {
+ public:
+  TraceSynthesizer(const TraceProfile& profile, const SynthesizeOptions& options, int trace_fd)
+      : profile_(profile), options_(options), random_(options.seed), writer_(trace_fd) {}
+
+  bool Run();
+
+ private:
+  int32_t PickThread();
+  uint64_t SampleLifetime(size_t size);
+  void ScheduleEnd(uint64_t id, uint64_t size, uint32_t depth, int32_t tid);
+  bool Allocate();
+  bool EndAllocation();
+  bool Write(const TraceEntry& entry);
+
+  const TraceProfile& profile_;
+  SynthesizeOptions options_;
+  Random random_;
+  TraceWriter writer_;
+
+  // The cumulative action rates of the threads.
+  std::vector<double> thread_rates_;
+  std::priority_queue<AllocEnd, std::vector<AllocEnd>, std::greater<AllocEnd>> ends_;
+  uint64_t now_ = 0;
+  uint64_t live_allocs_ = 0;
+  uint64_t cross_thread_slack_ = 0;
+  uint64_t num_ends_ = 0;
+  uint64_t cross_thread_ends_ = 0;
+};
+
+int32_t TraceSynthesizer::PickThread() {
+  double target = random_.UniformReal() * thread_rates_.back();
+  size_t index = std::upper_bound(thread_rates_.begin(), thread_rates_.end(), target) -
+                 thread_rates_.begin();
+  return std::min(index, thread_rates_.size() - 1) + 1;
+}
+
+uint64_t TraceSynthesizer::SampleLifetime(size_t size) {
+  const Distribution* lifetimes = &profile_.lifetimes_[ActionHistograms::GetSizeClass(size)];
+  if (lifetimes->count() == 0) {
+    lifetimes = &profile_.all_lifetimes_;
+  }
+  // Pick a value in the bucket.
+  size_t bucket = lifetimes->Sample(&random_);
+  uint64_t min = bucket == 0 ? 0 : Histogram::GetBucketMaxValue(bucket - 1) + 1;
+  uint64_t max = Histogram::GetBucketMaxValue(bucket);
+  if (bucket == Histogram::NUM_BUCKETS - 1) {
+    max = min * 2;
+  }
+  return std::max<uint64_t>(1, min + random_.Uniform(max - min + 1));
+}
+
+void TraceSynthesizer::ScheduleEnd(uint64_t id, uint64_t size, uint32_t depth, int32_t tid) {
+  size_t size_class = ActionHistograms::GetSizeClass(size);
+  uint64_t num_allocs = profile_.num_allocs_[size_class];
+  if (num_allocs != 0 && random_.Uniform(num_allocs) < profile_.never_freed_[size_class]) {
+    return;
+  }
+  ends_.push(AllocEnd{now_ + SampleLifetime(size), now_, id, size, depth, tid});
+}
+
+bool TraceSynthesizer::Write(const TraceEntry& entry) {
+  now_++;
+  return writer_.Write(entry);
+}
+
+bool TraceSynthesizer::Allocate() {
+  TraceEntry entry = {};
+  entry.type = profile_.alloc_types_.Sample(&random_);
+  entry.tid = PickThread();
+  entry.id = ++writer_.header()->num_ids;
+  uint64_t size = profile_.sizes_[entry.type].Sample(&random_);
+  entry.size = size;
+  if (entry.type == TRACE_CALLOC) {
+    entry.arg = 1;
+  } else if (entry.type == TRACE_MEMALIGN) {
+    entry.arg = profile_.alignments_.Sample(&random_);
+  }
+  if (++live_allocs_ > writer_.header()->max_allocs) {
+    writer_.header()->max_allocs = live_allocs_;
+  }
+  ScheduleEnd(entry.id, size, 0, entry.tid);
+  return Write(entry);
+}
+
+bool TraceSynthesizer::EndAllocation() {
+  AllocEnd end = ends_.top();
+  ends_.pop();
+
+  TraceEntry entry = {};
+  entry.tid = end.tid;
+  // A free of a recent allocation by another thread makes it wait until the
+  // allocating thread catches up, so only old enough allocations are freed
+  // by other threads. They are picked more often to keep the share of cross
+  // thread ends of the profile, as far as there are enough of them.
+  num_ends_++;
+  size_t num_threads = thread_rates_.size();
+  if (num_threads > 1 && now_ - end.created >= cross_thread_slack_ &&
+      cross_thread_ends_ * profile_.num_ends_ < profile_.cross_thread_ends_ * num_ends_) {
+    // Any thread but the one that made the allocation.
+    entry.tid = random_.Uniform(num_threads - 1) + 1;
+    if (entry.tid >= end.tid) {
+      entry.tid++;
+    }
+    cross_thread_ends_++;
+  }
+
+  uint64_t reallocs = profile_.chain_reallocs_[end.depth];
+  uint64_t ends = reallocs + profile_.chain_frees_[end.depth];
+  if (ends == 0 || random_.Uniform(ends) >= reallocs) {
+    entry.type = TRACE_FREE;
+    entry.id = end.id;
+    entry.size = end.size;
+    live_allocs_--;
+    return Write(entry);
+  }
+
+  uint64_t size = 0;
+  if (end.size != 0 && profile_.realloc_ratios_.count() != 0) {
+    // Spread the size over the quarter of a power of two of the step.
+    int64_t step = static_cast<int64_t>(profile_.realloc_ratios_.Sample(&random_)) - RATIO_OFFSET;
+    double ratio = exp2((step - 0.5 + random_.UniformReal()) / RATIO_STEPS);
+    size = std::max<uint64_t>(1, llround(end.size * ratio));
+  }
+  if (size == 0 || size > profile_.realloc_sizes_.Percentile(100)) {
+    size = profile_.realloc_sizes_.Sample(&random_);
+  }
+  entry.type = TRACE_REALLOC;
+  entry.id = ++writer_.header()->num_ids;
+  entry.arg = end.id;
+  entry.size = size;
+  uint32_t depth = std::min<uint32_t>(end.depth + 1, TraceProfile::MAX_CHAIN - 1);
+  ScheduleEnd(entry.id, size, depth, entry.tid);
+  return Write(entry);
+}
+
+bool TraceSynthesizer::Run() {
+  if (profile_.alloc_types_.count() == 0) {
+    fprintf(stderr, "The profiled trace has no allocations.\n");
+    return false;
+  }
+  size_t num_threads = options_.num_threads;
+  if (num_threads == 0) {
+    num_threads = std::max<size_t>(1, profile_.max_threads_);
+  }
+  uint64_t num_actions = options_.num_actions;
+  if (num_actions == 0) {
+    num_actions = profile_.num_actions_;
+  }
+
+  // Every thread gets the rate of a random thread of the profiled trace, or
+  // the same rate. Skewed rates leave most threads waiting for the busiest
+  // ones in a parallel replay.
+  double total = 0;
+  for (size_t i = 0; i < num_threads; i++) {
+    total += options_.profile_thread_rates ? profile_.thread_actions_.Sample(&random_) : 1;
+    thread_rates_.push_back(total);
+  }
+  cross_thread_slack_ = options_.cross_thread_slack * num_threads;
+
+  if (!writer_.Start()) {
+    return false;
+  }
+  writer_.header()->max_threads = num_threads;
+  while (now_ < num_actions) {
+    bool success = !ends_.empty() && ends_.top().due <= now_ ? EndAllocation() : Allocate();
+    if (!success) {
+      return false;
+    }
+  }
+  // The slack, or a single thread, can keep the share of cross thread ends
+  // below the one of the profile.
+  if (num_ends_ != 0 && profile_.num_ends_ != 0) {
+    double share = 100.0 * cross_thread_ends_ / num_ends_;
+    double profile_share = 100.0 * profile_.cross_thread_ends_ / profile_.num_ends_;
+    if (share < 0.9 * profile_share) {
+      fprintf(stderr, "Warning: %0.1f%% of the allocations are freed by another thread, %0.1f%% "
+              "in the profile.\n", share, profile_share);
+    }
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    TraceEntry entry = {};
+    entry.type = TRACE_THREAD_DONE;
+    entry.tid = i + 1;
+    if (!Write(entry)) {
+      return false;
+    }
+  }
+  return writer_.Finish();
+}
+
+bool SynthesizeTrace(const TraceProfile& profile, const SynthesizeOptions& options,
+                     int trace_fd) {
+  TraceSynthesizer synthesizer(profile, options, trace_fd);
+  return synthesizer.Run();
+}
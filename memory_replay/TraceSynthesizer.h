@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEMORY_REPLAY_TRACE_SYNTHESIZER_H
+#define _MEMORY_REPLAY_TRACE_SYNTHESIZER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <map>
+#include <random>
+#include <vector>
+
+#include "Histogram.h"
+#include "TraceFile.h"
+
+// A deterministic random number generator. The distributions of the
+// standard library are implementation defined, so the same seed could
+// give different traces on device and on host.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : engine_(seed) {}
+
+  // Returns a value in [0, n).
+  uint64_t Uniform(uint64_t n) { return engine_() % n; }
+  // Returns a value in [0, 1).
+  double UniformReal() { return (engine_() >> 11) * (1.0 / (1ULL << 53)); }
+
+ private:
+  std::mt19937_64 engine_;
+};
+
+// An empirical distribution of values.
+class Distribution {
+ public:
+  void Add(uint64_t value, uint64_t count = 1);
+  // Must be called after the last Add() and before sampling.
+  void Finalize();
+
+  uint64_t Sample(Random* random) const;
+  uint64_t Percentile(double percentile) const;
+  uint64_t count() const { return total_; }
+
+ private:
+  std::map<uint64_t, uint64_t> counts_;
+  std::vector<uint64_t> values_;
+  // The number of samples with a value less than or equal to values_[i].
+  std::vector<uint64_t> cumulative_counts_;
+  uint64_t total_ = 0;
+};
+
+// The statistics of a trace used to synthesize traces that behave like it.
+// Lifetimes are counted in actions of the whole trace, from the action
+// that creates an allocation to the free or realloc that ends it.
+class TraceProfile {
+ public:
+  void Build(const TraceFile& trace);
+  void Print(FILE* fp) const;
+
+  // Realloc chains longer than this are counted as this long.
+  static constexpr size_t MAX_CHAIN = 8;
+
+ private:
+  void AddLifetime(size_t size, uint64_t lifetime);
+  void AddChainEnd(uint32_t depth, bool realloc, bool cross_thread);
+
+  uint64_t num_actions_ = 0;
+  uint32_t max_threads_ = 0;
+
+  // The type and size of allocations that don't come from a realloc of an
+  // existing allocation, indexed by trace type.
+  Distribution alloc_types_;
+  Distribution sizes_[TRACE_MEMALIGN + 1];
+  Distribution alignments_;
+
+  // Lifetimes are stored as log-linear buckets, per size class.
+  Distribution lifetimes_[NUM_SIZE_CLASSES];
+  Distribution all_lifetimes_;
+  uint64_t num_allocs_[NUM_SIZE_CLASSES] = {};
+  uint64_t never_freed_[NUM_SIZE_CLASSES] = {};
+
+  // How often an allocation at each depth of a realloc chain is ended by
+  // another realloc instead of a free, and by how much the size changes,
+  // in quarters of a power of two. The new sizes bound the sizes of
+  // synthesized chains, which would otherwise grow without limit.
+  uint64_t chain_reallocs_[MAX_CHAIN] = {};
+  uint64_t chain_frees_[MAX_CHAIN] = {};
+  Distribution realloc_ratios_;
+  Distribution realloc_sizes_;
+
+  uint64_t cross_thread_ends_ = 0;
+  uint64_t num_ends_ = 0;
+
+  // The number of actions of every thread in the trace.
+  Distribution thread_actions_;
+
+  friend class TraceSynthesizer;
+};
+
+struct SynthesizeOptions {
+  // Zero uses the value of the profiled trace.
+  size_t num_threads = 0;
+  uint64_t num_actions = 0;
+  uint64_t seed = 1;
+  // Give threads the skewed action rates of the profiled trace. Spreading the
+  // actions evenly over the threads instead lets more threads run at the
+  // same time in a parallel replay.
+  bool profile_thread_rates = true;
+  // A thread only frees allocations of another thread that were made at
+  // least this many actions per thread earlier, so threads rarely have to
+  // wait for each other in a parallel replay. Fewer allocations are then
+  // freed by another thread than in the profile.
+  uint64_t cross_thread_slack = 0;
+};
+
+// Writes a compiled trace following the profile to trace_fd. The same
+// profile, options and seed always produce the same trace.
+bool SynthesizeTrace(const TraceProfile& profile, const SynthesizeOptions& options,
+                     int trace_fd);
+
+#endif // _MEMORY_REPLAY_TRACE_SYNTHESIZER_H
@@ -17,59 +17,114 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+
 #include "Action.h"
-#include "LineBuffer.h"
+#include "Allocator.h"
+#include "Histogram.h"
+#include "MemoryToucher.h"
+#include "MemorySampler.h"
 #include "NativeInfo.h"
+#include "ParallelReplay.h"
 #include "Pointers.h"
 #include "Thread.h"
 #include "Threads.h"
+#include "TraceFile.h"
+#include "TraceSynthesizer.h"
+#include "Utils.h"
 
-static char g_buffer[65535];
-
-size_t GetMaxAllocs(int fd) {
-  lseek(fd, 0, SEEK_SET);
-  LineBuffer line_buf(fd, g_buffer, sizeof(g_buffer));
-  char* line;
-  size_t line_len;
-  size_t num_allocs = 0;
-  while (line_buf.GetLine(&line, &line_len)) {
-    char* word = reinterpret_cast<char*>(memchr(line, ':', line_len));
-    if (word == nullptr) {
-      continue;
-    }
+struct ReplayOptions {
+  bool parallel = false;
+  size_t max_threads = 0;
+  const char* latency_csv_file = nullptr;
+  const char* latency_json_file = nullptr;
+  // Zero disables sampling the memory during the replay.
+  uint64_t sample_interval_nsecs = 100000000;
+  const char* memory_csv_file = nullptr;
+  TouchOptions touch;
+  // The allocators to compare, each replayed in its own process.
+  std::vector<const char*> allocators;
+};
 
-    word++;
-    while (*word++ == ' ');
-    // This will treat a realloc as an allocation, even if it frees
-    // another allocation. Since reallocs are relatively rare, this
-    // shouldn't inflate the numbers that much.
-    if (*word == 'f') {
-      // Check if this is a free of zero.
-      uintptr_t pointer;
-      if (sscanf(word, "free %" SCNxPTR, &pointer) == 1 && pointer != 0) {
-        num_allocs--;
-      }
-    } else if (*word != 't') {
-      // Skip the thread_done message.
-      num_allocs++;
-    }
+// The results of a replay, compared between allocators.
+struct ReplayResult {
+  uint64_t alloc_time_nsecs = 0;
+  uint64_t wall_time_nsecs = 0;
+  size_t peak_rss_bytes = 0;
+  size_t final_pss_bytes = 0;
+  // The anonymous memory added by the replay while the allocations left at
+  // the end of the trace are still alive.
+  size_t heap_bytes = 0;
+  uint64_t minor_faults = 0;
+  uint64_t major_faults = 0;
+};
+
+static void GetStartMemory(ProcessMemory* memory) {
+  if (!GetProcessMemory(memory)) {
+    fprintf(stderr, "Failed to read process memory: %s\n", strerror(errno));
+  }
+}
+
+static void GetEndMemory(const ProcessMemory& start, ReplayResult* result) {
+  ProcessMemory end;
+  if (GetProcessMemory(&end)) {
+    result->final_pss_bytes = end.pss_bytes;
+    result->heap_bytes = end.anon_bytes > start.anon_bytes ? end.anon_bytes - start.anon_bytes : 0;
+  }
+}
+
+static bool ReportLatencies(const ActionHistograms& histograms, const ReplayOptions& options) {
+  printf("\n");
+  histograms.Print(stdout);
+  if (options.latency_csv_file != nullptr && !histograms.WriteCsv(options.latency_csv_file)) {
+    return false;
+  }
+  if (options.latency_json_file != nullptr && !histograms.WriteJson(options.latency_json_file)) {
+    return false;
+  }
+  return true;
+}
+
+// The number of sample rows printed, the full series can be written to a
+// csv file.
+constexpr size_t MAX_PRINTED_SAMPLES = 20;
+
+static void ReportTouchStats(const TouchStats& stats, const ReplayOptions& options) {
+  if (options.touch.count_faults) {
+    printf("\nMemory touching, %0.0f%% written%s:\n", options.touch.write_fraction * 100,
+           options.touch.read_before_free ? ", read before free" : "");
+    stats.Print(stdout);
   }
-  return num_allocs;
 }
 
-void ProcessDump(int fd, size_t max_allocs, size_t max_threads) {
-  lseek(fd, 0, SEEK_SET);
+static bool ReportMemorySamples(const MemorySampler& sampler, const ReplayOptions& options) {
+  printf("\nMemory over time:\n");
+  sampler.Print(stdout, MAX_PRINTED_SAMPLES);
+  return options.memory_csv_file == nullptr || sampler.WriteCsv(options.memory_csv_file);
+}
+
+bool ProcessTrace(const TraceFile& trace, const ReplayOptions& options, Allocator* allocator,
+                  ReplayResult* result) {
+  size_t max_allocs = trace.header().max_allocs;
   Pointers pointers(max_allocs);
-  Threads threads(&pointers, max_threads);
+  Threads threads(&pointers, options.max_threads, allocator, options.touch);
 
   printf("Maximum threads available:   %zu\n", threads.max_threads());
   printf("Maximum allocations in dump: %zu\n", max_allocs);
@@ -78,40 +133,31 @@ void ProcessDump(int fd, size_t max_allocs, size_t max_threads) {
 
   PrintNativeInfo("Initial ");
 
-  LineBuffer line_buf(fd, g_buffer, sizeof(g_buffer));
-  char* line;
-  size_t line_len;
-  size_t line_number = 0;
-  while (line_buf.GetLine(&line, &line_len)) {
-    pid_t tid;
-    int line_pos = 0;
-    char type[128];
-    uintptr_t key_pointer;
-
-    // Every line is of this format:
-    //   <tid>: <action_type> <pointer>
-    // Some actions have extra arguments which will be used and verified
-    // when creating the Action object.
-    if (sscanf(line, "%d: %s %" SCNxPTR " %n", &tid, type, &key_pointer, &line_pos) != 3) {
-      err(1, "Unparseable line found: %s\n", line);
-    }
-    line_number++;
-    if ((line_number % 100000) == 0) {
-      printf("  At line %zu:\n", line_number);
-      PrintNativeInfo("    ");
-    }
-    Thread* thread = threads.FindThread(tid);
+  ProcessMemory start_memory;
+  GetStartMemory(&start_memory);
+  std::atomic<uint64_t> num_actions(0);
+  MemorySampler sampler(&num_actions, options.sample_interval_nsecs);
+  if (options.sample_interval_nsecs != 0 && !sampler.Start()) {
+    return false;
+  }
+  uint64_t start_nsecs = Nanotime();
+  const TraceEntry* entries = trace.entries();
+  size_t num_entries = trace.num_entries();
+  for (size_t i = 0; i < num_entries; i++) {
+    const TraceEntry& entry = entries[i];
+    num_actions.store(i, std::memory_order_relaxed);
+    Thread* thread = threads.FindThread(entry.tid);
     if (thread == nullptr) {
-      thread = threads.CreateThread(tid);
+      thread = threads.CreateThread(entry.tid);
     }
 
     // Wait for the thread to complete any previous actions before handling
     // the next action.
     thread->WaitForReady();
 
-    Action* action = thread->CreateAction(key_pointer, type, line + line_pos);
+    Action* action = thread->CreateAction(entry);
     if (action == nullptr) {
-      err(1, "Cannot create action from line: %s\n", line);
+      err(1, "Cannot create action from entry %zu: unknown type %u\n", i, entry.type);
     }
 
     bool does_free = action->DoesFree();
@@ -139,6 +185,10 @@ void ProcessDump(int fd, size_t max_allocs, size_t max_threads) {
   }
   // Wait for all threads to stop processing actions.
   threads.WaitForAllToQuiesce();
+  result->wall_time_nsecs = Nanotime() - start_nsecs;
+  num_actions.store(num_entries, std::memory_order_relaxed);
+  sampler.Stop();
+  GetEndMemory(start_memory, result);
 
   PrintNativeInfo("Final ");
 
@@ -146,46 +196,459 @@ void ProcessDump(int fd, size_t max_allocs, size_t max_threads) {
   // This allows us to run a tool like valgrind to verify that no memory
   // is leaked and everything is accounted for during a run.
   threads.FinishAll();
-  pointers.FreeAll();
+  pointers.FreeAll(allocator);
+  result->alloc_time_nsecs = threads.total_time_nsecs();
 
   // Print out the total time making all allocation calls.
   printf("Total Allocation/Free Time: %" PRIu64 "ns %0.2fs\n",
          threads.total_time_nsecs(), threads.total_time_nsecs()/1000000000.0);
+  ReportTouchStats(threads.touch_stats(), options);
+  if (options.sample_interval_nsecs != 0 && !ReportMemorySamples(sampler, options)) {
+    return false;
+  }
+  return ReportLatencies(threads.histograms(), options);
+}
+
+bool ProcessTraceParallel(const TraceFile& trace, const ReplayOptions& options,
+                          Allocator* allocator, ReplayResult* result) {
+  Pointers pointers(ParallelReplay::GetMaxAllocs(trace));
+  ParallelReplay replay(trace, &pointers, allocator, options.touch);
+
+  printf("Threads in dump:             %zu\n", replay.num_threads());
+  printf("Concurrency of dump:         %0.2f\n", ParallelReplay::GetTraceConcurrency(trace));
+  printf("Maximum allocations in dump: %" PRIu64 "\n", trace.header().max_allocs);
+  printf("Total pointers available:    %zu\n", pointers.max_pointers());
+  printf("\n");
+
+  PrintNativeInfo("Initial ");
+  ProcessMemory start_memory;
+  GetStartMemory(&start_memory);
+  MemorySampler sampler(replay.num_actions(), options.sample_interval_nsecs);
+  if (options.sample_interval_nsecs != 0 && !sampler.Start()) {
+    return false;
+  }
+  replay.Run();
+  sampler.Stop();
+  GetEndMemory(start_memory, result);
+  PrintNativeInfo("Final ");
+
+  // Free any outstanding pointers.
+  pointers.FreeAll(allocator);
+  result->alloc_time_nsecs = replay.total_time_nsecs();
+  result->wall_time_nsecs = replay.wall_time_nsecs();
+
+  printf("Total Allocation/Free Time: %" PRIu64 "ns %0.2fs\n",
+         replay.total_time_nsecs(), replay.total_time_nsecs()/1000000000.0);
+  printf("Replay Wall Time: %" PRIu64 "ns %0.2fs\n",
+         replay.wall_time_nsecs(), replay.wall_time_nsecs()/1000000000.0);
+  printf("Dependency Waits: %" PRIu64 " waits %0.2fs\n",
+         replay.num_waits(), replay.wait_time_nsecs()/1000000000.0);
+  printf("Achieved Concurrency: %0.2f average %zu max\n",
+         replay.concurrency(), replay.max_concurrency());
+  printf("Replay Threads Alive: %zu max\n", replay.max_live_threads());
+  ReportTouchStats(replay.touch_stats(), options);
+  if (options.sample_interval_nsecs != 0 && !ReportMemorySamples(sampler, options)) {
+    return false;
+  }
+  return ReportLatencies(replay.histograms(), options);
+}
+
+static bool Replay(const TraceFile& trace, const ReplayOptions& options, Allocator* allocator,
+                   ReplayResult* result) {
+  struct rusage start_usage = {};
+  getrusage(RUSAGE_SELF, &start_usage);
+  bool success;
+  if (options.parallel) {
+    success = ProcessTraceParallel(trace, options, allocator, result);
+  } else {
+    success = ProcessTrace(trace, options, allocator, result);
+  }
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    result->peak_rss_bytes = usage.ru_maxrss * 1024;
+    result->minor_faults = usage.ru_minflt - start_usage.ru_minflt;
+    result->major_faults = usage.ru_majflt - start_usage.ru_majflt;
+  }
+  return success;
+}
+
+// Replay in a child process, so that every allocator starts from the same
+// state and its peak RSS isn't affected by the other allocators.
+static bool ReplayInChild(const TraceFile& trace, const ReplayOptions& options,
+                          const char* allocator_name, ReplayResult* result) {
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+    fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+    return false;
+  }
+  android::base::unique_fd read_fd(pipe_fds[0]);
+  android::base::unique_fd write_fd(pipe_fds[1]);
+
+  printf("\nAllocator: %s\n", allocator_name);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+    return false;
+  }
+  if (pid == 0) {
+    read_fd.reset();
+    Allocator* allocator = Allocator::Create(allocator_name);
+    if (allocator == nullptr) {
+      _exit(1);
+    }
+    bool success = Replay(trace, options, allocator, result);
+    fflush(stdout);
+    _exit(success && android::base::WriteFully(write_fd, result, sizeof(*result)) ? 0 : 1);
+  }
+  write_fd.reset();
+
+  int status;
+  if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) == -1) {
+    fprintf(stderr, "Failed to wait for replay: %s\n", strerror(errno));
+    return false;
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "Replay with allocator %s failed.\n", allocator_name);
+    return false;
+  }
+  return android::base::ReadFully(read_fd, result, sizeof(*result));
+}
+
+// Returns the bytes still allocated at the end of the trace.
+static size_t GetLiveBytes(const TraceFile& trace) {
+  std::vector<size_t> sizes(trace.header().num_ids + 1);
+  size_t live_bytes = 0;
+  const TraceEntry* entries = trace.entries();
+  for (size_t i = 0; i < trace.num_entries(); i++) {
+    const TraceEntry& entry = entries[i];
+    switch (entry.type) {
+      case TRACE_REALLOC:
+        live_bytes -= sizes[entry.arg];
+        sizes[entry.arg] = 0;
+        [[fallthrough]];
+      case TRACE_MALLOC:
+      case TRACE_MEMALIGN:
+        sizes[entry.id] = entry.size;
+        live_bytes += entry.size;
+        break;
+      case TRACE_CALLOC:
+        sizes[entry.id] = entry.arg * entry.size;
+        live_bytes += sizes[entry.id];
+        break;
+      case TRACE_FREE:
+        live_bytes -= sizes[entry.id];
+        sizes[entry.id] = 0;
+        break;
+    }
+  }
+  return live_bytes;
+}
+
+static int CompareAllocators(const TraceFile& trace, const ReplayOptions& options) {
+  std::vector<ReplayResult> results(options.allocators.size());
+  for (size_t i = 0; i < options.allocators.size(); i++) {
+    if (!ReplayInChild(trace, options, options.allocators[i], &results[i])) {
+      return 1;
+    }
+  }
+
+  // Frag is the part of the heap bytes not used by live allocations.
+  size_t live_bytes = GetLiveBytes(trace);
+  printf("\n%-20s %11s %11s %11s %11s %11s %11s %6s %11s\n", "Allocator", "Alloc Time",
+         "Wall Time", "Peak RSS", "Final PSS", "Heap Bytes", "Live Bytes", "Frag", "Faults");
+  for (size_t i = 0; i < options.allocators.size(); i++) {
+    const ReplayResult& result = results[i];
+    double frag = 0;
+    if (result.heap_bytes > live_bytes) {
+      frag = 100.0 * (result.heap_bytes - live_bytes) / result.heap_bytes;
+    }
+    printf("%-20s %10.3fs %10.3fs %9.2fMB %9.2fMB %9.2fMB %9.2fMB %5.1f%% %11" PRIu64 "\n",
+           options.allocators[i], result.alloc_time_nsecs / 1000000000.0,
+           result.wall_time_nsecs / 1000000000.0, result.peak_rss_bytes / (1024 * 1024.0),
+           result.final_pss_bytes / (1024 * 1024.0), result.heap_bytes / (1024 * 1024.0),
+           live_bytes / (1024 * 1024.0), frag, result.minor_faults + result.major_faults);
+  }
+  return 0;
 }
 
 constexpr size_t DEFAULT_MAX_THREADS = 512;
 
+static void Usage(const char* name) {
+  fprintf(stderr, "Usage: %s [OPTIONS] MEMORY_LOG_FILE [MAX_THREADS]\n", name);
+  fprintf(stderr, "       %s --compile MEMORY_LOG_FILE TRACE_FILE\n", name);
+  fprintf(stderr, "       %s --synthesize [--threads N] [--actions N] [--seed N]\n", name);
+  fprintf(stderr, "           [--even-thread-rates] [--cross-thread-slack N]\n");
+  fprintf(stderr, "           MEMORY_LOG_FILE TRACE_FILE\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "MEMORY_LOG_FILE can be a text dump or a trace compiled with --compile.\n");
+  fprintf(stderr, "Replaying a compiled trace skips all parsing of the text dump.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "  --allocator NAME     Replay with the allocator NAME, which is libc, bump\n");
+  fprintf(stderr, "                       (a pointer bump baseline that never reuses memory)\n");
+  fprintf(stderr, "                       or LIB[:PREFIX] to use the PREFIXmalloc functions\n");
+  fprintf(stderr, "                       of the shared library LIB. Can be repeated to\n");
+  fprintf(stderr, "                       compare the time, RSS and fragmentation of\n");
+  fprintf(stderr, "                       several allocators, each in its own process.\n");
+  fprintf(stderr, "  --latency-csv FILE   Write the latency percentiles of each action type\n");
+  fprintf(stderr, "                       and size class to FILE in csv format.\n");
+  fprintf(stderr, "  --latency-json FILE  Same as --latency-csv, but in json format.\n");
+  fprintf(stderr, "  --memory-csv FILE    Write the memory samples taken during the replay\n");
+  fprintf(stderr, "                       to FILE in csv format.\n");
+  fprintf(stderr, "  --parallel           Run the actions of every thread independently, only\n");
+  fprintf(stderr, "                       waiting for frees of allocations made by other\n");
+  fprintf(stderr, "                       threads, instead of dispatching all actions from\n");
+  fprintf(stderr, "                       one thread.\n");
+  fprintf(stderr, "  --read-before-free   Read every cache line of the written part of an\n");
+  fprintf(stderr, "                       allocation before freeing it.\n");
+  fprintf(stderr, "  --sample-interval MS\n");
+  fprintf(stderr, "                       Sample the RSS and PSS of the process every MS\n");
+  fprintf(stderr, "                       milliseconds from a low priority thread, default\n");
+  fprintf(stderr, "                       100. Zero disables sampling.\n");
+  fprintf(stderr, "  --touch FRACTION     Write FRACTION, between 0 and 1, of every allocation\n");
+  fprintf(stderr, "                       instead of all of it. With this option or\n");
+  fprintf(stderr, "                       --read-before-free, the time and page faults of\n");
+  fprintf(stderr, "                       allocating, writing, reading and freeing are\n");
+  fprintf(stderr, "                       reported separately.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "--synthesize writes a compiled trace with the same size, lifetime, realloc\n");
+  fprintf(stderr, "and thread statistics as MEMORY_LOG_FILE. Lifetimes are measured in\n");
+  fprintf(stderr, "actions, not in time.\n");
+  fprintf(stderr, "  --threads N          Spread the actions over N threads, default the\n");
+  fprintf(stderr, "                       maximum number of threads of MEMORY_LOG_FILE.\n");
+  fprintf(stderr, "  --actions N          Write N actions, default the number of actions of\n");
+  fprintf(stderr, "                       MEMORY_LOG_FILE.\n");
+  fprintf(stderr, "  --seed N             The seed of the random generator, default 1. The\n");
+  fprintf(stderr, "                       same seed always gives the same trace.\n");
+  fprintf(stderr, "  --even-thread-rates  Give every thread the same number of actions,\n");
+  fprintf(stderr, "                       instead of the number of actions of a random\n");
+  fprintf(stderr, "                       thread of MEMORY_LOG_FILE. The busiest threads\n");
+  fprintf(stderr, "                       otherwise limit how many threads run at the same\n");
+  fprintf(stderr, "                       time in a --parallel replay.\n");
+  fprintf(stderr, "  --cross-thread-slack N\n");
+  fprintf(stderr, "                       Only free allocations in another thread than the\n");
+  fprintf(stderr, "                       one that made them once they are N actions per\n");
+  fprintf(stderr, "                       thread old, default 0. Higher values, like 1024,\n");
+  fprintf(stderr, "                       make threads wait for each other less often in a\n");
+  fprintf(stderr, "                       --parallel replay, but drop some of the cross\n");
+  fprintf(stderr, "                       thread frees of MEMORY_LOG_FILE.\n");
+}
+
+static int Compile(const char* dump_file, const char* trace_file) {
+  android::base::unique_fd dump_fd(open(dump_file, O_RDONLY | O_CLOEXEC));
+  if (dump_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", dump_file, strerror(errno));
+    return 1;
+  }
+  android::base::unique_fd trace_fd(
+      open(trace_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (trace_fd == -1) {
+    fprintf(stderr, "Failed to create %s: %s\n", trace_file, strerror(errno));
+    return 1;
+  }
+  if (!CompileTrace(dump_fd, trace_fd)) {
+    unlink(trace_file);
+    return 1;
+  }
+  return 0;
+}
+
+// Compile in a child process so that the memory used by the compiler does
+// not show up in the native heap of the replay.
+static bool CompileInChild(int dump_fd, int trace_fd) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+    return false;
+  }
+  if (pid == 0) {
+    _exit(CompileTrace(dump_fd, trace_fd) ? 0 : 1);
+  }
+  int status;
+  if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) == -1) {
+    fprintf(stderr, "Failed to wait for compile: %s\n", strerror(errno));
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Opens a compiled trace, or compiles a text dump into a temporary file
+// first. This also computes the maximum number of allocations alive at one
+// time to allow a single mmap that can hold all of the pointers needed at
+// once.
+static bool LoadTrace(const char* dump_file, TraceFile* trace) {
+  android::base::unique_fd dump_fd(open(dump_file, O_RDONLY | O_CLOEXEC));
+  if (dump_fd == -1) {
+    fprintf(stderr, "Failed to open %s: %s\n", dump_file, strerror(errno));
+    return false;
+  }
+  if (TraceFile::IsTraceFile(dump_fd)) {
+    return trace->Open(dump_fd);
+  }
+  FILE* tmp = tmpfile();
+  if (tmp == nullptr) {
+    fprintf(stderr, "Failed to create temporary trace file: %s\n", strerror(errno));
+    return false;
+  }
+  bool compiled = CompileInChild(dump_fd, fileno(tmp)) && trace->Open(fileno(tmp));
+  fclose(tmp);
+  return compiled;
+}
+
+static int Synthesize(const char* dump_file, const char* trace_file,
+                      const SynthesizeOptions& synthesize_options) {
+  TraceProfile profile;
+  {
+    TraceFile trace;
+    if (!LoadTrace(dump_file, &trace)) {
+      return 1;
+    }
+    profile.Build(trace);
+  }
+  profile.Print(stdout);
+
+  android::base::unique_fd trace_fd(
+      open(trace_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (trace_fd == -1) {
+    fprintf(stderr, "Failed to create %s: %s\n", trace_file, strerror(errno));
+    return 1;
+  }
+  if (!SynthesizeTrace(profile, synthesize_options, trace_fd)) {
+    unlink(trace_file);
+    return 1;
+  }
+  return 0;
+}
+
 int main(int argc, char** argv) {
-  if (argc != 2 && argc != 3) {
-    if (argc > 3) {
+  const char* name = basename(argv[0]);
+  bool compile = false;
+  bool synthesize = false;
+  ReplayOptions replay_options;
+  SynthesizeOptions synthesize_options;
+  static const option options[] = {
+    {"allocator", required_argument, nullptr, 'a'},
+    {"compile", no_argument, nullptr, 'c'},
+    {"latency-csv", required_argument, nullptr, 'C'},
+    {"latency-json", required_argument, nullptr, 'J'},
+    {"memory-csv", required_argument, nullptr, 'M'},
+    {"parallel", no_argument, nullptr, 'p'},
+    {"read-before-free", no_argument, nullptr, 'R'},
+    {"sample-interval", required_argument, nullptr, 'I'},
+    {"synthesize", no_argument, nullptr, 's'},
+    {"touch", required_argument, nullptr, 'T'},
+    {"threads", required_argument, nullptr, 't'},
+    {"actions", required_argument, nullptr, 'n'},
+    {"seed", required_argument, nullptr, 'S'},
+    {"even-thread-rates", no_argument, nullptr, 'E'},
+    {"cross-thread-slack", required_argument, nullptr, 'X'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, 0, nullptr, 0},
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", options, nullptr)) != -1) {
+    switch (opt) {
+      case 'a':
+        replay_options.allocators.push_back(optarg);
+        break;
+      case 'c':
+        compile = true;
+        break;
+      case 'C':
+        replay_options.latency_csv_file = optarg;
+        break;
+      case 'J':
+        replay_options.latency_json_file = optarg;
+        break;
+      case 'M':
+        replay_options.memory_csv_file = optarg;
+        break;
+      case 'p':
+        replay_options.parallel = true;
+        break;
+      case 'R':
+        replay_options.touch.read_before_free = true;
+        replay_options.touch.count_faults = true;
+        break;
+      case 'T':
+        replay_options.touch.write_fraction = strtod(optarg, nullptr);
+        if (replay_options.touch.write_fraction < 0 || replay_options.touch.write_fraction > 1) {
+          fprintf(stderr, "The touch fraction must be between 0 and 1.\n");
+          return 1;
+        }
+        replay_options.touch.count_faults = true;
+        break;
+      case 'I':
+        replay_options.sample_interval_nsecs = strtoull(optarg, nullptr, 10) * 1000000;
+        break;
+      case 's':
+        synthesize = true;
+        break;
+      case 't':
+        synthesize_options.num_threads = strtoul(optarg, nullptr, 10);
+        break;
+      case 'n':
+        synthesize_options.num_actions = strtoull(optarg, nullptr, 10);
+        break;
+      case 'S':
+        synthesize_options.seed = strtoull(optarg, nullptr, 10);
+        break;
+      case 'E':
+        synthesize_options.profile_thread_rates = false;
+        break;
+      case 'X':
+        synthesize_options.cross_thread_slack = strtoull(optarg, nullptr, 10);
+        break;
+      default:
+        Usage(name);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+
+  if (compile) {
+    if (argc != 2) {
+      Usage(name);
+      return 1;
+    }
+    return Compile(argv[0], argv[1]);
+  }
+  if (synthesize) {
+    if (argc != 2) {
+      Usage(name);
+      return 1;
+    }
+    return Synthesize(argv[0], argv[1], synthesize_options);
+  }
+  if (argc != 1 && argc != 2) {
+    if (argc > 2) {
       fprintf(stderr, "Only two arguments are expected.\n");
     } else {
       fprintf(stderr, "Requires at least one argument.\n");
     }
-    fprintf(stderr, "Usage: %s MEMORY_LOG_FILE [MAX_THREADS]\n", basename(argv[0]));
+    Usage(name);
     return 1;
   }
 
-  size_t max_threads = DEFAULT_MAX_THREADS;
-  if (argc == 3) {
-    max_threads = atoi(argv[2]);
-  }
+  printf("Processing: %s\n", argv[0]);
 
-  int dump_fd = open(argv[1], O_RDONLY);
-  if (dump_fd == -1) {
-    fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
+  TraceFile trace;
+  if (!LoadTrace(argv[0], &trace)) {
     return 1;
   }
 
-  printf("Processing: %s\n", argv[1]);
-
-  // Do a first pass to get the total number of allocations used at one
-  // time to allow a single mmap that can hold the maximum number of
-  // pointers needed at once.
-  size_t max_allocs = GetMaxAllocs(dump_fd);
-  ProcessDump(dump_fd, max_allocs, max_threads);
-
-  close(dump_fd);
+  replay_options.max_threads = DEFAULT_MAX_THREADS;
+  if (argc == 2) {
+    replay_options.max_threads = atoi(argv[1]);
+  } else if (trace.header().max_threads > replay_options.max_threads) {
+    replay_options.max_threads = trace.header().max_threads;
+  }
 
-  return 0;
+  if (!replay_options.allocators.empty()) {
+    return CompareAllocators(trace, replay_options);
+  }
+  ReplayResult result;
+  return Replay(trace, replay_options, Allocator::GetLibc(), &result) ? 0 : 1;
 }
@@ -20,6 +20,7 @@
 
 #include "Action.h"
 #include "Pointers.h"
+#include "TraceFile.h"
 
 TEST(ActionTest, malloc) {
   uint8_t memory[Action::MaxActionSize()];
@@ -166,3 +167,31 @@ TEST(ActionTest, endthread) {
 
   action->Execute(nullptr);
 }
+
+TEST(ActionTest, from_trace_entry) {
+  uint8_t memory[128];
+  TraceEntry entry = {};
+  entry.type = TRACE_REALLOC;
+  entry.id = 2;
+  entry.arg = 1;
+  entry.size = 100;
+  Action* action = Action::CreateAction(entry, memory);
+  ASSERT_TRUE(action != NULL);
+  ASSERT_TRUE(action->DoesFree());
+  ASSERT_FALSE(action->EndThread());
+
+  Pointers pointers(2);
+  pointers.Add(1, malloc(10));
+  action->Execute(&pointers);
+  void* pointer = pointers.Remove(2);
+  ASSERT_TRUE(pointer != nullptr);
+  free(pointer);
+
+  entry.type = TRACE_THREAD_DONE;
+  action = Action::CreateAction(entry, memory);
+  ASSERT_TRUE(action != NULL);
+  ASSERT_TRUE(action->EndThread());
+
+  entry.type = 0;
+  ASSERT_TRUE(Action::CreateAction(entry, memory) == nullptr);
+}
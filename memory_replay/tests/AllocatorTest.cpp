@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+
+#include "Action.h"
+#include "Allocator.h"
+#include "Pointers.h"
+
+#if defined(__BIONIC__)
+static constexpr const char* LIBC_NAME = "libc.so";
+#else
+static constexpr const char* LIBC_NAME = "libc.so.6";
+#endif
+
+static void TestAllocator(Allocator* allocator) {
+  uint8_t* memory = reinterpret_cast<uint8_t*>(allocator->Malloc(100));
+  ASSERT_TRUE(memory != nullptr);
+  ASSERT_EQ(0U, reinterpret_cast<uintptr_t>(memory) & 0xf);
+  memset(memory, 0x5a, 100);
+
+  memory = reinterpret_cast<uint8_t*>(allocator->Realloc(memory, 200));
+  ASSERT_TRUE(memory != nullptr);
+  for (size_t i = 0; i < 100; i++) {
+    ASSERT_EQ(0x5a, memory[i]) << "Failed at byte " << i;
+  }
+  allocator->Free(memory);
+
+  memory = reinterpret_cast<uint8_t*>(allocator->Calloc(10, 30));
+  ASSERT_TRUE(memory != nullptr);
+  for (size_t i = 0; i < 300; i++) {
+    ASSERT_EQ(0, memory[i]) << "Failed at byte " << i;
+  }
+  allocator->Free(memory);
+
+  memory = reinterpret_cast<uint8_t*>(allocator->Memalign(4096, 50));
+  ASSERT_TRUE(memory != nullptr);
+  ASSERT_EQ(0U, reinterpret_cast<uintptr_t>(memory) & 0xfff);
+  allocator->Free(memory);
+
+  // Larger than the chunks of the bump allocator.
+  memory = reinterpret_cast<uint8_t*>(allocator->Malloc(4 * 1024 * 1024));
+  ASSERT_TRUE(memory != nullptr);
+  memset(memory, 1, 4 * 1024 * 1024);
+  allocator->Free(memory);
+
+  allocator->Free(nullptr);
+}
+
+TEST(AllocatorTest, libc) {
+  TestAllocator(Allocator::GetLibc());
+
+  std::unique_ptr<Allocator> allocator(Allocator::Create("libc"));
+  ASSERT_TRUE(allocator != nullptr);
+  TestAllocator(allocator.get());
+}
+
+TEST(AllocatorTest, bump) {
+  std::unique_ptr<Allocator> allocator(Allocator::Create("bump"));
+  ASSERT_TRUE(allocator != nullptr);
+  TestAllocator(allocator.get());
+
+  // Allocations never overlap, even when spread over several chunks.
+  uint8_t* previous = nullptr;
+  for (size_t i = 0; i < 10000; i++) {
+    uint8_t* memory = reinterpret_cast<uint8_t*>(allocator->Malloc(200));
+    ASSERT_TRUE(memory != nullptr);
+    memset(memory, i & 0xff, 200);
+    if (previous != nullptr) {
+      ASSERT_EQ((i - 1) & 0xff, previous[199]) << "Failed at allocation " << i;
+    }
+    previous = memory;
+  }
+}
+
+TEST(AllocatorTest, bump_recreate) {
+  // The chunk used by this thread must not be reused once the allocator
+  // that owns it is destroyed.
+  for (size_t i = 0; i < 3; i++) {
+    std::unique_ptr<Allocator> allocator(Allocator::Create("bump"));
+    ASSERT_TRUE(allocator != nullptr);
+    void* memory = allocator->Malloc(64);
+    ASSERT_TRUE(memory != nullptr);
+    memset(memory, 1, 64);
+  }
+}
+
+TEST(AllocatorTest, shared_lib) {
+  std::unique_ptr<Allocator> allocator(Allocator::Create(LIBC_NAME));
+  ASSERT_TRUE(allocator != nullptr);
+  TestAllocator(allocator.get());
+}
+
+TEST(AllocatorTest, shared_lib_errors) {
+  ASSERT_TRUE(Allocator::Create("libdoes_not_exist.so") == nullptr);
+  std::string name = std::string(LIBC_NAME) + ":does_not_exist_";
+  ASSERT_TRUE(Allocator::Create(name.c_str()) == nullptr);
+}
+
+TEST(AllocatorTest, execute_action) {
+  std::unique_ptr<Allocator> allocator(Allocator::Create("bump"));
+  ASSERT_TRUE(allocator != nullptr);
+  Pointers pointers(1);
+
+  uint8_t memory[Action::MaxActionSize()];
+  Action* action = Action::CreateAction(0x1234, "malloc", "100", memory);
+  ASSERT_TRUE(action != nullptr);
+  action->Execute(&pointers, allocator.get());
+  void* pointer = pointers.Remove(0x1234);
+  ASSERT_TRUE(pointer != nullptr);
+  ASSERT_EQ(1, reinterpret_cast<uint8_t*>(pointer)[99]);
+}
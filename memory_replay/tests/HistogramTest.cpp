@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+
+#include <string>
+
+#include <android-base/file.h>
+
+#include "Histogram.h"
+
+TEST(HistogramTest, buckets) {
+  // Small values are recorded exactly.
+  for (uint64_t value = 0; value < Histogram::SUB_BUCKETS; value++) {
+    ASSERT_EQ(value, Histogram::GetBucket(value));
+    ASSERT_EQ(value, Histogram::GetBucketMaxValue(value));
+  }
+  // Every value falls in a bucket whose range contains it, with a
+  // relative error of at most 1/16.
+  for (uint64_t value = Histogram::SUB_BUCKETS; value < (1ULL << 31); value = value * 9 / 8 + 1) {
+    size_t bucket = Histogram::GetBucket(value);
+    ASSERT_LT(bucket, Histogram::NUM_BUCKETS);
+    uint64_t max_value = Histogram::GetBucketMaxValue(bucket);
+    ASSERT_GE(max_value, value);
+    ASSERT_LT(Histogram::GetBucketMaxValue(bucket - 1), value);
+    ASSERT_LE(max_value - value, value / Histogram::SUB_BUCKETS);
+  }
+  ASSERT_EQ(Histogram::NUM_BUCKETS - 1, Histogram::GetBucket(UINT64_MAX));
+}
+
+TEST(HistogramTest, percentiles) {
+  Histogram histogram = {};
+  ASSERT_EQ(0U, histogram.Percentile(50));
+  for (uint64_t value = 1; value <= 1000; value++) {
+    histogram.Record(value);
+  }
+  ASSERT_EQ(1000U, histogram.count());
+  ASSERT_EQ(1000U, histogram.max());
+  ASSERT_EQ(500500U, histogram.total());
+
+  uint64_t p50 = histogram.Percentile(50);
+  ASSERT_GE(p50, 500U);
+  ASSERT_LE(p50, 500U + 500U / Histogram::SUB_BUCKETS);
+  uint64_t p99 = histogram.Percentile(99);
+  ASSERT_GE(p99, 990U);
+  ASSERT_LE(p99, 1000U);
+  // Percentiles never go above the max.
+  ASSERT_EQ(1000U, histogram.Percentile(99.9));
+  ASSERT_EQ(1000U, histogram.Percentile(100));
+}
+
+TEST(HistogramTest, merge) {
+  Histogram histogram1 = {};
+  Histogram histogram2 = {};
+  histogram1.Record(10);
+  histogram2.Record(20000);
+  histogram1.Merge(histogram2);
+  ASSERT_EQ(2U, histogram1.count());
+  ASSERT_EQ(20000U, histogram1.max());
+  ASSERT_EQ(10U, histogram1.Percentile(50));
+}
+
+TEST(HistogramTest, size_classes) {
+  ASSERT_EQ(0U, ActionHistograms::GetSizeClass(0));
+  ASSERT_EQ(0U, ActionHistograms::GetSizeClass(16));
+  ASSERT_EQ(1U, ActionHistograms::GetSizeClass(17));
+  ASSERT_EQ(NUM_SIZE_CLASSES - 1, ActionHistograms::GetSizeClass(1 << 20));
+  ASSERT_STREQ("<=16", ActionHistograms::GetSizeClassName(0));
+  ASSERT_STREQ(">256K", ActionHistograms::GetSizeClassName(NUM_SIZE_CLASSES - 1));
+}
+
+TEST(HistogramTest, export) {
+  ActionHistograms* histograms = ActionHistograms::Create();
+  histograms->Record(ACTION_MALLOC, 24, 100);
+  histograms->Record(ACTION_MALLOC, 24, 300);
+  histograms->Record(ACTION_FREE, 5000, 50);
+
+  TemporaryFile csv_file;
+  ASSERT_TRUE(histograms->WriteCsv(csv_file.path));
+  std::string csv;
+  ASSERT_TRUE(android::base::ReadFileToString(csv_file.path, &csv));
+  ASSERT_NE(std::string::npos, csv.find("malloc,all,2,200,"));
+  ASSERT_NE(std::string::npos, csv.find("malloc,<=32,2,200,"));
+  ASSERT_NE(std::string::npos, csv.find("free,<=16K,1,50,50,50,50,50,50\n"));
+  ASSERT_EQ(std::string::npos, csv.find("calloc"));
+
+  TemporaryFile json_file;
+  ASSERT_TRUE(histograms->WriteJson(json_file.path));
+  std::string json;
+  ASSERT_TRUE(android::base::ReadFileToString(json_file.path, &json));
+  ASSERT_NE(std::string::npos, json.find("\"action\": \"free\", \"size_class\": \"<=16K\""));
+  ASSERT_NE(std::string::npos, json.find("\"max_ns\": 300}"));
+
+  ActionHistograms::Destroy(histograms);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+
+#include <android-base/file.h>
+
+#include "MemorySampler.h"
+
+TEST(MemorySamplerTest, samples) {
+  std::atomic<uint64_t> num_actions(0);
+  MemorySampler sampler(&num_actions, 1000000);
+  ASSERT_TRUE(sampler.Start());
+  for (size_t i = 1; i <= 20; i++) {
+    num_actions.store(i * 100);
+    usleep(2000);
+  }
+  sampler.Stop();
+
+  // The last sample is taken when stopping.
+  ASSERT_GE(sampler.num_samples(), 2U);
+  const MemorySample* samples = sampler.samples();
+  ASSERT_EQ(2000U, samples[sampler.num_samples() - 1].num_actions);
+  for (size_t i = 0; i < sampler.num_samples(); i++) {
+    ASSERT_NE(0U, samples[i].rss_bytes) << "Failed at sample " << i;
+    if (i != 0) {
+      ASSERT_GE(samples[i].time_nsecs, samples[i - 1].time_nsecs) << "Failed at sample " << i;
+      ASSERT_GE(samples[i].num_actions, samples[i - 1].num_actions) << "Failed at sample " << i;
+    }
+  }
+}
+
+TEST(MemorySamplerTest, stop_without_start) {
+  std::atomic<uint64_t> num_actions(0);
+  MemorySampler sampler(&num_actions, 1000000);
+  sampler.Stop();
+  ASSERT_EQ(0U, sampler.num_samples());
+}
+
+TEST(MemorySamplerTest, write_csv) {
+  std::atomic<uint64_t> num_actions(10);
+  MemorySampler sampler(&num_actions, 1000000000);
+  ASSERT_TRUE(sampler.Start());
+  sampler.Stop();
+  ASSERT_GE(sampler.num_samples(), 1U);
+
+  TemporaryFile tf;
+  ASSERT_TRUE(sampler.WriteCsv(tf.path));
+  std::string csv;
+  ASSERT_TRUE(android::base::ReadFileToString(tf.path, &csv));
+  ASSERT_EQ(0U, csv.find("time_ns,actions,rss_bytes,pss_bytes,anon_bytes,allocated_bytes\n"));
+  size_t lines = 0;
+  for (char c : csv) {
+    lines += c == '\n';
+  }
+  ASSERT_EQ(sampler.num_samples() + 1, lines);
+  ASSERT_NE(std::string::npos, csv.find(",10,"));
+}
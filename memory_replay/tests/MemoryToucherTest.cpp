@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Action.h"
+#include "MemoryToucher.h"
+#include "Pointers.h"
+#include "TraceFile.h"
+
+TEST(MemoryToucherTest, write_fraction) {
+  TouchOptions options;
+  options.write_fraction = 0.25;
+  MemoryToucher toucher(options);
+
+  uint8_t buffer[100];
+  memset(buffer, 0xff, sizeof(buffer));
+  toucher.Write(buffer, sizeof(buffer), 1);
+  for (size_t i = 0; i < sizeof(buffer); i++) {
+    ASSERT_EQ(i < 25 ? 1 : 0xff, buffer[i]) << "Failed at byte " << i;
+  }
+  // Faults are not counted by default.
+  ASSERT_EQ(0U, toucher.stats().count(TOUCH_PHASE_WRITE));
+}
+
+TEST(MemoryToucherTest, count_write_faults) {
+  TouchOptions options;
+  options.count_faults = true;
+  MemoryToucher toucher(options);
+
+  size_t size = 64 * getpagesize();
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, memory);
+  toucher.Begin();
+  toucher.Write(memory, size, 1);
+  // Writing the memory again doesn't fault.
+  toucher.Write(memory, size, 2);
+  munmap(memory, size);
+
+  const TouchStats& stats = toucher.stats();
+  ASSERT_EQ(2U, stats.count(TOUCH_PHASE_WRITE));
+  ASSERT_NE(0U, stats.minor_faults(TOUCH_PHASE_WRITE));
+  ASSERT_LE(stats.minor_faults(TOUCH_PHASE_WRITE), 64U + 16U);
+}
+
+TEST(MemoryToucherTest, action_phases) {
+  TouchOptions options;
+  options.read_before_free = true;
+  options.count_faults = true;
+  MemoryToucher toucher(options);
+  Pointers pointers(1);
+  uint8_t action_memory[Action::MaxActionSize()];
+
+  TraceEntry entry = {};
+  entry.type = TRACE_MALLOC;
+  entry.id = 1;
+  entry.size = 1000;
+  Action* action = Action::CreateAction(entry, action_memory);
+  ASSERT_TRUE(action != nullptr);
+  action->Execute(&pointers, Allocator::GetLibc(), &toucher);
+
+  entry.type = TRACE_FREE;
+  action = Action::CreateAction(entry, action_memory);
+  ASSERT_TRUE(action != nullptr);
+  action->Execute(&pointers, Allocator::GetLibc(), &toucher);
+
+  const TouchStats& stats = toucher.stats();
+  for (size_t i = 0; i < NUM_TOUCH_PHASES; i++) {
+    TouchPhase phase = static_cast<TouchPhase>(i);
+    ASSERT_EQ(1U, stats.count(phase)) << "Failed at phase " << TouchStats::GetPhaseName(phase);
+  }
+}
+
+TEST(MemoryToucherTest, merge) {
+  TouchStats stats;
+  stats.Record(TOUCH_PHASE_ALLOC, 100, 1, 0);
+  TouchStats other;
+  other.Record(TOUCH_PHASE_ALLOC, 50, 2, 1);
+  other.Record(TOUCH_PHASE_FREE, 10, 0, 0);
+  stats.Merge(other);
+
+  ASSERT_EQ(2U, stats.count(TOUCH_PHASE_ALLOC));
+  ASSERT_EQ(150U, stats.time_nsecs(TOUCH_PHASE_ALLOC));
+  ASSERT_EQ(3U, stats.minor_faults(TOUCH_PHASE_ALLOC));
+  ASSERT_EQ(1U, stats.major_faults(TOUCH_PHASE_ALLOC));
+  ASSERT_EQ(1U, stats.count(TOUCH_PHASE_FREE));
+  ASSERT_EQ(0U, stats.count(TOUCH_PHASE_WRITE));
+}
@@ -264,3 +264,79 @@ TEST_F(NativeInfoTest, mix_heap_anon) {
   ASSERT_EQ(73728U, pss_bytes);
   ASSERT_EQ(12288U, va_bytes);
 }
+
+TEST_F(NativeInfoTest, process_memory_rollup) {
+  std::string smaps_data =
+      "00400000-ffffffffff601000 ---p 00000000 00:00 0                          [rollup]\n"
+      "Rss:                 884 kB\n"
+      "Pss:                 380 kB\n"
+      "Pss_Anon:            200 kB\n"
+      "Shared_Clean:        504 kB\n"
+      "Private_Dirty:       252 kB\n"
+      "Anonymous:           252 kB\n"
+      "Swap:                  0 kB\n";
+  ASSERT_TRUE(TEMP_FAILURE_RETRY(
+      write(tmp_file_->fd, smaps_data.c_str(), smaps_data.size())) != -1);
+  ASSERT_TRUE(lseek(tmp_file_->fd, 0, SEEK_SET) != off_t(-1));
+
+  ProcessMemory memory;
+  GetProcessMemory(tmp_file_->fd, &memory);
+  ASSERT_EQ(884U * 1024, memory.rss_bytes);
+  ASSERT_EQ(380U * 1024, memory.pss_bytes);
+  ASSERT_EQ(252U * 1024, memory.anon_bytes);
+}
+
+TEST_F(NativeInfoTest, process_memory_all_maps) {
+  std::string smaps_data =
+      "b6f1a000-b6f1c000 rw-p 00000000 00:00 0          [anon:libc_malloc]\n"
+      "Size:                  8 kB\n"
+      "Rss:                   8 kB\n"
+      "Pss:                   8 kB\n"
+      "Anonymous:             8 kB\n"
+      "Name:           [anon:libc_malloc]\n"
+      "b6f2e000-b6f30000 r--p 00000000 00:00 0          /system/lib/libc.so\n"
+      "Size:                  8 kB\n"
+      "Rss:                   8 kB\n"
+      "Pss:                   4 kB\n"
+      "Anonymous:             0 kB\n"
+      "Name:           /system/lib/libc.so\n";
+  ASSERT_TRUE(TEMP_FAILURE_RETRY(
+      write(tmp_file_->fd, smaps_data.c_str(), smaps_data.size())) != -1);
+  ASSERT_TRUE(lseek(tmp_file_->fd, 0, SEEK_SET) != off_t(-1));
+
+  ProcessMemory memory;
+  GetProcessMemory(tmp_file_->fd, &memory);
+  ASSERT_EQ(16384U, memory.rss_bytes);
+  ASSERT_EQ(12288U, memory.pss_bytes);
+  ASSERT_EQ(8192U, memory.anon_bytes);
+}
+
+TEST_F(NativeInfoTest, process_memory_long_map_name) {
+  // Map names can be longer than the buffer used to read lines. Try names
+  // ending around a 4 KiB buffer, so the buffer ends right before the
+  // "Rss:" in one of them.
+  for (size_t name_len = 3900; name_len < 4100; name_len++) {
+    std::string name = "/" + std::string(name_len, 'a') + "Rss: 1000 kB";
+    std::string smaps_data =
+        "b6f1a000-b6f1c000 rw-p 00000000 00:00 0          " + name + "\n"
+        "Size:                  8 kB\n"
+        "Rss:                   8 kB\n"
+        "Pss:                   8 kB\n"
+        "Anonymous:             8 kB\n"
+        "b6f2e000-b6f30000 r--p 00000000 00:00 0          /system/lib/libc.so\n"
+        "Size:                  8 kB\n"
+        "Rss:                   8 kB\n"
+        "Pss:                   4 kB\n"
+        "Anonymous:             0 kB\n";
+    TemporaryFile tf;
+    ASSERT_TRUE(tf.fd != -1);
+    ASSERT_TRUE(TEMP_FAILURE_RETRY(write(tf.fd, smaps_data.c_str(), smaps_data.size())) != -1);
+    ASSERT_TRUE(lseek(tf.fd, 0, SEEK_SET) != off_t(-1));
+
+    ProcessMemory memory;
+    GetProcessMemory(tf.fd, &memory);
+    ASSERT_EQ(16384U, memory.rss_bytes) << "name_len " << name_len;
+    ASSERT_EQ(12288U, memory.pss_bytes) << "name_len " << name_len;
+    ASSERT_EQ(8192U, memory.anon_bytes) << "name_len " << name_len;
+  }
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+
+#include "Allocator.h"
+#include "ParallelReplay.h"
+#include "Pointers.h"
+#include "TraceFile.h"
+
+static void OpenTrace(const std::string& dump, TemporaryFile* trace_file, TraceFile* trace) {
+  TemporaryFile dump_file;
+  ASSERT_TRUE(android::base::WriteStringToFd(dump, dump_file.fd));
+  ASSERT_TRUE(CompileTrace(dump_file.fd, trace_file->fd));
+  ASSERT_TRUE(trace->Open(trace_file->fd));
+}
+
+TEST(ParallelReplayTest, cross_thread_frees) {
+  // Every allocation is freed by a different thread, so the replay only
+  // completes if frees wait for the allocations they depend on.
+  std::string dump;
+  for (size_t i = 0; i < 1000; i++) {
+    uintptr_t pointer = 0x1000 + i * 0x10;
+    dump += android::base::StringPrintf("100: malloc 0x%" PRIxPTR " 16\n", pointer);
+    dump += android::base::StringPrintf("101: realloc 0x%" PRIxPTR " 0x%" PRIxPTR " 32\n",
+                                        pointer + 0x100000, pointer);
+    dump += android::base::StringPrintf("102: free 0x%" PRIxPTR "\n", pointer + 0x100000);
+  }
+  dump += "100: thread_done 0x0\n101: thread_done 0x0\n102: thread_done 0x0\n";
+
+  TemporaryFile trace_file;
+  TraceFile trace;
+  ASSERT_NO_FATAL_FAILURE(OpenTrace(dump, &trace_file, &trace));
+
+  Pointers pointers(ParallelReplay::GetMaxAllocs(trace));
+  ParallelReplay replay(trace, &pointers, Allocator::GetLibc());
+  ASSERT_EQ(3U, replay.num_threads());
+  replay.Run();
+  ASSERT_NE(0U, replay.wall_time_nsecs());
+  ASSERT_LE(replay.max_concurrency(), 3U);
+  ASSERT_GT(replay.concurrency(), 0.0);
+}
+
+TEST(ParallelReplayTest, reused_tid) {
+  // The second thread with tid 100 can only start once the first one has
+  // ended, and it frees an allocation made by the first one.
+  std::string dump =
+      "100: malloc 0x1000 16\n"
+      "100: thread_done 0x0\n"
+      "100: free 0x1000\n"
+      "100: malloc 0x2000 16\n"
+      "101: free 0x2000\n";
+
+  TemporaryFile trace_file;
+  TraceFile trace;
+  ASSERT_NO_FATAL_FAILURE(OpenTrace(dump, &trace_file, &trace));
+
+  Pointers pointers(ParallelReplay::GetMaxAllocs(trace));
+  ParallelReplay replay(trace, &pointers, Allocator::GetLibc());
+  ASSERT_EQ(3U, replay.num_threads());
+  replay.Run();
+  ASSERT_LE(replay.max_concurrency(), 2U);
+}
+
+TEST(ParallelReplayTest, short_lived_threads) {
+  // Threads are created when they can start and joined when they end, so
+  // 10000 threads that never overlap only need one thread at a time.
+  // A thread that never ends is alive together with all of them.
+  std::string dump = "99: malloc 0x100 16\n";
+  for (size_t i = 0; i < 10000; i++) {
+    uintptr_t pointer = 0x1000 + i * 0x10;
+    dump += android::base::StringPrintf("%zu: malloc 0x%" PRIxPTR " 16\n", 100 + i, pointer);
+    dump += android::base::StringPrintf("%zu: free 0x%" PRIxPTR "\n", 100 + i, pointer);
+    dump += android::base::StringPrintf("%zu: thread_done 0x0\n", 100 + i);
+  }
+
+  TemporaryFile trace_file;
+  TraceFile trace;
+  ASSERT_NO_FATAL_FAILURE(OpenTrace(dump, &trace_file, &trace));
+
+  Pointers pointers(ParallelReplay::GetMaxAllocs(trace));
+  ParallelReplay replay(trace, &pointers, Allocator::GetLibc());
+  ASSERT_EQ(10001U, replay.num_threads());
+  replay.Run();
+  ASSERT_EQ(2U, replay.max_live_threads());
+  pointers.FreeAll(Allocator::GetLibc());
+}
+
+TEST(ParallelReplayTest, trace_concurrency) {
+  // Two threads that don't depend on each other can always run together.
+  std::string dump =
+      "100: malloc 0x1000 16\n"
+      "101: malloc 0x2000 16\n"
+      "100: free 0x1000\n"
+      "101: free 0x2000\n";
+  TemporaryFile trace_file;
+  TraceFile trace;
+  ASSERT_NO_FATAL_FAILURE(OpenTrace(dump, &trace_file, &trace));
+  ASSERT_DOUBLE_EQ(2.0, ParallelReplay::GetTraceConcurrency(trace));
+
+  // Every free waits for the allocation made just before by the other
+  // thread, so the threads can't run at the same time.
+  dump =
+      "100: malloc 0x1000 16\n"
+      "101: free 0x1000\n"
+      "101: malloc 0x2000 16\n"
+      "100: free 0x2000\n";
+  TemporaryFile chain_file;
+  TraceFile chain;
+  ASSERT_NO_FATAL_FAILURE(OpenTrace(dump, &chain_file, &chain));
+  ASSERT_DOUBLE_EQ(1.0, ParallelReplay::GetTraceConcurrency(chain));
+}
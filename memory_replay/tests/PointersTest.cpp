@@ -15,8 +15,16 @@
  */
 
 #include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <vector>
 
 #include "Pointers.h"
+#include "Utils.h"
 
 TEST(PointersTest, smoke) {
   Pointers pointers(1);
@@ -77,18 +85,82 @@ TEST(PointersTest, multiple_add_removes) {
   ASSERT_EQ(reinterpret_cast<void*>(0x2abcd), memory_pointer);
 }
 
-static void TestNoEntriesLeft() {
+TEST(PointersTest, more_than_max_pointers) {
   Pointers pointers(1);
 
-  // Even though we've requested only one pointer, we get more due
-  // to the way the data is allocated.
-  for (size_t i = 0; i <= pointers.max_pointers(); i++) {
+  // Even though we've requested only one pointer, the table keeps working
+  // when more pointers than its size are added.
+  size_t num_pointers = pointers.max_pointers() * 4 + 1;
+  for (size_t i = 0; i < num_pointers; i++) {
     pointers.Add(0x1234 + i, reinterpret_cast<void*>(0xabcd + i));
   }
+  for (size_t i = 0; i < num_pointers; i++) {
+    ASSERT_EQ(reinterpret_cast<void*>(0xabcd + i), pointers.Remove(0x1234 + i))
+        << "Failed at pointer " << i;
+  }
 }
 
-TEST(PointersTest_DeathTest, no_entries_left) {
-  ASSERT_EXIT(TestNoEntriesLeft(), ::testing::ExitedWithCode(1), "");
+struct BenchmarkThread {
+  Pointers* pointers;
+  std::atomic<bool>* start;
+  size_t thread_index;
+  size_t num_threads;
+  size_t num_ops;
+  bool failed;
+};
+
+static constexpr size_t BENCHMARK_LIVE_POINTERS = 256;
+
+static void* BenchmarkRunner(void* data) {
+  BenchmarkThread* thread = reinterpret_cast<BenchmarkThread*>(data);
+  while (!thread->start->load()) {
+    sched_yield();
+  }
+  // Consecutive keys belong to different threads, as the ids of a trace
+  // replayed in parallel would.
+  uintptr_t next_key = thread->thread_index + 1;
+  for (size_t ops = 0; ops < thread->num_ops; ops += 2 * BENCHMARK_LIVE_POINTERS) {
+    uintptr_t first_key = next_key;
+    for (size_t i = 0; i < BENCHMARK_LIVE_POINTERS; i++) {
+      thread->pointers->Add(next_key, reinterpret_cast<void*>(next_key * 2));
+      next_key += thread->num_threads;
+    }
+    for (uintptr_t key = first_key; key != next_key; key += thread->num_threads) {
+      thread->pointers->Prefetch(key + thread->num_threads);
+      if (thread->pointers->Remove(key) != reinterpret_cast<void*>(key * 2)) {
+        thread->failed = true;
+      }
+    }
+  }
+  return nullptr;
+}
+
+// Prints the Add/Remove throughput of threads sharing a table. The total
+// work is fixed, so the run time doesn't grow with the number of threads.
+TEST(PointersTest, benchmark_threads) {
+  static constexpr size_t TOTAL_OPS = 1 << 21;
+  printf("%8s %14s\n", "Threads", "Ops/sec");
+  for (size_t num_threads = 1; num_threads <= 64; num_threads *= 2) {
+    Pointers pointers(num_threads * BENCHMARK_LIVE_POINTERS);
+    std::atomic<bool> start(false);
+    std::vector<BenchmarkThread> threads(num_threads);
+    std::vector<pthread_t> thread_ids(num_threads);
+    for (size_t i = 0; i < num_threads; i++) {
+      threads[i] = BenchmarkThread{&pointers, &start, i, num_threads, TOTAL_OPS / num_threads,
+                                   false};
+      ASSERT_EQ(0, pthread_create(&thread_ids[i], nullptr, BenchmarkRunner, &threads[i]));
+    }
+    uint64_t start_nsecs = Nanotime();
+    start = true;
+    for (size_t i = 0; i < num_threads; i++) {
+      ASSERT_EQ(0, pthread_join(thread_ids[i], nullptr));
+    }
+    uint64_t nsecs = Nanotime() - start_nsecs;
+    for (size_t i = 0; i < num_threads; i++) {
+      ASSERT_FALSE(threads[i].failed) << "Thread " << i << " of " << num_threads;
+    }
+    printf("%8zu %14.0f\n", num_threads, TOTAL_OPS * 1000000000.0 / nsecs);
+  }
 }
 
 static void TestFindNoPointer() {
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/file.h>
+
+#include "TraceFile.h"
+
+static void CompileString(const std::string& dump, TemporaryFile* trace_file) {
+  TemporaryFile dump_file;
+  ASSERT_TRUE(android::base::WriteStringToFd(dump, dump_file.fd));
+  ASSERT_TRUE(CompileTrace(dump_file.fd, trace_file->fd));
+}
+
+TEST(TraceFileTest, compile) {
+  std::string dump =
+      "100: malloc 0x1000 32\n"
+      "101: calloc 0x2000 4 8\n"
+      "100: realloc 0x3000 0x1000 64\n"
+      "101: memalign 0x1000 16 128\n"
+      "100: free 0x2000\n"
+      "100: free 0x0\n"
+      "100: thread_done 0x0\n"
+      "101: free 0x3000\n"
+      "101: thread_done 0x0\n";
+  TemporaryFile trace_file;
+  ASSERT_NO_FATAL_FAILURE(CompileString(dump, &trace_file));
+  ASSERT_TRUE(TraceFile::IsTraceFile(trace_file.fd));
+
+  TraceFile trace;
+  ASSERT_TRUE(trace.Open(trace_file.fd));
+  const TraceHeader& header = trace.header();
+  ASSERT_EQ(2U, header.max_threads);
+  ASSERT_EQ(3U, header.max_allocs);
+  ASSERT_EQ(4U, header.num_ids);
+  ASSERT_EQ(9U, trace.num_entries());
+
+  const TraceEntry* entries = trace.entries();
+  ASSERT_EQ(TRACE_MALLOC, entries[0].type);
+  ASSERT_EQ(100, entries[0].tid);
+  ASSERT_EQ(1U, entries[0].id);
+  ASSERT_EQ(32U, entries[0].size);
+
+  ASSERT_EQ(TRACE_CALLOC, entries[1].type);
+  ASSERT_EQ(101, entries[1].tid);
+  ASSERT_EQ(2U, entries[1].id);
+  ASSERT_EQ(4U, entries[1].arg);
+  ASSERT_EQ(8U, entries[1].size);
+
+  // The old pointer of the realloc is renumbered to the id of the malloc.
+  ASSERT_EQ(TRACE_REALLOC, entries[2].type);
+  ASSERT_EQ(3U, entries[2].id);
+  ASSERT_EQ(1U, entries[2].arg);
+  ASSERT_EQ(64U, entries[2].size);
+
+  // A reused pointer value gets a new id.
+  ASSERT_EQ(TRACE_MEMALIGN, entries[3].type);
+  ASSERT_EQ(4U, entries[3].id);
+  ASSERT_EQ(16U, entries[3].arg);
+  ASSERT_EQ(128U, entries[3].size);
+
+  ASSERT_EQ(TRACE_FREE, entries[4].type);
+  ASSERT_EQ(2U, entries[4].id);
+  ASSERT_EQ(32U, entries[4].size);
+  ASSERT_EQ(TRACE_FREE, entries[5].type);
+  ASSERT_EQ(0U, entries[5].id);
+  ASSERT_EQ(TRACE_THREAD_DONE, entries[6].type);
+  ASSERT_EQ(TRACE_FREE, entries[7].type);
+  ASSERT_EQ(3U, entries[7].id);
+  ASSERT_EQ(TRACE_THREAD_DONE, entries[8].type);
+}
+
+TEST(TraceFileTest, compile_malformed) {
+  TemporaryFile dump_file1;
+  TemporaryFile trace_file;
+  ASSERT_TRUE(android::base::WriteStringToFd("100: malloc 0x1000\n", dump_file1.fd));
+  ASSERT_FALSE(CompileTrace(dump_file1.fd, trace_file.fd));
+
+  TemporaryFile dump_file2;
+  ASSERT_TRUE(android::base::WriteStringToFd("100: unknown 0x1000 10\n", dump_file2.fd));
+  ASSERT_FALSE(CompileTrace(dump_file2.fd, trace_file.fd));
+}
+
+TEST(TraceFileTest, compile_unknown_free) {
+  TemporaryFile dump_file;
+  TemporaryFile trace_file;
+  ASSERT_TRUE(android::base::WriteStringToFd("100: free 0x1000\n", dump_file.fd));
+  ASSERT_FALSE(CompileTrace(dump_file.fd, trace_file.fd));
+}
+
+TEST(TraceFileTest, open_text_dump) {
+  TemporaryFile dump_file;
+  ASSERT_TRUE(android::base::WriteStringToFd("100: malloc 0x1000 32\n", dump_file.fd));
+  ASSERT_FALSE(TraceFile::IsTraceFile(dump_file.fd));
+
+  TraceFile trace;
+  ASSERT_FALSE(trace.Open(dump_file.fd));
+}
+
+TEST(TraceFileTest, open_truncated) {
+  TemporaryFile trace_file;
+  ASSERT_NO_FATAL_FAILURE(CompileString("100: malloc 0x1000 32\n", &trace_file));
+  ASSERT_EQ(0, ftruncate(trace_file.fd, sizeof(TraceHeader) + sizeof(TraceEntry) / 2));
+
+  TraceFile trace;
+  ASSERT_FALSE(trace.Open(trace_file.fd));
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/file.h>
+
+#include "ParallelReplay.h"
+#include "TraceFile.h"
+#include "TraceSynthesizer.h"
+
+TEST(TraceSynthesizerTest, distribution) {
+  Distribution distribution;
+  distribution.Add(10, 50);
+  distribution.Add(20, 40);
+  distribution.Add(30, 10);
+  distribution.Finalize();
+
+  ASSERT_EQ(100U, distribution.count());
+  ASSERT_EQ(10U, distribution.Percentile(50));
+  ASSERT_EQ(20U, distribution.Percentile(51));
+  ASSERT_EQ(20U, distribution.Percentile(90));
+  ASSERT_EQ(30U, distribution.Percentile(100));
+
+  Random random(1);
+  size_t counts[3] = {};
+  for (size_t i = 0; i < 10000; i++) {
+    uint64_t value = distribution.Sample(&random);
+    ASSERT_TRUE(value == 10 || value == 20 || value == 30) << "Bad value " << value;
+    counts[value / 10 - 1]++;
+  }
+  ASSERT_NEAR(5000, counts[0], 300);
+  ASSERT_NEAR(4000, counts[1], 300);
+  ASSERT_NEAR(1000, counts[2], 300);
+}
+
+TEST(TraceSynthesizerTest, empty_distribution) {
+  Distribution distribution;
+  distribution.Finalize();
+  Random random(1);
+  ASSERT_EQ(0U, distribution.count());
+  ASSERT_EQ(0U, distribution.Sample(&random));
+  ASSERT_EQ(0U, distribution.Percentile(50));
+}
+
+static void CompileString(const std::string& dump, TraceFile* trace, TemporaryFile* trace_file) {
+  TemporaryFile dump_file;
+  ASSERT_TRUE(android::base::WriteStringToFd(dump, dump_file.fd));
+  ASSERT_TRUE(CompileTrace(dump_file.fd, trace_file->fd));
+  ASSERT_TRUE(trace->Open(trace_file->fd));
+}
+
+static void BuildProfile(TraceProfile* profile) {
+  std::string dump;
+  // Two threads allocating small, short lived memory, with realloc chains,
+  // frees from the other thread and a few allocations that are never freed.
+  for (size_t i = 0; i < 200; i++) {
+    uint64_t addr = 0x10000 + i * 0x100;
+    dump += "100: malloc 0x" + std::to_string(addr) + " " + std::to_string(16 + i % 64) + "\n";
+    dump += "101: calloc 0x" + std::to_string(addr + 1) + " 4 8\n";
+    dump += "100: realloc 0x" + std::to_string(addr + 2) + " 0x" + std::to_string(addr) +
+            " 256\n";
+    dump += "101: free 0x" + std::to_string(addr + 2) + "\n";
+    if (i % 10 != 0) {
+      dump += "100: free 0x" + std::to_string(addr + 1) + "\n";
+    }
+  }
+  dump += "100: memalign 0x1 64 128\n";
+  dump += "100: thread_done 0x0\n";
+  dump += "101: thread_done 0x0\n";
+
+  TraceFile trace;
+  TemporaryFile trace_file;
+  ASSERT_NO_FATAL_FAILURE(CompileString(dump, &trace, &trace_file));
+  profile->Build(trace);
+}
+
+static void Synthesize(const TraceProfile& profile, const SynthesizeOptions& options,
+                       std::string* contents) {
+  TemporaryFile tf;
+  ASSERT_TRUE(SynthesizeTrace(profile, options, tf.fd));
+  ASSERT_TRUE(android::base::ReadFileToString(tf.path, contents));
+}
+
+TEST(TraceSynthesizerTest, same_seed_same_trace) {
+  TraceProfile profile;
+  ASSERT_NO_FATAL_FAILURE(BuildProfile(&profile));
+
+  SynthesizeOptions options;
+  options.num_threads = 4;
+  options.num_actions = 5000;
+  std::string first;
+  ASSERT_NO_FATAL_FAILURE(Synthesize(profile, options, &first));
+  std::string second;
+  ASSERT_NO_FATAL_FAILURE(Synthesize(profile, options, &second));
+  ASSERT_EQ(first, second);
+
+  options.seed = 2;
+  std::string other;
+  ASSERT_NO_FATAL_FAILURE(Synthesize(profile, options, &other));
+  ASSERT_NE(first, other);
+}
+
+TEST(TraceSynthesizerTest, consistent_trace) {
+  TraceProfile profile;
+  ASSERT_NO_FATAL_FAILURE(BuildProfile(&profile));
+
+  SynthesizeOptions options;
+  options.num_threads = 8;
+  options.num_actions = 20000;
+  TemporaryFile tf;
+  ASSERT_TRUE(SynthesizeTrace(profile, options, tf.fd));
+  TraceFile trace;
+  ASSERT_TRUE(trace.Open(tf.fd));
+
+  const TraceHeader& header = trace.header();
+  ASSERT_EQ(8U, header.max_threads);
+  ASSERT_EQ(20000U + 8U, trace.num_entries());
+
+  std::set<uint64_t> live;
+  std::set<int32_t> done;
+  uint64_t max_id = 0;
+  size_t max_live = 0;
+  size_t num_reallocs = 0;
+  size_t num_frees = 0;
+  const TraceEntry* entries = trace.entries();
+  for (size_t i = 0; i < trace.num_entries(); i++) {
+    const TraceEntry& entry = entries[i];
+    ASSERT_GE(entry.tid, 1) << "Failed at entry " << i;
+    ASSERT_LE(entry.tid, 8) << "Failed at entry " << i;
+    ASSERT_EQ(0U, done.count(entry.tid)) << "Failed at entry " << i;
+    switch (entry.type) {
+      case TRACE_FREE:
+        ASSERT_EQ(1U, live.erase(entry.id)) << "Failed at entry " << i;
+        num_frees++;
+        break;
+      case TRACE_REALLOC:
+        ASSERT_EQ(1U, live.erase(entry.arg)) << "Failed at entry " << i;
+        num_reallocs++;
+        [[fallthrough]];
+      case TRACE_MALLOC:
+      case TRACE_CALLOC:
+      case TRACE_MEMALIGN:
+        ASSERT_EQ(max_id + 1, entry.id) << "Failed at entry " << i;
+        max_id = entry.id;
+        live.insert(entry.id);
+        max_live = std::max(max_live, live.size());
+        break;
+      case TRACE_THREAD_DONE:
+        done.insert(entry.tid);
+        break;
+      default:
+        FAIL() << "Unknown type " << entry.type << " at entry " << i;
+    }
+  }
+  ASSERT_EQ(8U, done.size());
+  ASSERT_EQ(max_id, header.num_ids);
+  ASSERT_EQ(max_live, header.max_allocs);
+  ASSERT_NE(0U, num_reallocs);
+  ASSERT_NE(0U, num_frees);
+}
+
+// Returns the share of frees and reallocs in another thread than the one
+// that made the allocation.
+static double GetCrossThreadShare(const TraceFile& trace) {
+  std::unordered_map<uint64_t, int32_t> alloc_tids;
+  uint64_t num_ends = 0;
+  uint64_t cross_thread_ends = 0;
+  const TraceEntry* entries = trace.entries();
+  for (size_t i = 0; i < trace.num_entries(); i++) {
+    const TraceEntry& entry = entries[i];
+    uint64_t old_id = 0;
+    if (entry.type == TRACE_FREE) {
+      old_id = entry.id;
+    } else if (entry.type == TRACE_REALLOC) {
+      old_id = entry.arg;
+    }
+    if (old_id != 0) {
+      num_ends++;
+      if (alloc_tids[old_id] != entry.tid) {
+        cross_thread_ends++;
+      }
+    }
+    if (entry.type != TRACE_FREE && entry.type != TRACE_THREAD_DONE) {
+      alloc_tids[entry.id] = entry.tid;
+    }
+  }
+  return num_ends == 0 ? 0.0 : static_cast<double>(cross_thread_ends) / num_ends;
+}
+
+TEST(TraceSynthesizerTest, follows_profile) {
+  TraceProfile profile;
+  ASSERT_NO_FATAL_FAILURE(BuildProfile(&profile));
+
+  // 380 of the 580 ends of the profile are in the other thread.
+  SynthesizeOptions options;
+  options.num_threads = 8;
+  options.num_actions = 20000;
+  TemporaryFile tf;
+  ASSERT_TRUE(SynthesizeTrace(profile, options, tf.fd));
+  TraceFile trace;
+  ASSERT_TRUE(trace.Open(tf.fd));
+  ASSERT_NEAR(380.0 / 580.0, GetCrossThreadShare(trace), 0.01);
+
+  // Slack drops some of them.
+  options.cross_thread_slack = 1024;
+  TemporaryFile slack_tf;
+  ASSERT_TRUE(SynthesizeTrace(profile, options, slack_tf.fd));
+  TraceFile slack_trace;
+  ASSERT_TRUE(slack_trace.Open(slack_tf.fd));
+  ASSERT_LT(GetCrossThreadShare(slack_trace), 0.9 * 380.0 / 580.0);
+}
+
+TEST(TraceSynthesizerTest, trace_concurrency) {
+  TraceProfile profile;
+  ASSERT_NO_FATAL_FAILURE(BuildProfile(&profile));
+
+  // Most of the ends of the profile are in the other thread, but with even
+  // thread rates and slack, threads should rarely have to wait for each
+  // other.
+  SynthesizeOptions options;
+  options.num_threads = 64;
+  options.num_actions = 100000;
+  options.profile_thread_rates = false;
+  options.cross_thread_slack = 1024;
+  TemporaryFile tf;
+  ASSERT_TRUE(SynthesizeTrace(profile, options, tf.fd));
+  TraceFile trace;
+  ASSERT_TRUE(trace.Open(tf.fd));
+  double concurrency = ParallelReplay::GetTraceConcurrency(trace);
+  ASSERT_GE(concurrency, 48.0);
+
+  // By default, cross thread frees of recent allocations tie the threads
+  // together.
+  SynthesizeOptions default_options;
+  default_options.num_threads = 64;
+  default_options.num_actions = 100000;
+  TemporaryFile default_tf;
+  ASSERT_TRUE(SynthesizeTrace(profile, default_options, default_tf.fd));
+  TraceFile default_trace;
+  ASSERT_TRUE(default_trace.Open(default_tf.fd));
+  ASSERT_LT(ParallelReplay::GetTraceConcurrency(default_trace), concurrency);
+}
+
+TEST(TraceSynthesizerTest, empty_profile) {
+  TraceFile trace;
+  TemporaryFile trace_file;
+  ASSERT_NO_FATAL_FAILURE(CompileString("100: thread_done 0x0\n", &trace, &trace_file));
+  TraceProfile profile;
+  profile.Build(trace);
+
+  TemporaryFile tf;
+  ASSERT_FALSE(SynthesizeTrace(profile, SynthesizeOptions(), tf.fd));
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BuildIdResolver.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#include "read_apk.h"
+#include "read_elf.h"
+
+namespace simpleperf {
+
+static constexpr const char* kCacheFileMagic = "simpleperf_build_id_cache_v1";
+
+BuildIdResolver::BuildIdResolver(size_t thread_count, const std::string& cache_file)
+    : cache_file_(cache_file) {
+  if (!cache_file_.empty() && !LoadCacheFile()) {
+    LOG(DEBUG) << "Ignore invalid build id cache file " << cache_file_;
+    cache_.clear();
+  }
+  for (size_t i = 0; i < thread_count; ++i) {
+    workers_.emplace_back([this]() { RunWorker(); });
+  }
+}
+
+BuildIdResolver::~BuildIdResolver() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    exit_workers_ = true;
+  }
+  request_cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+bool BuildIdResolver::CreateRequest(const std::string& path, Request* request) {
+  request->path = path;
+  auto tuple = SplitUrlInApk(path);
+  if (!std::get<0>(tuple)) {
+    request->elf_path = path;
+    return true;
+  }
+  EmbeddedElf* elf = ApkInspector::FindElfInApkByName(std::get<1>(tuple), std::get<2>(tuple));
+  if (elf == nullptr) {
+    return false;
+  }
+  request->elf_path = elf->filepath();
+  request->elf_offset = elf->entry_offset();
+  request->elf_size = elf->entry_size();
+  return true;
+}
+
+void BuildIdResolver::AddFile(const std::string& path) {
+  if (workers_.empty()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(lock_);
+  if (exit_workers_ || files_.find(path) != files_.end()) {
+    return;
+  }
+  FileEntry& entry = files_[path];
+  lock.unlock();
+  Request request;
+  bool valid = CreateRequest(path, &request);
+  lock.lock();
+  if (!valid) {
+    entry.resolved = true;
+    return;
+  }
+  requests_.push_back(std::move(request));
+  lock.unlock();
+  request_cond_.notify_one();
+}
+
+ElfFileInfo BuildIdResolver::GetFileInfo(const std::string& path) {
+  std::unique_lock<std::mutex> lock(lock_);
+  auto it = files_.find(path);
+  if (it != files_.end()) {
+    result_cond_.wait(lock, [&]() { return files_[path].resolved; });
+    return files_[path].info;
+  }
+  lock.unlock();
+  Request request;
+  ElfFileInfo info;
+  if (CreateRequest(path, &request)) {
+    info = ResolveFile(request);
+  }
+  lock.lock();
+  FileEntry& entry = files_[path];
+  entry.resolved = true;
+  entry.info = info;
+  return info;
+}
+
+bool BuildIdResolver::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    exit_workers_ = true;
+  }
+  request_cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+  LOG(DEBUG) << "BuildIdResolver: parsed " << parsed_file_count_ << " files, hit cache "
+             << cache_hit_count_ << " times";
+  return SaveCacheFile();
+}
+
+void BuildIdResolver::RunWorker() {
+  while (true) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      request_cond_.wait(lock, [&]() { return exit_workers_ || !requests_.empty(); });
+      // Finish all requests before exiting, so Finish() doesn't leave unresolved files.
+      if (requests_.empty()) {
+        return;
+      }
+      request = std::move(requests_.front());
+      requests_.pop_front();
+    }
+    ElfFileInfo info = ResolveFile(request);
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      auto it = files_.find(request.path);
+      if (it != files_.end()) {
+        it->second.resolved = true;
+        it->second.info = info;
+      }
+    }
+    result_cond_.notify_all();
+  }
+}
+
+ElfFileInfo BuildIdResolver::ResolveFile(const Request& request) {
+  FileKey key;
+  struct stat st;
+  bool has_key = stat(request.elf_path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+  if (has_key) {
+    key.inode = st.st_ino;
+    key.mtime_in_ns = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = cache_.find(request.path);
+    if (it != cache_.end() && it->second.key == key) {
+      cache_hit_count_++;
+      return it->second.info;
+    }
+  }
+  ElfFileInfo info;
+  if (!has_key) {
+    return info;
+  }
+  ElfStatus result;
+  bool in_apk = request.elf_path != request.path;
+  if (in_apk) {
+    result = GetBuildIdFromEmbeddedElfFile(request.elf_path, request.elf_offset, request.elf_size,
+                                           &info.build_id);
+  } else {
+    result = GetBuildIdFromElfFile(request.elf_path, &info.build_id);
+  }
+  info.has_build_id = result == ElfStatus::NO_ERROR;
+  if (in_apk) {
+    result = ReadMinExecutableVirtualAddressFromEmbeddedElfFile(
+        request.elf_path, request.elf_offset, request.elf_size, BuildId(), &info.min_vaddr,
+        &info.file_offset_of_min_vaddr);
+  } else {
+    result = ReadMinExecutableVirtualAddressFromElfFile(request.elf_path, BuildId(),
+                                                        &info.min_vaddr,
+                                                        &info.file_offset_of_min_vaddr);
+  }
+  info.has_min_vaddr = result == ElfStatus::NO_ERROR;
+
+  std::lock_guard<std::mutex> lock(lock_);
+  parsed_file_count_++;
+  CacheEntry& entry = cache_[request.path];
+  entry.key = key;
+  entry.info = info;
+  cache_changed_ = true;
+  return info;
+}
+
+// The cache file is a text file. The first line is kCacheFileMagic. Each following line is an
+// entry in format:
+//   inode mtime_in_ns has_build_id build_id has_min_vaddr min_vaddr file_offset_of_min_vaddr path
+bool BuildIdResolver::LoadCacheFile() {
+  std::string content;
+  if (!android::base::ReadFileToString(cache_file_, &content)) {
+    // The cache file doesn't exist before the first run.
+    return true;
+  }
+  if (content.empty()) {
+    return true;
+  }
+  std::vector<std::string> lines = android::base::Split(content, "\n");
+  if (lines.empty() || lines[0] != kCacheFileMagic) {
+    return false;
+  }
+  for (size_t i = 1; i < lines.size(); ++i) {
+    if (lines[i].empty()) {
+      continue;
+    }
+    CacheEntry entry;
+    int has_build_id;
+    int has_min_vaddr;
+    char build_id[BUILD_ID_SIZE * 2 + 1];
+    int path_pos = 0;
+    if (sscanf(lines[i].c_str(),
+               "%" SCNu64 " %" SCNu64 " %d %40s %d %" SCNx64 " %" SCNx64 " %n",
+               &entry.key.inode, &entry.key.mtime_in_ns, &has_build_id, build_id,
+               &has_min_vaddr, &entry.info.min_vaddr, &entry.info.file_offset_of_min_vaddr,
+               &path_pos) != 7 || path_pos == 0 ||
+        static_cast<size_t>(path_pos) >= lines[i].size()) {
+      return false;
+    }
+    entry.info.has_build_id = has_build_id != 0;
+    entry.info.build_id = BuildId(std::string(build_id));
+    entry.info.has_min_vaddr = has_min_vaddr != 0;
+    cache_[lines[i].substr(path_pos)] = entry;
+  }
+  return true;
+}
+
+bool BuildIdResolver::SaveCacheFile() {
+  if (cache_file_.empty() || !cache_changed_) {
+    return true;
+  }
+  std::string content = std::string(kCacheFileMagic) + "\n";
+  for (const auto& pair : cache_) {
+    const CacheEntry& entry = pair.second;
+    // Remove the "0x" prefix of BuildId::ToString().
+    std::string build_id = entry.info.build_id.ToString().substr(2);
+    content += android::base::StringPrintf(
+        "%" PRIu64 " %" PRIu64 " %d %s %d %" PRIx64 " %" PRIx64 " %s\n", entry.key.inode,
+        entry.key.mtime_in_ns, entry.info.has_build_id ? 1 : 0, build_id.c_str(),
+        entry.info.has_min_vaddr ? 1 : 0, entry.info.min_vaddr,
+        entry.info.file_offset_of_min_vaddr, pair.first.c_str());
+  }
+  if (!android::base::WriteStringToFile(content, cache_file_)) {
+    PLOG(ERROR) << "failed to write build id cache file " << cache_file_;
+    return false;
+  }
+  cache_changed_ = false;
+  return true;
+}
+
+}  // namespace simpleperf
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/macros.h>
+
+#include "build_id.h"
+
+namespace simpleperf {
+
+// Info of an elf file needed when dumping build id and file features in perf.data.
+struct ElfFileInfo {
+  bool has_build_id = false;
+  BuildId build_id;
+  bool has_min_vaddr = false;
+  uint64_t min_vaddr = 0;
+  uint64_t file_offset_of_min_vaddr = 0;
+};
+
+// BuildIdResolver reads build ids and min executable vaddrs of elf files in background threads.
+// The record command adds a file when it first sees the file mapped, so most files are parsed
+// before recording stops. Results are cached by (path, inode, mtime). The cache can be loaded
+// from and saved to a file, to be reused across runs.
+// AddFile() and GetFileInfo() should be called in the same thread, because they use
+// ApkInspector, which isn't thread safe.
+class BuildIdResolver {
+ public:
+  // If thread_count is 0, all files are resolved in the calling thread of GetFileInfo().
+  BuildIdResolver(size_t thread_count, const std::string& cache_file = "");
+  ~BuildIdResolver();
+
+  // Request resolving a file in background. It can be called multiple times for the same file.
+  void AddFile(const std::string& path);
+  // Return info of a file, waiting for the result if it is being resolved.
+  ElfFileInfo GetFileInfo(const std::string& path);
+  // Wait for all added files, stop worker threads and save the cache file.
+  bool Finish();
+
+  size_t CacheHitCount() const { return cache_hit_count_; }
+  size_t ParsedFileCount() const { return parsed_file_count_; }
+
+ private:
+  struct Request {
+    std::string path;
+    // The file really read. For an elf embedded in an apk, it is the apk file.
+    std::string elf_path;
+    uint64_t elf_offset = 0;
+    uint32_t elf_size = 0;
+  };
+
+  struct FileKey {
+    uint64_t inode = 0;
+    uint64_t mtime_in_ns = 0;
+
+    bool operator==(const FileKey& other) const {
+      return inode == other.inode && mtime_in_ns == other.mtime_in_ns;
+    }
+  };
+
+  struct CacheEntry {
+    FileKey key;
+    ElfFileInfo info;
+  };
+
+  struct FileEntry {
+    bool resolved = false;
+    ElfFileInfo info;
+  };
+
+  bool CreateRequest(const std::string& path, Request* request);
+  void RunWorker();
+  ElfFileInfo ResolveFile(const Request& request);
+  bool LoadCacheFile();
+  bool SaveCacheFile();
+
+  const std::string cache_file_;
+  std::mutex lock_;
+  std::condition_variable request_cond_;
+  std::condition_variable result_cond_;
+  std::deque<Request> requests_;
+  std::unordered_map<std::string, FileEntry> files_;
+  std::unordered_map<std::string, CacheEntry> cache_;
+  bool cache_changed_ = false;
+  bool exit_workers_ = false;
+  size_t cache_hit_count_ = 0;
+  size_t parsed_file_count_ = 0;
+  std::vector<std::thread> workers_;
+
+  DISALLOW_COPY_AND_ASSIGN(BuildIdResolver);
+};
+
+}  // namespace simpleperf
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BuildIdResolver.h"
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+
+#include "get_test_data.h"
+#include "read_apk.h"
+#include "read_elf.h"
+
+using namespace simpleperf;
+
+static void CheckElfFileInfo(const std::string& path, const ElfFileInfo& info) {
+  BuildId build_id;
+  ASSERT_EQ(GetBuildIdFromElfFile(path, &build_id), ElfStatus::NO_ERROR);
+  ASSERT_TRUE(info.has_build_id);
+  ASSERT_EQ(info.build_id, build_id);
+  uint64_t min_vaddr;
+  uint64_t file_offset_of_min_vaddr;
+  ASSERT_EQ(ReadMinExecutableVirtualAddressFromElfFile(path, BuildId(), &min_vaddr,
+                                                       &file_offset_of_min_vaddr),
+            ElfStatus::NO_ERROR);
+  ASSERT_TRUE(info.has_min_vaddr);
+  ASSERT_EQ(info.min_vaddr, min_vaddr);
+  ASSERT_EQ(info.file_offset_of_min_vaddr, file_offset_of_min_vaddr);
+}
+
+TEST(BuildIdResolver, resolve_in_background) {
+  BuildIdResolver resolver(2);
+  std::string path = GetTestData(ELF_FILE);
+  resolver.AddFile(path);
+  resolver.AddFile(path);
+  CheckElfFileInfo(path, resolver.GetFileInfo(path));
+  ASSERT_TRUE(resolver.Finish());
+  ASSERT_EQ(resolver.ParsedFileCount(), 1u);
+}
+
+TEST(BuildIdResolver, resolve_in_calling_thread) {
+  BuildIdResolver resolver(0);
+  std::string path = GetTestData(ELF_FILE);
+  resolver.AddFile(path);
+  CheckElfFileInfo(path, resolver.GetFileInfo(path));
+  ASSERT_EQ(resolver.ParsedFileCount(), 1u);
+}
+
+TEST(BuildIdResolver, elf_in_apk) {
+  BuildIdResolver resolver(1);
+  std::string path = GetUrlInApk(GetTestData(APK_FILE), NATIVELIB_IN_APK);
+  resolver.AddFile(path);
+  ElfFileInfo info = resolver.GetFileInfo(path);
+  ASSERT_TRUE(info.has_build_id);
+  ASSERT_EQ(info.build_id, native_lib_build_id);
+  ASSERT_TRUE(info.has_min_vaddr);
+}
+
+TEST(BuildIdResolver, missing_file) {
+  BuildIdResolver resolver(1);
+  resolver.AddFile("/not_exist_file");
+  ElfFileInfo info = resolver.GetFileInfo("/not_exist_file");
+  ASSERT_FALSE(info.has_build_id);
+  ASSERT_FALSE(info.has_min_vaddr);
+}
+
+TEST(BuildIdResolver, cache_file) {
+  TemporaryFile cache_file;
+  std::string path = GetTestData(ELF_FILE);
+  {
+    BuildIdResolver resolver(1, cache_file.path);
+    resolver.AddFile(path);
+    ASSERT_TRUE(resolver.Finish());
+    ASSERT_EQ(resolver.ParsedFileCount(), 1u);
+    ASSERT_EQ(resolver.CacheHitCount(), 0u);
+  }
+  BuildIdResolver resolver(1, cache_file.path);
+  resolver.AddFile(path);
+  CheckElfFileInfo(path, resolver.GetFileInfo(path));
+  ASSERT_TRUE(resolver.Finish());
+  ASSERT_EQ(resolver.ParsedFileCount(), 0u);
+  ASSERT_EQ(resolver.CacheHitCount(), 1u);
+}
+
+TEST(BuildIdResolver, invalid_cache_file) {
+  TemporaryFile cache_file;
+  ASSERT_TRUE(android::base::WriteStringToFile("invalid content", cache_file.path));
+  BuildIdResolver resolver(1, cache_file.path);
+  std::string path = GetTestData(ELF_FILE);
+  CheckElfFileInfo(path, resolver.GetFileInfo(path));
+  ASSERT_TRUE(resolver.Finish());
+  ASSERT_EQ(resolver.ParsedFileCount(), 1u);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FlightRecorderBuffer.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace simpleperf {
+
+FlightRecorderBuffer::FlightRecorderBuffer(const perf_event_attr& attr, uint64_t duration_in_ns,
+                                           uint64_t size_limit, EvictCallback evict_callback)
+    : attr_(attr),
+      duration_in_ns_(duration_in_ns),
+      size_limit_(size_limit),
+      evict_callback_(std::move(evict_callback)) {}
+
+void FlightRecorderBuffer::Add(const Record& record) {
+  char* p = new char[record.size()];
+  memcpy(p, record.Binary(), record.size());
+  std::unique_ptr<Record> r = ReadRecordFromBuffer(attr_, record.type(), p);
+  r->OwnBinary();
+  newest_timestamp_ = std::max(newest_timestamp_, r->Timestamp());
+  size_ += r->size();
+  records_.push_back(std::move(r));
+  Evict();
+}
+
+bool FlightRecorderBuffer::Flush(const std::function<bool(const Record&)>& write_callback) {
+  for (const auto& r : records_) {
+    if (!write_callback(*r)) {
+      return false;
+    }
+  }
+  // Records written are no longer dropped when evicted.
+  while (!records_.empty()) {
+    std::unique_ptr<Record> r = std::move(records_.front());
+    records_.pop_front();
+    evict_callback_(std::move(r));
+  }
+  size_ = 0;
+  return true;
+}
+
+uint64_t FlightRecorderBuffer::OldestTimestamp() const {
+  return records_.empty() ? 0 : records_.front()->Timestamp();
+}
+
+void FlightRecorderBuffer::Evict() {
+  // Records read from different cpus are roughly ordered by time. So it is enough to only check
+  // the oldest record.
+  while (!records_.empty()) {
+    const Record& r = *records_.front();
+    if (size_ <= size_limit_ && r.Timestamp() + duration_in_ns_ >= newest_timestamp_) {
+      break;
+    }
+    size_ -= r.size();
+    if (r.type() == PERF_RECORD_SAMPLE) {
+      dropped_sample_count_++;
+    }
+    std::unique_ptr<Record> evicted = std::move(records_.front());
+    records_.pop_front();
+    evict_callback_(std::move(evicted));
+  }
+}
+
+}  // namespace simpleperf
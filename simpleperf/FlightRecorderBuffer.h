@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include <android-base/macros.h>
+
+#include "perf_event.h"
+#include "record.h"
+
+namespace simpleperf {
+
+// FlightRecorderBuffer keeps copies of the latest records in memory, used by the flight recorder
+// mode of the record command. A record is evicted when it is older than the newest record by more
+// than the kept duration, or when the total size of kept records exceeds the size limit. Evicted
+// records are passed to a callback, so the record command can remember the maps and threads they
+// describe.
+class FlightRecorderBuffer {
+ public:
+  using EvictCallback = std::function<void(std::unique_ptr<Record>)>;
+
+  FlightRecorderBuffer(const perf_event_attr& attr, uint64_t duration_in_ns, uint64_t size_limit,
+                       EvictCallback evict_callback);
+
+  void Add(const Record& record);
+  // Call write_callback on kept records from the oldest to the newest, then evict all of them.
+  bool Flush(const std::function<bool(const Record&)>& write_callback);
+
+  size_t RecordCount() const { return records_.size(); }
+  uint64_t Size() const { return size_; }
+  // Return timestamp of the oldest kept record, or 0 if there is no kept records.
+  uint64_t OldestTimestamp() const;
+  // Return the number of evicted samples, which will not be written to any record file.
+  uint64_t DroppedSampleCount() const { return dropped_sample_count_; }
+
+ private:
+  void Evict();
+
+  const perf_event_attr attr_;
+  const uint64_t duration_in_ns_;
+  const uint64_t size_limit_;
+  EvictCallback evict_callback_;
+  std::deque<std::unique_ptr<Record>> records_;
+  uint64_t size_ = 0;
+  uint64_t newest_timestamp_ = 0;
+  uint64_t dropped_sample_count_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(FlightRecorderBuffer);
+};
+
+}  // namespace simpleperf
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FlightRecorderBuffer.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "event_attr.h"
+#include "event_type.h"
+
+using namespace simpleperf;
+
+class FlightRecorderBufferTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    const EventType* type = FindEventTypeByName("cpu-clock");
+    ASSERT_TRUE(type != nullptr);
+    attr = CreateDefaultPerfEventAttr(*type);
+    attr.sample_id_all = 1;
+  }
+
+  std::unique_ptr<FlightRecorderBuffer> CreateBuffer(uint64_t duration_in_ns,
+                                                     uint64_t size_limit) {
+    return std::unique_ptr<FlightRecorderBuffer>(new FlightRecorderBuffer(
+        attr, duration_in_ns, size_limit,
+        [this](std::unique_ptr<Record> r) { evicted.push_back(std::move(r)); }));
+  }
+
+  SampleRecord CreateSample(uint64_t time) {
+    return SampleRecord(attr, 0, 0x1000, 1, 1, time, 0, 1, {}, {}, 0);
+  }
+
+  perf_event_attr attr;
+  std::vector<std::unique_ptr<Record>> evicted;
+};
+
+TEST_F(FlightRecorderBufferTest, evict_old_records) {
+  auto buffer = CreateBuffer(100, UINT64_MAX);
+  CommRecord comm(attr, 1, 1, "comm", 0, 0);
+  buffer->Add(comm);
+  for (uint64_t time : {10, 50, 120, 200}) {
+    buffer->Add(CreateSample(time));
+  }
+  // Records older than 200 - 100 are evicted.
+  ASSERT_EQ(3u, evicted.size());
+  ASSERT_EQ(PERF_RECORD_COMM, evicted[0]->type());
+  ASSERT_EQ(50u, evicted[2]->Timestamp());
+  ASSERT_EQ(2u, buffer->DroppedSampleCount());
+  ASSERT_EQ(2u, buffer->RecordCount());
+  ASSERT_EQ(120u, buffer->OldestTimestamp());
+}
+
+TEST_F(FlightRecorderBufferTest, evict_by_size_limit) {
+  SampleRecord sample = CreateSample(0);
+  auto buffer = CreateBuffer(UINT64_MAX / 2, sample.size() * 2);
+  for (uint64_t time = 0; time < 5; ++time) {
+    buffer->Add(CreateSample(time));
+  }
+  ASSERT_EQ(2u, buffer->RecordCount());
+  ASSERT_EQ(sample.size() * 2, buffer->Size());
+  ASSERT_EQ(3u, buffer->DroppedSampleCount());
+}
+
+TEST_F(FlightRecorderBufferTest, flush) {
+  auto buffer = CreateBuffer(100, UINT64_MAX);
+  for (uint64_t time : {10, 20, 30}) {
+    buffer->Add(CreateSample(time));
+  }
+  std::vector<uint64_t> written;
+  ASSERT_TRUE(buffer->Flush([&](const Record& r) {
+    written.push_back(r.Timestamp());
+    return true;
+  }));
+  ASSERT_EQ(std::vector<uint64_t>({10, 20, 30}), written);
+  ASSERT_EQ(0u, buffer->RecordCount());
+  ASSERT_EQ(0u, buffer->OldestTimestamp());
+  // Flushed samples aren't dropped.
+  ASSERT_EQ(0u, buffer->DroppedSampleCount());
+  ASSERT_EQ(3u, evicted.size());
+}
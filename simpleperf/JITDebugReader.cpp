@@ -195,14 +195,17 @@ bool JITDebugReader::ReadAllProcesses() {
     return false;
   }
   std::vector<JITDebugInfo> debug_info;
-  for (auto it = processes_.begin(); it != processes_.end();) {
-    Process& process = it->second;
-    ReadProcess(process, &debug_info);
-    if (process.died) {
-      LOG(DEBUG) << "Stop monitoring process " << process.pid;
-      it = processes_.erase(it);
-    } else {
-      ++it;
+  {
+    ScopedStageTimer timer(read_stat_);
+    for (auto it = processes_.begin(); it != processes_.end();) {
+      Process& process = it->second;
+      ReadProcess(process, &debug_info);
+      if (process.died) {
+        LOG(DEBUG) << "Stop monitoring process " << process.pid;
+        it = processes_.erase(it);
+      } else {
+        ++it;
+      }
     }
   }
   if (!AddDebugInfo(debug_info, true)) {
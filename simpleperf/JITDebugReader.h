@@ -32,6 +32,7 @@
 
 #include "IOEventLoop.h"
 #include "record.h"
+#include "StageStat.h"
 
 namespace simpleperf {
 
@@ -100,6 +101,10 @@ class JITDebugReader {
   // Flush all debug info registered before timestamp.
   bool FlushDebugInfo(uint64_t timestamp);
 
+  // Collect time used to read debug info from processes in ReadAllProcesses(), excluding
+  // the callback.
+  void SetReadStat(StageStat* stat) { read_stat_ = stat; }
+
  private:
 
   // An arch-independent representation of JIT/dex debug descriptor.
@@ -172,6 +177,7 @@ class JITDebugReader {
   bool sync_with_records_ = false;
   IOEventRef read_event_ = nullptr;
   debug_info_callback_t debug_info_callback_;
+  StageStat* read_stat_ = nullptr;
 
   // Keys are pids of processes having libart.so, values show whether a process has been monitored.
   std::unordered_map<pid_t, bool> pids_with_art_lib_;
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "KernelSymbolTable.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+
+#include "utils.h"
+
+namespace simpleperf {
+
+// "KSYM" in little endian.
+static constexpr uint32_t kKernelSymbolTableMagic = 0x4d59534b;
+
+bool KernelSymbolTable::Build(std::string& kallsyms, std::vector<char>* data) {
+  struct Entry {
+    uint64_t addr;
+    uint32_t name_offset;
+  };
+  std::vector<Entry> entries;
+  std::string name_blob;
+  auto callback = [&](const KernelSymbol& symbol) {
+    if (strchr("TtWw", symbol.type) && symbol.addr != 0u) {
+      entries.push_back(Entry{symbol.addr, static_cast<uint32_t>(name_blob.size())});
+      name_blob.append(symbol.name);
+      name_blob.push_back('\0');
+    }
+    return false;
+  };
+  ProcessKernelSymbols(kallsyms, callback);
+  if (entries.empty()) {
+    return false;
+  }
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const Entry& e1, const Entry& e2) { return e1.addr < e2.addr; });
+  uint32_t symbol_count = entries.size();
+  data->resize(sizeof(uint32_t) * 2 + (sizeof(uint64_t) + sizeof(uint32_t)) * symbol_count +
+               name_blob.size());
+  char* p = data->data();
+  MoveToBinaryFormat(kKernelSymbolTableMagic, p);
+  MoveToBinaryFormat(symbol_count, p);
+  for (const Entry& entry : entries) {
+    MoveToBinaryFormat(entry.addr, p);
+  }
+  for (const Entry& entry : entries) {
+    MoveToBinaryFormat(entry.name_offset, p);
+  }
+  MoveToBinaryFormat(name_blob.data(), name_blob.size(), p);
+  return true;
+}
+
+bool KernelSymbolTable::Open(const char* data, size_t size) {
+  const char* end = data + size;
+  uint32_t magic;
+  uint32_t symbol_count;
+  if (size < sizeof(magic) + sizeof(symbol_count)) {
+    LOG(ERROR) << "kernel symbol table is too small";
+    return false;
+  }
+  MoveFromBinaryFormat(magic, data);
+  MoveFromBinaryFormat(symbol_count, data);
+  if (magic != kKernelSymbolTableMagic) {
+    LOG(ERROR) << "unexpected kernel symbol table magic: " << std::hex << magic;
+    return false;
+  }
+  size_t index_size = (sizeof(uint64_t) + sizeof(uint32_t)) * static_cast<size_t>(symbol_count);
+  if (static_cast<size_t>(end - data) < index_size) {
+    LOG(ERROR) << "kernel symbol table is truncated";
+    return false;
+  }
+  const uint64_t* addrs = reinterpret_cast<const uint64_t*>(data);
+  const uint32_t* name_offsets = reinterpret_cast<const uint32_t*>(addrs + symbol_count);
+  const char* name_blob = reinterpret_cast<const char*>(name_offsets + symbol_count);
+  size_t name_blob_size = end - name_blob;
+  if (name_blob_size == 0 || name_blob[name_blob_size - 1] != '\0') {
+    LOG(ERROR) << "invalid name blob in kernel symbol table";
+    return false;
+  }
+  for (uint32_t i = 0; i < symbol_count; ++i) {
+    if (name_offsets[i] >= name_blob_size) {
+      LOG(ERROR) << "invalid name offset in kernel symbol table";
+      return false;
+    }
+  }
+  symbol_count_ = symbol_count;
+  addrs_ = addrs;
+  name_offsets_ = name_offsets;
+  name_blob_ = name_blob;
+  return true;
+}
+
+}  // namespace simpleperf
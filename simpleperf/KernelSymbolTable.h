@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace simpleperf {
+
+// KernelSymbolTable is a binary image of kernel function symbols, stored in the kernel_symbols
+// feature section of perf.data. Unlike the text in /proc/kallsyms, it can be used without
+// parsing. Its format is:
+//   uint32_t magic;  // kKernelSymbolTableMagic
+//   uint32_t symbol_count;
+//   uint64_t addrs[symbol_count];  // sorted in ascending order
+//   uint32_t name_offsets[symbol_count];  // offsets of names in name_blob
+//   char name_blob[];  // null terminated names
+class KernelSymbolTable {
+ public:
+  // Build a table from the content of /proc/kallsyms. Only function symbols with non-zero
+  // addresses are kept. Return false if there are no such symbols.
+  static bool Build(std::string& kallsyms, std::vector<char>* data);
+
+  // Check and use a table built by Build(). The data isn't copied, so it should live longer
+  // than the table, and be 8-byte aligned.
+  bool Open(const char* data, size_t size);
+
+  size_t SymbolCount() const {
+    return symbol_count_;
+  }
+  uint64_t GetAddr(size_t index) const {
+    return addrs_[index];
+  }
+  const char* GetName(size_t index) const {
+    return name_blob_ + name_offsets_[index];
+  }
+
+ private:
+  size_t symbol_count_ = 0;
+  const uint64_t* addrs_ = nullptr;
+  const uint32_t* name_offsets_ = nullptr;
+  const char* name_blob_ = nullptr;
+};
+
+}  // namespace simpleperf
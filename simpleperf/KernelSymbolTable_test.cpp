@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "KernelSymbolTable.h"
+
+#include <gtest/gtest.h>
+
+using namespace simpleperf;
+
+TEST(KernelSymbolTable, smoke) {
+  std::string kallsyms =
+      "ffffffffa005c4e4 d __warned.41698   [libsas]\n"
+      "ffffffffa0060000 t sas_init   [libsas]\n"
+      "ffffffff81000000 T _text\n"
+      "ffffffff81000100 W weak_func\n"
+      "0000000000000000 T zero_addr_func\n"
+      "ffffffff81000080 t local_func\n";
+  std::vector<char> data;
+  ASSERT_TRUE(KernelSymbolTable::Build(kallsyms, &data));
+  KernelSymbolTable table;
+  ASSERT_TRUE(table.Open(data.data(), data.size()));
+  ASSERT_EQ(table.SymbolCount(), 4u);
+  // Symbols are sorted by address.
+  ASSERT_EQ(table.GetAddr(0), 0xffffffff81000000);
+  ASSERT_STREQ(table.GetName(0), "_text");
+  ASSERT_EQ(table.GetAddr(1), 0xffffffff81000080);
+  ASSERT_STREQ(table.GetName(1), "local_func");
+  ASSERT_EQ(table.GetAddr(2), 0xffffffff81000100);
+  ASSERT_STREQ(table.GetName(2), "weak_func");
+  ASSERT_EQ(table.GetAddr(3), 0xffffffffa0060000);
+  ASSERT_STREQ(table.GetName(3), "sas_init");
+}
+
+TEST(KernelSymbolTable, no_symbols) {
+  std::string kallsyms = "0000000000000000 T _text\n0000000000000000 t local_func\n";
+  std::vector<char> data;
+  ASSERT_FALSE(KernelSymbolTable::Build(kallsyms, &data));
+}
+
+TEST(KernelSymbolTable, invalid_data) {
+  std::string kallsyms = "ffffffff81000000 T _text\n";
+  std::vector<char> data;
+  ASSERT_TRUE(KernelSymbolTable::Build(kallsyms, &data));
+  KernelSymbolTable table;
+  // Truncated data.
+  ASSERT_FALSE(table.Open(data.data(), 4));
+  ASSERT_FALSE(table.Open(data.data(), data.size() - 1));
+  // Wrong magic.
+  std::vector<char> bad_data = data;
+  bad_data[0] ^= 1;
+  ASSERT_FALSE(table.Open(bad_data.data(), bad_data.size()));
+}
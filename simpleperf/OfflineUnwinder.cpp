@@ -18,6 +18,9 @@
 
 #include <sys/mman.h>
 
+#include <list>
+#include <mutex>
+
 #include <android-base/logging.h>
 #include <unwindstack/MachineArm.h>
 #include <unwindstack/MachineArm64.h>
@@ -116,7 +119,90 @@ static unwindstack::Regs* GetBacktraceRegs(const RegSet& regs) {
   }
 }
 
-static unwindstack::MapInfo* CreateMapInfo(const MapEntry* entry) {
+// OfflineUnwinders can run in multiple threads (in debug-unwind cmd), but ApkInspector isn't
+// thread safe.
+static std::mutex apk_inspector_lock;
+
+// ElfCache keeps parsed Elf objects (including their CIE/FDE tables) after the maps using them
+// are removed, so they can be reused when a file is mapped again, in the same or another process.
+// Elf objects are keyed by build id (or path if the build id is unknown) and file offset. The
+// memory used by an Elf object is approximated by the size of its executable map. Least recently
+// used Elf objects are evicted when the total size exceeds the capacity.
+class ElfCache {
+ public:
+  static ElfCache& GetInstance() {
+    static ElfCache cache;
+    return cache;
+  }
+
+  void SetCapacity(uint64_t capacity) {
+    std::lock_guard<std::mutex> lock(lock_);
+    stat_.capacity = capacity;
+    Evict();
+  }
+
+  bool Get(const std::string& key, std::shared_ptr<unwindstack::Elf>* elf, uint64_t* elf_offset) {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = key_map_.find(key);
+    if (it == key_map_.end()) {
+      stat_.miss_count++;
+      return false;
+    }
+    stat_.hit_count++;
+    lru_list_.splice(lru_list_.begin(), lru_list_, it->second);
+    *elf = it->second->elf;
+    *elf_offset = it->second->elf_offset;
+    return true;
+  }
+
+  void Put(const std::string& key, const std::shared_ptr<unwindstack::Elf>& elf,
+           uint64_t elf_offset, uint64_t size) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (size > stat_.capacity || key_map_.find(key) != key_map_.end()) {
+      return;
+    }
+    lru_list_.push_front(Entry{key, elf, elf_offset, size});
+    key_map_[key] = lru_list_.begin();
+    stat_.size += size;
+    stat_.elf_count++;
+    Evict();
+  }
+
+  ElfCacheStat GetStat() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return stat_;
+  }
+
+ private:
+  struct Entry {
+    std::string key;
+    std::shared_ptr<unwindstack::Elf> elf;
+    uint64_t elf_offset;
+    uint64_t size;
+  };
+
+  // Disabled by default, so Elf objects are cached by unwindstack as before.
+  ElfCache() {}
+
+  void Evict() {
+    while (stat_.size > stat_.capacity) {
+      const Entry& entry = lru_list_.back();
+      stat_.size -= entry.size;
+      stat_.elf_count--;
+      stat_.evict_count++;
+      key_map_.erase(entry.key);
+      lru_list_.pop_back();
+    }
+  }
+
+  std::mutex lock_;
+  // The most recently used entry is at the front.
+  std::list<Entry> lru_list_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> key_map_;
+  ElfCacheStat stat_;
+};
+
+unwindstack::MapInfo* UnwindMaps::CreateMapInfo(const MapEntry* entry) {
   const char* name = entry->dso->GetDebugFilePath().c_str();
   uint64_t pgoff = entry->pgoff;
   if (entry->pgoff == 0) {
@@ -124,6 +210,7 @@ static unwindstack::MapInfo* CreateMapInfo(const MapEntry* entry) {
     if (std::get<0>(tuple)) {
       // The unwinder does not understand the ! format, so change back to
       // the previous format (apk, offset).
+      std::lock_guard<std::mutex> lock(apk_inspector_lock);
       EmbeddedElf* elf = ApkInspector::FindElfInApkByName(std::get<1>(tuple), std::get<2>(tuple));
       if (elf != nullptr) {
         name = elf->filepath().c_str();
@@ -131,8 +218,56 @@ static unwindstack::MapInfo* CreateMapInfo(const MapEntry* entry) {
       }
     }
   }
-  return new unwindstack::MapInfo(nullptr, entry->start_addr, entry->get_end_addr(), pgoff,
-                                  PROT_READ | PROT_EXEC | entry->flags, name);
+  auto map_info = new unwindstack::MapInfo(nullptr, entry->start_addr, entry->get_end_addr(),
+                                           pgoff, PROT_READ | PROT_EXEC | entry->flags, name);
+  // Symfiles of JITed code are temporary files, not worth caching.
+  if (entry->flags & map_flags::PROT_JIT_SYMFILE_MAP) {
+    return map_info;
+  }
+  BuildId build_id = Dso::FindExpectedBuildIdForPath(entry->dso->Path());
+  std::string key = build_id.IsEmpty() ? name : build_id.ToString();
+  key += "@" + std::to_string(pgoff);
+  if (!ElfCache::GetInstance().Get(key, &map_info->elf, &map_info->elf_offset)) {
+    elf_cache_keys_[map_info] = key;
+  }
+  return map_info;
+}
+
+void UnwindMaps::RemoveMap(size_t index) {
+  auto it = elf_cache_keys_.find(maps_[index].get());
+  if (it != elf_cache_keys_.end()) {
+    unwindstack::MapInfo* map_info = maps_[index].get();
+    if (map_info->elf) {
+      ElfCache::GetInstance().Put(it->second, map_info->elf, map_info->elf_offset,
+                                  map_info->end - map_info->start);
+    }
+    elf_cache_keys_.erase(it);
+  }
+  entries_[index] = nullptr;
+  maps_[index] = nullptr;
+}
+
+void UnwindMaps::AddLoadedElfsToCache(const std::vector<unwindstack::FrameData>& frames) {
+  if (elf_cache_keys_.empty()) {
+    return;
+  }
+  uint64_t prev_map_start = 0;
+  for (const auto& frame : frames) {
+    if (frame.map_start == 0 || frame.map_start == prev_map_start) {
+      continue;
+    }
+    prev_map_start = frame.map_start;
+    unwindstack::MapInfo* map_info = Find(frame.map_start);
+    if (map_info == nullptr || !map_info->elf) {
+      continue;
+    }
+    auto it = elf_cache_keys_.find(map_info);
+    if (it != elf_cache_keys_.end()) {
+      ElfCache::GetInstance().Put(it->second, map_info->elf, map_info->elf_offset,
+                                  map_info->end - map_info->start);
+      elf_cache_keys_.erase(it);
+    }
+  }
 }
 
 void UnwindMaps::UpdateMaps(const MapSet& map_set) {
@@ -142,25 +277,28 @@ void UnwindMaps::UpdateMaps(const MapSet& map_set) {
   version_ = map_set.version;
   size_t i = 0;
   size_t old_size = entries_.size();
+  std::vector<const MapEntry*> new_entries;
   for (auto it = map_set.maps.begin(); it != map_set.maps.end();) {
     const MapEntry* entry = it->second;
     if (i < old_size && entry == entries_[i]) {
       i++;
       ++it;
     } else if (i == old_size || entry->start_addr <= entries_[i]->start_addr) {
-      // Add an entry.
-      entries_.push_back(entry);
-      maps_.emplace_back(CreateMapInfo(entry));
+      // Add an entry. It is created after removing entries, so it can reuse Elf objects of
+      // removed entries.
+      new_entries.push_back(entry);
       ++it;
     } else {
       // Remove an entry.
-      entries_[i] = nullptr;
-      maps_[i++] = nullptr;
+      RemoveMap(i++);
     }
   }
   while (i < old_size) {
-    entries_[i] = nullptr;
-    maps_[i++] = nullptr;
+    RemoveMap(i++);
+  }
+  for (const MapEntry* entry : new_entries) {
+    entries_.push_back(entry);
+    maps_.emplace_back(CreateMapInfo(entry));
   }
   std::sort(entries_.begin(), entries_.end(), [](const auto& e1, const auto& e2) {
     if (e1 == nullptr || e2 == nullptr) {
@@ -179,8 +317,24 @@ void UnwindMaps::UpdateMaps(const MapSet& map_set) {
   maps_.resize(map_set.maps.size());
 }
 
+// Elf objects are cached either by ElfCache or by unwindstack, never by both. The unwindstack
+// cache is process wide and unbounded, so it is only used when ElfCache is disabled. The setting
+// is process wide, but in simpleperf only OfflineUnwinder uses unwindstack.
+static void UpdateUnwindstackElfCaching() {
+  unwindstack::Elf::SetCachingEnabled(ElfCache::GetInstance().GetStat().capacity == 0);
+}
+
 OfflineUnwinder::OfflineUnwinder(bool collect_stat) : collect_stat_(collect_stat) {
-  unwindstack::Elf::SetCachingEnabled(true);
+  UpdateUnwindstackElfCaching();
+}
+
+void OfflineUnwinder::SetElfCacheSize(uint64_t size) {
+  ElfCache::GetInstance().SetCapacity(size);
+  UpdateUnwindstackElfCaching();
+}
+
+ElfCacheStat OfflineUnwinder::GetElfCacheStat() {
+  return ElfCache::GetInstance().GetStat();
 }
 
 bool OfflineUnwinder::UnwindCallChain(const ThreadEntry& thread, const RegSet& regs,
@@ -214,6 +368,7 @@ bool OfflineUnwinder::UnwindCallChain(const ThreadEntry& thread, const RegSet& r
                                  stack_memory);
   unwinder.SetResolveNames(false);
   unwinder.Unwind();
+  cached_map.AddLoadedElfsToCache(unwinder.frames());
   size_t last_jit_method_frame = UINT_MAX;
   for (auto& frame : unwinder.frames()) {
     // Unwinding in arm architecture can return 0 pc address.
@@ -18,6 +18,7 @@
 #define SIMPLE_PERF_OFFLINE_UNWINDER_H_
 
 #include <memory>
+#include <string>
 #include <vector>
 #include <unordered_map>
 
@@ -26,6 +27,10 @@
 
 #if defined(__linux__)
 #include <unwindstack/Maps.h>
+
+namespace unwindstack {
+struct FrameData;
+}
 #endif
 
 namespace simpleperf {
@@ -55,20 +60,47 @@ struct UnwindingResult {
   uint64_t stack_end;
 };
 
+// Stat of the Elf cache shared by all OfflineUnwinders.
+struct ElfCacheStat {
+  // Max memory used by cached Elf objects, in bytes.
+  uint64_t capacity = 0;
+  // Memory used by cached Elf objects, in bytes.
+  uint64_t size = 0;
+  uint64_t elf_count = 0;
+  uint64_t hit_count = 0;
+  uint64_t miss_count = 0;
+  uint64_t evict_count = 0;
+};
+
 #if defined(__linux__)
 class UnwindMaps : public unwindstack::Maps {
  public:
   void UpdateMaps(const MapSet& map_set);
+  // Add Elf objects loaded while unwinding frames to the Elf cache, so they can be reused by
+  // other processes.
+  void AddLoadedElfsToCache(const std::vector<unwindstack::FrameData>& frames);
 
  private:
+  unwindstack::MapInfo* CreateMapInfo(const MapEntry* entry);
+  void RemoveMap(size_t index);
+
   uint64_t version_ = 0u;
   std::vector<const MapEntry*> entries_;
+  // Cache keys of MapInfos whose Elf objects are not in the Elf cache yet.
+  std::unordered_map<const unwindstack::MapInfo*, std::string> elf_cache_keys_;
 };
 
 class OfflineUnwinder {
  public:
   OfflineUnwinder(bool collect_stat);
 
+  // Parsed Elf objects are cached by build id, and reused across map updates and processes.
+  // The cache size is the max memory used by cached Elf objects. It is 0 by default, which
+  // disables the cache and falls back to the unbounded cache in unwindstack. It should be set
+  // before unwinding starts.
+  static void SetElfCacheSize(uint64_t size);
+  static ElfCacheStat GetElfCacheStat();
+
   bool UnwindCallChain(const ThreadEntry& thread, const RegSet& regs, const char* stack,
                        size_t stack_size, std::vector<uint64_t>* ips, std::vector<uint64_t>* sps);
 
@@ -97,6 +129,10 @@ class OfflineUnwinder {
 class OfflineUnwinder {
  public:
   OfflineUnwinder(bool) {}
+  static void SetElfCacheSize(uint64_t) {}
+  static ElfCacheStat GetElfCacheStat() {
+    return ElfCacheStat();
+  }
   bool UnwindCallChain(const ThreadEntry&, const RegSet&, const char*, size_t,
                        std::vector<uint64_t>*, std::vector<uint64_t>*) {
     return false;
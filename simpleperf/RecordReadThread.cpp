@@ -214,6 +214,21 @@ RecordReadThread::RecordReadThread(size_t record_buffer_size, const perf_event_a
   record_buffer_critical_level_ = std::min(record_buffer_size / 6, kDefaultCriticalBufferLevel);
 }
 
+void RecordReadThread::EnableStageStats() {
+  kernel_read_stat_.reset(new StageStat("kernel_buffer_read", "ns"));
+  record_buffer_usage_stat_.reset(new StageStat("record_buffer_usage", "bytes"));
+}
+
+std::vector<StageStat> RecordReadThread::GetStageStats() {
+  std::vector<StageStat> stats;
+  std::lock_guard<std::mutex> lock(stat_mutex_);
+  if (kernel_read_stat_) {
+    stats.push_back(*kernel_read_stat_);
+    stats.push_back(*record_buffer_usage_stat_);
+  }
+  return stats;
+}
+
 RecordReadThread::~RecordReadThread() {
   if (read_thread_) {
     StopReadThread();
@@ -413,6 +428,7 @@ static bool CompareRecordTime(KernelRecordReader* r1, KernelRecordReader* r2) {
 // different buffers easily in memory. Otherwise, we have to sort records with greater effort.
 bool RecordReadThread::ReadRecordsFromKernelBuffer() {
   do {
+    uint64_t start_time = kernel_read_stat_ ? GetSystemClock() : 0;
     std::vector<KernelRecordReader*> readers;
     for (auto& reader : kernel_record_readers_) {
       if (reader.GetDataFromKernelBuffer()) {
@@ -447,6 +463,11 @@ bool RecordReadThread::ReadRecordsFromKernelBuffer() {
         }
       }
     }
+    if (kernel_read_stat_) {
+      std::lock_guard<std::mutex> lock(stat_mutex_);
+      kernel_read_stat_->Add(GetSystemClock() - start_time);
+      record_buffer_usage_stat_->Add(record_buffer_.size() - record_buffer_.GetFreeSize());
+    }
     if (!SendDataNotificationToMainThread()) {
       return false;
     }
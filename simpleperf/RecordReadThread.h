@@ -24,12 +24,14 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include <android-base/macros.h>
 #include <android-base/unique_fd.h>
 
 #include "event_fd.h"
 #include "record.h"
+#include "StageStat.h"
 
 namespace simpleperf {
 
@@ -121,6 +123,9 @@ class RecordReadThread {
     record_buffer_low_level_ = record_buffer_low_level;
     record_buffer_critical_level_ = record_buffer_critical_level;
   }
+  // Collect time used to read kernel buffers and usage of the RecordBuffer. It should be called
+  // before RegisterDataCallback().
+  void EnableStageStats();
 
   // Below functions are called in the main thread:
 
@@ -142,6 +147,8 @@ class RecordReadThread {
     *lost_non_samples = lost_non_samples_;
     *cut_stack_samples = cut_stack_samples_;
   }
+  // Return a copy of stage stats, which are updated in the read thread.
+  std::vector<StageStat> GetStageStats();
 
  private:
   enum Cmd {
@@ -198,6 +205,11 @@ class RecordReadThread {
   size_t lost_samples_ = 0;
   size_t lost_non_samples_ = 0;
   size_t cut_stack_samples_ = 0;
+
+  // Stats updated in the read thread, protected by stat_mutex_.
+  std::mutex stat_mutex_;
+  std::unique_ptr<StageStat> kernel_read_stat_;
+  std::unique_ptr<StageStat> record_buffer_usage_stat_;
 };
 
 }  // namespace simpleperf
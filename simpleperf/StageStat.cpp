@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StageStat.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include <android-base/stringprintf.h>
+
+namespace simpleperf {
+
+void StageStat::Add(uint64_t value) {
+  count_++;
+  sum_ += value;
+  max_ = std::max(max_, value);
+  size_t bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  buckets_[bucket]++;
+}
+
+uint64_t StageStat::Percentile(double percentile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(count_ * percentile / 100));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    seen += buckets_[i];
+    if (seen >= target) {
+      if (i == 0) {
+        return 0;
+      }
+      // The upper bound of the last bucket doesn't fit in uint64_t.
+      return i == kBucketCount - 1 ? UINT64_MAX : (static_cast<uint64_t>(1) << i) - 1;
+    }
+  }
+  return max_;
+}
+
+std::string StageStat::ToString() const {
+  auto value_str = [&](uint64_t value) { return std::to_string(value) + unit_; };
+  uint64_t avg = count_ == 0 ? 0 : sum_ / count_;
+  return android::base::StringPrintf(
+      "count %" PRIu64 ", sum %s, avg %s, p50 <= %s, p99 <= %s, max %s", count_,
+      value_str(sum_).c_str(), value_str(avg).c_str(),
+      value_str(std::min(Percentile(50), max_)).c_str(),
+      value_str(std::min(Percentile(99), max_)).c_str(), value_str(max_).c_str());
+}
+
+}  // namespace simpleperf
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "environment.h"
+
+namespace simpleperf {
+
+// StageStat collects values of a stage in a pipeline, like time used by each run of the stage.
+// It keeps the count, sum, max and a histogram of values with power-of-two buckets, so
+// percentiles can be estimated. It isn't thread safe, each stage should be updated in one thread.
+class StageStat {
+ public:
+  StageStat(const std::string& name, const std::string& unit) : name_(name), unit_(unit) {}
+
+  const std::string& Name() const { return name_; }
+  void Add(uint64_t value);
+  uint64_t Count() const { return count_; }
+  uint64_t Sum() const { return sum_; }
+  uint64_t Max() const { return max_; }
+  // Return the upper bound of the bucket containing the value at percentile (in [0, 100]).
+  uint64_t Percentile(double percentile) const;
+  // Return a summary like "count 10, sum 100ns, avg 10ns, p50 <= 16ns, p99 <= 32ns, max 20ns".
+  std::string ToString() const;
+
+ private:
+  // Bucket 0 has value 0. Bucket i (i > 0) has values in [2^(i-1), 2^i).
+  static constexpr size_t kBucketCount = 65;
+
+  const std::string name_;
+  const std::string unit_;
+  uint64_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint64_t max_ = 0;
+  uint64_t buckets_[kBucketCount] = {};
+};
+
+// ScopedStageTimer adds the time used in its scope to a StageStat. If the StageStat is nullptr,
+// it doesn't read the clock.
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(StageStat* stat) : stat_(stat) {
+    if (stat_ != nullptr) {
+      start_time_in_ns_ = GetSystemClock();
+    }
+  }
+
+  ~ScopedStageTimer() {
+    if (stat_ != nullptr) {
+      stat_->Add(GetSystemClock() - start_time_in_ns_);
+    }
+  }
+
+ private:
+  StageStat* stat_;
+  uint64_t start_time_in_ns_ = 0;
+};
+
+}  // namespace simpleperf
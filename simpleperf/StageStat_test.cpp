@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StageStat.h"
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+using namespace simpleperf;
+
+TEST(StageStat, smoke) {
+  StageStat stat("test", "ns");
+  ASSERT_EQ(0u, stat.Percentile(50));
+  for (uint64_t value = 1; value <= 100; ++value) {
+    stat.Add(value);
+  }
+  ASSERT_EQ(100u, stat.Count());
+  ASSERT_EQ(5050u, stat.Sum());
+  ASSERT_EQ(100u, stat.Max());
+  // Value 50 is in bucket [32, 64).
+  ASSERT_EQ(63u, stat.Percentile(50));
+  // Value 99 is in bucket [64, 128).
+  ASSERT_EQ(127u, stat.Percentile(99));
+  ASSERT_EQ("count 100, sum 5050ns, avg 50ns, p50 <= 63ns, p99 <= 100ns, max 100ns",
+            stat.ToString());
+}
+
+TEST(StageStat, zero_and_large_values) {
+  StageStat stat("test", "bytes");
+  stat.Add(0);
+  ASSERT_EQ(0u, stat.Percentile(100));
+  stat.Add(UINT64_MAX);
+  ASSERT_EQ(UINT64_MAX, stat.Percentile(100));
+  ASSERT_EQ(UINT64_MAX, stat.Max());
+}
+
+TEST(StageStat, scoped_timer) {
+  StageStat stat("test", "ns");
+  {
+    ScopedStageTimer timer(&stat);
+    usleep(1000);
+  }
+  ASSERT_EQ(1u, stat.Count());
+  ASSERT_GE(stat.Sum(), 1000000u);
+  {
+    // A nullptr StageStat disables the timer.
+    ScopedStageTimer timer(nullptr);
+  }
+}
@@ -15,8 +15,12 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -75,6 +79,189 @@ static bool GetMemStat(MemStat* stat) {
   return true;
 }
 
+// UnwindingReplayer unwinds samples on multiple threads, and collects stat to measure unwinding
+// performance. Samples are unwound in batches. The current batch should be finished by calling
+// Flush() before changing the thread tree, so worker threads only read the thread tree.
+class UnwindingReplayer {
+ public:
+  static constexpr size_t kStopReasonCount = UnwindingResult::MAP_MISSING + 1;
+
+  struct DsoStat {
+    uint64_t frame_count = 0;
+    // Samples whose last unwound frame is in this dso.
+    uint64_t last_frame_count = 0;
+    // Unwinding time of a sample is evenly shared by its frames.
+    double unwinding_time_in_ns = 0;
+  };
+
+  struct Stat {
+    uint64_t sample_count = 0;
+    uint64_t failed_sample_count = 0;
+    uint64_t frame_count = 0;
+    uint64_t total_unwinding_time_in_ns = 0;
+    uint64_t max_unwinding_time_in_ns = 0;
+    uint64_t stop_reason_count[kStopReasonCount] = {};
+    std::unordered_map<const Dso*, DsoStat> dso_stat;
+
+    void Merge(const Stat& other);
+  };
+
+  UnwindingReplayer(ThreadTree& thread_tree, size_t thread_count);
+  ~UnwindingReplayer();
+
+  void AddSample(std::unique_ptr<Record> record, const ThreadEntry* thread);
+  // Unwind all added samples, and wait until they are finished.
+  void Flush();
+  // Return stat merged from all worker threads.
+  Stat GetStat() const;
+  // Return wall time spent in unwinding samples.
+  uint64_t WallTimeInNs() const { return wall_time_in_ns_; }
+
+ private:
+  struct Sample {
+    std::unique_ptr<Record> record;
+    const ThreadEntry* thread;
+  };
+
+  void RunWorker(size_t worker_id);
+  void UnwindSample(const Sample& sample, OfflineUnwinder& unwinder, Stat& stat);
+
+  ThreadTree& thread_tree_;
+  std::vector<Sample> samples_;
+  std::atomic_size_t next_sample_;
+  std::mutex lock_;
+  std::condition_variable start_cond_;
+  std::condition_variable finish_cond_;
+  uint64_t batch_id_ = 0;
+  size_t running_workers_ = 0;
+  bool exit_workers_ = false;
+  std::vector<Stat> worker_stats_;
+  std::vector<std::thread> workers_;
+  uint64_t wall_time_in_ns_ = 0;
+};
+
+void UnwindingReplayer::Stat::Merge(const Stat& other) {
+  sample_count += other.sample_count;
+  failed_sample_count += other.failed_sample_count;
+  frame_count += other.frame_count;
+  total_unwinding_time_in_ns += other.total_unwinding_time_in_ns;
+  max_unwinding_time_in_ns = std::max(max_unwinding_time_in_ns, other.max_unwinding_time_in_ns);
+  for (size_t i = 0; i < kStopReasonCount; ++i) {
+    stop_reason_count[i] += other.stop_reason_count[i];
+  }
+  for (auto& pair : other.dso_stat) {
+    DsoStat& dso_stat = this->dso_stat[pair.first];
+    dso_stat.frame_count += pair.second.frame_count;
+    dso_stat.last_frame_count += pair.second.last_frame_count;
+    dso_stat.unwinding_time_in_ns += pair.second.unwinding_time_in_ns;
+  }
+}
+
+UnwindingReplayer::UnwindingReplayer(ThreadTree& thread_tree, size_t thread_count)
+    : thread_tree_(thread_tree), next_sample_(0), worker_stats_(thread_count) {
+  for (size_t i = 0; i < thread_count; ++i) {
+    workers_.emplace_back([this, i]() { RunWorker(i); });
+  }
+}
+
+UnwindingReplayer::~UnwindingReplayer() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    exit_workers_ = true;
+  }
+  start_cond_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void UnwindingReplayer::AddSample(std::unique_ptr<Record> record, const ThreadEntry* thread) {
+  // Limit the memory used by stack data of pending samples.
+  constexpr size_t MAX_PENDING_SAMPLES = 1024;
+  samples_.push_back(Sample{std::move(record), thread});
+  if (samples_.size() == MAX_PENDING_SAMPLES) {
+    Flush();
+  }
+}
+
+void UnwindingReplayer::Flush() {
+  if (samples_.empty()) {
+    return;
+  }
+  uint64_t start_time = GetSystemClock();
+  std::unique_lock<std::mutex> lock(lock_);
+  next_sample_ = 0;
+  running_workers_ = workers_.size();
+  batch_id_++;
+  start_cond_.notify_all();
+  finish_cond_.wait(lock, [&]() { return running_workers_ == 0; });
+  wall_time_in_ns_ += GetSystemClock() - start_time;
+  samples_.clear();
+}
+
+UnwindingReplayer::Stat UnwindingReplayer::GetStat() const {
+  Stat stat;
+  for (auto& worker_stat : worker_stats_) {
+    stat.Merge(worker_stat);
+  }
+  return stat;
+}
+
+void UnwindingReplayer::RunWorker(size_t worker_id) {
+  OfflineUnwinder unwinder(true);
+  Stat& stat = worker_stats_[worker_id];
+  uint64_t finished_batch_id = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      start_cond_.wait(lock, [&]() { return exit_workers_ || batch_id_ != finished_batch_id; });
+      if (exit_workers_) {
+        return;
+      }
+      finished_batch_id = batch_id_;
+    }
+    size_t i;
+    while ((i = next_sample_++) < samples_.size()) {
+      UnwindSample(samples_[i], unwinder, stat);
+    }
+    std::lock_guard<std::mutex> lock(lock_);
+    if (--running_workers_ == 0) {
+      finish_cond_.notify_one();
+    }
+  }
+}
+
+void UnwindingReplayer::UnwindSample(const Sample& sample, OfflineUnwinder& unwinder,
+                                     Stat& stat) {
+  auto& r = *static_cast<const SampleRecord*>(sample.record.get());
+  RegSet regs(r.regs_user_data.abi, r.regs_user_data.reg_mask, r.regs_user_data.regs);
+  std::vector<uint64_t> ips;
+  std::vector<uint64_t> sps;
+  if (!unwinder.UnwindCallChain(*sample.thread, regs, r.stack_user_data.data,
+                                r.GetValidStackSize(), &ips, &sps)) {
+    stat.failed_sample_count++;
+    return;
+  }
+  const UnwindingResult& result = unwinder.GetUnwindingResult();
+  stat.sample_count++;
+  stat.frame_count += ips.size();
+  stat.total_unwinding_time_in_ns += result.used_time;
+  stat.max_unwinding_time_in_ns = std::max(stat.max_unwinding_time_in_ns, result.used_time);
+  if (result.stop_reason < kStopReasonCount) {
+    stat.stop_reason_count[result.stop_reason]++;
+  }
+  double time_per_frame = static_cast<double>(result.used_time) / ips.size();
+  for (size_t i = 0; i < ips.size(); ++i) {
+    const MapEntry* map = thread_tree_.FindMap(sample.thread, ips[i], false);
+    DsoStat& dso_stat = stat.dso_stat[map->dso];
+    dso_stat.frame_count++;
+    dso_stat.unwinding_time_in_ns += time_per_frame;
+    if (i + 1 == ips.size()) {
+      dso_stat.last_frame_count++;
+    }
+  }
+}
+
 class DebugUnwindCommand : public Command {
  public:
   DebugUnwindCommand()
@@ -90,6 +277,13 @@ class DebugUnwindCommand : public Command {
 "-o <file>  The path ot write new perf.data. Default is perf.data.debug.\n"
 "--symfs <dir>  Look for files with symbols relative to this directory.\n"
 "--time time    Only unwind samples recorded at selected time.\n"
+"--replay-threads <n>  Replay unwinding of samples on n threads to measure unwinding\n"
+"                      performance, instead of generating a new perf.data. It reports\n"
+"                      frames unwound per second, stop reasons of unwinding, and\n"
+"                      unwinding time and frames of each dso.\n"
+"--elf-cache-size <size>  Max memory used to cache parsed elf files shared by all unwinding\n"
+"                         threads, in bytes. Suffixes K/M/G are accepted. Default is 0,\n"
+"                         which uses the unbounded cache of libunwindstack instead.\n"
                 // clang-format on
                ),
           input_filename_("perf.data"),
@@ -103,7 +297,11 @@ class DebugUnwindCommand : public Command {
 
  private:
   bool ParseOptions(const std::vector<std::string>& args);
+  bool OpenInputFile();
   bool UnwindRecordFile();
+  bool ReplayUnwinding();
+  bool IsSampleToUnwind(const SampleRecord& r);
+  void PrintReplayStat(const UnwindingReplayer& replayer);
   bool ProcessRecord(Record* record);
   void CollectHitFileInfo(const SampleRecord& r, const std::vector<uint64_t>& ips);
   bool JoinCallChains();
@@ -130,6 +328,7 @@ class DebugUnwindCommand : public Command {
   CallChainJoiner callchain_joiner_;
   Stat stat_;
   uint64_t selected_time_;
+  size_t replay_threads_ = 0;
 };
 
 bool DebugUnwindCommand::Run(const std::vector<std::string>& args) {
@@ -137,6 +336,9 @@ bool DebugUnwindCommand::Run(const std::vector<std::string>& args) {
   if (!ParseOptions(args)) {
     return false;
   }
+  if (replay_threads_ > 0) {
+    return ReplayUnwinding();
+  }
   ScopedTempFiles scoped_temp_files(android::base::Dirname(output_filename_));
 
   // 2. Read input perf.data, and generate new perf.data.
@@ -161,6 +363,16 @@ bool DebugUnwindCommand::ParseOptions(const std::vector<std::string>& args) {
         return false;
       }
       output_filename_ = args[i];
+    } else if (args[i] == "--elf-cache-size") {
+      uint64_t size;
+      if (!GetUintOption(args, &i, &size, 0, std::numeric_limits<uint64_t>::max(), true)) {
+        return false;
+      }
+      OfflineUnwinder::SetElfCacheSize(size);
+    } else if (args[i] == "--replay-threads") {
+      if (!GetUintOption(args, &i, &replay_threads_, 1)) {
+        return false;
+      }
     } else if (args[i] == "--symfs") {
       if (!NextArgumentOrError(args, &i)) {
         return false;
@@ -180,8 +392,7 @@ bool DebugUnwindCommand::ParseOptions(const std::vector<std::string>& args) {
   return true;
 }
 
-bool DebugUnwindCommand::UnwindRecordFile() {
-  // 1. Check input file.
+bool DebugUnwindCommand::OpenInputFile() {
   reader_ = RecordFileReader::CreateInstance(input_filename_);
   if (!reader_) {
     return false;
@@ -194,6 +405,23 @@ bool DebugUnwindCommand::UnwindRecordFile() {
     LOG(ERROR) << input_filename_ << " isn't recorded with \"-g --no-unwind\"";
     return false;
   }
+  return true;
+}
+
+bool DebugUnwindCommand::IsSampleToUnwind(const SampleRecord& r) {
+  if (selected_time_ != 0u && r.Timestamp() != selected_time_) {
+    return false;
+  }
+  uint64_t need_type = PERF_SAMPLE_CALLCHAIN | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+  return (r.sample_type & need_type) == need_type && r.regs_user_data.reg_mask != 0 &&
+         r.GetValidStackSize() > 0;
+}
+
+bool DebugUnwindCommand::UnwindRecordFile() {
+  // 1. Check input file.
+  if (!OpenInputFile()) {
+    return false;
+  }
   ScopedCurrentArch scoped_arch(GetArchType(reader_->ReadFeatureString(PerfFileFormat::FEAT_ARCH)));
 
   // 2. Copy attr section.
@@ -229,9 +457,7 @@ bool DebugUnwindCommand::ProcessRecord(Record* record) {
     if (selected_time_ != 0u && r.Timestamp() != selected_time_) {
       return true;
     }
-    uint64_t need_type = PERF_SAMPLE_CALLCHAIN | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
-    if ((r.sample_type & need_type) == need_type && r.regs_user_data.reg_mask != 0 &&
-        r.GetValidStackSize() > 0) {
+    if (IsSampleToUnwind(r)) {
       ThreadEntry* thread = thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
       RegSet regs(r.regs_user_data.abi, r.regs_user_data.reg_mask, r.regs_user_data.regs);
       std::vector<uint64_t> ips;
@@ -382,7 +608,14 @@ bool DebugUnwindCommand::WriteFeatureSections() {
   if (!writer_->WriteMetaInfoFeature(info_map)) {
     return false;
   }
-  CHECK(it == features.end());
+  // Copy feature sections after FEAT_META_INFO.
+  while (it != features.end()) {
+    std::vector<char> data;
+    if (!reader_->ReadFeatureSection(it->first, &data) || !writer_->WriteFeature(it->first, data)) {
+      return false;
+    }
+    ++it;
+  }
   return writer_->EndWriteFeatures() && writer_->Close();
 }
 
@@ -407,6 +640,84 @@ void DebugUnwindCommand::PrintStat() {
   printf("Please use debug_unwind_reporter.py to get a report in details.\n");
 }
 
+bool DebugUnwindCommand::ReplayUnwinding() {
+  if (!OpenInputFile()) {
+    return false;
+  }
+  ScopedCurrentArch scoped_arch(GetArchType(reader_->ReadFeatureString(PerfFileFormat::FEAT_ARCH)));
+  UnwindingReplayer replayer(thread_tree_, replay_threads_);
+  auto callback = [&](std::unique_ptr<Record> record) {
+    if (record->type() == PERF_RECORD_SAMPLE) {
+      auto& r = *static_cast<SampleRecord*>(record.get());
+      if (IsSampleToUnwind(r)) {
+        const ThreadEntry* thread = thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+        replayer.AddSample(std::move(record), thread);
+      }
+    } else {
+      replayer.Flush();
+      thread_tree_.Update(*record);
+    }
+    return true;
+  };
+  if (!reader_->ReadDataSection(callback)) {
+    return false;
+  }
+  replayer.Flush();
+  PrintReplayStat(replayer);
+  return true;
+}
+
+void DebugUnwindCommand::PrintReplayStat(const UnwindingReplayer& replayer) {
+  UnwindingReplayer::Stat stat = replayer.GetStat();
+  double wall_time_in_sec = replayer.WallTimeInNs() / 1e9;
+  printf("Unwinding sample count: %" PRIu64 "\n", stat.sample_count);
+  printf("Failed sample count: %" PRIu64 "\n", stat.failed_sample_count);
+  printf("Unwinding threads: %zu\n", replay_threads_);
+  printf("Unwound frame count: %" PRIu64 "\n", stat.frame_count);
+  printf("Wall time: %f ms\n", wall_time_in_sec * 1e3);
+  printf("Total unwinding time: %f ms\n", stat.total_unwinding_time_in_ns / 1e6);
+  if (wall_time_in_sec > 0) {
+    printf("Frames per second: %f\n", stat.frame_count / wall_time_in_sec);
+    printf("Samples per second: %f\n", stat.sample_count / wall_time_in_sec);
+  }
+  if (stat.sample_count == 0) {
+    return;
+  }
+  printf("Average unwinding time: %f us\n",
+         static_cast<double>(stat.total_unwinding_time_in_ns) / 1000 / stat.sample_count);
+  printf("Max unwinding time: %f us\n", static_cast<double>(stat.max_unwinding_time_in_ns) / 1000);
+  ElfCacheStat elf_cache_stat = OfflineUnwinder::GetElfCacheStat();
+  printf("Elf cache: %" PRIu64 " elfs, %" PRIu64 "/%" PRIu64 " bytes, hit %" PRIu64
+         ", miss %" PRIu64 ", evict %" PRIu64 "\n",
+         elf_cache_stat.elf_count, elf_cache_stat.size, elf_cache_stat.capacity,
+         elf_cache_stat.hit_count, elf_cache_stat.miss_count, elf_cache_stat.evict_count);
+
+  printf("Stop reasons:\n");
+  for (size_t i = 0; i < UnwindingReplayer::kStopReasonCount; ++i) {
+    if (stat.stop_reason_count[i] != 0) {
+      PrintIndented(1, "%-32s %10" PRIu64 " %6.2f%%\n",
+                    UnwindingResultRecord::StopReasonToString(i), stat.stop_reason_count[i],
+                    100.0 * stat.stop_reason_count[i] / stat.sample_count);
+    }
+  }
+
+  std::vector<std::pair<const Dso*, UnwindingReplayer::DsoStat>> dso_stats(stat.dso_stat.begin(),
+                                                                           stat.dso_stat.end());
+  std::sort(dso_stats.begin(), dso_stats.end(), [](const auto& a, const auto& b) {
+    return a.second.unwinding_time_in_ns > b.second.unwinding_time_in_ns;
+  });
+  printf("Unwinding cost per dso:\n");
+  PrintIndented(1, "%12s %8s %10s %10s  %s\n", "Time(ms)", "Time%", "Frames", "LastFrames",
+                "Dso");
+  for (auto& pair : dso_stats) {
+    const UnwindingReplayer::DsoStat& dso_stat = pair.second;
+    PrintIndented(1, "%12.3f %7.2f%% %10" PRIu64 " %10" PRIu64 "  %s\n",
+                  dso_stat.unwinding_time_in_ns / 1e6,
+                  100.0 * dso_stat.unwinding_time_in_ns / stat.total_unwinding_time_in_ns,
+                  dso_stat.frame_count, dso_stat.last_frame_count, pair.first->Path().c_str());
+  }
+}
+
 void RegisterDebugUnwindCommand() {
   RegisterCommand("debug-unwind",
                   []{ return std::unique_ptr<Command>(new DebugUnwindCommand()); });
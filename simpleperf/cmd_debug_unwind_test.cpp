@@ -73,3 +73,37 @@ TEST(cmd_debug_unwind, unwind_with_ip_zero_in_callchain) {
                                      "-o", tmp_file.path}));
   ASSERT_NE(capture.Finish().find("Unwinding sample count: 1"), std::string::npos);
 }
+
+TEST(cmd_debug_unwind, replay_threads_option) {
+  std::string input_data = GetTestData(PERF_DATA_NO_UNWIND);
+  CaptureStdout capture;
+  ASSERT_TRUE(capture.Start());
+  ASSERT_TRUE(DebugUnwindCmd()->Run({"-i", input_data, "--replay-threads", "4"}));
+  std::string output = capture.Finish();
+  ASSERT_NE(output.find("Unwinding sample count: 8"), std::string::npos);
+  ASSERT_NE(output.find("Frames per second:"), std::string::npos);
+  ASSERT_NE(output.find("Stop reasons:"), std::string::npos);
+  ASSERT_NE(output.find("Unwinding cost per dso:"), std::string::npos);
+  ASSERT_FALSE(DebugUnwindCmd()->Run({"-i", input_data, "--replay-threads", "0"}));
+}
+
+TEST(cmd_debug_unwind, elf_cache_size_option) {
+  std::string input_data = GetTestData(PERF_DATA_NO_UNWIND);
+  CaptureStdout capture;
+  // The cache is disabled by default.
+  ASSERT_TRUE(capture.Start());
+  ASSERT_TRUE(DebugUnwindCmd()->Run({"-i", input_data, "--replay-threads", "1"}));
+  std::string output = capture.Finish();
+  ASSERT_NE(output.find("Elf cache: 0 elfs, 0/0 bytes"), std::string::npos);
+  ASSERT_TRUE(capture.Start());
+  ASSERT_TRUE(DebugUnwindCmd()->Run({"-i", input_data, "--replay-threads", "1",
+                                     "--elf-cache-size", "0"}));
+  output = capture.Finish();
+  ASSERT_NE(output.find("Elf cache: 0 elfs, 0/0 bytes"), std::string::npos);
+  ASSERT_TRUE(capture.Start());
+  ASSERT_TRUE(DebugUnwindCmd()->Run({"-i", input_data, "--replay-threads", "1",
+                                     "--elf-cache-size", "64M"}));
+  output = capture.Finish();
+  ASSERT_NE(output.find("/67108864 bytes"), std::string::npos);
+  ASSERT_FALSE(DebugUnwindCmd()->Run({"-i", input_data, "--elf-cache-size", "-1"}));
+}
@@ -27,6 +27,7 @@
 #include "command.h"
 #include "event_attr.h"
 #include "event_type.h"
+#include "KernelSymbolTable.h"
 #include "perf_regs.h"
 #include "record.h"
 #include "record_file.h"
@@ -276,6 +277,14 @@ bool DumpRecordCommand::DumpFeatureSection() {
       for (auto& pair : info_map) {
         PrintIndented(2, "%s = %s\n", pair.first.c_str(), pair.second.c_str());
       }
+    } else if (feature == FEAT_KERNEL_SYMBOLS) {
+      std::vector<char> data;
+      simpleperf::KernelSymbolTable table;
+      if (!record_file_reader_->ReadFeatureSection(feature, &data) ||
+          !table.Open(data.data(), data.size())) {
+        return false;
+      }
+      PrintIndented(1, "kernel_symbols: %zu symbols\n", table.SymbolCount());
     }
   }
   return true;
@@ -17,11 +17,13 @@
 #include <inttypes.h>
 #include <libgen.h>
 #include <signal.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/utsname.h>
 #include <time.h>
 #include <unistd.h>
+#include <deque>
 #include <set>
 #include <string>
 #include <unordered_map>
@@ -37,18 +39,22 @@
 #include <android-base/properties.h>
 #endif
 
+#include "BuildIdResolver.h"
 #include "CallChainJoiner.h"
 #include "command.h"
 #include "environment.h"
 #include "event_selection_set.h"
 #include "event_type.h"
+#include "FlightRecorderBuffer.h"
 #include "IOEventLoop.h"
 #include "JITDebugReader.h"
+#include "KernelSymbolTable.h"
 #include "OfflineUnwinder.h"
 #include "read_apk.h"
 #include "read_elf.h"
 #include "record.h"
 #include "record_file.h"
+#include "StageStat.h"
 #include "thread_tree.h"
 #include "tracing.h"
 #include "utils.h"
@@ -92,6 +98,10 @@ constexpr size_t DEFAULT_CALL_CHAIN_JOINER_CACHE_SIZE = 8 * 1024 * 1024;
 static constexpr size_t kRecordBufferSize = 64 * 1024 * 1024;
 static constexpr size_t kSystemWideRecordBufferSize = 256 * 1024 * 1024;
 
+// Threads used by BuildIdResolver to read build ids while recording. Use a small number to avoid
+// disturbing the monitored threads.
+static constexpr size_t kBuildIdResolverThreads = 2;
+
 struct TimeStat {
   uint64_t prepare_recording_time = 0;
   uint64_t start_recording_time = 0;
@@ -200,13 +210,36 @@ class RecordCommand : public Command {
 "               callchains. The count should be >= 1. By default it is 1.\n"
 "\n"
 "Recording file options:\n"
+"--build-id-cache <file>   Cache build ids and min vaddrs of hit files in <file>, keyed by\n"
+"                          path, inode and mtime. It saves the time parsing elf files\n"
+"                          when recording repeatedly on the same device.\n"
 "--no-dump-kernel-symbols  Don't dump kernel symbols in perf.data. By default\n"
 "                          kernel symbols will be dumped when needed.\n"
 "--no-dump-symbols       Don't dump symbols in perf.data. By default symbols are\n"
 "                        dumped in perf.data, to support reporting in another\n"
 "                        environment.\n"
 "-o record_file_name    Set record file name, default is perf.data.\n"
-"--size-limit SIZE[K|M|G]      Stop recording after SIZE bytes of records.\n"
+"--shard-size SIZE[K|M|G]  Record in shards, which are complete record files in a\n"
+"                          directory set by -o. Start a new shard when the current one\n"
+"                          has SIZE bytes of records. The directory can be used as a\n"
+"                          record file in report commands. It can't have shards of a\n"
+"                          previous recording. To start new shards quickly, only the\n"
+"                          last shard dumps symbols, the others are like\n"
+"                          --no-dump-symbols.\n"
+"--shard-duration time_in_sec  Record in shards like --shard-size, but start a new shard\n"
+"                              every time_in_sec seconds.\n"
+"--flight-recorder time_in_sec  Keep records of the last time_in_sec seconds in memory, and\n"
+"                               only write them to a new record file in the directory set by\n"
+"                               -o when receiving SIGUSR1, the \"dump\" control cmd of\n"
+"                               --stdio-controls-profiling, or when recording stops. Each\n"
+"                               dump has records since the later of time_in_sec seconds ago\n"
+"                               and the previous dump. Like --shard-size, the directory can\n"
+"                               be used in report commands.\n"
+"--flight-recorder-buffer-size SIZE[K|M|G]  Max size of records kept in memory for\n"
+"                               --flight-recorder. Default is 256M.\n"
+"--size-limit SIZE[K|M|G]      Stop recording after SIZE bytes of records. When recording\n"
+"                              in shards or dumps of --flight-recorder, delete the oldest\n"
+"                              files instead, to keep their total size under SIZE.\n"
 "                              Default is unlimited.\n"
 "--symfs <dir>    Look for files with symbols relative to this directory.\n"
 "                 This option is used to provide files with symbol table and\n"
@@ -215,9 +248,15 @@ class RecordCommand : public Command {
 "Other options:\n"
 "--exit-with-parent            Stop recording when the process starting\n"
 "                              simpleperf dies.\n"
+"--log-stage-stats             Collect count, time and a histogram for each stage of reading\n"
+"                              and processing records, like reading kernel buffers, unwinding\n"
+"                              and writing records. Log them after recording, and store them\n"
+"                              in the meta_info feature. They help tune options like -m and\n"
+"                              --no-post-unwind.\n"
 "--start_profiling_fd fd_no    After starting profiling, write \"STARTED\" to\n"
 "                              <fd_no>, then close <fd_no>.\n"
-"--stdio-controls-profiling    Use stdin/stdout to pause/resume profiling.\n"
+"--stdio-controls-profiling    Use stdin/stdout to pause/resume profiling, or dump records\n"
+"                              of --flight-recorder.\n"
 #if defined(__ANDROID__)
 "--in-app                      We are already running in the app's context.\n"
 "--tracepoint-events file_name   Read tracepoint events from [file_name] instead of tracefs.\n"
@@ -277,12 +316,24 @@ class RecordCommand : public Command {
   bool DumpKernelMaps();
   bool DumpUserSpaceMaps();
   bool DumpProcessMaps(pid_t pid, const std::unordered_set<pid_t>& tids);
+  bool RecordingInShards() const {
+    return shard_size_in_bytes_ != 0 || shard_duration_in_sec_ != 0 ||
+           flight_recorder_time_in_sec_ != 0;
+  }
+  bool StartNewShard();
+  bool DumpThreadTree(const ThreadTree& thread_tree, uint64_t timestamp);
+  bool RemoveOldShards();
+  void KeepEvictedFlightRecord(std::unique_ptr<Record> record);
+  bool FlushFlightRecorder();
+  bool DumpFlightRecorder();
   bool ProcessRecord(Record* record);
   bool ShouldOmitRecord(Record* record);
   bool DumpMapsForRecord(Record* record);
   bool SaveRecordForPostUnwinding(Record* record);
   bool SaveRecordAfterUnwinding(Record* record);
   bool SaveRecordWithoutUnwinding(Record* record);
+  bool WriteRecord(const Record& record);
+  std::vector<StageStat> GetStageStats();
   bool ProcessJITDebugInfo(const std::vector<JITDebugInfo>& debug_info, bool sync_kernel_records);
   bool ProcessControlCmd(IOEventLoop* loop);
 
@@ -290,11 +341,13 @@ class RecordCommand : public Command {
   bool UnwindRecord(SampleRecord& r);
   bool PostUnwindRecords();
   bool JoinCallChains();
-  bool DumpAdditionalFeatures(const std::vector<std::string>& args);
+  bool DumpAdditionalFeatures(const std::vector<std::string>& args, bool dump_symbols);
   bool DumpBuildIdFeature();
   bool DumpFileFeature();
   bool DumpMetaInfoFeature(bool kernel_symbols_available);
-  void CollectHitFileInfo(const SampleRecord& r);
+  void CollectHitFileInfo(const SampleRecord& r, bool dump_symbols);
+  void AddMappedFileToBuildIdResolver(const Record& record);
+  void SetMinVaddrFromBuildIdResolver(const Record& record, std::unordered_set<Dso*>* dsos);
 
   std::unique_ptr<SampleSpeed> sample_speed_;
   bool system_wide_collection_;
@@ -340,6 +393,35 @@ class RecordCommand : public Command {
   std::unique_ptr<CallChainJoiner> callchain_joiner_;
 
   std::unique_ptr<JITDebugReader> jit_debug_reader_;
+  std::string build_id_cache_file_;
+  std::unique_ptr<BuildIdResolver> build_id_resolver_;
+  std::vector<char> kernel_symbol_table_;
+
+  // For recording in shards.
+  uint64_t shard_size_in_bytes_ = 0;
+  double shard_duration_in_sec_ = 0;
+  size_t shard_index_ = 0;
+  bool starting_new_shard_ = false;
+  // Finished shards and their sizes, the oldest is at the front.
+  std::deque<std::pair<std::string, uint64_t>> finished_shards_;
+  std::vector<std::string> record_args_;
+
+  // Stats of stages processing records, collected with --log-stage-stats.
+  bool log_stage_stats_ = false;
+  std::unique_ptr<StageStat> process_record_stat_;
+  std::unique_ptr<StageStat> unwinding_stat_;
+  std::unique_ptr<StageStat> record_write_stat_;
+  std::unique_ptr<StageStat> jit_debug_info_read_stat_;
+  std::unique_ptr<StageStat> jit_debug_info_process_stat_;
+
+  // For the flight recorder mode.
+  double flight_recorder_time_in_sec_ = 0;
+  uint64_t flight_recorder_buffer_size_ = 256 * 1024 * 1024;
+  std::unique_ptr<FlightRecorderBuffer> flight_recorder_;
+  // Maps and threads of records evicted from flight_recorder_.
+  ThreadTree flight_thread_tree_;
+  // Evicted kernel maps and tracing data, which can't be kept in flight_thread_tree_.
+  std::vector<std::unique_ptr<Record>> flight_kept_records_;
   uint64_t last_record_timestamp_;  // used to insert Mmap2Records for JIT debug info
   TimeStat time_stat_;
   EventAttrWithId dumping_attr_id_;
@@ -361,12 +443,18 @@ bool RecordCommand::Run(const std::vector<std::string>& args) {
   if (!AdjustPerfEventLimit()) {
     return false;
   }
+  record_args_ = args;
   ScopedTempFiles scoped_temp_files(android::base::Dirname(record_filename_));
   if (!app_package_name_.empty() && !in_app_context_) {
     // Some users want to profile non debuggable apps on rooted devices. If we use run-as,
     // it will be impossible when using --app. So don't switch to app's context when we are
     // root.
     if (!IsRoot()) {
+      if (RecordingInShards()) {
+        LOG(ERROR) << "Recording in shards or --flight-recorder isn't supported when recording "
+                   << "an app as non-root.";
+        return false;
+      }
       return RunInAppContext(app_package_name_, "record", args, workload_args.size(),
                              record_filename_, true);
     }
@@ -392,6 +480,13 @@ bool RecordCommand::Run(const std::vector<std::string>& args) {
 bool RecordCommand::PrepareRecording(Workload* workload) {
   // 1. Prepare in other modules.
   PrepareVdsoFile();
+  if (log_stage_stats_) {
+    process_record_stat_.reset(new StageStat("process_record", "ns"));
+    unwinding_stat_.reset(new StageStat("unwinding", "ns"));
+    record_write_stat_.reset(new StageStat("record_write", "ns"));
+    jit_debug_info_read_stat_.reset(new StageStat("jit_debug_info_read", "ns"));
+    jit_debug_info_process_stat_.reset(new StageStat("jit_debug_info_process", "ns"));
+  }
 
   // 2. Add default event type.
   if (event_selection_set_.empty()) {
@@ -420,6 +515,7 @@ bool RecordCommand::PrepareRecording(Workload* workload) {
                                                 callchain_joiner_min_matching_nodes_,
                                                 false));
   }
+  build_id_resolver_.reset(new BuildIdResolver(kBuildIdResolverThreads, build_id_cache_file_));
 
   // 4. Add monitored targets.
   bool need_to_check_targets = false;
@@ -458,11 +554,15 @@ bool RecordCommand::PrepareRecording(Workload* workload) {
     bool keep_symfiles = dwarf_callchain_sampling_ && !unwind_dwarf_callchain_;
     bool sync_with_records = clockid_ == "monotonic";
     jit_debug_reader_.reset(new JITDebugReader(keep_symfiles, sync_with_records));
+    jit_debug_reader_->SetReadStat(jit_debug_info_read_stat_.get());
     // To profile java code, need to dump maps containing vdex files, which are not executable.
     event_selection_set_.SetRecordNotExecutableMaps(true);
   }
 
   // 5. Open perf event files and create mapped buffers.
+  if (log_stage_stats_) {
+    event_selection_set_.EnableStageStats();
+  }
   if (!event_selection_set_.OpenEventFiles(cpus_)) {
     return false;
   }
@@ -513,6 +613,17 @@ bool RecordCommand::PrepareRecording(Workload* workload) {
       return false;
     }
   }
+  if (shard_duration_in_sec_ != 0) {
+    if (!loop->AddPeriodicEvent(SecondToTimeval(shard_duration_in_sec_),
+                                [this]() { return StartNewShard(); })) {
+      return false;
+    }
+  }
+  if (flight_recorder_) {
+    if (!loop->AddSignalEvent(SIGUSR1, [this]() { return DumpFlightRecorder(); })) {
+      return false;
+    }
+  }
   if (stdio_controls_profiling_) {
     if (!loop->AddReadEvent(0, [&]() { return ProcessControlCmd(loop); })) {
       return false;
@@ -611,12 +722,25 @@ bool RecordCommand::PostProcessRecording(const std::vector<std::string>& args) {
   }
 
   // 3. Dump additional features, and close record file.
-  if (!DumpAdditionalFeatures(args)) {
+  if (flight_recorder_ && !FlushFlightRecorder()) {
+    return false;
+  }
+  if (!DumpAdditionalFeatures(args, dump_symbols_)) {
+    return false;
+  }
+  if (!build_id_resolver_->Finish()) {
     return false;
   }
   if (!record_file_writer_->Close()) {
     return false;
   }
+  if (RecordingInShards()) {
+    std::string shard = GetRecordShardPath(record_filename_, shard_index_);
+    finished_shards_.emplace_back(shard, GetFileSize(shard));
+    if (!RemoveOldShards()) {
+      return false;
+    }
+  }
   if (out_fd_ != -1 && !WriteRecordDataToOutFd(record_filename_, std::move(out_fd_))) {
     return false;
   }
@@ -636,6 +760,13 @@ bool RecordCommand::PostProcessRecording(const std::vector<std::string>& args) {
             << ". Samples lost: " << lost_record_count_ << ".";
   LOG(DEBUG) << "In user space, dropped " << lost_samples << " samples, " << lost_non_samples
              << " non samples, cut stack of " << cut_stack_samples << " samples.";
+  for (const StageStat& stat : GetStageStats()) {
+    LOG(INFO) << "Stage " << stat.Name() << ": " << stat.ToString();
+  }
+  if (flight_recorder_) {
+    LOG(INFO) << "Samples not dumped by flight recorder: "
+              << flight_recorder_->DroppedSampleCount() << ".";
+  }
   if (sample_record_count_ + lost_record_count_ != 0) {
     double lost_percent = static_cast<double>(lost_record_count_) /
                           (lost_record_count_ + sample_record_count_);
@@ -675,6 +806,11 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
       app_package_name_ = args[i];
     } else if (args[i] == "-b") {
       branch_sampling_ = branch_sampling_type_map["any"];
+    } else if (args[i] == "--build-id-cache") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      build_id_cache_file_ = args[i];
     } else if (args[i] == "-c" || args[i] == "-f") {
       uint64_t value;
       if (!GetUintOption(args, &i, &value, 1)) {
@@ -776,6 +912,15 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
       }
     } else if (args[i] == "--exit-with-parent") {
       prctl(PR_SET_PDEATHSIG, SIGHUP, 0, 0, 0);
+    } else if (args[i] == "--flight-recorder") {
+      if (!GetDoubleOption(args, &i, &flight_recorder_time_in_sec_, 1e-9)) {
+        return false;
+      }
+    } else if (args[i] == "--flight-recorder-buffer-size") {
+      if (!GetUintOption(args, &i, &flight_recorder_buffer_size_, 1,
+                         std::numeric_limits<uint64_t>::max(), true)) {
+        return false;
+      }
     } else if (args[i] == "-g") {
       fp_callchain_sampling_ = false;
       dwarf_callchain_sampling_ = true;
@@ -809,6 +954,8 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
         }
         branch_sampling_ |= it->second;
       }
+    } else if (args[i] == "--log-stage-stats") {
+      log_stage_stats_ = true;
     } else if (args[i] == "-m") {
       uint64_t pages;
       if (!GetUintOption(args, &i, &pages)) {
@@ -862,6 +1009,15 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
         LOG(ERROR) << "unexpected option " << args[i];
         return false;
       }
+    } else if (args[i] == "--shard-duration") {
+      if (!GetDoubleOption(args, &i, &shard_duration_in_sec_, 1e-9)) {
+        return false;
+      }
+    } else if (args[i] == "--shard-size") {
+      if (!GetUintOption(args, &i, &shard_size_in_bytes_, 1,
+                         std::numeric_limits<uint64_t>::max(), true)) {
+        return false;
+      }
     } else if (args[i] == "--size-limit") {
       if (!GetUintOption(args, &i, &size_limit_in_bytes_, 1, std::numeric_limits<uint64_t>::max(),
                          true)) {
@@ -947,8 +1103,24 @@ bool RecordCommand::ParseOptions(const std::vector<std::string>& args,
     return false;
   }
 
-  if (dump_symbols_ && can_dump_kernel_symbols_) {
-    // No need to dump kernel symbols as we will dump all required symbols.
+  if (RecordingInShards()) {
+    if (post_unwind_ || out_fd_ != -1) {
+      LOG(ERROR) << "Recording in shards or --flight-recorder can't be used with --post-unwind "
+                 << "or --out-fd.";
+      return false;
+    }
+    if (IsRegularFile(record_filename_)) {
+      LOG(ERROR) << "Recording in shards or --flight-recorder needs a directory for -o, but "
+                 << record_filename_ << " is a file.";
+      return false;
+    }
+    // Callchains are joined at the end of recording, which doesn't work with shards.
+    allow_callchain_joiner_ = false;
+  }
+
+  if (dump_symbols_ && can_dump_kernel_symbols_ && !RecordingInShards()) {
+    // No need to dump kernel symbols as we will dump all required symbols. But shards other
+    // than the last one don't dump symbols.
     can_dump_kernel_symbols_ = false;
   }
   if (clockid_.empty()) {
@@ -1030,12 +1202,31 @@ bool RecordCommand::SetEventSelectionFlags() {
 }
 
 bool RecordCommand::CreateAndInitRecordFile() {
-  record_file_writer_ = CreateRecordFile(record_filename_);
+  std::string filename = record_filename_;
+  if (RecordingInShards()) {
+    if (!IsDir(record_filename_) && !MkdirWithParents(record_filename_ + "/")) {
+      return false;
+    }
+    // Shards of different recordings can't be told apart, so don't mix them.
+    if (!GetRecordShards(record_filename_).empty()) {
+      LOG(ERROR) << record_filename_ << " has shards of a previous recording. Remove them or "
+                 << "use another directory for -o.";
+      return false;
+    }
+    filename = GetRecordShardPath(record_filename_, shard_index_);
+  }
+  record_file_writer_ = CreateRecordFile(filename);
   if (record_file_writer_ == nullptr) {
     return false;
   }
   // Use first perf_event_attr and first event id to dump mmap and comm records.
   dumping_attr_id_ = event_selection_set_.GetEventAttrWithId()[0];
+  if (flight_recorder_time_in_sec_ != 0) {
+    flight_recorder_.reset(new FlightRecorderBuffer(
+        *dumping_attr_id_.attr, static_cast<uint64_t>(flight_recorder_time_in_sec_ * 1e9),
+        flight_recorder_buffer_size_,
+        [this](std::unique_ptr<Record> r) { KeepEvictedFlightRecord(std::move(r)); }));
+  }
   return DumpKernelSymbol() && DumpTracingData() && DumpKernelMaps() && DumpUserSpaceMaps();
 }
 
@@ -1062,10 +1253,9 @@ bool RecordCommand::DumpKernelSymbol() {
         PLOG(ERROR) << "failed to read /proc/kallsyms";
         return false;
       }
-      KernelSymbolRecord r(kallsyms);
-      if (!ProcessRecord(&r)) {
-        return false;
-      }
+      // Symbols are read when recording starts, but dumped in the kernel_symbols feature
+      // section after recording.
+      KernelSymbolTable::Build(kallsyms, &kernel_symbol_table_);
     }
   }
   return true;
@@ -1175,12 +1365,158 @@ bool RecordCommand::DumpProcessMaps(pid_t pid, const std::unordered_set<pid_t>&
   return true;
 }
 
+bool RecordCommand::StartNewShard() {
+  // 1. Finish the current shard, in the same way as finishing a recording. But this stops reading
+  // records, so don't look up symbols, which can take long for newly hit files.
+  std::string shard = GetRecordShardPath(record_filename_, shard_index_);
+  if (!DumpAdditionalFeatures(record_args_, false) || !record_file_writer_->Close()) {
+    return false;
+  }
+  finished_shards_.emplace_back(shard, GetFileSize(shard));
+  if (!RemoveOldShards()) {
+    return false;
+  }
+  // DumpAdditionalFeatures() rebuilds thread_tree_, so maps cached in the unwinder are stale.
+  if (offline_unwinder_) {
+    offline_unwinder_.reset(new OfflineUnwinder(false));
+  }
+
+  // 2. Start a new shard. It begins with maps and thread names known so far, so it can be
+  // reported without previous shards.
+  shard_index_++;
+  record_file_writer_ = CreateRecordFile(GetRecordShardPath(record_filename_, shard_index_));
+  if (!record_file_writer_) {
+    return false;
+  }
+  if (flight_recorder_) {
+    // A dump of the flight recorder starts with maps and threads of evicted records.
+    return true;
+  }
+  starting_new_shard_ = true;
+  bool result = DumpTracingData() && DumpKernelMaps() &&
+                DumpThreadTree(thread_tree_, last_record_timestamp_);
+  starting_new_shard_ = false;
+  return result;
+}
+
+bool RecordCommand::DumpThreadTree(const ThreadTree& thread_tree, uint64_t timestamp) {
+  const perf_event_attr& attr = *dumping_attr_id_.attr;
+  uint64_t event_id = dumping_attr_id_.ids[0];
+  std::unordered_set<const MapSet*> dumped_map_sets;
+  for (const ThreadEntry* thread : thread_tree.GetAllThreads()) {
+    // Threads in a process share the same MapSet.
+    if (dumped_map_sets.insert(thread->maps).second) {
+      for (const auto& pair : thread->maps->maps) {
+        const MapEntry* map = pair.second;
+        Mmap2Record record(attr, false, thread->pid, thread->pid, map->start_addr, map->len,
+                           map->pgoff, map->flags, map->dso->Path(), event_id, timestamp);
+        if (!record_file_writer_->WriteRecord(record)) {
+          return false;
+        }
+      }
+    }
+    CommRecord record(attr, thread->pid, thread->tid, thread->comm, event_id, timestamp);
+    if (!record_file_writer_->WriteRecord(record)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RecordCommand::RemoveOldShards() {
+  if (size_limit_in_bytes_ == 0) {
+    return true;
+  }
+  uint64_t total_size = 0;
+  for (const auto& pair : finished_shards_) {
+    total_size += pair.second;
+  }
+  // Always keep the latest shard.
+  while (total_size > size_limit_in_bytes_ && finished_shards_.size() > 1) {
+    const std::string& shard = finished_shards_.front().first;
+    if (unlink(shard.c_str()) != 0) {
+      PLOG(ERROR) << "failed to remove " << shard;
+      return false;
+    }
+    LOG(DEBUG) << "Removed " << shard << " to keep shards under size limit";
+    total_size -= finished_shards_.front().second;
+    finished_shards_.pop_front();
+  }
+  return true;
+}
+
+void RecordCommand::KeepEvictedFlightRecord(std::unique_ptr<Record> record) {
+  switch (record->type()) {
+    case PERF_RECORD_SAMPLE:
+    case PERF_RECORD_LOST:
+      break;
+    case PERF_RECORD_MMAP:
+    case PERF_RECORD_MMAP2:
+      if (record->InKernel()) {
+        flight_kept_records_.push_back(std::move(record));
+      } else {
+        flight_thread_tree_.Update(*record);
+      }
+      break;
+    case PERF_RECORD_COMM:
+    case PERF_RECORD_FORK:
+    case PERF_RECORD_EXIT:
+      flight_thread_tree_.Update(*record);
+      break;
+    case PERF_RECORD_TRACING_DATA:
+    case SIMPLE_PERF_RECORD_TRACING_DATA:
+      // Written once at the start of recording, and needed by all dumps.
+      flight_kept_records_.push_back(std::move(record));
+      break;
+    default:
+      // Other records, like throttle or aux records, are only useful with the samples around
+      // them. Keeping them would grow memory for the life of the recording.
+      break;
+  }
+}
+
+bool RecordCommand::FlushFlightRecorder() {
+  for (const auto& r : flight_kept_records_) {
+    if (!record_file_writer_->WriteRecord(*r)) {
+      return false;
+    }
+  }
+  uint64_t timestamp = flight_recorder_->OldestTimestamp();
+  if (timestamp == 0) {
+    timestamp = last_record_timestamp_;
+  }
+  if (!DumpThreadTree(flight_thread_tree_, timestamp)) {
+    return false;
+  }
+  size_t record_count = flight_recorder_->RecordCount();
+  auto write_callback = [this](const Record& r) { return record_file_writer_->WriteRecord(r); };
+  if (!flight_recorder_->Flush(write_callback)) {
+    return false;
+  }
+  LOG(DEBUG) << "Flight recorder dumped " << record_count << " records, dropped "
+             << flight_recorder_->DroppedSampleCount() << " samples so far";
+  return true;
+}
+
+bool RecordCommand::DumpFlightRecorder() {
+  // Process records left in the kernel buffer, so the dump includes the latest samples.
+  return event_selection_set_.SyncAndReadMmapEventData() && FlushFlightRecorder() &&
+         StartNewShard();
+}
+
 bool RecordCommand::ProcessRecord(Record* record) {
+  // It includes time used by unwinding and writing the record.
+  ScopedStageTimer timer(process_record_stat_.get());
   UpdateRecord(record);
   if (ShouldOmitRecord(record)) {
     return true;
   }
-  if (size_limit_in_bytes_ > 0u) {
+  if (RecordingInShards()) {
+    if (shard_size_in_bytes_ > 0u && !starting_new_shard_ &&
+        record_file_writer_->GetDataSectionSize() >= shard_size_in_bytes_ && !StartNewShard()) {
+      return false;
+    }
+  } else if (size_limit_in_bytes_ > 0u) {
     if (size_limit_in_bytes_ < record_file_writer_->GetDataSectionSize()) {
       return event_selection_set_.GetIOEventLoop()->ExitLoop();
     }
@@ -1189,6 +1525,7 @@ bool RecordCommand::ProcessRecord(Record* record) {
     return false;
   }
   last_record_timestamp_ = std::max(last_record_timestamp_, record->Timestamp());
+  AddMappedFileToBuildIdResolver(*record);
   // In system wide recording, maps are dumped when they are needed by records.
   if (system_wide_collection_ && !DumpMapsForRecord(record)) {
     return false;
@@ -1241,7 +1578,7 @@ bool RecordCommand::DumpMapsForRecord(Record* record) {
 }
 
 bool RecordCommand::SaveRecordForPostUnwinding(Record* record) {
-  if (!record_file_writer_->WriteRecord(*record)) {
+  if (!WriteRecord(*record)) {
     LOG(ERROR) << "If there isn't enough space for storing profiling data, consider using "
                << "--no-post-unwind option.";
     return false;
@@ -1270,7 +1607,7 @@ bool RecordCommand::SaveRecordAfterUnwinding(Record* record) {
   } else {
     thread_tree_.Update(*record);
   }
-  return record_file_writer_->WriteRecord(*record);
+  return WriteRecord(*record);
 }
 
 bool RecordCommand::SaveRecordWithoutUnwinding(Record* record) {
@@ -1287,11 +1624,33 @@ bool RecordCommand::SaveRecordWithoutUnwinding(Record* record) {
   } else if (record->type() == PERF_RECORD_LOST) {
     lost_record_count_ += static_cast<LostRecord*>(record)->lost;
   }
-  return record_file_writer_->WriteRecord(*record);
+  return WriteRecord(*record);
+}
+
+bool RecordCommand::WriteRecord(const Record& record) {
+  ScopedStageTimer timer(record_write_stat_.get());
+  if (flight_recorder_) {
+    flight_recorder_->Add(record);
+    return true;
+  }
+  return record_file_writer_->WriteRecord(record);
+}
+
+std::vector<StageStat> RecordCommand::GetStageStats() {
+  // Stages reading records from kernel buffers run in the read thread.
+  std::vector<StageStat> stats = event_selection_set_.GetStageStats();
+  for (auto stat : {&process_record_stat_, &unwinding_stat_, &record_write_stat_,
+                    &jit_debug_info_read_stat_, &jit_debug_info_process_stat_}) {
+    if (*stat) {
+      stats.push_back(**stat);
+    }
+  }
+  return stats;
 }
 
 bool RecordCommand::ProcessJITDebugInfo(const std::vector<JITDebugInfo>& debug_info,
                                         bool sync_kernel_records) {
+  ScopedStageTimer timer(jit_debug_info_process_stat_.get());
   EventAttrWithId attr_id = event_selection_set_.GetEventAttrWithId()[0];
   for (auto& info : debug_info) {
     if (info.type == JITDebugInfo::JIT_DEBUG_JIT_CODE) {
@@ -1334,6 +1693,8 @@ bool RecordCommand::ProcessControlCmd(IOEventLoop* loop) {
     result = event_selection_set_.SetEnableEvents(false);
   } else if (cmd == "resume") {
     result = event_selection_set_.SetEnableEvents(true);
+  } else if (cmd == "dump" && flight_recorder_) {
+    result = DumpFlightRecorder();
   } else {
     LOG(ERROR) << "unknown control cmd: " << cmd;
   }
@@ -1405,6 +1766,7 @@ void RecordCommand::UpdateRecord(Record* record) {
 }
 
 bool RecordCommand::UnwindRecord(SampleRecord& r) {
+  ScopedStageTimer timer(unwinding_stat_.get());
   if ((r.sample_type & PERF_SAMPLE_CALLCHAIN) &&
       (r.sample_type & PERF_SAMPLE_REGS_USER) &&
       (r.regs_user_data.reg_mask != 0) &&
@@ -1516,18 +1878,28 @@ bool RecordCommand::JoinCallChains() {
 }
 
 bool RecordCommand::DumpAdditionalFeatures(
-    const std::vector<std::string>& args) {
+    const std::vector<std::string>& args, bool dump_symbols) {
   // Read data section of perf.data to collect hit file information.
   thread_tree_.ClearThreadAndMap();
   bool kernel_symbols_available = false;
   if (CheckKernelSymbolAddresses()) {
-    Dso::ReadKernelSymbolsFromProc();
+    if (dump_symbols) {
+      // Reuse the symbols parsed by DumpKernelSymbol() instead of parsing /proc/kallsyms again.
+      if (!kernel_symbol_table_.empty()) {
+        Dso::SetKernelSymbolTable(kernel_symbol_table_);
+      } else {
+        Dso::ReadKernelSymbolsFromProc();
+      }
+    }
     kernel_symbols_available = true;
   }
+  std::unordered_set<Dso*> dsos_with_min_vaddr;
   auto callback = [&](const Record* r) {
     thread_tree_.Update(*r);
     if (r->type() == PERF_RECORD_SAMPLE) {
-      CollectHitFileInfo(*reinterpret_cast<const SampleRecord*>(r));
+      CollectHitFileInfo(*reinterpret_cast<const SampleRecord*>(r), dump_symbols);
+    } else {
+      SetMinVaddrFromBuildIdResolver(*r, &dsos_with_min_vaddr);
     }
   };
   if (!record_file_writer_->ReadDataSection(callback)) {
@@ -1538,6 +1910,9 @@ bool RecordCommand::DumpAdditionalFeatures(
   if (branch_sampling_) {
     feature_count++;
   }
+  if (!kernel_symbol_table_.empty()) {
+    feature_count++;
+  }
   if (!record_file_writer_->BeginWriteFeatures(feature_count)) {
     return false;
   }
@@ -1577,6 +1952,11 @@ bool RecordCommand::DumpAdditionalFeatures(
   if (!DumpMetaInfoFeature(kernel_symbols_available)) {
     return false;
   }
+  if (!kernel_symbol_table_.empty() &&
+      !record_file_writer_->WriteFeature(PerfFileFormat::FEAT_KERNEL_SYMBOLS,
+                                         kernel_symbol_table_)) {
+    return false;
+  }
 
   if (!record_file_writer_->EndWriteFeatures()) {
     return false;
@@ -1613,12 +1993,13 @@ bool RecordCommand::DumpBuildIdFeature() {
       if (dso->Path() == DEFAULT_EXECNAME_FOR_THREAD_MMAP) {
         continue;
       }
-      if (!GetBuildIdFromDsoPath(dso->Path(), &build_id)) {
+      ElfFileInfo info = build_id_resolver_->GetFileInfo(dso->Path());
+      if (!info.has_build_id) {
         LOG(DEBUG) << "Can't read build_id from file " << dso->Path();
         continue;
       }
       build_id_records.push_back(
-          BuildIdRecord(false, UINT_MAX, build_id, dso->Path()));
+          BuildIdRecord(false, UINT_MAX, info.build_id, dso->Path()));
     }
   }
   if (!record_file_writer_->WriteBuildIdFeature(build_id_records)) {
@@ -1653,17 +2034,20 @@ bool RecordCommand::DumpMetaInfoFeature(bool kernel_symbols_available) {
   info_map["clockid"] = clockid_;
   info_map["timestamp"] = std::to_string(time(nullptr));
   info_map["kernel_symbols_available"] = kernel_symbols_available ? "true" : "false";
+  for (const StageStat& stat : GetStageStats()) {
+    info_map["stage_stat:" + stat.Name()] = stat.ToString();
+  }
   return record_file_writer_->WriteMetaInfoFeature(info_map);
 }
 
-void RecordCommand::CollectHitFileInfo(const SampleRecord& r) {
+void RecordCommand::CollectHitFileInfo(const SampleRecord& r, bool dump_symbols) {
   const ThreadEntry* thread =
       thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
   const MapEntry* map =
       thread_tree_.FindMap(thread, r.ip_data.ip, r.InKernel());
   Dso* dso = map->dso;
   const Symbol* symbol;
-  if (dump_symbols_) {
+  if (dump_symbols) {
     symbol = thread_tree_.FindSymbol(map, r.ip_data.ip, nullptr, &dso);
     if (!symbol->HasDumpId()) {
       dso->CreateSymbolDumpId(symbol);
@@ -1699,7 +2083,7 @@ void RecordCommand::CollectHitFileInfo(const SampleRecord& r) {
         }
         map = thread_tree_.FindMap(thread, ip, in_kernel);
         dso = map->dso;
-        if (dump_symbols_) {
+        if (dump_symbols) {
           symbol = thread_tree_.FindSymbol(map, ip, nullptr, &dso);
           if (!symbol->HasDumpId()) {
             dso->CreateSymbolDumpId(symbol);
@@ -1713,6 +2097,67 @@ void RecordCommand::CollectHitFileInfo(const SampleRecord& r) {
   }
 }
 
+// Return the path of a user space file mapped executable by an mmap record, or nullptr if the
+// record isn't for such a file.
+static const char* GetExecutableMappedFile(const Record& record) {
+  const char* filename;
+  if (record.type() == PERF_RECORD_MMAP) {
+    filename = static_cast<const MmapRecord&>(record).filename;
+  } else if (record.type() == PERF_RECORD_MMAP2) {
+    auto& r = static_cast<const Mmap2Record&>(record);
+    if (!(r.data->prot & PROT_EXEC)) {
+      return nullptr;
+    }
+    filename = r.filename;
+  } else {
+    return nullptr;
+  }
+  // Skip maps like [vdso] and //anon.
+  if (record.InKernel() || filename[0] != '/' ||
+      strcmp(filename, DEFAULT_EXECNAME_FOR_THREAD_MMAP) == 0) {
+    return nullptr;
+  }
+  return filename;
+}
+
+// Start reading build id of a mapped file in background, so the result is likely ready when
+// dumping features after recording.
+void RecordCommand::AddMappedFileToBuildIdResolver(const Record& record) {
+  const char* filename = GetExecutableMappedFile(record);
+  if (filename != nullptr) {
+    build_id_resolver_->AddFile(filename);
+  }
+}
+
+// ElfDso reads min vaddr lazily when converting ips to vaddrs in file. To avoid parsing the elf
+// file again, set the min vaddr resolved in background before collecting hit file info.
+void RecordCommand::SetMinVaddrFromBuildIdResolver(const Record& record,
+                                                  std::unordered_set<Dso*>* dsos) {
+  if (GetExecutableMappedFile(record) == nullptr) {
+    return;
+  }
+  const MapEntry* map;
+  if (record.type() == PERF_RECORD_MMAP) {
+    auto& r = static_cast<const MmapRecord&>(record);
+    map = thread_tree_.FindMap(thread_tree_.FindThreadOrNew(r.data->pid, r.data->tid),
+                               r.data->addr, false);
+  } else {
+    auto& r = static_cast<const Mmap2Record&>(record);
+    map = thread_tree_.FindMap(thread_tree_.FindThreadOrNew(r.data->pid, r.data->tid),
+                               r.data->addr, false);
+  }
+  Dso* dso = map->dso;
+  // When the debug file is found in symfs, ElfDso reads min vaddr from the debug file instead.
+  if (dso->type() != DSO_ELF_FILE || dso->Path() != dso->GetDebugFilePath() ||
+      !dsos->insert(dso).second) {
+    return;
+  }
+  ElfFileInfo info = build_id_resolver_->GetFileInfo(dso->Path());
+  if (info.has_min_vaddr) {
+    dso->SetMinExecutableVaddr(info.min_vaddr, info.file_offset_of_min_vaddr);
+  }
+}
+
 void RegisterRecordCommand() {
   RegisterCommand("record",
                   [] { return std::unique_ptr<Command>(new RecordCommand()); });
@@ -23,6 +23,7 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 
 #include <map>
 #include <memory>
@@ -33,6 +34,7 @@
 #include "environment.h"
 #include "event_selection_set.h"
 #include "get_test_data.h"
+#include "KernelSymbolTable.h"
 #include "record.h"
 #include "record_file.h"
 #include "test_util.h"
@@ -163,6 +165,17 @@ TEST(record_cmd, dump_build_id_feature) {
   ASSERT_GT(reader->FeatureSectionDescriptors().size(), 0u);
 }
 
+TEST(record_cmd, build_id_cache_option) {
+  TEST_REQUIRE_HW_COUNTER();
+  TemporaryFile cache_file;
+  ASSERT_TRUE(RunRecordCmd({"--build-id-cache", cache_file.path}));
+  std::string content;
+  ASSERT_TRUE(android::base::ReadFileToString(cache_file.path, &content));
+  ASSERT_NE(content.find("simpleperf_build_id_cache_v1"), std::string::npos);
+  // Recording again reuses the cache file.
+  ASSERT_TRUE(RunRecordCmd({"--build-id-cache", cache_file.path}));
+}
+
 TEST(record_cmd, tracepoint_event) {
   TEST_IN_ROOT(ASSERT_TRUE(RunRecordCmd({"-a", "-e", "sched:sched_switch"})));
 }
@@ -363,14 +376,19 @@ static void CheckKernelSymbol(const std::string& path, bool need_kallsyms,
       RecordFileReader::CreateInstance(path);
   ASSERT_TRUE(reader != nullptr);
   std::vector<std::unique_ptr<Record>> records = reader->DataSection();
-  bool has_kernel_symbol_records = false;
   for (const auto& record : records) {
-    if (record->type() == SIMPLE_PERF_RECORD_KERNEL_SYMBOL) {
-      has_kernel_symbol_records = true;
-    }
+    // Kernel symbols are dumped in the kernel_symbols feature section instead.
+    ASSERT_NE(record->type(), SIMPLE_PERF_RECORD_KERNEL_SYMBOL);
   }
   bool require_kallsyms = need_kallsyms && CheckKernelSymbolAddresses();
-  ASSERT_EQ(require_kallsyms, has_kernel_symbol_records);
+  ASSERT_EQ(require_kallsyms, reader->HasFeature(FEAT_KERNEL_SYMBOLS));
+  if (require_kallsyms) {
+    std::vector<char> data;
+    ASSERT_TRUE(reader->ReadFeatureSection(FEAT_KERNEL_SYMBOLS, &data));
+    simpleperf::KernelSymbolTable table;
+    ASSERT_TRUE(table.Open(data.data(), data.size()));
+    ASSERT_GT(table.SymbolCount(), 0u);
+  }
   *success = true;
 }
 
@@ -674,6 +692,111 @@ TEST(record_cmd, size_limit_option) {
   ASSERT_FALSE(RunRecordCmd({"--size-limit", "0"}));
 }
 
+TEST(record_cmd, shard_size_option) {
+  TEST_REQUIRE_HW_COUNTER();
+  std::vector<std::unique_ptr<Workload>> workloads;
+  CreateProcesses(1, &workloads);
+  std::string pid = std::to_string(workloads[0]->GetPid());
+  TemporaryDir tmpdir;
+  std::string dir = std::string(tmpdir.path) + "/perf_data";
+  ASSERT_TRUE(RecordCmd()->Run({"-o", dir, "-p", pid, "--shard-size", "4k", "--duration", "1"}));
+  std::vector<std::string> shards = GetRecordShards(dir);
+  ASSERT_GT(shards.size(), 1u);
+  // Each shard is a complete record file.
+  for (const auto& shard : shards) {
+    std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(shard);
+    ASSERT_TRUE(reader);
+    ASSERT_TRUE(reader->HasFeature(FEAT_META_INFO));
+  }
+  // The directory can be read as one record file.
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(dir);
+  ASSERT_TRUE(reader);
+  size_t sample_count = 0;
+  ASSERT_TRUE(reader->ReadDataSection([&](std::unique_ptr<Record> r) {
+    if (r->type() == PERF_RECORD_SAMPLE) {
+      sample_count++;
+    }
+    return true;
+  }));
+  ASSERT_GT(sample_count, 0u);
+  // Shards of a previous recording aren't overwritten.
+  ASSERT_FALSE(RecordCmd()->Run({"-o", dir, "-p", pid, "--shard-size", "4k", "--duration", "1"}));
+  ASSERT_EQ(shards, GetRecordShards(dir));
+
+  // --size-limit removes old shards.
+  dir = std::string(tmpdir.path) + "/perf_data_with_size_limit";
+  ASSERT_TRUE(RecordCmd()->Run({"-o", dir, "-p", pid, "--shard-size", "4k", "--size-limit", "8k",
+                                "--duration", "1"}));
+  shards = GetRecordShards(dir);
+  ASSERT_GE(shards.size(), 1u);
+  if (shards.size() > 1u) {
+    uint64_t total_size = 0;
+    for (const auto& shard : shards) {
+      total_size += GetFileSize(shard);
+    }
+    ASSERT_LE(total_size, 8192u);
+  }
+  // -o can't be a file when recording in shards.
+  TemporaryFile tmpfile;
+  ASSERT_FALSE(RecordCmd()->Run({"-o", tmpfile.path, "--shard-size", "4k", "sleep", "1"}));
+}
+
+TEST(record_cmd, flight_recorder_option) {
+  TEST_REQUIRE_HW_COUNTER();
+  std::vector<std::unique_ptr<Workload>> workloads;
+  CreateProcesses(1, &workloads);
+  std::string pid = std::to_string(workloads[0]->GetPid());
+  TemporaryDir tmpdir;
+  std::string dir = std::string(tmpdir.path) + "/perf_data";
+  ASSERT_TRUE(RecordCmd()->Run({"-o", dir, "-p", pid, "--flight-recorder", "0.5",
+                                "--flight-recorder-buffer-size", "1M", "--duration", "2"}));
+  // Records are dumped when recording stops.
+  std::vector<std::string> shards = GetRecordShards(dir);
+  ASSERT_EQ(1u, shards.size());
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(shards[0]);
+  ASSERT_TRUE(reader);
+  uint64_t min_time = UINT64_MAX;
+  uint64_t max_time = 0;
+  bool has_mmap = false;
+  ASSERT_TRUE(reader->ReadDataSection([&](std::unique_ptr<Record> r) {
+    if (r->type() == PERF_RECORD_SAMPLE) {
+      min_time = std::min(min_time, r->Timestamp());
+      max_time = std::max(max_time, r->Timestamp());
+    } else if (r->type() == PERF_RECORD_MMAP || r->type() == PERF_RECORD_MMAP2) {
+      has_mmap = true;
+    }
+    return true;
+  }));
+  ASSERT_TRUE(has_mmap);
+  // Only samples of about the last 0.5 seconds are kept.
+  ASSERT_LE(min_time, max_time);
+  ASSERT_LE(max_time - min_time, 600000000u);
+  ASSERT_FALSE(RecordCmd()->Run({"-o", dir, "--flight-recorder", "1", "-g", "--post-unwind=yes",
+                                 "sleep", "1"}));
+}
+
+TEST(record_cmd, log_stage_stats_option) {
+  TemporaryFile tmpfile;
+  ASSERT_TRUE(RunRecordCmd({"--log-stage-stats"}, tmpfile.path));
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(tmpfile.path);
+  ASSERT_TRUE(reader);
+  std::unordered_map<std::string, std::string> meta_info;
+  ASSERT_TRUE(reader->ReadMetaInfoFeature(&meta_info));
+  for (const char* stage : {"kernel_buffer_read", "record_buffer_usage", "process_record",
+                            "record_write"}) {
+    auto it = meta_info.find(std::string("stage_stat:") + stage);
+    ASSERT_NE(it, meta_info.end()) << stage;
+    ASSERT_TRUE(android::base::StartsWith(it->second, "count ")) << it->second;
+  }
+  // Stage stats are only collected with --log-stage-stats.
+  ASSERT_TRUE(RunRecordCmd({}, tmpfile.path));
+  reader = RecordFileReader::CreateInstance(tmpfile.path);
+  ASSERT_TRUE(reader);
+  meta_info.clear();
+  ASSERT_TRUE(reader->ReadMetaInfoFeature(&meta_info));
+  ASSERT_EQ(meta_info.find("stage_stat:process_record"), meta_info.end());
+}
+
 TEST(record_cmd, support_mmap2) {
   // mmap2 is supported in kernel >= 3.16. If not supported, please cherry pick below kernel
   // patches:
@@ -16,6 +16,7 @@
 
 #include <inttypes.h>
 #include <algorithm>
+#include <cmath>
 #include <functional>
 #include <map>
 #include <set>
@@ -125,7 +126,19 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
     symbol_filter_ = symbol_filter;
   }
 
+  // Used by report --diff, to collect the callchain of each sample as a list of sample entries.
+  // Callchains longer than max_stack are truncated.
+  void CollectCallChains(uint32_t max_stack) {
+    collect_callchains_ = true;
+    collect_callchain_max_stack_ = max_stack;
+  }
+
+  const std::map<std::vector<const SampleEntry*>, uint64_t>& GetCollectedCallChains() const {
+    return collected_callchains_;
+  }
+
   SampleTree GetSampleTree() {
+    FinishCollectingCallChain();
     AddCallChainDuplicateInfo();
     SampleTree sample_tree;
     sample_tree.samples = GetSamples();
@@ -157,8 +170,17 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
         thread_tree_->FindSymbol(map, r.ip_data.ip, &vaddr_in_file);
     uint64_t period = GetPeriod(r);
     *acc_info = period;
-    return InsertSample(std::unique_ptr<SampleEntry>(
+    SampleEntry* sample = InsertSample(std::unique_ptr<SampleEntry>(
         new SampleEntry(r.time_data.time, period, 0, 1, thread, map, symbol, vaddr_in_file)));
+    if (collect_callchains_) {
+      // The callchain of the previous sample is complete.
+      FinishCollectingCallChain();
+      if (sample != nullptr) {
+        current_callchain_.push_back(sample);
+        current_callchain_period_ = period;
+      }
+    }
+    return sample;
   }
 
   SampleEntry* CreateBranchSample(const SampleRecord& r,
@@ -199,7 +221,12 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
     std::unique_ptr<SampleEntry> callchain_sample(new SampleEntry(
         sample->time, 0, acc_info, 0, thread, map, symbol, vaddr_in_file));
     callchain_sample->thread_comm = sample->thread_comm;
-    return InsertCallChainSample(std::move(callchain_sample), callchain);
+    SampleEntry* result = InsertCallChainSample(std::move(callchain_sample), callchain);
+    if (collect_callchains_ && result != nullptr && !current_callchain_.empty() &&
+        current_callchain_.size() < collect_callchain_max_stack_) {
+      current_callchain_.push_back(result);
+    }
+    return result;
   }
 
   const ThreadEntry* GetThreadOfSample(SampleEntry* sample) override {
@@ -247,6 +274,13 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
   }
 
  private:
+  void FinishCollectingCallChain() {
+    if (!current_callchain_.empty()) {
+      collected_callchains_[current_callchain_] += current_callchain_period_;
+      current_callchain_.clear();
+    }
+  }
+
   ThreadTree* thread_tree_;
 
   std::unordered_set<int> pid_filter_;
@@ -258,6 +292,12 @@ class ReportCmdSampleTreeBuilder : public SampleTreeBuilder<SampleEntry, uint64_
   uint64_t total_samples_;
   uint64_t total_period_;
   uint64_t total_error_callchains_;
+
+  bool collect_callchains_ = false;
+  uint32_t collect_callchain_max_stack_ = UINT32_MAX;
+  std::vector<const SampleEntry*> current_callchain_;
+  uint64_t current_callchain_period_ = 0;
+  std::map<std::vector<const SampleEntry*>, uint64_t> collected_callchains_;
 };
 
 // Build sample tree based on event count in each sample.
@@ -320,6 +360,8 @@ struct SampleTreeBuilderOptions {
   bool build_callchain;
   bool use_caller_as_callchain_root;
   bool trace_offcpu;
+  bool collect_callchains = false;
+  uint32_t collect_callchain_max_stack = UINT32_MAX;
 
   std::unique_ptr<ReportCmdSampleTreeBuilder> CreateSampleTreeBuilder() {
     std::unique_ptr<ReportCmdSampleTreeBuilder> builder;
@@ -332,6 +374,9 @@ struct SampleTreeBuilderOptions {
     builder->SetBranchSampleOption(use_branch_address);
     builder->SetCallChainSampleOptions(accumulate_callchain, build_callchain,
                                        use_caller_as_callchain_root);
+    if (collect_callchains) {
+      builder->CollectCallChains(collect_callchain_max_stack);
+    }
     return builder;
   }
 };
@@ -358,6 +403,63 @@ struct EventAttrWithName {
   std::string name;
 };
 
+// Symbols and callchains of an event in a record file, used by report --diff. It only keeps
+// strings, so it stays valid after the ThreadTree of the record file is destroyed.
+struct DiffDsoInfo {
+  std::string path;
+  // Empty if the build id isn't recorded.
+  std::string build_id;
+};
+
+struct DiffSymbolInfo {
+  size_t dso_index;
+  std::string name;
+  uint64_t self_period;
+  uint64_t children_period;
+};
+
+struct DiffEventProfile {
+  std::string event_name;
+  uint64_t total_samples = 0;
+  uint64_t total_period = 0;
+  std::vector<DiffDsoInfo> dsos;
+  std::vector<DiffSymbolInfo> symbols;
+  // Each callchain is a list of indexes in symbols, from the sampled function to its callers.
+  std::vector<std::pair<std::vector<size_t>, uint64_t>> callchains;
+};
+
+// A (dso, symbol) pair matched between the baseline and test files. Values are percentages of
+// the total event count in each file.
+struct SymbolDiff {
+  std::string dso;
+  std::string symbol;
+  double baseline_self = 0;
+  double test_self = 0;
+  double baseline_children = 0;
+  double test_children = 0;
+
+  double DeltaSelf() const { return test_self - baseline_self; }
+  double DeltaChildren() const { return test_children - baseline_children; }
+  double MaxAbsDelta() const { return std::max(std::abs(DeltaSelf()), std::abs(DeltaChildren())); }
+};
+
+struct CallChainDiff {
+  // (dso, symbol) of each frame, from the sampled function to its callers.
+  std::vector<std::pair<std::string, std::string>> frames;
+  double baseline = 0;
+  double test = 0;
+
+  double Delta() const { return test - baseline; }
+};
+
+struct EventDiff {
+  std::string event_name;
+  const DiffEventProfile* baseline;
+  const DiffEventProfile* test;
+  std::vector<SymbolDiff> symbols;
+  std::vector<CallChainDiff> callchains;
+};
+
 class ReportCommand : public Command {
  public:
   ReportCommand()
@@ -371,6 +473,16 @@ class ReportCommand : public Command {
 "      option.\n"
 "--children    Print the overhead accumulated by appearing in the callchain.\n"
 "--comms comm1,comm2,...   Report only for selected comms.\n"
+"--diff <baseline_file>  Compare the record file (-i) with a baseline record file.\n"
+"                        Symbols are matched by (dso, symbol name), where dsos\n"
+"                        are matched by build id, or by file name if build ids\n"
+"                        differ. It reports deltas of self and children overhead\n"
+"                        of each symbol, and deltas of overhead of each callchain.\n"
+"                        Filters like --comms can be used. --sort, -b and -g can't\n"
+"                        be used.\n"
+"--diff-json     Print the diff report in json format.\n"
+"--diff-threshold <percent>  Hide symbols and callchains whose overhead changes\n"
+"                            less than <percent>. Default is 0.1.\n"
 "--dsos dso1,dso2,...      Report only for selected dsos.\n"
 "--full-callgraph  Print full call graph. Used with -g option. By default,\n"
 "                  brief call graph is printed.\n"
@@ -425,12 +537,15 @@ class ReportCommand : public Command {
         raw_period_(false),
         brief_callgraph_(true),
         trace_offcpu_(false),
-        sched_switch_attr_id_(0u) {}
+        sched_switch_attr_id_(0u),
+        diff_json_(false),
+        diff_threshold_(0.1) {}
 
   bool Run(const std::vector<std::string>& args);
 
  private:
   bool ParseOptions(const std::vector<std::string>& args);
+  bool ReadRecordFile();
   bool ReadMetaInfoFromRecordFile();
   bool ReadEventAttrFromRecordFile();
   bool ReadFeaturesFromRecordFile();
@@ -440,6 +555,11 @@ class ReportCommand : public Command {
   bool ProcessTracingData(const std::vector<char>& data);
   bool PrintReport();
   void PrintReportContext(FILE* fp);
+  bool RunDiff(const std::vector<std::string>& args);
+  std::vector<DiffEventProfile> GetDiffEventProfiles();
+  EventDiff BuildEventDiff(const DiffEventProfile& baseline, const DiffEventProfile& test);
+  void PrintDiffReport(FILE* fp, const std::vector<EventDiff>& diffs);
+  void PrintDiffReportInJson(FILE* fp, const std::vector<EventDiff>& diffs);
 
   std::string record_filename_;
   ArchType record_file_arch_;
@@ -469,6 +589,10 @@ class ReportCommand : public Command {
   std::string report_filename_;
   std::unordered_map<std::string, std::string> meta_info_;
   std::unique_ptr<ScopedEventTypes> scoped_event_types_;
+
+  std::string diff_baseline_filename_;
+  bool diff_json_;
+  double diff_threshold_;
 };
 
 bool ReportCommand::Run(const std::vector<std::string>& args) {
@@ -477,7 +601,24 @@ bool ReportCommand::Run(const std::vector<std::string>& args) {
     return false;
   }
 
+  if (!diff_baseline_filename_.empty()) {
+    return RunDiff(args);
+  }
+
   // 2. Read record file and build SampleTree.
+  if (!ReadRecordFile()) {
+    return false;
+  }
+
+  // 3. Show collected information.
+  if (!PrintReport()) {
+    return false;
+  }
+
+  return true;
+}
+
+bool ReportCommand::ReadRecordFile() {
   record_file_reader_ = RecordFileReader::CreateInstance(record_filename_);
   if (record_file_reader_ == nullptr) {
     return false;
@@ -493,16 +634,7 @@ bool ReportCommand::Run(const std::vector<std::string>& args) {
     return false;
   }
   ScopedCurrentArch scoped_arch(record_file_arch_);
-  if (!ReadSampleTreeFromRecordFile()) {
-    return false;
-  }
-
-  // 3. Show collected information.
-  if (!PrintReport()) {
-    return false;
-  }
-
-  return true;
+  return ReadSampleTreeFromRecordFile();
 }
 
 bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
@@ -526,6 +658,17 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
       }
       std::vector<std::string> strs = android::base::Split(args[i], ",");
       filter.insert(strs.begin(), strs.end());
+    } else if (args[i] == "--diff") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      diff_baseline_filename_ = args[i];
+    } else if (args[i] == "--diff-json") {
+      diff_json_ = true;
+    } else if (args[i] == "--diff-threshold") {
+      if (!GetDoubleOption(args, &i, &diff_threshold_)) {
+        return false;
+      }
     } else if (args[i] == "--full-callgraph") {
       brief_callgraph_ = false;
     } else if (args[i] == "-g") {
@@ -626,6 +769,18 @@ bool ReportCommand::ParseOptions(const std::vector<std::string>& args) {
     }
   }
 
+  if (!diff_baseline_filename_.empty()) {
+    if (use_branch_address_ || print_callgraph_) {
+      LOG(ERROR) << "--diff can't be used with -b or -g";
+      return false;
+    }
+    // Children overhead and callchains are always compared.
+    sort_keys = {"dso", "symbol"};
+    accumulate_callchain_ = true;
+    sample_tree_builder_options_.collect_callchains = true;
+    sample_tree_builder_options_.collect_callchain_max_stack = callgraph_max_stack_;
+  }
+
   Dso::SetDemangle(demangle);
   if (!vmlinux.empty()) {
     Dso::SetVmlinux(vmlinux);
@@ -957,6 +1112,308 @@ void ReportCommand::PrintReportContext(FILE* report_fp) {
   fprintf(report_fp, "Arch: %s\n", GetArchString(record_file_arch_).c_str());
 }
 
+// The baseline file is read before the test file, not in parallel, because Dso keeps global
+// state (like build ids) for the record file being read. Results of each file are copied into
+// DiffEventProfiles before reading the next file.
+bool ReportCommand::RunDiff(const std::vector<std::string>& args) {
+  std::vector<DiffEventProfile> baseline_profiles;
+  {
+    // Dso keeps process-wide state (build ids, kernel symbols) until all Dsos are destroyed. So
+    // baseline_cmd must be destroyed before reading the test file, otherwise the test file is
+    // symbolized with the state of the baseline file.
+    ReportCommand baseline_cmd;
+    if (!baseline_cmd.ParseOptions(args)) {
+      return false;
+    }
+    baseline_cmd.record_filename_ = diff_baseline_filename_;
+    if (!baseline_cmd.ReadRecordFile()) {
+      return false;
+    }
+    baseline_profiles = baseline_cmd.GetDiffEventProfiles();
+  }
+  if (!ReadRecordFile()) {
+    return false;
+  }
+  std::vector<DiffEventProfile> test_profiles = GetDiffEventProfiles();
+
+  std::vector<EventDiff> diffs;
+  for (const auto& test : test_profiles) {
+    auto it = std::find_if(baseline_profiles.begin(), baseline_profiles.end(),
+                           [&](const DiffEventProfile& p) {
+                             return p.event_name == test.event_name;
+                           });
+    if (it == baseline_profiles.end()) {
+      LOG(WARNING) << "Event " << test.event_name << " isn't recorded in "
+                   << diff_baseline_filename_;
+      continue;
+    }
+    diffs.push_back(BuildEventDiff(*it, test));
+  }
+
+  std::unique_ptr<FILE, decltype(&fclose)> file_handler(nullptr, fclose);
+  FILE* report_fp = stdout;
+  if (!report_filename_.empty()) {
+    report_fp = fopen(report_filename_.c_str(), "w");
+    if (report_fp == nullptr) {
+      PLOG(ERROR) << "failed to open file " << report_filename_;
+      return false;
+    }
+    file_handler.reset(report_fp);
+  }
+  if (diff_json_) {
+    PrintDiffReportInJson(report_fp, diffs);
+  } else {
+    PrintDiffReport(report_fp, diffs);
+  }
+  fflush(report_fp);
+  if (ferror(report_fp) != 0) {
+    PLOG(ERROR) << "print report failed";
+    return false;
+  }
+  return true;
+}
+
+std::vector<DiffEventProfile> ReportCommand::GetDiffEventProfiles() {
+  std::vector<DiffEventProfile> profiles;
+  for (size_t i = 0; i < event_attrs_.size(); ++i) {
+    if (trace_offcpu_ && i == sched_switch_attr_id_) {
+      continue;
+    }
+    const SampleTree& sample_tree = sample_tree_[i];
+    DiffEventProfile profile;
+    profile.event_name = event_attrs_[i].name;
+    profile.total_samples = sample_tree.total_samples;
+    profile.total_period = sample_tree.total_period;
+    std::unordered_map<const Dso*, size_t> dso_map;
+    std::unordered_map<const SampleEntry*, size_t> symbol_map;
+    // Entries only appearing in callchains of filtered samples aren't in the sample tree, and
+    // their periods are not counted.
+    auto get_symbol_index = [&](const SampleEntry* sample, bool in_sample_tree) {
+      auto it = symbol_map.find(sample);
+      if (it != symbol_map.end()) {
+        return it->second;
+      }
+      const Dso* dso = sample->map->dso;
+      auto dso_it = dso_map.find(dso);
+      if (dso_it == dso_map.end()) {
+        DiffDsoInfo dso_info;
+        dso_info.path = dso->Path();
+        BuildId build_id = Dso::FindExpectedBuildIdForPath(dso->Path());
+        if (!build_id.IsEmpty()) {
+          dso_info.build_id = build_id.ToString();
+        }
+        dso_it = dso_map.emplace(dso, profile.dsos.size()).first;
+        profile.dsos.push_back(dso_info);
+      }
+      DiffSymbolInfo symbol;
+      symbol.dso_index = dso_it->second;
+      symbol.name = sample->symbol->DemangledName();
+      symbol.self_period = in_sample_tree ? sample->period : 0;
+      symbol.children_period = in_sample_tree ? sample->period + sample->accumulated_period : 0;
+      size_t index = profile.symbols.size();
+      profile.symbols.push_back(symbol);
+      symbol_map[sample] = index;
+      return index;
+    };
+    for (const SampleEntry* sample : sample_tree.samples) {
+      get_symbol_index(sample, true);
+    }
+    for (const auto& pair : sample_tree_builder_[i]->GetCollectedCallChains()) {
+      std::vector<size_t> callchain;
+      for (const SampleEntry* sample : pair.first) {
+        callchain.push_back(get_symbol_index(sample, false));
+      }
+      profile.callchains.emplace_back(std::move(callchain), pair.second);
+    }
+    profiles.push_back(std::move(profile));
+  }
+  return profiles;
+}
+
+EventDiff ReportCommand::BuildEventDiff(const DiffEventProfile& baseline,
+                                        const DiffEventProfile& test) {
+  EventDiff diff;
+  diff.event_name = test.event_name;
+  diff.baseline = &baseline;
+  diff.test = &test;
+
+  // Dsos are named by file names, as paths of apps change after reinstalling. A baseline dso
+  // having the same build id as a test dso is named after the test dso.
+  std::vector<std::string> test_dso_names;
+  std::unordered_map<std::string, std::string> build_id_to_name;
+  for (const auto& dso : test.dsos) {
+    test_dso_names.push_back(android::base::Basename(dso.path));
+    if (!dso.build_id.empty()) {
+      build_id_to_name[dso.build_id] = test_dso_names.back();
+    }
+  }
+  std::vector<std::string> baseline_dso_names;
+  for (const auto& dso : baseline.dsos) {
+    auto it = dso.build_id.empty() ? build_id_to_name.end() : build_id_to_name.find(dso.build_id);
+    baseline_dso_names.push_back(it != build_id_to_name.end() ? it->second
+                                                              : android::base::Basename(dso.path));
+  }
+
+  auto get_percent = [](uint64_t period, uint64_t total_period) {
+    return total_period == 0 ? 0.0 : 100.0 * period / total_period;
+  };
+  using SymbolKey = std::pair<std::string, std::string>;
+  std::map<SymbolKey, SymbolDiff> symbol_map;
+  std::map<std::vector<SymbolKey>, CallChainDiff> callchain_map;
+  auto add_profile = [&](const DiffEventProfile& profile, const std::vector<std::string>& dso_names,
+                         bool is_test) {
+    std::vector<SymbolKey> keys;
+    for (const auto& symbol : profile.symbols) {
+      keys.emplace_back(dso_names[symbol.dso_index], symbol.name);
+      SymbolDiff& d = symbol_map[keys.back()];
+      double self = get_percent(symbol.self_period, profile.total_period);
+      double children = get_percent(symbol.children_period, profile.total_period);
+      (is_test ? d.test_self : d.baseline_self) += self;
+      (is_test ? d.test_children : d.baseline_children) += children;
+    }
+    for (const auto& pair : profile.callchains) {
+      std::vector<SymbolKey> callchain_key;
+      for (size_t symbol_index : pair.first) {
+        callchain_key.push_back(keys[symbol_index]);
+      }
+      CallChainDiff& d = callchain_map[callchain_key];
+      (is_test ? d.test : d.baseline) += get_percent(pair.second, profile.total_period);
+    }
+  };
+  add_profile(baseline, baseline_dso_names, false);
+  add_profile(test, test_dso_names, true);
+
+  for (auto& pair : symbol_map) {
+    if (pair.second.MaxAbsDelta() >= diff_threshold_) {
+      pair.second.dso = pair.first.first;
+      pair.second.symbol = pair.first.second;
+      diff.symbols.push_back(pair.second);
+    }
+  }
+  std::sort(diff.symbols.begin(), diff.symbols.end(),
+            [](const SymbolDiff& d1, const SymbolDiff& d2) {
+              return d1.MaxAbsDelta() > d2.MaxAbsDelta();
+            });
+  for (auto& pair : callchain_map) {
+    if (std::abs(pair.second.Delta()) >= diff_threshold_) {
+      pair.second.frames = pair.first;
+      diff.callchains.push_back(pair.second);
+    }
+  }
+  std::sort(diff.callchains.begin(), diff.callchains.end(),
+            [](const CallChainDiff& d1, const CallChainDiff& d2) {
+              return std::abs(d1.Delta()) > std::abs(d2.Delta());
+            });
+  return diff;
+}
+
+void ReportCommand::PrintDiffReport(FILE* fp, const std::vector<EventDiff>& diffs) {
+  fprintf(fp, "Baseline: %s\n", diff_baseline_filename_.c_str());
+  fprintf(fp, "Test: %s\n", record_filename_.c_str());
+  fprintf(fp, "Threshold: %.2f%%\n", diff_threshold_);
+  for (const auto& diff : diffs) {
+    fprintf(fp, "\nEvent: %s\n", diff.event_name.c_str());
+    fprintf(fp, "Samples: baseline %" PRIu64 ", test %" PRIu64 "\n", diff.baseline->total_samples,
+            diff.test->total_samples);
+    fprintf(fp, "Event count: baseline %" PRIu64 ", test %" PRIu64 "\n\n",
+            diff.baseline->total_period, diff.test->total_period);
+
+    SampleDisplayer<SymbolDiff, EventDiff> displayer;
+    displayer.AddDisplayFunction("Delta Self", [](const SymbolDiff* d) {
+      return android::base::StringPrintf("%+.2f%%", d->DeltaSelf());
+    });
+    displayer.AddDisplayFunction("Baseline Self", [](const SymbolDiff* d) {
+      return android::base::StringPrintf("%.2f%%", d->baseline_self);
+    });
+    displayer.AddDisplayFunction("Test Self", [](const SymbolDiff* d) {
+      return android::base::StringPrintf("%.2f%%", d->test_self);
+    });
+    displayer.AddDisplayFunction("Delta Children", [](const SymbolDiff* d) {
+      return android::base::StringPrintf("%+.2f%%", d->DeltaChildren());
+    });
+    displayer.AddDisplayFunction("Baseline Children", [](const SymbolDiff* d) {
+      return android::base::StringPrintf("%.2f%%", d->baseline_children);
+    });
+    displayer.AddDisplayFunction("Test Children", [](const SymbolDiff* d) {
+      return android::base::StringPrintf("%.2f%%", d->test_children);
+    });
+    displayer.AddDisplayFunction("Shared Object", [](const SymbolDiff* d) { return d->dso; });
+    displayer.AddDisplayFunction("Symbol", [](const SymbolDiff* d) { return d->symbol; });
+    for (const auto& d : diff.symbols) {
+      displayer.AdjustWidth(&d);
+    }
+    displayer.PrintNames(fp);
+    for (const auto& d : diff.symbols) {
+      displayer.PrintSample(fp, &d);
+    }
+
+    fprintf(fp, "\nCallchains:\n");
+    for (const auto& d : diff.callchains) {
+      fprintf(fp, "\n%+.2f%% (baseline %.2f%%, test %.2f%%)\n", d.Delta(), d.baseline, d.test);
+      for (size_t i = 0; i < d.frames.size(); ++i) {
+        fprintf(fp, "  %s%s (%s)\n", i == 0 ? "" : "<- ", d.frames[i].second.c_str(),
+                d.frames[i].first.c_str());
+      }
+    }
+  }
+}
+
+static std::string ToJsonString(const std::string& s) {
+  std::string result = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      result.push_back('\\');
+      result.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      result += android::base::StringPrintf("\\u%04x", c);
+    } else {
+      result.push_back(c);
+    }
+  }
+  result.push_back('"');
+  return result;
+}
+
+void ReportCommand::PrintDiffReportInJson(FILE* fp, const std::vector<EventDiff>& diffs) {
+  fprintf(fp, "{\n  \"baseline\": %s,\n  \"test\": %s,\n  \"threshold\": %f,\n  \"events\": [",
+          ToJsonString(diff_baseline_filename_).c_str(), ToJsonString(record_filename_).c_str(),
+          diff_threshold_);
+  for (size_t i = 0; i < diffs.size(); ++i) {
+    const EventDiff& diff = diffs[i];
+    fprintf(fp, "%s\n    {\n      \"name\": %s,\n", i == 0 ? "" : ",",
+            ToJsonString(diff.event_name).c_str());
+    fprintf(fp, "      \"baseline\": {\"samples\": %" PRIu64 ", \"event_count\": %" PRIu64 "},\n",
+            diff.baseline->total_samples, diff.baseline->total_period);
+    fprintf(fp, "      \"test\": {\"samples\": %" PRIu64 ", \"event_count\": %" PRIu64 "},\n",
+            diff.test->total_samples, diff.test->total_period);
+    fprintf(fp, "      \"symbols\": [");
+    for (size_t j = 0; j < diff.symbols.size(); ++j) {
+      const SymbolDiff& d = diff.symbols[j];
+      fprintf(fp,
+              "%s\n        {\"dso\": %s, \"symbol\": %s, \"baseline_self\": %f, "
+              "\"test_self\": %f, \"delta_self\": %f, \"baseline_children\": %f, "
+              "\"test_children\": %f, \"delta_children\": %f}",
+              j == 0 ? "" : ",", ToJsonString(d.dso).c_str(), ToJsonString(d.symbol).c_str(),
+              d.baseline_self, d.test_self, d.DeltaSelf(), d.baseline_children, d.test_children,
+              d.DeltaChildren());
+    }
+    fprintf(fp, "\n      ],\n      \"callchains\": [");
+    for (size_t j = 0; j < diff.callchains.size(); ++j) {
+      const CallChainDiff& d = diff.callchains[j];
+      fprintf(fp, "%s\n        {\"baseline\": %f, \"test\": %f, \"delta\": %f, \"frames\": [",
+              j == 0 ? "" : ",", d.baseline, d.test, d.Delta());
+      for (size_t k = 0; k < d.frames.size(); ++k) {
+        fprintf(fp, "%s{\"dso\": %s, \"symbol\": %s}", k == 0 ? "" : ", ",
+                ToJsonString(d.frames[k].first).c_str(),
+                ToJsonString(d.frames[k].second).c_str());
+      }
+      fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n      ]\n    }");
+  }
+  fprintf(fp, "\n  ]\n}\n");
+}
+
 }  // namespace
 
 void RegisterReportCommand() {
@@ -495,6 +495,78 @@ TEST_F(ReportCommandTest, report_big_trace_data) {
   ASSERT_TRUE(success);
 }
 
+TEST_F(ReportCommandTest, diff_option) {
+  // Compare a record file with itself, all deltas are zero.
+  Report(CALLGRAPH_FP_PERF_DATA,
+         {"--diff", GetTestData(CALLGRAPH_FP_PERF_DATA), "--diff-threshold", "0"});
+  ASSERT_TRUE(success);
+  ASSERT_NE(content.find("Delta Self"), std::string::npos);
+  ASSERT_NE(content.find("Callchains:"), std::string::npos);
+  bool found = false;
+  for (auto& line : lines) {
+    if (line.find("GlobalFunc") != std::string::npos && line.find("+0.00%") == 0) {
+      found = true;
+      break;
+    }
+  }
+  ASSERT_TRUE(found);
+  // With the default threshold, no symbols or callchains are shown.
+  Report(CALLGRAPH_FP_PERF_DATA, {"--diff", GetTestData(CALLGRAPH_FP_PERF_DATA)});
+  ASSERT_TRUE(success);
+  ASSERT_EQ(content.find("GlobalFunc"), std::string::npos);
+
+  Report(CALLGRAPH_FP_PERF_DATA, {"--diff", GetTestData(CALLGRAPH_FP_PERF_DATA),
+                                  "--diff-threshold", "0", "--diff-json"});
+  ASSERT_TRUE(success);
+  ASSERT_EQ(content[0], '{');
+  ASSERT_NE(content.find("\"symbol\": \"GlobalFunc\""), std::string::npos);
+  ASSERT_NE(content.find("\"callchains\": ["), std::string::npos);
+
+  ASSERT_FALSE(ReportCmd()->Run({"-i", GetTestData(CALLGRAPH_FP_PERF_DATA), "--diff",
+                                 GetTestData(CALLGRAPH_FP_PERF_DATA), "-g"}));
+}
+
+// Returns the Test Self and Test Children columns of the diff report line of GlobalFunc.
+static std::string GetTestColumnsOfGlobalFunc(const std::vector<std::string>& lines) {
+  for (auto& line : lines) {
+    if (line.find("GlobalFunc") != std::string::npos) {
+      std::vector<std::string> columns;
+      for (auto& column : android::base::Split(line, " ")) {
+        if (!column.empty()) {
+          columns.push_back(column);
+        }
+      }
+      if (columns.size() >= 6) {
+        return columns[2] + " " + columns[5];
+      }
+    }
+  }
+  return "";
+}
+
+TEST_F(ReportCommandTest, diff_option_with_different_files) {
+  Report(CALLGRAPH_FP_PERF_DATA,
+         {"--diff", GetTestData(CALLGRAPH_FP_PERF_DATA), "--diff-threshold", "0"});
+  ASSERT_TRUE(success);
+  std::string test_columns = GetTestColumnsOfGlobalFunc(lines);
+  ASSERT_NE(test_columns, "");
+
+  // Compare with a different record file of the same program. The baseline file is read first, but
+  // must not change how the test file is symbolized.
+  Report(CALLGRAPH_FP_PERF_DATA, {"--diff", GetTestData(PERF_DATA), "--diff-threshold", "0"});
+  ASSERT_TRUE(success);
+  ASSERT_EQ(GetTestColumnsOfGlobalFunc(lines), test_columns);
+  bool has_nonzero_delta = false;
+  for (auto& line : lines) {
+    if ((line[0] == '+' || line[0] == '-') && line.find("%") != std::string::npos &&
+        line.find("+0.00%") != 0 && line.find("-0.00%") != 0) {
+      has_nonzero_delta = true;
+      break;
+    }
+  }
+  ASSERT_TRUE(has_nonzero_delta);
+}
+
 #if defined(__linux__)
 #include "event_selection_set.h"
 
@@ -0,0 +1,607 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#include "command.h"
+#include "event_selection_set.h"
+#include "record.h"
+#include "record_file.h"
+#include "SampleDisplayer.h"
+#include "StageStat.h"
+#include "thread_tree.h"
+#include "tracing.h"
+#include "utils.h"
+
+using android::base::StringPrintf;
+using namespace simpleperf;
+
+namespace {
+
+// Callchain id 0 means no callchain. Callchain id 1 is used when too many callchains are kept.
+constexpr uint32_t kNoCallChainId = 0;
+constexpr uint32_t kDroppedCallChainId = 1;
+
+enum class ThreadState {
+  UNKNOWN,
+  RUNNING,
+  RUNNABLE,  // Waiting in a run queue, after being preempted or woken up.
+  BLOCKED,   // Sleeping, until being woken up.
+};
+
+struct ThreadInfo {
+  pid_t pid = 0;
+  pid_t tid = 0;
+  std::string name;
+  int prio = -1;
+  ThreadState state = ThreadState::UNKNOWN;
+  uint64_t state_start_time = 0;
+  // Valid in BLOCKED state.
+  uint32_t blocked_callchain_id = kNoCallChainId;
+  bool blocked_uninterruptible = false;
+
+  StageStat runq_latency{"runq_latency", "ns"};
+  uint64_t blocked_count = 0;
+  uint64_t blocked_time_in_ns = 0;
+  uint64_t uninterruptible_time_in_ns = 0;
+
+  uint64_t OffCpuTime() const { return runq_latency.Sum() + blocked_time_in_ns; }
+};
+
+// A wakee thread blocked at a callchain, and woken up by a waker thread at a callchain.
+struct WakeupPairKey {
+  pid_t waker_tid;
+  pid_t wakee_tid;
+  uint32_t waker_callchain_id;
+  uint32_t wakee_callchain_id;
+
+  bool operator==(const WakeupPairKey& other) const {
+    return waker_tid == other.waker_tid && wakee_tid == other.wakee_tid &&
+           waker_callchain_id == other.waker_callchain_id &&
+           wakee_callchain_id == other.wakee_callchain_id;
+  }
+};
+
+struct WakeupPairKeyHash {
+  size_t operator()(const WakeupPairKey& key) const {
+    size_t seed = std::hash<pid_t>()(key.waker_tid);
+    seed = seed * 31 + std::hash<pid_t>()(key.wakee_tid);
+    seed = seed * 31 + std::hash<uint32_t>()(key.waker_callchain_id);
+    return seed * 31 + std::hash<uint32_t>()(key.wakee_callchain_id);
+  }
+};
+
+struct WakeupPairInfo {
+  uint64_t count = 0;
+  uint64_t blocked_time_in_ns = 0;
+  uint64_t max_blocked_time_in_ns = 0;
+  // Times the waker had lower priority (a bigger prio value) than the wakee.
+  uint64_t priority_inversion_count = 0;
+};
+
+class SchedLatencyCommand : public Command {
+ public:
+  SchedLatencyCommand()
+      : Command("sched-latency", "Report off-cpu time and wakeup latency of threads.",
+                // clang-format off
+"Records system-wide sched:sched_switch and sched:sched_waking (or sched:sched_wakeup)\n"
+"events with callchains. For each thread, it reports run queue latency (time from\n"
+"being woken up or preempted to running on a cpu) and blocked time. It also reports\n"
+"callchains of wakers and blocked wakees taking the most blocked time, which helps\n"
+"finding lock contention and priority inversion.\n"
+"Records are processed in one pass, with memory bounded by --max-entries.\n"
+"Usage: simpleperf sched-latency [options]\n"
+"--duration time_in_sec  Monitor for time_in_sec seconds. Here time_in_sec may\n"
+"                        be any positive floating point number. Default is 10.\n"
+"--call-graph fp|dwarf[,<dump_stack_size>]  Set the way to record callchains.\n"
+"                        Default is fp.\n"
+"--record-file file_path   Read records from file_path, instead of recording.\n"
+"                          The file should be recorded with sched:sched_switch and\n"
+"                          sched:sched_waking (or sched:sched_wakeup) events.\n"
+"--max-callchain-depth depth  Max number of frames kept for each callchain. Default is 32.\n"
+"--max-entries count    Max number of callchains and wakeup pairs kept in memory.\n"
+"                       When there are more wakeup pairs, those taking the least\n"
+"                       blocked time are dropped. Default is 100000.\n"
+"--top count            Show top count wakeup pairs. Default is 10.\n"
+                // clang-format on
+                ),
+        duration_in_sec_(10.0),
+        call_graph_("fp"),
+        max_callchain_depth_(32),
+        max_entries_(100000),
+        top_count_(10) {
+  }
+
+  bool Run(const std::vector<std::string>& args);
+
+ private:
+  bool ParseOptions(const std::vector<std::string>& args);
+  bool RecordSchedEvents(const std::string& record_file_path);
+  bool ParseSchedEvents(const std::string& record_file_path);
+  bool ProcessRecord(std::unique_ptr<Record> record);
+  bool ProcessTracingData(const TracingDataRecord& r);
+  void ProcessSchedSwitch(const SampleRecord& r);
+  void ProcessSchedWakeup(const SampleRecord& r);
+  ThreadInfo& GetThread(pid_t tid);
+  uint32_t GetCallChainId(const SampleRecord& r);
+  void AddWakeupPair(const WakeupPairKey& key, uint64_t blocked_time_in_ns,
+                     bool priority_inversion);
+  void PruneWakeupPairs();
+  void ReportThreads();
+  void ReportWakeupPairs();
+  void PrintCallChain(const char* title, uint32_t callchain_id);
+
+  double duration_in_sec_;
+  std::string call_graph_;
+  std::string record_file_;
+  size_t max_callchain_depth_;
+  size_t max_entries_;
+  size_t top_count_;
+
+  std::unique_ptr<RecordFileReader> reader_;
+  ThreadTree thread_tree_;
+  size_t sched_switch_attr_index_ = SIZE_MAX;
+  size_t sched_wakeup_attr_index_ = SIZE_MAX;
+  uint64_t sched_switch_id_ = 0;
+  uint64_t sched_wakeup_id_ = 0;
+  StringTracingFieldPlace prev_comm_;
+  TracingFieldPlace prev_pid_;
+  TracingFieldPlace prev_prio_;
+  TracingFieldPlace prev_state_;
+  StringTracingFieldPlace next_comm_;
+  TracingFieldPlace next_pid_;
+  TracingFieldPlace next_prio_;
+  StringTracingFieldPlace wakee_comm_;
+  TracingFieldPlace wakee_pid_;
+  TracingFieldPlace wakee_prio_;
+  bool has_tracing_format_ = false;
+
+  std::unordered_map<pid_t, ThreadInfo> threads_;
+  std::unordered_map<std::string, uint32_t> callchain_ids_;
+  std::vector<const std::string*> callchains_;
+  std::unordered_map<WakeupPairKey, WakeupPairInfo, WakeupPairKeyHash> wakeup_pairs_;
+  uint64_t dropped_pair_count_ = 0;
+  uint64_t dropped_pair_blocked_time_in_ns_ = 0;
+};
+
+bool SchedLatencyCommand::Run(const std::vector<std::string>& args) {
+  if (!ParseOptions(args)) {
+    return false;
+  }
+  TemporaryFile tmp_file;
+  if (record_file_.empty()) {
+    if (!RecordSchedEvents(tmp_file.path)) {
+      return false;
+    }
+    record_file_ = tmp_file.path;
+  }
+  if (!ParseSchedEvents(record_file_)) {
+    return false;
+  }
+  ReportThreads();
+  ReportWakeupPairs();
+  return true;
+}
+
+bool SchedLatencyCommand::ParseOptions(const std::vector<std::string>& args) {
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--call-graph") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      call_graph_ = args[i];
+    } else if (args[i] == "--duration") {
+      if (!GetDoubleOption(args, &i, &duration_in_sec_, 1e-9)) {
+        return false;
+      }
+    } else if (args[i] == "--max-callchain-depth") {
+      if (!GetUintOption(args, &i, &max_callchain_depth_, 1)) {
+        return false;
+      }
+    } else if (args[i] == "--max-entries") {
+      if (!GetUintOption(args, &i, &max_entries_, 2)) {
+        return false;
+      }
+    } else if (args[i] == "--record-file") {
+      if (!NextArgumentOrError(args, &i)) {
+        return false;
+      }
+      record_file_ = args[i];
+    } else if (args[i] == "--top") {
+      if (!GetUintOption(args, &i, &top_count_)) {
+        return false;
+      }
+    } else {
+      ReportUnknownOption(args, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SchedLatencyCommand::RecordSchedEvents(const std::string& record_file_path) {
+  if (!IsRoot()) {
+    LOG(ERROR) << "Need root privilege to trace system wide events.\n";
+    return false;
+  }
+  // sched_waking is generated in the context of the waker, while sched_wakeup may be generated
+  // on the cpu of the wakee.
+  std::string wakeup_event = "sched:sched_waking";
+  if (FindEventTypeByName(wakeup_event, false) == nullptr) {
+    wakeup_event = "sched:sched_wakeup";
+  }
+  std::unique_ptr<Command> record_cmd = CreateCommandInstance("record");
+  CHECK(record_cmd);
+  std::vector<std::string> record_args = {"-e", "sched:sched_switch," + wakeup_event, "-a",
+                                          "--call-graph", call_graph_,
+                                          "--duration", std::to_string(duration_in_sec_),
+                                          "-o", record_file_path};
+  if (IsSettingClockIdSupported()) {
+    record_args.push_back("--clockid");
+    record_args.push_back("monotonic");
+  }
+  return record_cmd->Run(record_args);
+}
+
+bool SchedLatencyCommand::ParseSchedEvents(const std::string& record_file_path) {
+  reader_ = RecordFileReader::CreateInstance(record_file_path);
+  if (!reader_) {
+    return false;
+  }
+  std::unique_ptr<ScopedEventTypes> scoped_event_types;
+  if (reader_->HasFeature(PerfFileFormat::FEAT_META_INFO)) {
+    std::unordered_map<std::string, std::string> meta_info;
+    if (!reader_->ReadMetaInfoFeature(&meta_info)) {
+      return false;
+    }
+    auto it = meta_info.find("event_type_info");
+    if (it != meta_info.end()) {
+      scoped_event_types.reset(new ScopedEventTypes(it->second));
+    }
+  }
+  const EventType* sched_switch = FindEventTypeByName("sched:sched_switch", false);
+  const EventType* sched_wakeups[] = {FindEventTypeByName("sched:sched_waking", false),
+                                      FindEventTypeByName("sched:sched_wakeup", false)};
+  std::vector<EventAttrWithId> attrs = reader_->AttrSection();
+  for (size_t i = 0; i < attrs.size(); ++i) {
+    const perf_event_attr& attr = *attrs[i].attr;
+    if (attr.type != PERF_TYPE_TRACEPOINT) {
+      continue;
+    }
+    if (sched_switch != nullptr && attr.config == sched_switch->config) {
+      sched_switch_attr_index_ = i;
+      sched_switch_id_ = attr.config;
+    }
+    // Prefer sched_waking when both are recorded.
+    for (const EventType* event : sched_wakeups) {
+      if (event != nullptr && attr.config == event->config &&
+          (sched_wakeup_attr_index_ == SIZE_MAX || event == sched_wakeups[0])) {
+        sched_wakeup_attr_index_ = i;
+        sched_wakeup_id_ = attr.config;
+      }
+    }
+  }
+  if (sched_switch_attr_index_ == SIZE_MAX || sched_wakeup_attr_index_ == SIZE_MAX) {
+    LOG(ERROR) << "sched:sched_switch and sched:sched_waking (or sched:sched_wakeup) aren't "
+               << "recorded in " << record_file_path;
+    return false;
+  }
+  reader_->LoadBuildIdAndFileFeatures(thread_tree_);
+  // Reserve ids for no callchain and dropped callchains.
+  static const std::string no_callchain = "";
+  static const std::string dropped_callchain = "[not kept, too many callchains]";
+  callchains_.push_back(&no_callchain);
+  callchains_.push_back(&dropped_callchain);
+  return reader_->ReadDataSection(
+      [this](std::unique_ptr<Record> record) { return ProcessRecord(std::move(record)); });
+}
+
+bool SchedLatencyCommand::ProcessRecord(std::unique_ptr<Record> record) {
+  thread_tree_.Update(*record);
+  if (record->type() == PERF_RECORD_SAMPLE) {
+    if (!has_tracing_format_) {
+      LOG(ERROR) << "No tracing data before sample records";
+      return false;
+    }
+    const SampleRecord& r = *static_cast<const SampleRecord*>(record.get());
+    size_t attr_index = reader_->GetAttrIndexOfRecord(&r);
+    if (attr_index == sched_switch_attr_index_) {
+      ProcessSchedSwitch(r);
+    } else if (attr_index == sched_wakeup_attr_index_) {
+      ProcessSchedWakeup(r);
+    }
+  } else if (record->type() == PERF_RECORD_TRACING_DATA ||
+             record->type() == SIMPLE_PERF_RECORD_TRACING_DATA) {
+    return ProcessTracingData(*static_cast<const TracingDataRecord*>(record.get()));
+  }
+  return true;
+}
+
+bool SchedLatencyCommand::ProcessTracingData(const TracingDataRecord& r) {
+  Tracing tracing(std::vector<char>(r.data, r.data + r.data_size));
+  TracingFormat format = tracing.GetTracingFormatHavingId(sched_switch_id_);
+  format.GetField("prev_comm", prev_comm_);
+  format.GetField("prev_pid", prev_pid_);
+  format.GetField("prev_prio", prev_prio_);
+  format.GetField("prev_state", prev_state_);
+  format.GetField("next_comm", next_comm_);
+  format.GetField("next_pid", next_pid_);
+  format.GetField("next_prio", next_prio_);
+  format = tracing.GetTracingFormatHavingId(sched_wakeup_id_);
+  format.GetField("comm", wakee_comm_);
+  format.GetField("pid", wakee_pid_);
+  format.GetField("prio", wakee_prio_);
+  has_tracing_format_ = true;
+  return true;
+}
+
+ThreadInfo& SchedLatencyCommand::GetThread(pid_t tid) {
+  ThreadInfo& thread = threads_[tid];
+  thread.tid = tid;
+  return thread;
+}
+
+void SchedLatencyCommand::ProcessSchedSwitch(const SampleRecord& r) {
+  const char* data = r.raw_data.data;
+  uint64_t time = r.Timestamp();
+  pid_t prev_tid = static_cast<pid_t>(prev_pid_.ReadFromData(data));
+  if (prev_tid != 0) {
+    ThreadInfo& prev = GetThread(prev_tid);
+    prev.pid = r.tid_data.pid;
+    prev.name = prev_comm_.ReadFromData(data);
+    prev.prio = static_cast<int>(prev_prio_.ReadFromData(data));
+    // The low bits of prev_state are the task state, 0 means TASK_RUNNING. Higher bits are used
+    // to mark preemption, whose value differs between kernel versions.
+    uint64_t state = prev_state_.ReadFromData(data) & 0x7f;
+    prev.state_start_time = time;
+    if (state == 0) {
+      prev.state = ThreadState::RUNNABLE;
+    } else {
+      prev.state = ThreadState::BLOCKED;
+      // The sample is taken in the context of prev, so its callchain is where prev blocks.
+      prev.blocked_callchain_id = GetCallChainId(r);
+      // TASK_UNINTERRUPTIBLE is 2.
+      prev.blocked_uninterruptible = (state & 2) != 0;
+    }
+  }
+  pid_t next_tid = static_cast<pid_t>(next_pid_.ReadFromData(data));
+  if (next_tid != 0) {
+    ThreadInfo& next = GetThread(next_tid);
+    next.name = next_comm_.ReadFromData(data);
+    next.prio = static_cast<int>(next_prio_.ReadFromData(data));
+    if (next.state == ThreadState::RUNNABLE && time >= next.state_start_time) {
+      next.runq_latency.Add(time - next.state_start_time);
+    }
+    next.state = ThreadState::RUNNING;
+    next.state_start_time = time;
+  }
+}
+
+void SchedLatencyCommand::ProcessSchedWakeup(const SampleRecord& r) {
+  const char* data = r.raw_data.data;
+  uint64_t time = r.Timestamp();
+  pid_t wakee_tid = static_cast<pid_t>(wakee_pid_.ReadFromData(data));
+  if (wakee_tid == 0) {
+    return;
+  }
+  ThreadInfo& wakee = GetThread(wakee_tid);
+  wakee.name = wakee_comm_.ReadFromData(data);
+  wakee.prio = static_cast<int>(wakee_prio_.ReadFromData(data));
+  if (wakee.state == ThreadState::BLOCKED && time >= wakee.state_start_time) {
+    uint64_t blocked_time = time - wakee.state_start_time;
+    wakee.blocked_count++;
+    wakee.blocked_time_in_ns += blocked_time;
+    if (wakee.blocked_uninterruptible) {
+      wakee.uninterruptible_time_in_ns += blocked_time;
+    }
+    // The waker is the current thread, or an interrupt handler when the current thread is idle.
+    pid_t waker_tid = r.tid_data.tid;
+    bool priority_inversion = false;
+    if (waker_tid != 0) {
+      const ThreadInfo& waker = GetThread(waker_tid);
+      priority_inversion = waker.prio > wakee.prio && wakee.prio >= 0;
+    }
+    WakeupPairKey key;
+    key.waker_tid = waker_tid;
+    key.wakee_tid = wakee_tid;
+    key.waker_callchain_id = GetCallChainId(r);
+    key.wakee_callchain_id = wakee.blocked_callchain_id;
+    AddWakeupPair(key, blocked_time, priority_inversion);
+  }
+  if (wakee.state != ThreadState::RUNNING && wakee.state != ThreadState::RUNNABLE) {
+    wakee.state = ThreadState::RUNNABLE;
+    wakee.state_start_time = time;
+  }
+}
+
+// Symbolize a callchain and map it to an id. Callchains are compared by symbol names, so the
+// same code path in different processes and at different addresses share one id.
+uint32_t SchedLatencyCommand::GetCallChainId(const SampleRecord& r) {
+  if ((r.sample_type & PERF_SAMPLE_CALLCHAIN) == 0) {
+    return kNoCallChainId;
+  }
+  size_t kernel_ip_count;
+  std::vector<uint64_t> ips = r.GetCallChain(&kernel_ip_count);
+  const ThreadEntry* thread = thread_tree_.FindThreadOrNew(r.tid_data.pid, r.tid_data.tid);
+  std::string callchain;
+  for (size_t i = 0; i < ips.size() && i < max_callchain_depth_; ++i) {
+    const MapEntry* map = thread_tree_.FindMap(thread, ips[i], i < kernel_ip_count);
+    uint64_t vaddr_in_file;
+    const Symbol* symbol = thread_tree_.FindSymbol(map, ips[i], &vaddr_in_file);
+    callchain += StringPrintf("%s (%s)\n", symbol->DemangledName(), map->dso->Path().c_str());
+  }
+  auto it = callchain_ids_.find(callchain);
+  if (it != callchain_ids_.end()) {
+    return it->second;
+  }
+  if (callchains_.size() >= max_entries_) {
+    return kDroppedCallChainId;
+  }
+  uint32_t id = callchains_.size();
+  it = callchain_ids_.emplace(std::move(callchain), id).first;
+  callchains_.push_back(&it->first);
+  return id;
+}
+
+void SchedLatencyCommand::AddWakeupPair(const WakeupPairKey& key, uint64_t blocked_time_in_ns,
+                                        bool priority_inversion) {
+  WakeupPairInfo& info = wakeup_pairs_[key];
+  info.count++;
+  info.blocked_time_in_ns += blocked_time_in_ns;
+  info.max_blocked_time_in_ns = std::max(info.max_blocked_time_in_ns, blocked_time_in_ns);
+  if (priority_inversion) {
+    info.priority_inversion_count++;
+  }
+  if (wakeup_pairs_.size() > max_entries_) {
+    PruneWakeupPairs();
+  }
+}
+
+// Keep half of the wakeup pairs taking the most blocked time. So pruning runs at most once
+// per max_entries_ / 2 new pairs.
+void SchedLatencyCommand::PruneWakeupPairs() {
+  using PairEntry = std::pair<WakeupPairKey, WakeupPairInfo>;
+  std::vector<PairEntry> pairs(wakeup_pairs_.begin(), wakeup_pairs_.end());
+  size_t keep_count = max_entries_ / 2;
+  std::nth_element(pairs.begin(), pairs.begin() + keep_count, pairs.end(),
+                   [](const PairEntry& p1, const PairEntry& p2) {
+                     return p1.second.blocked_time_in_ns > p2.second.blocked_time_in_ns;
+                   });
+  for (size_t i = keep_count; i < pairs.size(); ++i) {
+    dropped_pair_count_ += pairs[i].second.count;
+    dropped_pair_blocked_time_in_ns_ += pairs[i].second.blocked_time_in_ns;
+    wakeup_pairs_.erase(pairs[i].first);
+  }
+}
+
+void SchedLatencyCommand::ReportThreads() {
+  std::vector<const ThreadInfo*> threads;
+  for (const auto& pair : threads_) {
+    const ThreadInfo& thread = pair.second;
+    // No need to report simpleperf.
+    if (thread.name != "simpleperf" && thread.OffCpuTime() != 0) {
+      threads.push_back(&thread);
+    }
+  }
+  std::sort(threads.begin(), threads.end(), [](const ThreadInfo* t1, const ThreadInfo* t2) {
+    return t1->OffCpuTime() > t2->OffCpuTime();
+  });
+
+  SampleDisplayer<ThreadInfo, uint64_t> displayer;
+  displayer.AddDisplayFunction("Pid", [](const ThreadInfo* thread) {
+    return StringPrintf("%d", thread->pid);
+  });
+  displayer.AddDisplayFunction("Tid", [](const ThreadInfo* thread) {
+    return StringPrintf("%d", thread->tid);
+  });
+  displayer.AddDisplayFunction("Name", [](const ThreadInfo* thread) { return thread->name; });
+  displayer.AddDisplayFunction("RunQ Count", [](const ThreadInfo* thread) {
+    return StringPrintf("%" PRIu64, thread->runq_latency.Count());
+  });
+  displayer.AddDisplayFunction("RunQ Total", [](const ThreadInfo* thread) {
+    return StringPrintf("%.3f ms", thread->runq_latency.Sum() / 1e6);
+  });
+  displayer.AddDisplayFunction("RunQ P99", [](const ThreadInfo* thread) {
+    return StringPrintf("<= %.3f ms", thread->runq_latency.Percentile(99) / 1e6);
+  });
+  displayer.AddDisplayFunction("RunQ Max", [](const ThreadInfo* thread) {
+    return StringPrintf("%.3f ms", thread->runq_latency.Max() / 1e6);
+  });
+  displayer.AddDisplayFunction("Blocked Count", [](const ThreadInfo* thread) {
+    return StringPrintf("%" PRIu64, thread->blocked_count);
+  });
+  displayer.AddDisplayFunction("Blocked Total", [](const ThreadInfo* thread) {
+    return StringPrintf("%.3f ms", thread->blocked_time_in_ns / 1e6);
+  });
+  displayer.AddDisplayFunction("Uninterruptible", [](const ThreadInfo* thread) {
+    return StringPrintf("%.3f ms", thread->uninterruptible_time_in_ns / 1e6);
+  });
+  for (auto thread : threads) {
+    displayer.AdjustWidth(thread);
+  }
+  displayer.PrintNames(stdout);
+  for (auto thread : threads) {
+    displayer.PrintSample(stdout, thread);
+  }
+}
+
+void SchedLatencyCommand::ReportWakeupPairs() {
+  using PairEntry = std::pair<WakeupPairKey, WakeupPairInfo>;
+  std::vector<PairEntry> pairs(wakeup_pairs_.begin(), wakeup_pairs_.end());
+  std::sort(pairs.begin(), pairs.end(), [](const PairEntry& p1, const PairEntry& p2) {
+    return p1.second.blocked_time_in_ns > p2.second.blocked_time_in_ns;
+  });
+  if (pairs.size() > top_count_) {
+    pairs.resize(top_count_);
+  }
+  auto get_thread_name = [&](pid_t tid) -> std::string {
+    if (tid == 0) {
+      return "[idle or interrupt]";
+    }
+    auto it = threads_.find(tid);
+    return it == threads_.end() ? "" : it->second.name;
+  };
+  printf("\nTop %zu wakeup pairs by blocked time:\n", pairs.size());
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    const WakeupPairKey& key = pairs[i].first;
+    const WakeupPairInfo& info = pairs[i].second;
+    printf("\n#%zu: wakee %s (%d) woken by %s (%d), count %" PRIu64
+           ", blocked %.3f ms, max %.3f ms\n",
+           i + 1, get_thread_name(key.wakee_tid).c_str(), key.wakee_tid,
+           get_thread_name(key.waker_tid).c_str(), key.waker_tid, info.count,
+           info.blocked_time_in_ns / 1e6, info.max_blocked_time_in_ns / 1e6);
+    if (info.priority_inversion_count != 0) {
+      printf("  Priority inversion: waker has lower priority than wakee in %" PRIu64
+             " wakeups\n", info.priority_inversion_count);
+    }
+    PrintCallChain("Wakee blocked at", key.wakee_callchain_id);
+    PrintCallChain("Waker callchain", key.waker_callchain_id);
+  }
+  if (dropped_pair_count_ != 0) {
+    printf("\nDropped %" PRIu64 " wakeups (%.3f ms blocked time) to limit memory usage.\n",
+           dropped_pair_count_, dropped_pair_blocked_time_in_ns_ / 1e6);
+  }
+}
+
+void SchedLatencyCommand::PrintCallChain(const char* title, uint32_t callchain_id) {
+  if (callchain_id == kNoCallChainId) {
+    return;
+  }
+  printf("  %s:\n", title);
+  for (const auto& frame : android::base::Split(*callchains_[callchain_id], "\n")) {
+    if (!frame.empty()) {
+      printf("    %s\n", frame.c_str());
+    }
+  }
+}
+
+}  // namespace
+
+void RegisterSchedLatencyCommand() {
+  RegisterCommand("sched-latency",
+                  [] { return std::unique_ptr<Command>(new SchedLatencyCommand()); });
+}
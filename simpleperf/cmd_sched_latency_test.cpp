@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include <android-base/file.h>
+
+#include "command.h"
+#include "environment.h"
+#include "event_type.h"
+#include "get_test_data.h"
+#include "test_util.h"
+
+static std::unique_ptr<Command> SchedLatencyCmd() {
+  return CreateCommandInstance("sched-latency");
+}
+
+TEST(sched_latency_cmd, smoke) {
+  TEST_IN_ROOT({
+    CaptureStdout capture;
+    ASSERT_TRUE(capture.Start());
+    ASSERT_TRUE(SchedLatencyCmd()->Run({"--duration", "1"}));
+    std::string data = capture.Finish();
+    ASSERT_NE(data.find("RunQ Count"), std::string::npos);
+    ASSERT_NE(data.find("wakeup pairs by blocked time"), std::string::npos);
+  });
+}
+
+static void TestRecordFileOption() {
+  if (FindEventTypeByName("sched:sched_switch", false) == nullptr ||
+      FindEventTypeByName("sched:sched_wakeup", false) == nullptr) {
+    GTEST_LOG_(INFO) << "Omit this test as sched events are not available";
+    return;
+  }
+  TemporaryFile tmpfile;
+  ASSERT_TRUE(CreateCommandInstance("record")->Run(
+      {"-e", "sched:sched_switch,sched:sched_wakeup", "-a", "--call-graph", "fp", "--duration",
+       "1", "-o", tmpfile.path}));
+  CaptureStdout capture;
+  ASSERT_TRUE(capture.Start());
+  ASSERT_TRUE(SchedLatencyCmd()->Run({"--record-file", tmpfile.path, "--top", "3",
+                                      "--max-entries", "100"}));
+  std::string data = capture.Finish();
+  ASSERT_NE(data.find("RunQ Count"), std::string::npos);
+}
+
+TEST(sched_latency_cmd, record_file_option) {
+  TEST_IN_ROOT(TestRecordFileOption());
+}
+
+TEST(sched_latency_cmd, record_file_without_sched_events) {
+  ASSERT_FALSE(SchedLatencyCmd()->Run({"--record-file", GetTestData(PERF_DATA)}));
+}
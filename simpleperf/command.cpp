@@ -93,6 +93,7 @@ extern void RegisterKmemCommand();
 extern void RegisterRecordCommand();
 extern void RegisterReportCommand();
 extern void RegisterReportSampleCommand();
+extern void RegisterSchedLatencyCommand();
 extern void RegisterStatCommand();
 extern void RegisterDebugUnwindCommand();
 extern void RegisterTraceSchedCommand();
@@ -112,6 +113,7 @@ class CommandRegister {
     RegisterStatCommand();
     RegisterDebugUnwindCommand();
     RegisterTraceSchedCommand();
+    RegisterSchedLatencyCommand();
 #if defined(__ANDROID__)
     RegisterAPICommands();
 #endif
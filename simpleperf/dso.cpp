@@ -28,6 +28,7 @@
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 
+#include "KernelSymbolTable.h"
 #include "environment.h"
 #include "read_apk.h"
 #include "read_dex_file.h"
@@ -197,6 +198,7 @@ const char* Symbol::DemangledName() const {
 bool Dso::demangle_ = true;
 std::string Dso::vmlinux_;
 std::string Dso::kallsyms_;
+std::vector<char> Dso::kernel_symbol_table_;
 bool Dso::read_kernel_symbols_from_proc_;
 std::unordered_map<std::string, BuildId> Dso::build_id_map_;
 size_t Dso::dso_count_;
@@ -294,6 +296,7 @@ Dso::~Dso() {
     demangle_ = true;
     vmlinux_.clear();
     kallsyms_.clear();
+    kernel_symbol_table_.clear();
     read_kernel_symbols_from_proc_ = false;
     build_id_map_.clear();
     g_dump_id_ = 0;
@@ -596,6 +599,8 @@ class KernelDso : public Dso {
       ReportReadElfSymbolResult(status, path_, vmlinux_);
     } else if (!kallsyms_.empty()) {
       symbols = ReadSymbolsFromKallsyms(kallsyms_);
+    } else if (!kernel_symbol_table_.empty()) {
+      symbols = ReadSymbolsFromKernelSymbolTable();
     } else if (read_kernel_symbols_from_proc_ || !build_id.IsEmpty()) {
       // Try /proc/kallsyms only when asked to do so, or when build id matches.
       // Otherwise, it is likely to use /proc/kallsyms on host for perf.data recorded on device.
@@ -639,6 +644,18 @@ class KernelDso : public Dso {
     }
     return symbols;
   }
+
+  std::vector<Symbol> ReadSymbolsFromKernelSymbolTable() {
+    std::vector<Symbol> symbols;
+    simpleperf::KernelSymbolTable table;
+    if (table.Open(kernel_symbol_table_.data(), kernel_symbol_table_.size())) {
+      symbols.reserve(table.SymbolCount());
+      for (size_t i = 0; i < table.SymbolCount(); ++i) {
+        symbols.emplace_back(table.GetName(i), table.GetAddr(i), 0);
+      }
+    }
+    return symbols;
+  }
 };
 
 class KernelModuleDso : public Dso {
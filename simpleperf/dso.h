@@ -128,6 +128,12 @@ class Dso {
       kallsyms_ = std::move(kallsyms);
     }
   }
+  // Set kernel symbols in the format of KernelSymbolTable.
+  static void SetKernelSymbolTable(std::vector<char> data) {
+    if (!data.empty()) {
+      kernel_symbol_table_ = std::move(data);
+    }
+  }
   static void ReadKernelSymbolsFromProc() {
     read_kernel_symbols_from_proc_ = true;
   }
@@ -189,6 +195,7 @@ class Dso {
   static bool demangle_;
   static std::string vmlinux_;
   static std::string kallsyms_;
+  static std::vector<char> kernel_symbol_table_;
   static bool read_kernel_symbols_from_proc_;
   static std::unordered_map<std::string, BuildId> build_id_map_;
   static size_t dso_count_;
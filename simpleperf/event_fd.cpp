@@ -16,6 +16,7 @@
 #define ATRACE_TAG ATRACE_TAG_ALWAYS
 #include "event_fd.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,6 +24,7 @@
 #include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <algorithm>
 #include <atomic>
 #include <memory>
 #include <cutils/trace.h>
@@ -95,6 +97,9 @@ std::unique_ptr<EventFd> EventFd::OpenEventFile(const perf_event_attr& attr,
 
 EventFd::~EventFd() {
   DestroyMappedBuffer();
+  if (user_page_ != nullptr) {
+    munmap(user_page_, sysconf(_SC_PAGE_SIZE));
+  }
   close(perf_event_fd_);
 }
 
@@ -125,6 +130,19 @@ bool EventFd::SetEnableEvent(bool enable) {
 
 bool EventFd::InnerReadCounter(PerfCounter* counter) const {
   CHECK(counter != nullptr);
+  if (attr_.read_format & PERF_FORMAT_GROUP) {
+    // Reading the group leader returns counters of all events in the group, the leader first.
+    std::vector<PerfCounter> counters;
+    if (!ReadGroupCounters(&counters)) {
+      return false;
+    }
+    if (counters.empty()) {
+      LOG(ERROR) << "ReadCounter from " << Name() << " returned no counters";
+      return false;
+    }
+    *counter = counters[0];
+    return true;
+  }
   if (!android::base::ReadFully(perf_event_fd_, counter, sizeof(*counter))) {
     PLOG(ERROR) << "ReadCounter from " << Name() << " failed";
     return false;
@@ -133,7 +151,7 @@ bool EventFd::InnerReadCounter(PerfCounter* counter) const {
 }
 
 bool EventFd::ReadCounter(PerfCounter* counter) {
-  if (!InnerReadCounter(counter)) {
+  if (!ReadCounterFromUserPage(counter) && !InnerReadCounter(counter)) {
     return false;
   }
   // Trace is always available to systrace if enabled
@@ -150,6 +168,117 @@ bool EventFd::ReadCounter(PerfCounter* counter) {
   return true;
 }
 
+bool EventFd::ReadGroupCounters(std::vector<PerfCounter>* counters) const {
+  CHECK(attr_.read_format & PERF_FORMAT_GROUP);
+  // read() with a too small buffer fails with ENOSPC. So start with a buffer for several events,
+  // and enlarge it when needed.
+  std::vector<uint64_t> buf(3 + 2 * std::max<size_t>(counters->size(), 8));
+  while (true) {
+    ssize_t size = read(perf_event_fd_, buf.data(), buf.size() * sizeof(uint64_t));
+    if (size >= 0) {
+      break;
+    }
+    if (errno != ENOSPC) {
+      PLOG(ERROR) << "ReadGroupCounters from " << Name() << " failed";
+      return false;
+    }
+    buf.resize(buf.size() * 2);
+  }
+  uint64_t nr = buf[0];
+  counters->resize(nr);
+  for (uint64_t i = 0; i < nr; ++i) {
+    PerfCounter& counter = (*counters)[i];
+    counter.time_enabled = buf[1];
+    counter.time_running = buf[2];
+    counter.value = buf[3 + i * 2];
+    counter.id = buf[4 + i * 2];
+  }
+  return true;
+}
+
+bool EventFd::MapUserPage() {
+  if (user_page_ != nullptr) {
+    return true;
+  }
+  size_t page_size = sysconf(_SC_PAGE_SIZE);
+  void* addr = mmap(nullptr, page_size, PROT_READ, MAP_SHARED, perf_event_fd_, 0);
+  if (addr == MAP_FAILED) {
+    PLOG(DEBUG) << "mmap user page failed for " << Name();
+    return false;
+  }
+  user_page_ = reinterpret_cast<perf_event_mmap_page*>(addr);
+  return true;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+
+static inline uint64_t ReadPmc(uint32_t index) {
+  uint32_t low;
+  uint32_t high;
+  asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(index));
+  return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+static inline uint64_t ReadTimestampCounter() {
+  uint32_t low;
+  uint32_t high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+// Follow the algorithm described for perf_event_mmap_page in include/uapi/linux/perf_event.h.
+bool EventFd::ReadCounterFromUserPage(PerfCounter* counter) {
+  if (user_page_ == nullptr || tid_ != gettid()) {
+    return false;
+  }
+  volatile perf_event_mmap_page* pc = user_page_;
+  uint32_t seq;
+  uint64_t count;
+  uint64_t enabled;
+  uint64_t running;
+  do {
+    seq = pc->lock;
+    __sync_synchronize();
+    if (!pc->cap_user_rdpmc || !pc->cap_user_time) {
+      return false;
+    }
+    enabled = pc->time_enabled;
+    running = pc->time_running;
+    count = pc->offset;
+    // Add the time since the page was last updated.
+    uint64_t cyc = ReadTimestampCounter();
+    uint64_t quot = cyc >> pc->time_shift;
+    uint64_t rem = cyc & ((static_cast<uint64_t>(1) << pc->time_shift) - 1);
+    uint64_t delta =
+        pc->time_offset + quot * pc->time_mult + ((rem * pc->time_mult) >> pc->time_shift);
+    enabled += delta;
+    uint32_t index = pc->index;
+    if (index != 0) {
+      // The event is running on the current cpu, add the hardware counter value.
+      uint32_t width = pc->pmc_width;
+      int64_t pmc = ReadPmc(index - 1);
+      pmc <<= 64 - width;
+      pmc >>= 64 - width;
+      count += pmc;
+      running += delta;
+    }
+    __sync_synchronize();
+  } while (pc->lock != seq);
+  counter->value = count;
+  counter->time_enabled = enabled;
+  counter->time_running = running;
+  counter->id = Id();
+  return true;
+}
+
+#else
+
+bool EventFd::ReadCounterFromUserPage(PerfCounter*) {
+  return false;
+}
+
+#endif
+
 bool EventFd::CreateMappedBuffer(size_t mmap_pages, bool report_error) {
   CHECK(IsPowerOfTwo(mmap_pages));
   size_t page_size = sysconf(_SC_PAGE_SIZE);
@@ -62,6 +62,17 @@ class EventFd {
 
   bool ReadCounter(PerfCounter* counter);
 
+  // Read counters of all events in the group led by this event with one read() call. It needs
+  // PERF_FORMAT_GROUP in attr.read_format. counters are in the order of opening the events.
+  bool ReadGroupCounters(std::vector<PerfCounter>* counters) const;
+
+  // Map the perf_event_mmap_page, so ReadCounter() can read counters without syscalls. It only
+  // works when reading events monitoring the calling thread, on architectures allowing reading
+  // hardware counters and timestamps in user space. Otherwise ReadCounter() uses read().
+  bool MapUserPage();
+  // Read counter through the page mapped by MapUserPage(). Return false if it isn't possible.
+  bool ReadCounterFromUserPage(PerfCounter* counter);
+
   // Create mapped buffer used to receive records sent by the kernel.
   // mmap_pages should be power of 2.
   virtual bool CreateMappedBuffer(size_t mmap_pages, bool report_error);
@@ -105,7 +116,8 @@ class EventFd {
         mmap_data_buffer_(nullptr),
         mmap_data_buffer_size_(0),
         ioevent_ref_(nullptr),
-        last_counter_value_(0) {}
+        last_counter_value_(0),
+        user_page_(nullptr) {}
 
   bool InnerReadCounter(PerfCounter* counter) const;
 
@@ -128,6 +140,9 @@ class EventFd {
   // Used by atrace to generate value difference between two ReadCounter() calls.
   uint64_t last_counter_value_;
 
+  // Mapped by MapUserPage(), used to read counters in user space.
+  perf_event_mmap_page* user_page_;
+
   DISALLOW_COPY_AND_ASSIGN(EventFd);
 };
 
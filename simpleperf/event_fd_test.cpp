@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "event_fd.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+#include "environment.h"
+#include "event_attr.h"
+#include "event_type.h"
+
+static std::unique_ptr<EventFd> OpenEvent(const std::string& event_name, uint64_t read_format,
+                                          EventFd* group_event_fd) {
+  const EventType* event_type = FindEventTypeByName(event_name);
+  if (event_type == nullptr) {
+    return nullptr;
+  }
+  perf_event_attr attr = CreateDefaultPerfEventAttr(*event_type);
+  attr.read_format |= read_format;
+  // Counting in user space only doesn't need permission to profile the kernel.
+  attr.exclude_kernel = 1;
+  return EventFd::OpenEventFile(attr, gettid(), -1, group_event_fd);
+}
+
+TEST(event_fd, read_counter_of_group_leader) {
+  // A group leader with PERF_FORMAT_GROUP returns counters of all events in the group.
+  std::unique_ptr<EventFd> leader = OpenEvent("cpu-clock", PERF_FORMAT_GROUP, nullptr);
+  ASSERT_TRUE(leader != nullptr);
+  std::vector<std::unique_ptr<EventFd>> members;
+  for (size_t i = 0; i < 3; ++i) {
+    members.emplace_back(OpenEvent("task-clock", 0, leader.get()));
+    ASSERT_TRUE(members.back() != nullptr);
+  }
+  ASSERT_TRUE(leader->SetEnableEvent(true));
+  for (volatile int i = 0; i < 1000000; i = i + 1) {
+  }
+
+  std::vector<PerfCounter> counters;
+  ASSERT_TRUE(leader->ReadGroupCounters(&counters));
+  ASSERT_EQ(counters.size(), members.size() + 1);
+  ASSERT_EQ(counters[0].id, leader->Id());
+  for (size_t i = 0; i < members.size(); ++i) {
+    ASSERT_EQ(counters[i + 1].id, members[i]->Id());
+  }
+
+  // ReadCounter() on the leader returns the leader's counter.
+  PerfCounter counter;
+  ASSERT_TRUE(leader->ReadCounter(&counter));
+  ASSERT_EQ(counter.id, leader->Id());
+  ASSERT_GE(counter.value, counters[0].value);
+}
@@ -422,6 +422,16 @@ void EventSelectionSet::SetInherit(bool enable) {
   }
 }
 
+void EventSelectionSet::EnableGroupRead() {
+  for (auto& group : groups_) {
+    // PERF_FORMAT_GROUP on the group leader makes reading it return counters of all events in
+    // the group.
+    if (group.size() > 1u) {
+      group[0].event_attr.read_format |= PERF_FORMAT_GROUP;
+    }
+  }
+}
+
 void EventSelectionSet::SetClockId(int clock_id) {
   for (auto& group : groups_) {
     for (auto& selection : group) {
@@ -590,20 +600,74 @@ static bool ReadCounter(EventFd* event_fd, CounterInfo* counter) {
 bool EventSelectionSet::ReadCounters(std::vector<CountersInfo>* counters) {
   counters->clear();
   for (size_t i = 0; i < groups_.size(); ++i) {
+    size_t first_counter = counters->size();
     for (auto& selection : groups_[i]) {
       CountersInfo counters_info;
       counters_info.group_id = i;
       counters_info.event_name = selection.event_type_modifier.event_type.name;
       counters_info.event_modifier = selection.event_type_modifier.modifier;
       counters_info.counters = selection.hotplugged_counters;
-      for (auto& event_fd : selection.event_fds) {
+      counters->push_back(counters_info);
+    }
+    if (groups_[i][0].event_attr.read_format & PERF_FORMAT_GROUP) {
+      if (!ReadGroupCounters(groups_[i], &(*counters)[first_counter])) {
+        return false;
+      }
+      continue;
+    }
+    for (size_t j = 0; j < groups_[i].size(); ++j) {
+      for (auto& event_fd : groups_[i][j].event_fds) {
         CounterInfo counter;
         if (!ReadCounter(event_fd.get(), &counter)) {
           return false;
         }
-        counters_info.counters.push_back(counter);
+        (*counters)[first_counter + j].counters.push_back(counter);
+      }
+    }
+  }
+  return true;
+}
+
+bool EventSelectionSet::ReadGroupCounters(EventSelectionGroup& group, CountersInfo* counters) {
+  // Event files of a group are opened together for each thread and cpu.
+  size_t fd_count = group[0].event_fds.size();
+  for (auto& selection : group) {
+    CHECK_EQ(selection.event_fds.size(), fd_count);
+  }
+  std::vector<PerfCounter> values(group.size());
+  for (size_t i = 0; i < fd_count; ++i) {
+    // Reading in user space is cheaper than a read() syscall for the whole group.
+    bool read_in_user_space = true;
+    for (size_t j = 0; j < group.size() && read_in_user_space; ++j) {
+      read_in_user_space = group[j].event_fds[i]->ReadCounterFromUserPage(&values[j]);
+    }
+    if (!read_in_user_space && !group[0].event_fds[i]->ReadGroupCounters(&values)) {
+      return false;
+    }
+    if (values.size() != group.size()) {
+      LOG(ERROR) << "Read " << values.size() << " counters from a group of " << group.size()
+                 << " events";
+      return false;
+    }
+    for (size_t j = 0; j < group.size(); ++j) {
+      CounterInfo counter;
+      counter.tid = group[j].event_fds[i]->ThreadId();
+      counter.cpu = group[j].event_fds[i]->Cpu();
+      counter.counter = values[j];
+      counters[j].counters.push_back(counter);
+    }
+  }
+  return true;
+}
+
+bool EventSelectionSet::MapUserPages() {
+  for (auto& group : groups_) {
+    for (auto& selection : group) {
+      for (auto& event_fd : selection.event_fds) {
+        if (!event_fd->MapUserPage()) {
+          return false;
+        }
       }
-      counters->push_back(counters_info);
     }
   }
   return true;
@@ -613,6 +677,9 @@ bool EventSelectionSet::MmapEventFiles(size_t min_mmap_pages, size_t max_mmap_pa
                                        size_t record_buffer_size) {
   record_read_thread_.reset(new simpleperf::RecordReadThread(
       record_buffer_size, groups_[0][0].event_attr, min_mmap_pages, max_mmap_pages));
+  if (enable_stage_stats_) {
+    record_read_thread_->EnableStageStats();
+  }
   return true;
 }
 
@@ -657,6 +724,10 @@ bool EventSelectionSet::ReadMmapEventData(bool with_time_limit) {
   return true;
 }
 
+bool EventSelectionSet::SyncAndReadMmapEventData() {
+  return SyncKernelBuffer() && ReadMmapEventData(false);
+}
+
 bool EventSelectionSet::FinishReadMmapEventData() {
   // Stop the read thread, so we don't get more records beyond current time.
   if (!SyncKernelBuffer() || !record_read_thread_->StopReadThread()) {
@@ -709,6 +780,13 @@ void EventSelectionSet::GetLostRecords(size_t* lost_samples, size_t* lost_non_sa
   record_read_thread_->GetLostRecords(lost_samples, lost_non_samples, cut_stack_samples);
 }
 
+std::vector<simpleperf::StageStat> EventSelectionSet::GetStageStats() {
+  if (!record_read_thread_) {
+    return {};
+  }
+  return record_read_thread_->GetStageStats();
+}
+
 bool EventSelectionSet::HandleCpuHotplugEvents(const std::vector<int>& monitored_cpus,
                                                double check_interval_in_sec) {
   monitored_cpus_.insert(monitored_cpus.begin(), monitored_cpus.end());
@@ -32,6 +32,7 @@
 #include "IOEventLoop.h"
 #include "perf_event.h"
 #include "record.h"
+#include "StageStat.h"
 
 namespace simpleperf {
   class RecordReadThread;
@@ -107,6 +108,8 @@ class EventSelectionSet {
   void EnableFpCallChainSampling();
   bool EnableDwarfCallChainSampling(uint32_t dump_stack_size);
   void SetInherit(bool enable);
+  // Read counters of events in a group with one read() call for each thread and cpu.
+  void EnableGroupRead();
   void SetClockId(int clock_id);
   bool NeedKernelSymbol() const;
   void SetRecordNotExecutableMaps(bool record);
@@ -134,11 +137,21 @@ class EventSelectionSet {
 
   bool OpenEventFiles(const std::vector<int>& on_cpus);
   bool ReadCounters(std::vector<CountersInfo>* counters);
+  // Let ReadCounters() read counters in user space when possible. It should be called after
+  // OpenEventFiles().
+  bool MapUserPages();
   bool MmapEventFiles(size_t min_mmap_pages, size_t max_mmap_pages, size_t record_buffer_size);
   bool PrepareToReadMmapEventData(const std::function<bool(Record*)>& callback);
   bool SyncKernelBuffer();
+  // Like FinishReadMmapEventData(), passes all records read so far to the callback, but keeps
+  // reading records afterwards.
+  bool SyncAndReadMmapEventData();
   bool FinishReadMmapEventData();
   void GetLostRecords(size_t* lost_samples, size_t* lost_non_samples, size_t* cut_stack_samples);
+  // Collect stats of reading records from kernel buffers. It should be called before
+  // MmapEventFiles().
+  void EnableStageStats() { enable_stage_stats_ = true; }
+  std::vector<simpleperf::StageStat> GetStageStats();
 
   // If monitored_cpus is empty, monitor all cpus.
   bool HandleCpuHotplugEvents(const std::vector<int>& monitored_cpus,
@@ -170,6 +183,7 @@ class EventSelectionSet {
                                     const std::map<pid_t, std::set<pid_t>>& process_map);
   bool OpenEventFilesOnGroup(EventSelectionGroup& group, pid_t tid, int cpu,
                              std::string* failed_event_type);
+  bool ReadGroupCounters(EventSelectionGroup& group, CountersInfo* counters);
   bool ReadMmapEventData(bool with_time_limit);
 
   bool DetectCpuHotplugEvents();
@@ -192,6 +206,7 @@ class EventSelectionSet {
   std::vector<int> online_cpus_;
 
   std::unique_ptr<simpleperf::RecordReadThread> record_read_thread_;
+  bool enable_stage_stats_ = false;
 
   DISALLOW_COPY_AND_ASSIGN(EventSelectionSet);
 };
@@ -36,7 +36,8 @@ struct Counter {
   uint64_t value;
   // If there is not enough hardware counters, kernel will share counters between events.
   // time_enabled_in_ns is the period when counting is enabled, and time_running_in_ns is
-  // the period when counting really happens in hardware.
+  // the period when counting really happens in hardware. When they are different, value *
+  // time_enabled_in_ns / time_running_in_ns estimates the count in the whole enabled period.
   uint64_t time_enabled_in_ns;
   uint64_t time_running_in_ns;
 };
@@ -84,6 +85,9 @@ class SIMPLEPERF_EXPORT PerfEventSet {
   virtual bool StopCounters();
   // Read counter values. There is a value for each event. You don't need to stop counters before
   // reading them. The counter values are the accumulated value from the first StartCounters().
+  // If possible, events are counted in a group, which is read with one syscall for each monitored
+  // thread, and whose events have the same time_running_in_ns. When only monitoring the current
+  // thread, counters read in that thread may be read without syscalls.
   virtual bool ReadCounters(std::vector<Counter>* counters);
 
  protected:
@@ -1161,10 +1161,8 @@ UnwindingResultRecord::UnwindingResultRecord(uint64_t time,
   UpdateBinary(new_binary);
 }
 
-void UnwindingResultRecord::DumpData(size_t indent) const {
-  PrintIndented(indent, "time %" PRIu64 "\n", time);
-  PrintIndented(indent, "used_time %" PRIu64 "\n", unwinding_result.used_time);
-  static std::unordered_map<int, std::string> map = {
+const char* UnwindingResultRecord::StopReasonToString(uint64_t stop_reason) {
+  static std::unordered_map<uint64_t, std::string> map = {
       {UnwindingResult::UNKNOWN_REASON, "UNKNOWN_REASON"},
       {UnwindingResult::EXCEED_MAX_FRAMES_LIMIT, "EXCEED_MAX_FRAME_LIMIT"},
       {UnwindingResult::ACCESS_REG_FAILED, "ACCESS_REG_FAILED"},
@@ -1175,7 +1173,14 @@ void UnwindingResultRecord::DumpData(size_t indent) const {
       {UnwindingResult::DIFFERENT_ARCH, "DIFFERENT_ARCH"},
       {UnwindingResult::MAP_MISSING, "MAP_MISSING"},
   };
-  PrintIndented(indent, "stop_reason %s\n", map[unwinding_result.stop_reason].c_str());
+  auto it = map.find(stop_reason);
+  return it != map.end() ? it->second.c_str() : "";
+}
+
+void UnwindingResultRecord::DumpData(size_t indent) const {
+  PrintIndented(indent, "time %" PRIu64 "\n", time);
+  PrintIndented(indent, "used_time %" PRIu64 "\n", unwinding_result.used_time);
+  PrintIndented(indent, "stop_reason %s\n", StopReasonToString(unwinding_result.stop_reason));
   if (unwinding_result.stop_reason == UnwindingResult::ACCESS_REG_FAILED) {
     PrintIndented(indent, "regno %" PRIu64 "\n", unwinding_result.stop_info);
   } else if (unwinding_result.stop_reason == UnwindingResult::ACCESS_STACK_FAILED ||
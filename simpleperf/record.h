@@ -541,6 +541,8 @@ struct UnwindingResultRecord : public Record {
     return time;
   }
 
+  static const char* StopReasonToString(uint64_t stop_reason);
+
  protected:
   void DumpData(size_t indent) const override;
 };
@@ -35,6 +35,12 @@
 #include "record_file_format.h"
 #include "thread_tree.h"
 
+// Shards are record files generated by `simpleperf record --shard-size/--shard-duration` in a
+// directory. Each shard is a complete record file, named by its order in the recording.
+std::string GetRecordShardPath(const std::string& dir, size_t index);
+// Return shards in a directory, in recording order.
+std::vector<std::string> GetRecordShards(const std::string& dir);
+
 // RecordFileWriter writes to a perf record file, like perf.data.
 // User should call RecordFileWriter::Close() to finish writing the file, otherwise the file will
 // be removed in RecordFileWriter::~RecordFileWriter().
@@ -99,6 +105,9 @@ class RecordFileWriter {
 };
 
 // RecordFileReader read contents from a perf record file, like perf.data.
+// It can also read a directory of shards as one record file. Then the header, attr section and
+// feature sections are read from the first shard, records are read from all shards in order,
+// and LoadBuildIdAndFileFeatures() merges features of all shards.
 class RecordFileReader {
  public:
   static std::unique_ptr<RecordFileReader> CreateInstance(const std::string& filename);
@@ -167,12 +176,17 @@ class RecordFileReader {
   bool ReadAttrSection();
   bool ReadIdsForAttr(const PerfFileFormat::FileAttr& attr, std::vector<uint64_t>* ids);
   bool ReadFeatureSectionDescriptors();
+  bool OpenNextShard();
+  void LoadBuildIdAndFileFeaturesOfShards(ThreadTree& thread_tree);
   std::unique_ptr<Record> ReadRecord(uint64_t* nbytes_read);
   bool Read(void* buf, size_t len);
   void ProcessEventIdRecord(const EventIdRecord& r);
 
-  const std::string filename_;
+  std::string filename_;
   FILE* record_fp_;
+  // All shards when reading a shard directory, and the index of the next shard to read records.
+  std::vector<std::string> shards_;
+  size_t next_shard_ = 0;
 
   PerfFileFormat::FileHeader header_;
   std::vector<PerfFileFormat::FileAttr> file_attrs_;
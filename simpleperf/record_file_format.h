@@ -65,6 +65,10 @@ meta_info feature section:
   keys in meta_info feature section include:
     simpleperf_version,
 
+kernel_symbols feature section:
+  It contains kernel function symbols read from /proc/kallsyms when recording, in the format
+  described in KernelSymbolTable.h. It replaces the KernelSymbolRecord in the data section.
+
 */
 
 namespace PerfFileFormat {
@@ -94,6 +98,7 @@ enum {
   FEAT_SIMPLEPERF_START = 128,
   FEAT_FILE = FEAT_SIMPLEPERF_START,
   FEAT_META_INFO,
+  FEAT_KERNEL_SYMBOLS,
   FEAT_MAX_NUM = 256,
 };
 
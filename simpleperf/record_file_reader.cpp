@@ -18,10 +18,14 @@
 
 #include <fcntl.h>
 #include <string.h>
+#include <algorithm>
 #include <set>
 #include <vector>
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 
 #include "event_attr.h"
 #include "record.h"
@@ -51,6 +55,7 @@ static const std::map<int, std::string> feature_name_map = {
     {FEAT_GROUP_DESC, "group_desc"},
     {FEAT_FILE, "file"},
     {FEAT_META_INFO, "meta_info"},
+    {FEAT_KERNEL_SYMBOLS, "kernel_symbols"},
 };
 
 std::string GetFeatureName(int feature_id) {
@@ -69,7 +74,41 @@ int GetFeatureId(const std::string& feature_name) {
 
 } // namespace PerfFileFormat
 
+std::string GetRecordShardPath(const std::string& dir, size_t index) {
+  return dir + OS_PATH_SEPARATOR + android::base::StringPrintf("perf-%06zu.data", index);
+}
+
+std::vector<std::string> GetRecordShards(const std::string& dir) {
+  std::vector<std::pair<size_t, std::string>> shards;
+  for (const std::string& name : GetEntriesInDir(dir)) {
+    size_t index;
+    if (android::base::StartsWith(name, "perf-") && android::base::EndsWith(name, ".data") &&
+        android::base::ParseUint(name.substr(5, name.size() - 10), &index)) {
+      shards.emplace_back(index, dir + OS_PATH_SEPARATOR + name);
+    }
+  }
+  std::sort(shards.begin(), shards.end());
+  std::vector<std::string> result;
+  for (auto& pair : shards) {
+    result.push_back(std::move(pair.second));
+  }
+  return result;
+}
+
 std::unique_ptr<RecordFileReader> RecordFileReader::CreateInstance(const std::string& filename) {
+  if (IsDir(filename)) {
+    std::vector<std::string> shards = GetRecordShards(filename);
+    if (shards.empty()) {
+      LOG(ERROR) << "no record file in directory '" << filename << "'";
+      return nullptr;
+    }
+    auto reader = CreateInstance(shards[0]);
+    if (reader != nullptr) {
+      reader->shards_ = std::move(shards);
+      reader->next_shard_ = 1;
+    }
+    return reader;
+  }
   std::string mode = std::string("rb") + CLOSE_ON_EXEC_MODE;
   FILE* fp = fopen(filename.c_str(), mode.c_str());
   if (fp == nullptr) {
@@ -192,6 +231,44 @@ bool RecordFileReader::ReadFeatureSectionDescriptors() {
   return true;
 }
 
+bool RecordFileReader::OpenNextShard() {
+  const std::string& shard = shards_[next_shard_++];
+  std::string mode = std::string("rb") + CLOSE_ON_EXEC_MODE;
+  FILE* fp = fopen(shard.c_str(), mode.c_str());
+  if (fp == nullptr) {
+    PLOG(ERROR) << "failed to open record file '" << shard << "'";
+    return false;
+  }
+  if (!Close()) {
+    fclose(fp);
+    return false;
+  }
+  filename_ = shard;
+  record_fp_ = fp;
+  read_record_size_ = 0;
+  std::vector<FileAttr> prev_attrs = std::move(file_attrs_);
+  file_attrs_.clear();
+  event_ids_for_file_attrs_.clear();
+  event_id_to_attr_map_.clear();
+  feature_section_descriptors_.clear();
+  if (!ReadHeader() || !ReadAttrSection() || !ReadFeatureSectionDescriptors()) {
+    return false;
+  }
+  if (prev_attrs.size() != file_attrs_.size()) {
+    LOG(ERROR) << shard << " has different events from previous shards";
+    return false;
+  }
+  for (size_t i = 0; i < prev_attrs.size(); ++i) {
+    if (memcmp(&prev_attrs[i].attr, &file_attrs_[i].attr, sizeof(perf_event_attr)) != 0) {
+      LOG(ERROR) << shard << " has different events from previous shards";
+      return false;
+    }
+  }
+  // Keep attrs returned by AttrSection() valid.
+  file_attrs_ = std::move(prev_attrs);
+  return true;
+}
+
 bool RecordFileReader::ReadIdsForAttr(const FileAttr& attr, std::vector<uint64_t>* ids) {
   size_t id_count = attr.ids.size / sizeof(uint64_t);
   if (fseek(record_fp_, attr.ids.offset, SEEK_SET) != 0) {
@@ -235,6 +312,8 @@ bool RecordFileReader::ReadRecord(std::unique_ptr<Record>& record) {
     if (record->type() == SIMPLE_PERF_RECORD_EVENT_ID) {
       ProcessEventIdRecord(*static_cast<EventIdRecord*>(record.get()));
     }
+  } else if (next_shard_ < shards_.size()) {
+    return OpenNextShard() && ReadRecord(record);
   }
   return true;
 }
@@ -489,6 +568,10 @@ bool RecordFileReader::ReadMetaInfoFeature(std::unordered_map<std::string, std::
 }
 
 void RecordFileReader::LoadBuildIdAndFileFeatures(ThreadTree& thread_tree) {
+  if (shards_.size() > 1) {
+    LoadBuildIdAndFileFeaturesOfShards(thread_tree);
+    return;
+  }
   std::vector<BuildIdRecord> records = ReadBuildIdFeature();
   std::vector<std::pair<std::string, BuildId>> build_ids;
   for (auto& r : records) {
@@ -510,6 +593,72 @@ void RecordFileReader::LoadBuildIdAndFileFeatures(ThreadTree& thread_tree) {
                              dex_file_offsets);
     }
   }
+
+  if (HasFeature(PerfFileFormat::FEAT_KERNEL_SYMBOLS)) {
+    std::vector<char> data;
+    if (ReadFeatureSection(PerfFileFormat::FEAT_KERNEL_SYMBOLS, &data)) {
+      Dso::SetKernelSymbolTable(std::move(data));
+    }
+  }
+}
+
+// Each shard only has symbols hit in itself and previous shards. So merge files and symbols in
+// all shards before reading records.
+void RecordFileReader::LoadBuildIdAndFileFeaturesOfShards(ThreadTree& thread_tree) {
+  struct FileInfo {
+    uint32_t type;
+    uint64_t min_vaddr;
+    uint64_t file_offset_of_min_vaddr;
+    std::map<uint64_t, Symbol> symbols;
+    std::set<uint64_t> dex_file_offsets;
+  };
+  std::map<std::string, BuildId> build_id_map;
+  std::map<std::string, FileInfo> file_map;
+  std::vector<char> kernel_symbol_table;
+  for (const std::string& shard : shards_) {
+    std::unique_ptr<RecordFileReader> reader = CreateInstance(shard);
+    if (reader == nullptr) {
+      continue;
+    }
+    for (auto& r : reader->ReadBuildIdFeature()) {
+      build_id_map[r.filename] = r.build_id;
+    }
+    std::string file_path;
+    uint32_t file_type;
+    uint64_t min_vaddr;
+    uint64_t file_offset_of_min_vaddr;
+    std::vector<Symbol> symbols;
+    std::vector<uint64_t> dex_file_offsets;
+    size_t read_pos = 0;
+    while (reader->ReadFileFeature(read_pos, &file_path, &file_type, &min_vaddr,
+                                   &file_offset_of_min_vaddr, &symbols, &dex_file_offsets)) {
+      FileInfo& info = file_map[file_path];
+      info.type = file_type;
+      info.min_vaddr = min_vaddr;
+      info.file_offset_of_min_vaddr = file_offset_of_min_vaddr;
+      for (auto& symbol : symbols) {
+        info.symbols.emplace(symbol.addr, symbol);
+      }
+      info.dex_file_offsets.insert(dex_file_offsets.begin(), dex_file_offsets.end());
+    }
+    if (reader->HasFeature(FEAT_KERNEL_SYMBOLS)) {
+      reader->ReadFeatureSection(FEAT_KERNEL_SYMBOLS, &kernel_symbol_table);
+    }
+  }
+  Dso::SetBuildIds(std::vector<std::pair<std::string, BuildId>>(build_id_map.begin(),
+                                                                 build_id_map.end()));
+  for (auto& pair : file_map) {
+    FileInfo& info = pair.second;
+    std::vector<Symbol> symbols;
+    symbols.reserve(info.symbols.size());
+    for (auto& symbol_pair : info.symbols) {
+      symbols.push_back(symbol_pair.second);
+    }
+    thread_tree.AddDsoInfo(pair.first, info.type, info.min_vaddr, info.file_offset_of_min_vaddr,
+                           &symbols, std::vector<uint64_t>(info.dex_file_offsets.begin(),
+                                                           info.dex_file_offsets.end()));
+  }
+  Dso::SetKernelSymbolTable(std::move(kernel_symbol_table));
 }
 
 std::vector<std::unique_ptr<Record>> RecordFileReader::DataSection() {
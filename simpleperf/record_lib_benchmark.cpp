@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "simpleperf.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+using namespace simpleperf;
+
+static const std::vector<std::string> kEvents = {"cpu-cycles", "instructions", "task-clock",
+                                                 "cpu-cycles:u"};
+
+// Threads staying alive while being monitored.
+class IdleThreads {
+ public:
+  explicit IdleThreads(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      threads_.emplace_back([this]() {
+        tids_.push_back(syscall(__NR_gettid));
+        started_++;
+        while (!exit_) {
+          usleep(1000);
+        }
+      });
+      while (started_ != i + 1) {
+        usleep(100);
+      }
+    }
+  }
+
+  ~IdleThreads() {
+    exit_ = true;
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  const std::vector<pid_t>& tids() const { return tids_; }
+
+ private:
+  std::vector<std::thread> threads_;
+  std::vector<pid_t> tids_;
+  std::atomic_size_t started_{0};
+  std::atomic_bool exit_{false};
+};
+
+static std::unique_ptr<PerfEventSet> CreatePerfEventSet(size_t event_count,
+                                                        const std::vector<pid_t>& tids) {
+  std::unique_ptr<PerfEventSet> perf(
+      PerfEventSet::CreateInstance(PerfEventSet::Type::kPerfForCounting));
+  if (!perf) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < event_count; ++i) {
+    if (!perf->AddEvent(kEvents[i])) {
+      return nullptr;
+    }
+  }
+  bool result = tids.empty() ? perf->MonitorCurrentThread()
+                             : perf->MonitorThreadsInCurrentProcess(tids);
+  if (!result || !perf->StartCounters()) {
+    return nullptr;
+  }
+  return perf;
+}
+
+// Arguments are (event count, monitored thread count). Monitored thread count 0 means only
+// monitoring the current thread.
+static void BM_ReadCounters(benchmark::State& state) {
+  size_t event_count = state.range(0);
+  IdleThreads threads(state.range(1));
+  std::unique_ptr<PerfEventSet> perf = CreatePerfEventSet(event_count, threads.tids());
+  if (!perf) {
+    state.SkipWithError("failed to create PerfEventSet");
+    return;
+  }
+  std::vector<Counter> counters;
+  while (state.KeepRunning()) {
+    if (!perf->ReadCounters(&counters)) {
+      state.SkipWithError("failed to read counters");
+      return;
+    }
+  }
+}
+BENCHMARK(BM_ReadCounters)
+    ->Args({1, 0})
+    ->Args({4, 0})
+    ->Args({1, 1})
+    ->Args({4, 1})
+    ->Args({1, 32})
+    ->Args({4, 32});
+
+// Start and read counters around a short code range, like bracketing a hot loop in an app.
+static void BM_StartStopReadCounters(benchmark::State& state) {
+  std::unique_ptr<PerfEventSet> perf = CreatePerfEventSet(state.range(0), {});
+  if (!perf) {
+    state.SkipWithError("failed to create PerfEventSet");
+    return;
+  }
+  std::vector<Counter> counters;
+  while (state.KeepRunning()) {
+    if (!perf->StartCounters() || !perf->StopCounters() || !perf->ReadCounters(&counters)) {
+      state.SkipWithError("failed to start/stop/read counters");
+      return;
+    }
+  }
+}
+BENCHMARK(BM_StartStopReadCounters)->Arg(1)->Arg(4);
+
+BENCHMARK_MAIN();
@@ -113,6 +113,7 @@ class PerfEventSetForCounting : public PerfEventSetImpl {
 
  private:
   bool CreateEventSelectionSet();
+  bool CreateEventSelectionSet(bool use_group);
   void InitAccumulatedCounters();
   bool ReadRawCounters(std::vector<Counter>* counters);
   // Add counter b to a.
@@ -130,15 +131,33 @@ class PerfEventSetForCounting : public PerfEventSetImpl {
 };
 
 bool PerfEventSetForCounting::CreateEventSelectionSet() {
-  std::unique_ptr<EventSelectionSet> set(new EventSelectionSet(true));
   if (event_names_.empty()) {
     LOG(ERROR) << "No events.";
     return false;
   }
-  for (const auto& name : event_names_) {
-    if (!set->AddEventType(name)) {
+  // Counting events in a group needs one read() for each thread instead of one for each event
+  // and thread. And events in a group are scheduled on hardware counters together, so they have
+  // the same time_running when multiplexed. But the kernel rejects a group with more hardware
+  // events than available hardware counters. So fall back to separate events.
+  if (event_names_.size() > 1u && CreateEventSelectionSet(true)) {
+    return true;
+  }
+  return CreateEventSelectionSet(false);
+}
+
+bool PerfEventSetForCounting::CreateEventSelectionSet(bool use_group) {
+  std::unique_ptr<EventSelectionSet> set(new EventSelectionSet(true));
+  if (use_group) {
+    if (!set->AddEventGroup(event_names_)) {
       return false;
     }
+    set->EnableGroupRead();
+  } else {
+    for (const auto& name : event_names_) {
+      if (!set->AddEventType(name)) {
+        return false;
+      }
+    }
   }
   if (whole_process_) {
     set->AddMonitoredProcesses({getpid()});
@@ -152,6 +171,10 @@ bool PerfEventSetForCounting::CreateEventSelectionSet() {
   if (!set->OpenEventFiles({-1})) {
     return false;
   }
+  // When only monitoring the current thread, counters may be read without syscalls.
+  if (!whole_process_ && threads_.size() == 1u && *threads_.begin() == gettid()) {
+    set->MapUserPages();
+  }
   event_selection_set_ = std::move(set);
   return true;
 }
@@ -197,7 +220,7 @@ bool PerfEventSetForCounting::ReadRawCounters(std::vector<Counter>* counters) {
 void PerfEventSetForCounting::AddCounter(Counter& a, const Counter& b) {
   a.value += b.value;
   a.time_enabled_in_ns += b.time_enabled_in_ns;
-  a.time_running_in_ns += b.time_enabled_in_ns;
+  a.time_running_in_ns += b.time_running_in_ns;
 }
 
 void PerfEventSetForCounting::SubCounter(Counter& a, const Counter& b) {
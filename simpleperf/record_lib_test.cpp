@@ -146,3 +146,32 @@ TEST(counter, no_change_after_stop) {
   ASSERT_EQ(counters[0].time_enabled_in_ns, prev_counter.time_enabled_in_ns);
   ASSERT_EQ(counters[0].time_running_in_ns, prev_counter.time_running_in_ns);
 }
+
+TEST(counter, read_in_monitored_thread) {
+  std::unique_ptr<PerfEventSet> perf(PerfEventSet::CreateInstance(
+      PerfEventSet::Type::kPerfForCounting));
+  ASSERT_TRUE(perf);
+  ASSERT_TRUE(perf->AddEvent("cpu-cycles"));
+  ASSERT_TRUE(perf->AddEvent("cpu-cycles:u"));
+  ASSERT_TRUE(perf->AddEvent("task-clock"));
+  ASSERT_TRUE(perf->MonitorCurrentThread());
+  ASSERT_TRUE(perf->StartCounters());
+  std::vector<Counter> prev_counters;
+  for (size_t i = 0; i < 3; ++i) {
+    DoSomeWork();
+    // Counters may be read without syscalls in the monitored thread.
+    std::vector<Counter> counters;
+    ASSERT_TRUE(perf->ReadCounters(&counters));
+    ASSERT_EQ(counters.size(), 3u);
+    for (size_t j = 0; j < counters.size(); ++j) {
+      ASSERT_GT(counters[j].value, 0u);
+      ASSERT_LE(counters[j].time_running_in_ns, counters[j].time_enabled_in_ns);
+      if (i > 0) {
+        ASSERT_GT(counters[j].value, prev_counters[j].value);
+        ASSERT_GE(counters[j].time_enabled_in_ns, prev_counters[j].time_enabled_in_ns);
+      }
+    }
+    prev_counters = counters;
+  }
+  ASSERT_TRUE(perf->StopCounters());
+}
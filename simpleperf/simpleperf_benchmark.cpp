@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks of offline hot paths in simpleperf: parsing perf.data, updating ThreadTree,
+// symbolization, and the report / report-sample commands. They run on synthetic perf.data
+// generated with a fixed seed, so results are comparable between builds. Use
+// --benchmark_format=json or --benchmark_out=<file> to save results as json.
+
+#include <inttypes.h>
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+
+#include "command.h"
+#include "dso.h"
+#include "event_attr.h"
+#include "event_type.h"
+#include "record.h"
+#include "record_file.h"
+#include "thread_tree.h"
+
+using namespace simpleperf;
+
+namespace {
+
+constexpr uint32_t kPid = 10000;
+constexpr uint64_t kDsoStartAddr = 0x7000000000ULL;
+constexpr uint64_t kDsoMapSize = 0x100000;
+constexpr uint64_t kFirstSymbolVaddr = 0x1000;
+constexpr uint64_t kSymbolSize = 0x100;
+constexpr size_t kSymbolsPerDso = 1000;
+constexpr uint64_t kSamplePeriodInNs = 1000000;
+
+// Parameters of a synthetic perf.data. They are passed as benchmark arguments in this order.
+struct CorpusConfig {
+  size_t sample_count;
+  size_t thread_count;
+  size_t dso_count;
+  size_t callchain_depth;
+
+  explicit CorpusConfig(const benchmark::State& state)
+      : sample_count(state.range(0)),
+        thread_count(state.range(1)),
+        dso_count(state.range(2)),
+        callchain_depth(state.range(3)) {}
+
+  std::tuple<size_t, size_t, size_t, size_t> Key() const {
+    return std::make_tuple(sample_count, thread_count, dso_count, callchain_depth);
+  }
+};
+
+std::string GetDsoPath(size_t dso_index) {
+  return android::base::StringPrintf("/data/simpleperf_benchmark/lib%zu.so", dso_index);
+}
+
+// Generate a perf.data with a cpu-clock event, a comm record for each thread, a mmap record
+// for each dso mapped in the process, and samples with user space callchains. Symbols of the
+// dsos are stored in the file feature section, so no elf file is needed to symbolize samples.
+bool GenerateCorpus(const CorpusConfig& config, const std::string& filename) {
+  std::unique_ptr<EventTypeAndModifier> event_type = ParseEventType("cpu-clock");
+  if (!event_type) {
+    return false;
+  }
+  perf_event_attr attr = CreateDefaultPerfEventAttr(event_type->event_type);
+  attr.sample_type |= PERF_SAMPLE_CALLCHAIN;
+  attr.sample_id_all = 1;
+  attr.sample_period = kSamplePeriodInNs;
+  EventAttrWithId attr_id;
+  attr_id.attr = &attr;
+  attr_id.ids.push_back(1);
+
+  std::unique_ptr<RecordFileWriter> writer = RecordFileWriter::CreateInstance(filename);
+  if (!writer || !writer->WriteAttrSection({attr_id})) {
+    return false;
+  }
+  uint64_t time = 1;
+  for (size_t i = 0; i < config.thread_count; ++i) {
+    uint32_t tid = kPid + i;
+    std::string comm = android::base::StringPrintf("thread%zu", i);
+    if (!writer->WriteRecord(CommRecord(attr, kPid, tid, comm, 1, time++))) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < config.dso_count; ++i) {
+    MmapRecord r(attr, false, kPid, kPid, kDsoStartAddr + i * kDsoMapSize, kDsoMapSize, 0,
+                 GetDsoPath(i), 1, time++);
+    if (!writer->WriteRecord(r)) {
+      return false;
+    }
+  }
+  std::mt19937_64 rand(0);
+  std::uniform_int_distribution<size_t> tid_dist(0, config.thread_count - 1);
+  std::uniform_int_distribution<size_t> dso_dist(0, config.dso_count - 1);
+  std::uniform_int_distribution<size_t> symbol_dist(0, kSymbolsPerDso - 1);
+  std::uniform_int_distribution<uint64_t> offset_dist(0, kSymbolSize - 1);
+  std::vector<uint64_t> ips;
+  for (size_t i = 0; i < config.sample_count; ++i) {
+    ips.clear();
+    ips.push_back(PERF_CONTEXT_USER);
+    for (size_t depth = 0; depth < config.callchain_depth; ++depth) {
+      uint64_t vaddr = kFirstSymbolVaddr + symbol_dist(rand) * kSymbolSize + offset_dist(rand);
+      ips.push_back(kDsoStartAddr + dso_dist(rand) * kDsoMapSize + vaddr);
+    }
+    uint32_t tid = kPid + tid_dist(rand);
+    SampleRecord r(attr, 1, ips[1], kPid, tid, time, 0, kSamplePeriodInNs, ips, {}, 0);
+    time += kSamplePeriodInNs;
+    if (!writer->WriteRecord(r)) {
+      return false;
+    }
+  }
+
+  std::vector<std::unique_ptr<Dso>> dsos;
+  std::vector<Dso*> dso_ptrs;
+  for (size_t i = 0; i < config.dso_count; ++i) {
+    std::unique_ptr<Dso> dso = Dso::CreateDso(DSO_ELF_FILE, GetDsoPath(i));
+    std::vector<Symbol> symbols;
+    for (size_t j = 0; j < kSymbolsPerDso; ++j) {
+      std::string name = android::base::StringPrintf("lib%zu_func%zu", i, j);
+      symbols.emplace_back(name, kFirstSymbolVaddr + j * kSymbolSize, kSymbolSize);
+    }
+    dso->SetSymbols(&symbols);
+    dso->CreateDumpId();
+    for (const auto& symbol : dso->GetSymbols()) {
+      dso->CreateSymbolDumpId(&symbol);
+    }
+    dso_ptrs.push_back(dso.get());
+    dsos.push_back(std::move(dso));
+  }
+  return writer->BeginWriteFeatures(1) && writer->WriteFileFeatures(dso_ptrs) &&
+         writer->EndWriteFeatures() && writer->Close();
+}
+
+// Return a perf.data generated for the config. Files are generated once and reused by all
+// benchmarks in the process.
+const char* GetCorpus(const CorpusConfig& config) {
+  static std::map<std::tuple<size_t, size_t, size_t, size_t>, std::unique_ptr<TemporaryFile>>
+      corpus_map;
+  auto it = corpus_map.find(config.Key());
+  if (it != corpus_map.end()) {
+    return it->second->path;
+  }
+  std::unique_ptr<TemporaryFile> tmpfile(new TemporaryFile);
+  if (!GenerateCorpus(config, tmpfile->path)) {
+    LOG(ERROR) << "failed to generate synthetic perf.data";
+    return nullptr;
+  }
+  const char* path = tmpfile->path;
+  corpus_map[config.Key()] = std::move(tmpfile);
+  return path;
+}
+
+bool ReadRecords(const char* filename, std::vector<std::unique_ptr<Record>>* records) {
+  std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(filename);
+  if (!reader) {
+    return false;
+  }
+  return reader->ReadDataSection([&](std::unique_ptr<Record> r) {
+    records->push_back(std::move(r));
+    return true;
+  });
+}
+
+// Arguments are (sample count, thread count, dso count, callchain depth).
+void CorpusArgs(benchmark::internal::Benchmark* b) {
+  b->Args({10000, 1, 10, 8});
+  b->Args({10000, 32, 10, 8});
+  b->Args({10000, 8, 100, 8});
+  b->Args({10000, 8, 10, 64});
+  b->Args({100000, 8, 50, 32});
+}
+
+}  // namespace
+
+static void BM_ReadRecordFile(benchmark::State& state) {
+  const char* filename = GetCorpus(CorpusConfig(state));
+  if (filename == nullptr) {
+    state.SkipWithError("failed to generate perf.data");
+    return;
+  }
+  size_t record_count = 0;
+  while (state.KeepRunning()) {
+    std::unique_ptr<RecordFileReader> reader = RecordFileReader::CreateInstance(filename);
+    if (!reader || !reader->ReadDataSection([&](std::unique_ptr<Record>) {
+          record_count++;
+          return true;
+        })) {
+      state.SkipWithError("failed to read perf.data");
+      return;
+    }
+  }
+  state.SetItemsProcessed(record_count);
+}
+BENCHMARK(BM_ReadRecordFile)->Apply(CorpusArgs);
+
+static void BM_ThreadTreeUpdate(benchmark::State& state) {
+  const char* filename = GetCorpus(CorpusConfig(state));
+  std::vector<std::unique_ptr<Record>> records;
+  if (filename == nullptr || !ReadRecords(filename, &records)) {
+    state.SkipWithError("failed to read perf.data");
+    return;
+  }
+  while (state.KeepRunning()) {
+    ThreadTree thread_tree;
+    for (const auto& r : records) {
+      thread_tree.Update(*r);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * records.size());
+}
+BENCHMARK(BM_ThreadTreeUpdate)->Apply(CorpusArgs);
+
+// Map each ip in callchains to a symbol, as the report commands do for each sample.
+static void BM_Symbolization(benchmark::State& state) {
+  const char* filename = GetCorpus(CorpusConfig(state));
+  std::unique_ptr<RecordFileReader> reader;
+  std::vector<std::unique_ptr<Record>> records;
+  if (filename == nullptr || !(reader = RecordFileReader::CreateInstance(filename)) ||
+      !ReadRecords(filename, &records)) {
+    state.SkipWithError("failed to read perf.data");
+    return;
+  }
+  ThreadTree thread_tree;
+  reader->LoadBuildIdAndFileFeatures(thread_tree);
+  std::vector<const SampleRecord*> samples;
+  for (const auto& r : records) {
+    thread_tree.Update(*r);
+    if (r->type() == PERF_RECORD_SAMPLE) {
+      samples.push_back(static_cast<const SampleRecord*>(r.get()));
+    }
+  }
+  size_t ip_count = 0;
+  while (state.KeepRunning()) {
+    for (const SampleRecord* r : samples) {
+      const ThreadEntry* thread = thread_tree.FindThreadOrNew(r->tid_data.pid, r->tid_data.tid);
+      for (size_t i = 0; i < r->callchain_data.ip_nr; ++i) {
+        uint64_t ip = r->callchain_data.ips[i];
+        if (ip >= PERF_CONTEXT_MAX) {
+          continue;
+        }
+        const MapEntry* map = thread_tree.FindMap(thread, ip, false);
+        uint64_t vaddr_in_file;
+        benchmark::DoNotOptimize(thread_tree.FindSymbol(map, ip, &vaddr_in_file));
+        ip_count++;
+      }
+    }
+  }
+  state.SetItemsProcessed(ip_count);
+}
+BENCHMARK(BM_Symbolization)->Apply(CorpusArgs);
+
+static void RunCommand(benchmark::State& state, const std::string& cmd_name,
+                       const std::vector<std::string>& args) {
+  const char* filename = GetCorpus(CorpusConfig(state));
+  if (filename == nullptr) {
+    state.SkipWithError("failed to generate perf.data");
+    return;
+  }
+  std::vector<std::string> cmd_args = {"-i", filename, "-o", "/dev/null"};
+  cmd_args.insert(cmd_args.end(), args.begin(), args.end());
+  while (state.KeepRunning()) {
+    std::unique_ptr<Command> cmd = CreateCommandInstance(cmd_name);
+    if (!cmd || !cmd->Run(cmd_args)) {
+      state.SkipWithError(("failed to run " + cmd_name).c_str());
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Build the sample tree with call graphs, sort and print it.
+static void BM_ReportCmd(benchmark::State& state) {
+  RunCommand(state, "report", {"-g", "--sort", "comm,pid,tid,dso,symbol"});
+}
+BENCHMARK(BM_ReportCmd)->Apply(CorpusArgs)->Unit(benchmark::kMillisecond);
+
+static void BM_ReportSampleProtobuf(benchmark::State& state) {
+  RunCommand(state, "report-sample", {"--protobuf", "--show-callchain"});
+}
+BENCHMARK(BM_ReportSampleProtobuf)->Apply(CorpusArgs)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
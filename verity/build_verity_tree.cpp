@@ -16,12 +16,177 @@
 
 #include "verity/build_verity_tree.h"
 
+#include <fcntl.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
 #include <sparse/sparse.h>
 
 #undef NDEBUG
 
+namespace {
+
+// The on-disk format of Android sparse images, as in libsparse's private
+// sparse_format.h.
+constexpr uint32_t kSparseHeaderMagic = 0xed26ff3a;
+constexpr uint16_t kSparseMajorVersion = 1;
+constexpr uint16_t kChunkTypeRaw = 0xCAC1;
+constexpr uint16_t kChunkTypeFill = 0xCAC2;
+constexpr uint16_t kChunkTypeDontCare = 0xCAC3;
+constexpr uint16_t kChunkTypeCrc32 = 0xCAC4;
+
+struct SparseHeader {
+  uint32_t magic;
+  uint16_t major_version;
+  uint16_t minor_version;
+  uint16_t file_hdr_sz;
+  uint16_t chunk_hdr_sz;
+  uint32_t blk_sz;
+  uint32_t total_blks;
+  uint32_t total_chunks;
+  uint32_t image_checksum;
+};
+
+struct ChunkHeader {
+  uint16_t chunk_type;
+  uint16_t reserved1;
+  uint32_t chunk_sz;
+  uint32_t total_sz;
+};
+
+// Smallest amount of raw chunk data read before it is hashed.
+constexpr size_t kReadBufferSize = 1024 * 1024;
+
+// Returns true if |fd| holds a sparse image that HashSparseChunks() can walk
+// with blocks of |block_size| bytes. The file offset is left unchanged.
+bool ReadSparseHeader(int fd, size_t block_size, SparseHeader* header) {
+  if (!android::base::ReadFullyAtOffset(fd, header, sizeof(*header), 0)) {
+    return false;
+  }
+  return header->magic == kSparseHeaderMagic &&
+         header->major_version == kSparseMajorVersion &&
+         header->file_hdr_sz >= sizeof(SparseHeader) &&
+         header->chunk_hdr_sz >= sizeof(ChunkHeader) &&
+         header->blk_sz == block_size;
+}
+
+// Hashes the sparse image in |fd| by walking its chunks. Only raw chunks are
+// read; the hashes of fill and don't care chunks follow from a single block.
+// Consecutive raw chunks are read into one buffer, which is only hashed when
+// it is full or another type of chunk follows, so that the builder gets
+// enough data at once to hash it on all its threads.
+bool HashSparseChunks(int fd, const SparseHeader& header,
+                      HashTreeBuilder* builder) {
+  uint64_t offset = header.file_hdr_sz;
+  uint64_t blocks = 0;
+  std::vector<unsigned char> buffer(
+      std::max(kReadBufferSize, builder->parallel_update_size()));
+  size_t buffered = 0;
+  auto flush = [&]() {
+    if (buffered == 0) {
+      return true;
+    }
+    bool ok = builder->Update(buffer.data(), buffered);
+    buffered = 0;
+    return ok;
+  };
+
+  for (uint32_t i = 0; i < header.total_chunks; i++) {
+    ChunkHeader chunk;
+    if (!android::base::ReadFullyAtOffset(fd, &chunk, sizeof(chunk), offset)) {
+      PLOG(ERROR) << "failed to read chunk header " << i;
+      return false;
+    }
+    if (chunk.total_sz < header.chunk_hdr_sz ||
+        chunk.chunk_sz > header.total_blks - blocks) {
+      LOG(ERROR) << "invalid size of chunk " << i;
+      return false;
+    }
+    uint64_t data_offset = offset + header.chunk_hdr_sz;
+    uint64_t data_size = chunk.total_sz - header.chunk_hdr_sz;
+    uint64_t len = uint64_t{chunk.chunk_sz} * header.blk_sz;
+
+    switch (chunk.chunk_type) {
+      case kChunkTypeRaw:
+        if (data_size != len) {
+          LOG(ERROR) << "invalid size " << chunk.total_sz << " of raw chunk "
+                     << i;
+          return false;
+        }
+        for (uint64_t done = 0; done < len;) {
+          size_t n = std::min<uint64_t>(len - done, buffer.size() - buffered);
+          if (!android::base::ReadFullyAtOffset(fd, buffer.data() + buffered,
+                                                n, data_offset + done)) {
+            PLOG(ERROR) << "failed to read raw chunk " << i;
+            return false;
+          }
+          done += n;
+          buffered += n;
+          if (buffered == buffer.size() && !flush()) {
+            return false;
+          }
+        }
+        break;
+
+      case kChunkTypeFill: {
+        if (!flush()) {
+          return false;
+        }
+        uint32_t fill;
+        if (data_size != sizeof(fill) ||
+            !android::base::ReadFullyAtOffset(fd, &fill, sizeof(fill),
+                                              data_offset)) {
+          LOG(ERROR) << "failed to read fill chunk " << i;
+          return false;
+        }
+        std::vector<unsigned char> block(header.blk_sz);
+        for (size_t j = 0; j < block.size(); j += sizeof(fill)) {
+          memcpy(block.data() + j, &fill, sizeof(fill));
+        }
+        if (!builder->UpdateRepeatedBlock(block.data(), len)) {
+          return false;
+        }
+        break;
+      }
+
+      case kChunkTypeDontCare:
+        // Don't care regions read as zeros, like in libsparse.
+        if (!flush() || !builder->Update(nullptr, len)) {
+          return false;
+        }
+        break;
+
+      case kChunkTypeCrc32:
+        break;
+
+      default:
+        LOG(ERROR) << "unknown type " << std::hex << chunk.chunk_type
+                   << " of chunk " << std::dec << i;
+        return false;
+    }
+
+    blocks += chunk.chunk_sz;
+    offset = data_offset + data_size;
+  }
+
+  if (!flush()) {
+    return false;
+  }
+  if (blocks != header.total_blks) {
+    LOG(ERROR) << "sparse image has " << blocks << " blocks instead of "
+               << header.total_blks;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
 bool generate_verity_tree(const std::string& data_filename,
                           const std::string& verity_filename,
                           HashTreeBuilder* builder,
@@ -33,43 +198,74 @@ bool generate_verity_tree(const std::string& data_filename,
     return false;
   }
 
-  struct sparse_file* file;
-  if (sparse) {
-    file = sparse_file_import(data_fd, false, false);
+  // Sparse images are hashed by walking their chunks, so fill and don't care
+  // regions are never expanded. Anything else goes through libsparse.
+  SparseHeader header;
+  bool walk_chunks = ReadSparseHeader(data_fd, block_size, &header);
+  std::unique_ptr<sparse_file, decltype(&sparse_file_destroy)> file(
+      nullptr, sparse_file_destroy);
+  int64_t len;
+  if (walk_chunks) {
+    len = int64_t{header.total_blks} * header.blk_sz;
   } else {
-    file = sparse_file_import_auto(data_fd, false, verbose);
-  }
+    if (sparse) {
+      file.reset(sparse_file_import(data_fd, false, false));
+    } else {
+      file.reset(sparse_file_import_auto(data_fd, false, verbose));
+    }
 
-  if (!file) {
-    LOG(ERROR) << "failed to read file " << data_filename;
-    return false;
+    if (!file) {
+      LOG(ERROR) << "failed to read file " << data_filename;
+      return false;
+    }
+
+    len = sparse_file_len(file.get(), false, false);
   }
 
-  int64_t len = sparse_file_len(file, false, false);
   if (len % block_size != 0) {
     LOG(ERROR) << "file size " << len << " is not a multiple of " << block_size
                << " byte";
     return false;
   }
 
-  // Initialize the builder to compute the hash tree.
-  if (!builder->Initialize(len, salt_content)) {
+  android::base::unique_fd verity_fd(
+      open(verity_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
+  if (verity_fd == -1) {
+    PLOG(ERROR) << "failed to open output file " << verity_filename;
+    return false;
+  }
+
+  // Initialize the builder to compute the hash tree, writing it out as the
+  // data is hashed so memory use doesn't grow with the image size.
+  if (!builder->InitializeStreaming(len, salt_content, verity_fd, 0)) {
     LOG(ERROR) << "Failed to initialize HashTreeBuilder";
     return false;
   }
 
-  auto hash_callback = [](void* priv, const void* data, size_t len) {
-    auto sparse_hasher = static_cast<HashTreeBuilder*>(priv);
-    return sparse_hasher->Update(static_cast<const unsigned char*>(data), len)
-               ? 0
-               : 1;
-  };
-  sparse_file_callback(file, false, false, hash_callback, builder);
-  sparse_file_destroy(file);
+  if (walk_chunks) {
+    if (!HashSparseChunks(data_fd, header, builder)) {
+      LOG(ERROR) << "failed to hash " << data_filename;
+      return false;
+    }
+  } else {
+    auto hash_callback = [](void* priv, const void* data, size_t len) {
+      auto sparse_hasher = static_cast<HashTreeBuilder*>(priv);
+      return sparse_hasher->Update(static_cast<const unsigned char*>(data), len)
+                 ? 0
+                 : 1;
+    };
+    int ret =
+        sparse_file_callback(file.get(), false, false, hash_callback, builder);
+    if (ret != 0) {
+      LOG(ERROR) << "failed to hash " << data_filename;
+      return false;
+    }
+  }
 
-  if (!builder->BuildHashTree()) {
-    return false;
+  if (verbose) {
+    LOG(INFO) << "hashed " << builder->hashed_size() << " of " << len
+              << " bytes of " << data_filename;
   }
 
-  return builder->WriteHashTreeToFile(verity_filename);
+  return builder->BuildHashTree();
 }
@@ -21,8 +21,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <limits>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -39,6 +41,8 @@ static void usage(void) {
       "  -a,--salt-str=<string>       set salt to <string>\n"
       "  -A,--salt-hex=<hex digits>   set salt to <hex digits>\n"
       "  -h                           show this help\n"
+      "  -j,--threads=<threads>       hash with <threads> threads, defaults\n"
+      "                               to the number of processors\n"
       "  -s,--verity-size=<data size> print the size of the verity tree\n"
       "  -v,                          enable verbose logging\n"
       "  -S                           treat <data image> as a sparse file\n");
@@ -52,19 +56,22 @@ int main(int argc, char** argv) {
   uint64_t calculate_size = 0;
   bool verbose = false;
   std::string hash_algorithm;
+  size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
 
   while (1) {
     constexpr struct option long_options[] = {
         {"salt-str", required_argument, nullptr, 'a'},
         {"salt-hex", required_argument, nullptr, 'A'},
         {"help", no_argument, nullptr, 'h'},
+        {"threads", required_argument, nullptr, 'j'},
         {"sparse", no_argument, nullptr, 'S'},
         {"verity-size", required_argument, nullptr, 's'},
         {"verbose", no_argument, nullptr, 'v'},
         {"hash-algorithm", required_argument, nullptr, 0},
         {nullptr, 0, nullptr, 0}};
     int option_index;
-    int c = getopt_long(argc, argv, "a:A:hSs:v", long_options, &option_index);
+    int c = getopt_long(argc, argv, "a:A:hj:Ss:v", long_options,
+                        &option_index);
     if (c < 0) {
       break;
     }
@@ -82,6 +89,13 @@ int main(int argc, char** argv) {
       case 'h':
         usage();
         return 1;
+      case 'j':
+        if (!android::base::ParseUint(optarg, &threads, size_t{1024}) ||
+            threads == 0) {
+          LOG(ERROR) << "Invalid number of threads: " << optarg;
+          return 1;
+        }
+        break;
       case 'S':
         sparse = true;
         break;
@@ -119,7 +133,7 @@ int main(int argc, char** argv) {
   if (hash_function == nullptr) {
     return 1;
   }
-  HashTreeBuilder builder(kBlockSize, hash_function);
+  HashTreeBuilder builder(kBlockSize, hash_function, threads);
 
   if (calculate_size) {
     if (argc != 0) {
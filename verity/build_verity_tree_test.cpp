@@ -15,16 +15,19 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <algorithm>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include <android-base/file.h>
 #include <gtest/gtest.h>
 #include <openssl/evp.h>
 
 #include "build_verity_tree_utils.h"
+#include "verity/build_verity_tree.h"
 #include "verity/hash_tree_builder.h"
 
 // The hex string we are using in build_image.py
@@ -34,6 +37,30 @@ constexpr unsigned char kSaltHex[] = {
     0xf5, 0x66, 0xa9, 0x46, 0x13, 0x49, 0x6b, 0x41, 0x7f, 0x2a, 0xf5,
     0x92, 0x63, 0x9b, 0xc8, 0x0d, 0x14, 0x1e, 0x34, 0xdf, 0xe7};
 
+// Appends a sparse chunk header for a chunk of |blocks| blocks of 4096 bytes
+// and its |data_size| bytes of data to |image|.
+static void AppendSparseChunk(std::string* image, uint16_t type,
+                              uint32_t blocks, const void* data,
+                              uint32_t data_size) {
+  const uint16_t reserved = 0;
+  const uint32_t total_size = 12 + data_size;
+  image->append(reinterpret_cast<const char*>(&type), 2);
+  image->append(reinterpret_cast<const char*>(&reserved), 2);
+  image->append(reinterpret_cast<const char*>(&blocks), 4);
+  image->append(reinterpret_cast<const char*>(&total_size), 4);
+  if (data_size > 0) {
+    image->append(static_cast<const char*>(data), data_size);
+  }
+}
+
+// Returns the header of a version 1.0 sparse image with 28 byte file and 12
+// byte chunk headers.
+static std::string SparseImageHeader(uint32_t blocks, uint32_t chunks) {
+  const uint32_t header[] = {0xed26ff3a, 1,      28 | (12 << 16), 4096,
+                             blocks,     chunks, 0};
+  return std::string(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
 class BuildVerityTreeTest : public ::testing::Test {
  protected:
   void SetUp() override {
@@ -48,6 +75,8 @@ class BuildVerityTreeTest : public ::testing::Test {
   const std::vector<std::vector<unsigned char>>& verity_tree() const {
     return builder->verity_tree_;
   }
+  // Returns true if the builder has hashed anything on more than one thread.
+  bool used_worker_pool() const { return builder->pool_ != nullptr; }
 
   void GenerateHashTree(const std::vector<unsigned char>& data,
                         const std::vector<unsigned char>& salt) {
@@ -168,3 +197,158 @@ TEST_F(BuildVerityTreeTest, SHA1MultipleBlocks) {
   ASSERT_EQ("7ea287e6167929988810077abaafbc313b2b8593000000000000000000000000",
             HashTreeBuilder::BytesArrayToString(builder->root_hash()));
 }
+
+TEST_F(BuildVerityTreeTest, ParallelHashing) {
+  std::vector<unsigned char> data(1000 * 4096);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = i * 7 + i / 4096;
+  }
+
+  GenerateHashTree(data, salt_hex);
+  std::vector<std::vector<unsigned char>> expected_tree = verity_tree();
+  std::vector<unsigned char> expected_root = builder->root_hash();
+
+  builder.reset(new HashTreeBuilder(4096, EVP_sha256(), 4));
+  GenerateHashTree(data, salt_hex);
+  ASSERT_EQ(expected_tree, verity_tree());
+  ASSERT_EQ(expected_root, builder->root_hash());
+}
+
+TEST_F(BuildVerityTreeTest, StreamingOutput) {
+  // With 64 byte hashes, 4097 blocks of data need three levels.
+  std::vector<unsigned char> data(4097 * 4096);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = i * 13 + i / 4096;
+  }
+
+  builder.reset(
+      new HashTreeBuilder(4096, HashTreeBuilder::HashFunction("SHA512")));
+  GenerateHashTree(data, salt_hex);
+  ASSERT_EQ(3u, verity_tree().size());
+  TemporaryFile expected_file;
+  ASSERT_TRUE(builder->WriteHashTreeToFd(expected_file.fd, 0));
+  std::vector<unsigned char> expected_root = builder->root_hash();
+
+  builder.reset(
+      new HashTreeBuilder(4096, HashTreeBuilder::HashFunction("SHA512"), 4));
+  TemporaryFile tf;
+  constexpr uint64_t kOffset = 4096;
+  ASSERT_TRUE(builder->InitializeStreaming(data.size(), salt_hex, tf.fd,
+                                           kOffset));
+  size_t offset = 0;
+  while (offset < data.size()) {
+    size_t data_length =
+        std::min<size_t>(rand() % (1024 * 4096), data.size() - offset);
+    ASSERT_TRUE(builder->Update(data.data() + offset, data_length));
+    offset += data_length;
+  }
+  ASSERT_TRUE(builder->BuildHashTree());
+  ASSERT_EQ(expected_root, builder->root_hash());
+  ASSERT_FALSE(builder->WriteHashTreeToFd(tf.fd, 0));
+
+  std::string expected;
+  ASSERT_TRUE(android::base::ReadFileToString(expected_file.path, &expected));
+  std::string actual;
+  ASSERT_TRUE(android::base::ReadFileToString(tf.path, &actual));
+  ASSERT_EQ(builder->CalculateSize(data.size()) + kOffset, actual.size());
+  ASSERT_EQ(expected, actual.substr(kOffset));
+}
+
+TEST_F(BuildVerityTreeTest, ZeroAndRepeatedBlocks) {
+  // 100 blocks of data, 300 zero blocks, 200 repeated blocks and 50 more
+  // blocks of data.
+  std::vector<unsigned char> data(650 * 4096);
+  for (size_t i = 0; i < 100 * 4096; i++) {
+    data[i] = i * 7 + i / 4096;
+  }
+  std::fill(data.begin() + 400 * 4096, data.begin() + 600 * 4096, 0x5a);
+  for (size_t i = 600 * 4096; i < data.size(); i++) {
+    data[i] = i * 11 + i / 4096;
+  }
+
+  GenerateHashTree(data, salt_hex);
+  std::vector<unsigned char> expected_root = builder->root_hash();
+  // Zero blocks are not hashed.
+  ASSERT_EQ(350u * 4096, builder->hashed_size());
+
+  builder.reset(new HashTreeBuilder(4096, EVP_sha256()));
+  TemporaryFile tf;
+  ASSERT_TRUE(builder->InitializeStreaming(data.size(), salt_hex, tf.fd, 0));
+  ASSERT_TRUE(builder->Update(data.data(), 100 * 4096));
+  ASSERT_TRUE(builder->Update(nullptr, 300 * 4096));
+  // Repeated blocks must be aligned.
+  ASSERT_FALSE(builder->UpdateRepeatedBlock(&data[400 * 4096], 4095));
+  ASSERT_TRUE(builder->UpdateRepeatedBlock(&data[400 * 4096], 200 * 4096));
+  ASSERT_TRUE(builder->Update(&data[600 * 4096], 50 * 4096));
+  ASSERT_TRUE(builder->BuildHashTree());
+  ASSERT_EQ(expected_root, builder->root_hash());
+  // Only one of the repeated blocks is hashed.
+  ASSERT_EQ(151u * 4096, builder->hashed_size());
+}
+
+TEST_F(BuildVerityTreeTest, SparseImage) {
+  std::vector<unsigned char> data(40 * 4096);
+  for (size_t i = 0; i < 10 * 4096; i++) {
+    data[i] = i * 7 + i / 4096;
+  }
+  const uint32_t fill = 0x12345678;
+  for (size_t i = 10 * 4096; i < 30 * 4096; i += sizeof(fill)) {
+    memcpy(&data[i], &fill, sizeof(fill));
+  }
+  for (size_t i = 35 * 4096; i < data.size(); i++) {
+    data[i] = i * 11 + i / 4096;
+  }
+  GenerateHashTree(data, salt_hex);
+  std::vector<unsigned char> expected_root = builder->root_hash();
+
+  // A sparse image with raw, fill, don't care, CRC32 and raw chunks.
+  std::string image = SparseImageHeader(40, 5);
+  AppendSparseChunk(&image, 0xCAC1, 10, data.data(), 10 * 4096);
+  AppendSparseChunk(&image, 0xCAC2, 20, &fill, sizeof(fill));
+  AppendSparseChunk(&image, 0xCAC3, 5, nullptr, 0);
+  const uint32_t crc = 0;
+  AppendSparseChunk(&image, 0xCAC4, 0, &crc, sizeof(crc));
+  AppendSparseChunk(&image, 0xCAC1, 5, &data[35 * 4096], 5 * 4096);
+
+  TemporaryFile sparse_file;
+  ASSERT_TRUE(android::base::WriteStringToFd(image, sparse_file.fd));
+  TemporaryFile verity_file;
+  builder.reset(new HashTreeBuilder(4096, EVP_sha256()));
+  ASSERT_TRUE(generate_verity_tree(sparse_file.path, verity_file.path,
+                                   builder.get(), salt_hex, 4096, true,
+                                   false));
+  ASSERT_EQ(expected_root, builder->root_hash());
+  // Only the raw chunks and one block of the fill chunk are hashed.
+  ASSERT_EQ(16u * 4096, builder->hashed_size());
+}
+
+TEST_F(BuildVerityTreeTest, SparseImageParallelHashing) {
+  // Two raw chunks that are each too small to be hashed on several threads,
+  // but not together, then a don't care and a raw chunk.
+  std::vector<unsigned char> data(640 * 4096);
+  for (size_t i = 0; i < 620 * 4096; i++) {
+    data[i] = i * 7 + i / 4096;
+  }
+  for (size_t i = 630 * 4096; i < data.size(); i++) {
+    data[i] = i * 11 + i / 4096;
+  }
+  GenerateHashTree(data, salt_hex);
+  std::vector<unsigned char> expected_root = builder->root_hash();
+
+  std::string image = SparseImageHeader(640, 4);
+  AppendSparseChunk(&image, 0xCAC1, 300, data.data(), 300 * 4096);
+  AppendSparseChunk(&image, 0xCAC1, 320, &data[300 * 4096], 320 * 4096);
+  AppendSparseChunk(&image, 0xCAC3, 10, nullptr, 0);
+  AppendSparseChunk(&image, 0xCAC1, 10, &data[630 * 4096], 10 * 4096);
+
+  TemporaryFile sparse_file;
+  ASSERT_TRUE(android::base::WriteStringToFd(image, sparse_file.fd));
+  TemporaryFile verity_file;
+  builder.reset(new HashTreeBuilder(4096, EVP_sha256(), 4));
+  ASSERT_TRUE(generate_verity_tree(sparse_file.path, verity_file.path,
+                                   builder.get(), salt_hex, 4096, true,
+                                   false));
+  ASSERT_EQ(expected_root, builder->root_hash());
+  ASSERT_EQ(630u * 4096, builder->hashed_size());
+  ASSERT_TRUE(used_worker_pool());
+}
@@ -16,8 +16,17 @@
 
 #include "verity/hash_tree_builder.h"
 
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
@@ -28,6 +37,107 @@
 
 #include "build_verity_tree_utils.h"
 
+// Hashing of large inputs is split between threads in chunks of this many
+// blocks.
+static constexpr size_t kChunkBlocks = 256;
+
+// A fixed set of threads that run a function for chunks of work, with the
+// calling thread taking part.
+class HashWorkerPool {
+ public:
+  explicit HashWorkerPool(size_t threads) {
+    for (size_t i = 1; i < threads; i++) {
+      threads_.emplace_back(&HashWorkerPool::WorkerLoop, this);
+    }
+  }
+
+  ~HashWorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Calls |work| for every index in [0, |count|), and returns once all the
+  // calls are done.
+  void Run(size_t count, const std::function<void(size_t)>& work) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      work_ = &work;
+      count_ = count;
+      next_ = 0;
+      running_ = threads_.size();
+      generation_++;
+    }
+    start_cv_.notify_all();
+
+    DoWork(work, count);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return running_ == 0; });
+    work_ = nullptr;
+  }
+
+ private:
+  void DoWork(const std::function<void(size_t)>& work, size_t count) {
+    for (size_t i = next_++; i < count; i = next_++) {
+      work(i);
+    }
+  }
+
+  void WorkerLoop() {
+    uint64_t generation = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      start_cv_.wait(lock,
+                     [&] { return stop_ || generation_ != generation; });
+      if (stop_) {
+        return;
+      }
+      generation = generation_;
+      const std::function<void(size_t)>* work = work_;
+      size_t count = count_;
+
+      lock.unlock();
+      DoWork(*work, count);
+      lock.lock();
+
+      if (--running_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_;
+  std::condition_variable done_cv_;
+  const std::function<void(size_t)>* work_ = nullptr;
+  size_t count_ = 0;
+  std::atomic<size_t> next_{0};
+  uint64_t generation_ = 0;
+  size_t running_ = 0;
+  bool stop_ = false;
+};
+
+static bool WriteFullyAtOffset(int fd, const unsigned char* data, size_t len,
+                               uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = TEMP_FAILURE_RETRY(pwrite(fd, data, len, offset));
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
 const EVP_MD* HashTreeBuilder::HashFunction(const std::string& hash_name) {
   if (android::base::EqualsIgnoreCase(hash_name, "sha1")) {
     return EVP_sha1();
@@ -46,8 +156,15 @@ const EVP_MD* HashTreeBuilder::HashFunction(const std::string& hash_name) {
   return nullptr;
 }
 
-HashTreeBuilder::HashTreeBuilder(size_t block_size, const EVP_MD* md)
-    : block_size_(block_size), data_size_(0), md_(md) {
+HashTreeBuilder::HashTreeBuilder(size_t block_size, const EVP_MD* md,
+                                 size_t threads)
+    : block_size_(block_size),
+      data_size_(0),
+      md_(md),
+      hashed_blocks_(0),
+      salt_ctx_(nullptr, EVP_MD_CTX_free),
+      threads_(std::max<size_t>(threads, 1)),
+      output_fd_(-1) {
   CHECK(md_ != nullptr) << "Failed to initialize md";
 
   hash_size_raw_ = EVP_MD_size(md_);
@@ -60,6 +177,8 @@ HashTreeBuilder::HashTreeBuilder(size_t block_size, const EVP_MD* md)
   CHECK_LT(hash_size_ * 2, block_size_);
 }
 
+HashTreeBuilder::~HashTreeBuilder() {}
+
 std::string HashTreeBuilder::BytesArrayToString(
     const std::vector<unsigned char>& bytes) {
   std::string result;
@@ -110,6 +229,9 @@ bool HashTreeBuilder::Initialize(int64_t expected_data_size,
                                  const std::vector<unsigned char>& salt) {
   data_size_ = expected_data_size;
   salt_ = salt;
+  hashed_blocks_ = 0;
+  output_fd_ = -1;
+  streamed_levels_.clear();
 
   if (data_size_ % block_size_ != 0) {
     LOG(ERROR) << "file size " << data_size_
@@ -124,6 +246,13 @@ bool HashTreeBuilder::Initialize(int64_t expected_data_size,
   base_level.reserve(base_level_blocks * block_size_);
   verity_tree_.emplace_back(std::move(base_level));
 
+  // Every block hash starts with the salt, so hash it only once.
+  salt_ctx_.reset(EVP_MD_CTX_create());
+  CHECK(salt_ctx_ != nullptr);
+  int ret = EVP_DigestInit_ex(salt_ctx_.get(), md_, nullptr);
+  ret &= EVP_DigestUpdate(salt_ctx_.get(), salt_.data(), salt_.size());
+  CHECK_EQ(1, ret);
+
   // Save the hash of the zero block to avoid future recalculation.
   std::vector<unsigned char> zero_block(block_size_, 0);
   zero_block_hash_.resize(hash_size_);
@@ -132,28 +261,86 @@ bool HashTreeBuilder::Initialize(int64_t expected_data_size,
   return true;
 }
 
+bool HashTreeBuilder::InitializeStreaming(
+    int64_t expected_data_size, const std::vector<unsigned char>& salt, int fd,
+    uint64_t offset) {
+  if (!Initialize(expected_data_size, salt)) {
+    return false;
+  }
+
+  // The base level only holds the hashes of one Update() at a time.
+  verity_tree_[0] = std::vector<unsigned char>();
+
+  std::vector<uint64_t> level_blocks;
+  do {
+    level_blocks.push_back(verity_tree_blocks(data_size_, block_size_,
+                                              hash_size_, level_blocks.size()));
+  } while (level_blocks.back() > 1);
+
+  // The levels are written top-down.
+  streamed_levels_.resize(level_blocks.size());
+  for (size_t i = level_blocks.size(); i > 0; i--) {
+    StreamedLevel& level = streamed_levels_[i - 1];
+    level.offset = offset;
+    level.blocks = level_blocks[i - 1];
+    level.written_blocks = 0;
+    level.partial.reserve(block_size_);
+    offset += level.blocks * block_size_;
+  }
+
+  output_fd_ = fd;
+  return true;
+}
+
 bool HashTreeBuilder::HashBlock(const unsigned char* block,
                                 unsigned char* out) {
-  unsigned int s;
-  int ret = 1;
+  HashBlocksSerial(block, 1, out, false);
+  return true;
+}
+
+static bool IsZeroBlock(const unsigned char* block, size_t block_size) {
+  return block[0] == 0 && memcmp(block, block + 1, block_size - 1) == 0;
+}
 
+size_t HashTreeBuilder::HashBlocksSerial(const unsigned char* data,
+                                         size_t count, unsigned char* out,
+                                         bool skip_zero_blocks) {
   EVP_MD_CTX* mdctx = EVP_MD_CTX_create();
   CHECK(mdctx != nullptr);
-  ret &= EVP_DigestInit_ex(mdctx, md_, nullptr);
-  ret &= EVP_DigestUpdate(mdctx, salt_.data(), salt_.size());
-  ret &= EVP_DigestUpdate(mdctx, block, block_size_);
-  ret &= EVP_DigestFinal_ex(mdctx, out, &s);
-  EVP_MD_CTX_destroy(mdctx);
+  size_t hashed = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    // Checking for zeros is much cheaper than hashing.
+    if (skip_zero_blocks && IsZeroBlock(data + i * block_size_, block_size_)) {
+      std::copy(zero_block_hash_.begin(), zero_block_hash_.end(),
+                out + i * hash_size_);
+      continue;
+    }
 
-  CHECK_EQ(1, ret);
-  CHECK_EQ(hash_size_raw_, s);
-  std::fill(out + s, out + hash_size_, 0);
+    unsigned int s;
+    int ret = EVP_MD_CTX_copy_ex(mdctx, salt_ctx_.get());
+    ret &= EVP_DigestUpdate(mdctx, data + i * block_size_, block_size_);
+    ret &= EVP_DigestFinal_ex(mdctx, out + i * hash_size_, &s);
 
-  return true;
+    CHECK_EQ(1, ret);
+    CHECK_EQ(hash_size_raw_, s);
+    std::fill(out + i * hash_size_ + s, out + (i + 1) * hash_size_, 0);
+    hashed++;
+  }
+
+  EVP_MD_CTX_destroy(mdctx);
+  return hashed;
+}
+
+size_t HashTreeBuilder::parallel_update_size() const {
+  // About two chunks per thread, so threads that finish early can take the
+  // chunks left by slower ones.
+  return threads_ * 2 * kChunkBlocks * block_size_;
 }
 
 bool HashTreeBuilder::HashBlocks(const unsigned char* data, size_t len,
-                                 std::vector<unsigned char>* output_vector) {
+                                 std::vector<unsigned char>* output_vector,
+                                 uint64_t* hashed_blocks) {
   if (len == 0) {
     return true;
   }
@@ -167,13 +354,32 @@ bool HashTreeBuilder::HashBlocks(const unsigned char* data, size_t len,
     return true;
   }
 
-  for (size_t i = 0; i < len; i += block_size_) {
-    unsigned char hash_buffer[hash_size_];
-    if (!HashBlock(data + i, hash_buffer)) {
-      return false;
+  size_t blocks = len / block_size_;
+  size_t offset = output_vector->size();
+  output_vector->resize(offset + blocks * hash_size_);
+  unsigned char* out = output_vector->data() + offset;
+
+  if (threads_ == 1 || blocks < 2 * kChunkBlocks) {
+    size_t hashed = HashBlocksSerial(data, blocks, out, true);
+    if (hashed_blocks != nullptr) {
+      *hashed_blocks += hashed;
     }
-    output_vector->insert(output_vector->end(), hash_buffer,
-                          hash_buffer + hash_size_);
+    return true;
+  }
+
+  if (!pool_) {
+    pool_.reset(new HashWorkerPool(threads_));
+  }
+
+  std::atomic<uint64_t> hashed{0};
+  pool_->Run(div_round_up(blocks, kChunkBlocks), [&](size_t chunk) {
+    size_t first = chunk * kChunkBlocks;
+    size_t count = std::min(kChunkBlocks, blocks - first);
+    hashed += HashBlocksSerial(data + first * block_size_, count,
+                               out + first * hash_size_, true);
+  });
+  if (hashed_blocks != nullptr) {
+    *hashed_blocks += hashed;
   }
 
   return true;
@@ -193,11 +399,14 @@ bool HashTreeBuilder::Update(const unsigned char* data, size_t len) {
     if (leftover_.size() < block_size_) {
       return true;
     }
-    if (!HashBlocks(leftover_.data(), leftover_.size(), &verity_tree_[0])) {
+    if (!HashBlocks(leftover_.data(), leftover_.size(), &verity_tree_[0],
+                    &hashed_blocks_)) {
       return false;
     }
     leftover_.clear();
-    data += append_len;
+    if (data != nullptr) {
+      data += append_len;
+    }
     len -= append_len;
   }
   if (len % block_size_ != 0) {
@@ -208,7 +417,121 @@ bool HashTreeBuilder::Update(const unsigned char* data, size_t len) {
     }
     len -= len % block_size_;
   }
-  return HashBlocks(data, len, &verity_tree_[0]);
+  if (data == nullptr) {
+    return AppendRepeatedHash(zero_block_hash_.data(), len / block_size_);
+  }
+  if (!HashBlocks(data, len, &verity_tree_[0], &hashed_blocks_)) {
+    return false;
+  }
+  return FlushBaseLevel();
+}
+
+bool HashTreeBuilder::UpdateRepeatedBlock(const unsigned char* block,
+                                          uint64_t len) {
+  CHECK_GT(data_size_, 0);
+
+  if (!leftover_.empty() || len % block_size_ != 0) {
+    LOG(ERROR) << "Repeated blocks must be aligned to the block size";
+    return false;
+  }
+  if (len == 0) {
+    return true;
+  }
+
+  std::vector<unsigned char> hash;
+  if (!HashBlocks(block, block_size_, &hash, &hashed_blocks_)) {
+    return false;
+  }
+  return AppendRepeatedHash(hash.data(), len / block_size_);
+}
+
+bool HashTreeBuilder::AppendRepeatedHash(const unsigned char* hash,
+                                         uint64_t count) {
+  // Hands the hashes over in batches in streaming mode, so memory use doesn't
+  // depend on the length of the region.
+  constexpr uint64_t kBatchHashes = 65536;
+
+  while (count > 0) {
+    uint64_t batch = output_fd_ == -1 ? count : std::min(count, kBatchHashes);
+    for (uint64_t i = 0; i < batch; i++) {
+      verity_tree_[0].insert(verity_tree_[0].end(), hash, hash + hash_size_);
+    }
+    count -= batch;
+    if (!FlushBaseLevel()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HashTreeBuilder::FlushBaseLevel() {
+  if (output_fd_ == -1) {
+    return true;
+  }
+  bool success =
+      AppendHashes(0, verity_tree_[0].data(), verity_tree_[0].size());
+  verity_tree_[0].clear();
+  return success;
+}
+
+bool HashTreeBuilder::AppendHashes(size_t level, const unsigned char* hashes,
+                                   size_t len) {
+  StreamedLevel& current = streamed_levels_[level];
+
+  if (!current.partial.empty()) {
+    size_t append_len = std::min(len, block_size_ - current.partial.size());
+    current.partial.insert(current.partial.end(), hashes, hashes + append_len);
+    hashes += append_len;
+    len -= append_len;
+    if (current.partial.size() < block_size_) {
+      return true;
+    }
+    if (!WriteLevelBlocks(level, current.partial.data(), block_size_)) {
+      return false;
+    }
+    current.partial.clear();
+  }
+
+  size_t full_len = len - len % block_size_;
+  if (!WriteLevelBlocks(level, hashes, full_len)) {
+    return false;
+  }
+  current.partial.assign(hashes + full_len, hashes + len);
+  return true;
+}
+
+bool HashTreeBuilder::WriteLevelBlocks(size_t level,
+                                       const unsigned char* blocks,
+                                       size_t len) {
+  if (len == 0) {
+    return true;
+  }
+
+  StreamedLevel& current = streamed_levels_[level];
+  size_t count = len / block_size_;
+  if (current.written_blocks + count > current.blocks) {
+    LOG(ERROR) << "Too many blocks for the hash tree level " << level;
+    return false;
+  }
+
+  uint64_t offset = current.offset + current.written_blocks * block_size_;
+  if (!WriteFullyAtOffset(output_fd_, blocks, len, offset)) {
+    PLOG(ERROR) << "Failed to write the hash tree level " << level;
+    return false;
+  }
+  current.written_blocks += count;
+
+  // The top level is a single block, which gives the root hash.
+  if (level + 1 == streamed_levels_.size()) {
+    root_hash_.clear();
+    return HashBlocks(blocks, len, &root_hash_);
+  }
+
+  std::vector<unsigned char> next_level;
+  if (!HashBlocks(blocks, len, &next_level)) {
+    return false;
+  }
+  return AppendHashes(level + 1, next_level.data(), next_level.size());
 }
 
 bool HashTreeBuilder::BuildHashTree() {
@@ -220,6 +543,27 @@ bool HashTreeBuilder::BuildHashTree() {
     return false;
   }
 
+  if (output_fd_ != -1) {
+    // Pad and write out the last block of every level.
+    for (size_t i = 0; i < streamed_levels_.size(); i++) {
+      StreamedLevel& level = streamed_levels_[i];
+      if (!level.partial.empty()) {
+        AppendPaddings(&level.partial);
+        if (!WriteLevelBlocks(i, level.partial.data(), block_size_)) {
+          return false;
+        }
+        level.partial.clear();
+      }
+      if (level.written_blocks != level.blocks) {
+        LOG(ERROR) << "Hash tree level " << i << " has "
+                   << level.written_blocks << " blocks instead of "
+                   << level.blocks;
+        return false;
+      }
+    }
+    return true;
+  }
+
   // Expects the base level to have the same size as the total hash size of
   // input data.
   AppendPaddings(&verity_tree_.back());
@@ -252,6 +596,11 @@ bool HashTreeBuilder::BuildHashTree() {
 
 bool HashTreeBuilder::CheckHashTree(
     const std::vector<unsigned char>& hash_tree) const {
+  if (output_fd_ != -1) {
+    LOG(ERROR) << "The hash tree was streamed to the output";
+    return false;
+  }
+
   size_t offset = 0;
   // Reads reversely to output the verity tree top-down.
   for (size_t i = verity_tree_.size(); i > 0; i--) {
@@ -279,6 +628,11 @@ bool HashTreeBuilder::CheckHashTree(
 }
 
 bool HashTreeBuilder::WriteHashTreeToFile(const std::string& output) const {
+  if (output_fd_ != -1) {
+    LOG(ERROR) << "The hash tree was streamed to the output";
+    return false;
+  }
+
   android::base::unique_fd output_fd(
       open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
   if (output_fd == -1) {
@@ -292,6 +646,11 @@ bool HashTreeBuilder::WriteHashTreeToFile(const std::string& output) const {
 bool HashTreeBuilder::WriteHashTreeToFd(int fd, uint64_t offset) const {
   CHECK(!verity_tree_.empty());
 
+  if (output_fd_ != -1) {
+    LOG(ERROR) << "The hash tree was streamed to the output";
+    return false;
+  }
+
   if (lseek(fd, offset, SEEK_SET) != offset) {
     PLOG(ERROR) << "Failed to seek the output fd, offset: " << offset;
     return false;
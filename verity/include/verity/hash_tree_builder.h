@@ -20,11 +20,14 @@
 #include <inttypes.h>
 #include <stddef.h>
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <openssl/evp.h>
 
+class HashWorkerPool;
+
 // This class builds a verity hash tree based on the input data and a salt with
 // the length of hash size. It also supports the streaming of input data while
 // the total data size should be know in advance. Once all the data is ready,
@@ -32,18 +35,32 @@
 // tree and output the tree to a file.
 class HashTreeBuilder {
  public:
-  HashTreeBuilder(size_t block_size, const EVP_MD* md);
+  // Large inputs to Update() are hashed on |threads| threads, including the
+  // calling one.
+  HashTreeBuilder(size_t block_size, const EVP_MD* md, size_t threads = 1);
+  ~HashTreeBuilder();
   // Returns the size of the verity tree in bytes given the input data size.
   uint64_t CalculateSize(uint64_t input_size) const;
   // Gets ready for the hash tree computation. We expect |expected_data_size|
   // bytes source data.
   bool Initialize(int64_t expected_data_size,
                   const std::vector<unsigned char>& salt);
+  // Like Initialize(), but writes the hash tree top-down to |fd| at |offset|
+  // as the data is streamed instead of keeping it in memory. Only the block
+  // being filled at every level is kept, and BuildHashTree() writes the rest.
+  // CheckHashTree() and WriteHashTreeToFd() are not available in this mode.
+  bool InitializeStreaming(int64_t expected_data_size,
+                           const std::vector<unsigned char>& salt, int fd,
+                           uint64_t offset);
   // Streams |len| bytes of source data to the hash tree builder. This function
   // can be called multiple until we processed all the source data. And the
   // accumulated data_size is expected to be exactly the |data_size_| when we
   // build the hash tree.
   bool Update(const unsigned char* data, size_t len);
+  // Streams |len| bytes of source data that repeat the single block |block|,
+  // such as a fill region of a sparse image, hashing the block only once. The
+  // data streamed so far and |len| must be multiples of the block size.
+  bool UpdateRepeatedBlock(const unsigned char* block, uint64_t len);
   // Computes the upper levels of the hash tree based on the 0th level.
   bool BuildHashTree();
   // Check the built hash tree against |hash_tree|, return true if they match.
@@ -53,6 +70,13 @@ class HashTreeBuilder {
   bool WriteHashTreeToFd(int fd, uint64_t offset) const;
 
   size_t hash_size() const { return hash_size_; }
+  // Returns how much data to pass to Update() at once for it to be hashed on
+  // all the threads. Callers that stream data in pieces should buffer at
+  // least this much.
+  size_t parallel_update_size() const;
+  // Returns the number of bytes of source data that were hashed, which leaves
+  // out zero blocks and repeated blocks whose hashes are known.
+  uint64_t hashed_size() const { return hashed_blocks_ * block_size_; }
   const std::vector<unsigned char>& root_hash() const { return root_hash_; }
   // Converts |bytes| to string for hexdump.
   static std::string BytesArrayToString(
@@ -71,11 +95,27 @@ class HashTreeBuilder {
   // buffer allocated by the caller.
   bool HashBlock(const unsigned char* block, unsigned char* out);
   // Calculates the hash of |len| bytes of data starting from |data|. Append the
-  // result to |output_vector|.
+  // result to |output_vector|, and add the number of blocks that were not
+  // zero blocks to |hashed_blocks| if it's not null.
   bool HashBlocks(const unsigned char* data, size_t len,
-                  std::vector<unsigned char>* output_vector);
+                  std::vector<unsigned char>* output_vector,
+                  uint64_t* hashed_blocks = nullptr);
+  // Calculates the hashes of |count| blocks starting from |data| and writes
+  // them to |out| with one EVP context. Zero blocks get |zero_block_hash_|
+  // if |skip_zero_blocks| is set. Returns the number of blocks hashed.
+  size_t HashBlocksSerial(const unsigned char* data, size_t count,
+                          unsigned char* out, bool skip_zero_blocks);
+  // Appends |count| copies of |hash| to the base level.
+  bool AppendRepeatedHash(const unsigned char* hash, uint64_t count);
+  // In streaming mode, moves the hashes of the base level to the output.
+  bool FlushBaseLevel();
   // Aligns |data| with block_size by padding 0s to the end.
   void AppendPaddings(std::vector<unsigned char>* data);
+  // Adds |len| bytes of hashes to |level| of a streamed hash tree.
+  bool AppendHashes(size_t level, const unsigned char* hashes, size_t len);
+  // Writes |len| bytes of full blocks of |level| to the output fd, and hashes
+  // them into the next level.
+  bool WriteLevelBlocks(size_t level, const unsigned char* blocks, size_t len);
 
   size_t block_size_;
   // Expected size of the source data, which is used to compute the hash for the
@@ -97,6 +137,24 @@ class HashTreeBuilder {
   // The remaining data passed to the last call to Update() that's less than a
   // block.
   std::vector<unsigned char> leftover_;
+  uint64_t hashed_blocks_;
+
+  // The context after hashing the salt, copied for every block.
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> salt_ctx_;
+  size_t threads_;
+  std::unique_ptr<HashWorkerPool> pool_;
+
+  // Streaming mode state, with |output_fd_| set to -1 otherwise.
+  struct StreamedLevel {
+    // Offset of the level in the output fd.
+    uint64_t offset;
+    uint64_t blocks;
+    uint64_t written_blocks;
+    // The block being filled.
+    std::vector<unsigned char> partial;
+  };
+  int output_fd_;
+  std::vector<StreamedLevel> streamed_levels_;
 };
 
 #endif  // __HASH_TREE_BUILDER_H__